@@ -9,8 +9,11 @@ class CustomGit < Formula
 
   depends_on "cmake" => :build
   depends_on "node"
+  depends_on "libnghttp2"
   depends_on "openssl@3"
 
+  uses_from_macos "zlib"
+
   def install
     # Allow CPM/FetchContent to download dependencies during build
     ENV["HOMEBREW_ALLOW_FETCHCONTENT"] = "1"
@@ -21,7 +24,8 @@ class CustomGit < Formula
       system "cmake", "-S", ".", "-B", "build",
              "-DCMAKE_BUILD_TYPE=Release",
              "-DCMAKE_VERBOSE_MAKEFILE=ON",
-             "-DOPENSSL_ROOT_DIR=#{Formula["openssl@3"].opt_prefix}"
+             "-DOPENSSL_ROOT_DIR=#{Formula["openssl@3"].opt_prefix}",
+             "-DCMAKE_PREFIX_PATH=#{Formula["libnghttp2"].opt_prefix}"
       system "cmake", "--build", "build", "--verbose"
       bin.install "build/git_gcommit.o"
     end
@@ -38,7 +42,8 @@ class CustomGit < Formula
       system "cmake", "-S", ".", "-B", "build",
              "-DCMAKE_BUILD_TYPE=Release",
              "-DCMAKE_VERBOSE_MAKEFILE=ON",
-             "-DOPENSSL_ROOT_DIR=#{Formula["openssl@3"].opt_prefix}"
+             "-DOPENSSL_ROOT_DIR=#{Formula["openssl@3"].opt_prefix}",
+             "-DCMAKE_PREFIX_PATH=#{Formula["libnghttp2"].opt_prefix}"
       system "cmake", "--build", "build", "--verbose"
       bin.install "build/git_mcommit.o"
       bin.install "git-mcommit"
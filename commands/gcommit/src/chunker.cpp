@@ -1,7 +1,81 @@
 #include "chunker.hpp"
+#include "ast.hpp"
+#include <algorithm>
+#include <chrono>
 
-Chunker::Chunker() {
+static size_t worker_count(size_t workers) {
+  return workers > 0 ? workers : max(1u, thread::hardware_concurrency());
+}
+
+static size_t queue_depth(size_t workers, size_t depth) {
+  return depth > 0 ? depth : 4 * worker_count(workers);
+}
+
+Chunker::Chunker(istream& diff, size_t workers, size_t depth)
+    : reader(diff), jobs(queue_depth(workers, depth)), results(queue_depth(workers, depth)) {
+  workers = worker_count(workers);
+  for (size_t i = 0; i < workers; i++) {
+    this->workers.emplace_back(&Chunker::work, this);
+  }
+  this->reader_thread = thread(&Chunker::read, this);
+}
+
+// Each hunk's future is queued before its job, so next() always waits on
+// a hunk that's been handed to the workers
+void Chunker::read() {
+  try {
+    DiffChunk hunk;
+    while (this->reader.nextChunk(hunk)) {
+      this->hunks++;
+      promise<vector<DiffChunk>> chunks;
+      if (!this->results.push(chunks.get_future())) break;
+      if (!this->jobs.push(Job{std::move(hunk), std::move(chunks)})) break;
+    }
+  } catch (...) {
+    promise<vector<DiffChunk>> failed;
+    failed.set_exception(current_exception());
+    this->results.push(failed.get_future());
+  }
+  this->jobs.close();
+  this->results.close();
+}
+
+void Chunker::work() {
+  while (optional<Job> job = this->jobs.pop()) {
+    try {
+      job->chunks.set_value(split_hunk(job->hunk));
+    } catch (...) {
+      job->chunks.set_exception(current_exception());
+    }
+  }
+}
+
+bool Chunker::next(vector<DiffChunk>& chunks) {
+  if (!this->pending) this->pending = this->results.pop();
+  if (!this->pending) return false;
+  future<vector<DiffChunk>> result = std::move(*this->pending);
+  this->pending.reset();
+  chunks = result.get();
+  return true;
+}
+
+bool Chunker::ready() {
+  if (!this->pending) this->pending = this->results.try_pop();
+  return this->pending && this->pending->wait_for(chrono::seconds(0)) == future_status::ready;
 }
 
 Chunker::~Chunker() {
-}
\ No newline at end of file
+  this->jobs.close();
+  this->results.close();
+  this->reader_thread.join();
+  for (thread& worker : this->workers) worker.join();
+}
+
+vector<DiffChunk> split_hunk(const DiffChunk& hunk) {
+  if (hunk.is_rename) return {hunk};
+
+  string language = detectLanguageFromPath(hunk.filepath);
+  if (language == "text") return chunkByLines(hunk);
+  ts::Tree tree = codeToTree(combineContent(hunk), language);
+  return chunkDiff(tree.getRootNode(), hunk);
+}
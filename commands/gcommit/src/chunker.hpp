@@ -1,7 +1,61 @@
+#ifndef CHUNKER_HPP
+#define CHUNKER_HPP
+
+#include "diffreader.hpp"
+#include "bounded_queue.hpp"
+#include <atomic>
+#include <future>
+#include <optional>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Splits a diff into the chunks gcommit embeds, as a pipeline: a reader
+// thread parses hunks off the stream, workers split each one (tree-sitter
+// for code, lines for text), and next() hands back each hunk's chunks in
+// diff order as soon as they're ready, while later hunks are still being
+// read and split. Every stage stops once it's depth hunks ahead of the
+// one after it, so a consumer that's waiting on the network holds back
+// the parsing instead of letting the whole diff pile up in memory.
 class Chunker {
 private:
+  struct Job {
+    DiffChunk hunk;
+    promise<vector<DiffChunk>> chunks;
+  };
+
+  DiffReader reader;
+  BoundedQueue<Job> jobs;
+  // One future per hunk, in diff order
+  BoundedQueue<future<vector<DiffChunk>>> results;
+  // Taken from results by ready() and not yet returned by next()
+  optional<future<vector<DiffChunk>>> pending;
+  atomic<size_t> hunks{0};
+  thread reader_thread;
+  vector<thread> workers;
+
+  void read();
+  void work();
+
 public:
-    Chunker();
-    
-    ~Chunker();
-};
\ No newline at end of file
+  // workers = 0 uses every core; depth = 0 allows 4 hunks per worker
+  explicit Chunker(istream& diff, size_t workers = 0, size_t depth = 0);
+  Chunker(const Chunker&) = delete;
+  Chunker& operator=(const Chunker&) = delete;
+
+  // The next hunk's chunks, waiting for them if need be. False once the
+  // diff is done; rethrows anything reading or splitting it threw.
+  bool next(vector<DiffChunk>& chunks);
+  // Whether next() has chunks it can return without waiting
+  bool ready();
+  size_t hunks_read() const { return hunks; }
+  // Stops the pipeline if next() wasn't run to the end
+  ~Chunker();
+};
+
+// One hunk's chunks: a pure rename stays whole, code splits along its
+// syntax tree, anything else by lines
+vector<DiffChunk> split_hunk(const DiffChunk& hunk);
+
+#endif // CHUNKER_HPP
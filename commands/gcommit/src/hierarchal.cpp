@@ -50,7 +50,7 @@ vector<vector<size_t>> UnionFind::get_sets() {
 
 HierachicalClustering::HierachicalClustering() {}
 
-vector<MergeEvent> HierachicalClustering::cluster(vector<vector<float>> data) {
+vector<MergeEvent> HierachicalClustering::cluster(const vector<vector<float>>& data) {
   vector<vector<float>> dist_mat(data.size(), vector<float>(data.size(), -1));
 
   for (size_t i = 0; i < data.size(); i++) {
@@ -25,7 +25,7 @@ class UnionFind {
 class HierachicalClustering {
 public:
   HierachicalClustering();
-  vector<MergeEvent> cluster(vector<vector<float>> data);
+  vector<MergeEvent> cluster(const vector<vector<float>>& data);
   ~HierachicalClustering();
 };
 
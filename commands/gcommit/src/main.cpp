@@ -1,5 +1,9 @@
 #include "ast.hpp"
 #include "async_openai_api.hpp"
+#include "bpe_tokenizer.hpp"
+#include "chunker.hpp"
+#include "embedding_cache.hpp"
+#include "local_embedder.hpp"
 #include "utils.hpp"
 #include "hierarchal.hpp"
 #include "diffreader.hpp"
@@ -8,6 +12,7 @@
 #include <fstream>
 #include <filesystem>
 #include <sstream>
+#include <unordered_map>
 
 using namespace std;
 using json = nlohmann::json;
@@ -26,31 +31,70 @@ struct ClusteredCommit {
   }
 };
 
+// First line of `git config --get key`, or empty if it isn't set
+string get_git_config(const string& key) {
+  string value;
+  FILE* pipe = popen(("git config --get " + key + " 2>/dev/null").c_str(), "r");
+  if (pipe) {
+    int c;
+    while ((c = fgetc(pipe)) != EOF && c != '\n') {
+      value += c;
+    }
+    pclose(pipe);
+  }
+  return value;
+}
+
 string get_api_key() {
   const char* api_key_env = getenv("OPENAI_API_KEY");
   string api_key = api_key_env ? api_key_env : "";
 
   if (api_key.empty()) {
-    FILE* pipe = popen("git config --get custom.openaiApiKey 2>/dev/null", "r");
-    if (pipe) {
-      char c;
-      while ((c = fgetc(pipe)) != EOF && c != '\n') {
-        api_key += c;
-      }
-      pclose(pipe);
-    }
+    api_key = get_git_config("custom.openaiApiKey");
   }
   return api_key;
 }
 
-int run_merge_mode(int verbose);
-int run_threshold_mode(float threshold, const string& json_path, int verbose);
+// Chunks per embeddings request in merge mode. Well under the API's limit,
+// so a big diff still goes out as several requests that run in parallel,
+// the first of them while later files are still being chunked.
+static constexpr size_t EMBEDDING_BATCH_INPUTS = 64;
+// Embedding requests merge mode lets out at once before it stops taking
+// chunks and waits for the oldest, which in turn stalls the chunker
+static constexpr size_t MAX_EMBEDDING_REQUESTS_IN_FLIGHT = 32;
+
+int run_merge_mode(int verbose, const string& stats_path, bool use_cache, bool local_embeddings, string embedding_model, size_t embedding_dimensions,
+                   const string& tokenizer_path);
+int run_threshold_mode(float threshold, const string& json_path, int verbose, bool stream_tokens, const string& stats_path);
+
+// Where the HTTP requests' time went: a table on stderr with -v, and the
+// same numbers as JSON in stats_path when given
+void report_http_stats(const AsyncHTTPSConnection& conn, int verbose, const string& stats_path) {
+  const LatencyStats& stats = conn.latency_stats();
+  if (verbose >= 1) stats.print(cerr);
+  if (!stats_path.empty()) {
+    ofstream out(stats_path);
+    if (!out) {
+      cerr << "Warning: Cannot write HTTP stats to " << stats_path << endl;
+      return;
+    }
+    out << stats.to_json().dump(2) << endl;
+  }
+}
 
 int main(int argc, char *argv[]) {
   float dist_thresh = -1;
   int verbose = 0;
   bool merge_mode = false;
+  bool stream_tokens = false;
+  bool use_cache = true;
+  bool local_embeddings = get_git_config("custom.embeddingProvider") == "local";
+  // Flags win over git config, which wins over the defaults
+  string embedding_model = get_git_config("custom.embeddingModel");
+  string dimensions_arg = get_git_config("custom.embeddingDimensions");
+  string tokenizer_path = get_git_config("custom.embeddingTokenizer");
   string json_path;
+  string stats_path;
 
   for (int i = 1; i < argc; i++) {
     string arg = argv[i];
@@ -60,6 +104,20 @@ int main(int argc, char *argv[]) {
       verbose = 1;
     } else if (arg == "-m") {
       merge_mode = true;
+    } else if (arg == "-s") {
+      stream_tokens = true;
+    } else if (arg == "--embedding-model" && i + 1 < argc) {
+      embedding_model = argv[++i];
+    } else if (arg == "--dimensions" && i + 1 < argc) {
+      dimensions_arg = argv[++i];
+    } else if (arg == "--tokenizer" && i + 1 < argc) {
+      tokenizer_path = argv[++i];
+    } else if (arg == "--local") {
+      local_embeddings = true;
+    } else if (arg == "--no-cache") {
+      use_cache = false;
+    } else if (arg == "--http-stats" && i + 1 < argc) {
+      stats_path = argv[++i];
     } else if (arg == "-t") {
       if (i + 2 < argc) {
         try {
@@ -75,7 +133,14 @@ int main(int argc, char *argv[]) {
       }
     } else {
       cerr << "Usage: " << argv[0] << " -m [-v|-vv]  (merge mode)" << endl;
-      cerr << "       " << argv[0] << " -t <threshold> <json_file> [-v|-vv]  (threshold mode)" << endl;
+      cerr << "       " << argv[0] << " -t <threshold> <json_file> [-s] [-v|-vv]  (threshold mode)" << endl;
+      cerr << "  -s  stream message tokens to stderr as they're generated" << endl;
+      cerr << "  --http-stats <file>  write request latency stats as JSON (-v prints them)" << endl;
+      cerr << "  --no-cache  don't read or write the on-disk embedding cache (-m)" << endl;
+      cerr << "  --local  embed on this machine, without the API (-m; used when no API key is set)" << endl;
+      cerr << "  --embedding-model <name>  embedding model (-m; git config custom.embeddingModel)" << endl;
+      cerr << "  --dimensions <n>  embedding length, 0 for the model's own (-m; git config custom.embeddingDimensions)" << endl;
+      cerr << "  --tokenizer <file>  tiktoken vocabulary for exact token limits (-m; git config custom.embeddingTokenizer)" << endl;
       return 1;
     }
   }
@@ -85,43 +150,191 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  // Unset leaves the length to the model (or the local embedder)
+  size_t embedding_dimensions = 0;
+  if (!dimensions_arg.empty()) {
+    try {
+      size_t parsed = 0;
+      long long dimensions = stoll(dimensions_arg, &parsed);
+      if (parsed != dimensions_arg.size() || dimensions < 0) throw invalid_argument(dimensions_arg);
+      embedding_dimensions = dimensions;
+    } catch (...) {
+      cerr << "Error: embedding dimensions must be a non-negative integer, got '" << dimensions_arg << "'" << endl;
+      return 1;
+    }
+  }
+
   if (merge_mode) {
-    return run_merge_mode(verbose);
+    return run_merge_mode(verbose, stats_path, use_cache, local_embeddings, embedding_model, embedding_dimensions, tokenizer_path);
   } else {
-    return run_threshold_mode(dist_thresh, json_path, verbose);
+    return run_threshold_mode(dist_thresh, json_path, verbose, stream_tokens, stats_path);
   }
 }
 
 // Phase 1: Read diff, get embeddings, cluster, output dendrogram + chunks
-int run_merge_mode(int verbose) {
-  string api_key = get_api_key();
-  if (api_key.empty()) {
-    cerr << "Error: OPENAI_API_KEY not found" << endl;
-    return 1;
+int run_merge_mode(int verbose, const string& stats_path, bool use_cache, bool local_embeddings, string embedding_model, size_t embedding_dimensions,
+                   const string& tokenizer_path) {
+  string api_key = local_embeddings ? "" : get_api_key();
+  if (!local_embeddings && api_key.empty()) {
+    cerr << "Warning: OPENAI_API_KEY not found, using local embeddings" << endl;
+    local_embeddings = true;
+  }
+  // Local vectors depend on every chunk in the diff (see LocalEmbedder), so
+  // they're computed together at the end and never cached
+  if (local_embeddings) {
+    embedding_model = LOCAL_EMBEDDING_MODEL;
+    use_cache = false;
+  } else if (embedding_model.empty()) {
+    embedding_model = EMBEDDING_MODEL;
+  }
+  // Older models reject the whole request when dimensions is set
+  if (!local_embeddings && embedding_dimensions > 0 && !embedding_model_takes_dimensions(embedding_model)) {
+    cerr << "Warning: " << embedding_model << " doesn't take --dimensions, using its full length" << endl;
+    embedding_dimensions = 0;
   }
 
-  DiffReader dr(cin);
-  dr.ingestDiff();
-  if (verbose >= 1) cerr << "Parsed " << dr.getChunks().size() << " chunks from git diff" << endl;
+  // Requests run on the connection's I/O thread, so each batch of
+  // embeddings goes out while the chunker is still reading and splitting
+  // the rest of the diff
+  AsyncHTTPSConnection conn(verbose);
+  AsyncOpenAIAPI openai_api(conn, api_key);
+  openai_api.set_embedding_model(embedding_model, embedding_dimensions);
+  if (!local_embeddings) conn.start_io_thread();
+
+  // With the model's vocabulary, inputs are cut at its token limit and
+  // batches packed by exact counts; without it, by bytes. A tokenizer that
+  // was asked for but won't load is worth a warning; a missing default isn't.
+  if (!local_embeddings) {
+    string path = tokenizer_path.empty() ? default_tokenizer_path() : tokenizer_path;
+    if (!tokenizer_path.empty() || (!path.empty() && filesystem::exists(path))) {
+      try {
+        openai_api.set_tokenizer(make_shared<BPETokenizer>(path));
+        if (verbose >= 1) cerr << "Counting tokens with " << path << endl;
+      } catch (const exception& e) {
+        cerr << "Warning: " << e.what() << ", limiting embedding inputs by bytes" << endl;
+      }
+    }
+  }
 
+  // A chunk whose text matches an earlier chunk's takes that chunk's vector
+  // (duplicate_of points back at it), and one whose text was embedded on an
+  // earlier run is answered from disk; only the rest are sent.
+  // embedding_futures has a slot per chunk, left empty for duplicates, and
+  // unsent_chunks says which slot each unsent text fills.
+  EmbeddingCache cache(use_cache ? default_embedding_cache_path() : "");
   vector<DiffChunk> all_chunks;
-  for (const DiffChunk& chunk : dr.getChunks()) {
+  vector<EmbeddingKey> chunk_keys;
+  vector<size_t> duplicate_of;
+  unordered_map<EmbeddingKey, size_t, EmbeddingKeyHash> first_with_key;
+  vector<future<vector<float>>> embedding_futures;
+  vector<string> unsent;
+  vector<size_t> unsent_tokens;
+  vector<size_t> unsent_chunks;
+  auto embed = [&](const DiffChunk& chunk) {
+    string content = combineContent(chunk);
     if (chunk.is_rename) {
-      all_chunks.push_back(chunk);
-      continue;
+      content = "renamed file from " + chunk.old_filepath + " to " + chunk.filepath;
+    } else if (content.empty()) {
+      content = "file: " + chunk.filepath;
     }
-
-    string language = detectLanguageFromPath(chunk.filepath);
+    // Keyed on what's actually sent, after truncation
+    size_t input_tokens = 0;
+    string input = openai_api.embedding_input(content, &input_tokens);
+    EmbeddingKey key = EmbeddingCache::key(embedding_model, embedding_dimensions, input);
+    auto [first, unique] = first_with_key.try_emplace(key, all_chunks.size());
+    duplicate_of.push_back(first->second);
+    vector<float> cached;
+    if (!unique) {
+      embedding_futures.emplace_back();
+    } else if (cache.get(key, cached)) {
+      promise<vector<float>> ready;
+      ready.set_value(std::move(cached));
+      embedding_futures.push_back(ready.get_future());
+    } else {
+      embedding_futures.emplace_back();
+      unsent.push_back(std::move(input));
+      unsent_tokens.push_back(input_tokens);
+      unsent_chunks.push_back(all_chunks.size());
+    }
+    chunk_keys.push_back(key);
+    all_chunks.push_back(chunk);
+  };
+  // The first slot of each request still out. A request's inputs all
+  // resolve together, so that one slot says when it's done.
+  vector<size_t> in_flight;
+  auto requests_in_flight = [&]() {
+    erase_if(in_flight, [&](size_t slot) { return embedding_futures[slot].wait_for(chrono::seconds(0)) == future_status::ready; });
+    return in_flight.size();
+  };
+  auto started = chrono::steady_clock::now();
+  long long first_request_ms = -1;
+  auto send_embeddings = [&]() {
+    if (local_embeddings || unsent.empty()) return;
+    while (requests_in_flight() >= MAX_EMBEDDING_REQUESTS_IN_FLIGHT) {
+      embedding_futures[in_flight.front()].wait();
+    }
+    if (first_request_ms < 0) {
+      first_request_ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count();
+    }
+    in_flight.push_back(unsent_chunks.front());
+    vector<future<vector<float>>> sent = openai_api.async_embedding_batch(std::move(unsent), unsent_tokens);
+    for (size_t i = 0; i < sent.size(); i++) {
+      embedding_futures[unsent_chunks[i]] = std::move(sent[i]);
+    }
+    unsent.clear();
+    unsent_tokens.clear();
+    unsent_chunks.clear();
+  };
+
+  // Hunks are read and split on other threads while this one embeds the
+  // chunks they turn into. Chunks go out in full batches, or sooner when
+  // the chunker has nothing ready and no request is out: the first request
+  // leaves as soon as the first hunk is split, and later ones gather
+  // whatever piled up while the network was busy.
+  size_t hunks = 0;
+  try {
+    Chunker chunker(cin);
     vector<DiffChunk> file_chunks;
+    for (;;) {
+      if (!unsent.empty() && !chunker.ready() && requests_in_flight() == 0) {
+        send_embeddings();
+      }
+      if (!chunker.next(file_chunks)) break;
+      for (const DiffChunk& file_chunk : file_chunks) {
+        embed(file_chunk);
+      }
+      if (unsent.size() >= EMBEDDING_BATCH_INPUTS) {
+        send_embeddings();
+      }
+    }
+    hunks = chunker.hunks_read();
+  } catch (const exception& e) {
+    cerr << "Error: couldn't parse the diff: " << e.what() << endl;
+    return 1;
+  }
+  send_embeddings();
+  if (verbose >= 1) {
+    cerr << "Parsed " << hunks << " hunks from git diff into " << all_chunks.size() << " chunks in "
+         << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count() << " ms";
+    if (first_request_ms >= 0) cerr << ", first embedding request after " << first_request_ms << " ms";
+    cerr << endl;
+  }
 
-    if (language != "text") {
-      string file_content = combineContent(chunk);
-      ts::Tree tree = codeToTree(file_content, language);
-      file_chunks = chunkDiff(tree.getRootNode(), chunk);
-    } else {
-      file_chunks = chunkByLines(chunk);
+  if (local_embeddings) {
+    auto local_started = chrono::steady_clock::now();
+    vector<vector<float>> local = LocalEmbedder(embedding_dimensions).embed(unsent);
+    for (size_t i = 0; i < local.size(); i++) {
+      promise<vector<float>> ready;
+      ready.set_value(std::move(local[i]));
+      embedding_futures[unsent_chunks[i]] = ready.get_future();
     }
-    all_chunks.insert(all_chunks.end(), file_chunks.begin(), file_chunks.end());
+    if (verbose >= 1) {
+      cerr << "Embedded " << local.size() << " chunks locally in "
+           << chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - local_started).count() << " ms" << endl;
+    }
+    unsent.clear();
+    unsent_tokens.clear();
+    unsent_chunks.clear();
   }
 
   if (all_chunks.empty()) {
@@ -129,35 +342,53 @@ int run_merge_mode(int verbose) {
     return 1;
   }
 
-  AsyncHTTPSConnection conn(verbose);
-  AsyncOpenAIAPI openai_api(conn, api_key);
-  vector<future<HTTPSResponse>> embedding_futures;
-
-  if (verbose >= 1) cerr << "Getting embeddings for " << all_chunks.size() << " chunks..." << endl;
-
-  for (const auto& chunk : all_chunks) {
-    string content = combineContent(chunk);
-    if (chunk.is_rename) {
-      content = "renamed file from " + chunk.old_filepath + " to " + chunk.filepath;
-    } else if (content.empty()) {
-      content = "file: " + chunk.filepath;
-    }
-    embedding_futures.push_back(openai_api.async_embedding(content));
+  if (verbose >= 1) {
+    cerr << "Getting embeddings for " << all_chunks.size() << " chunks from " << embedding_model;
+    if (embedding_dimensions > 0) cerr << " (" << embedding_dimensions << "-D)";
+    cerr << "..." << endl;
   }
 
-  openai_api.run_requests();
-
+  // Transient failures were already retried by the connection. Anything left
+  // is fatal: an empty embedding would silently skew the clustering.
   vector<vector<float>> embeddings;
-  for (auto& fut : embedding_futures) {
+  for (size_t i = 0; i < embedding_futures.size(); i++) {
+    if (duplicate_of[i] != i) {
+      embeddings.push_back(embeddings[duplicate_of[i]]);
+      continue;
+    }
     try {
-      embeddings.push_back(parse_embedding(fut.get().body));
-    } catch (...) {
-      embeddings.push_back({});
+      embeddings.push_back(embedding_futures[i].get());
+    } catch (const exception& e) {
+      if (verbose >= 1) cerr << endl;
+      cerr << "Error: embedding request failed for " << all_chunks[i].filepath << ": " << e.what() << endl;
+      return 1;
     }
     if (verbose >= 1) cerr << "." << flush;
   }
   if (verbose >= 1) cerr << " done" << endl;
 
+  conn.stop_io_thread();
+  if (!local_embeddings) report_http_stats(conn, verbose, stats_path);
+
+  if (verbose >= 1) {
+    size_t duplicates = all_chunks.size() - first_with_key.size();
+    cerr << "Deduplicated " << duplicates << " of " << all_chunks.size() << " chunks ("
+         << 100 * duplicates / all_chunks.size() << "%)" << endl;
+    if (!local_embeddings) {
+      cerr << "Sent " << (openai_api.has_tokenizer() ? "" : "at most ") << openai_api.embedding_tokens_sent()
+           << " tokens for embedding" << endl;
+    }
+  }
+
+  // A cache that can't be written only costs the next run its hits
+  if (use_cache) {
+    if (verbose >= 1) cerr << "Embedding cache: " << cache.hits() << " of " << first_with_key.size() << " unique chunks cached" << endl;
+    for (size_t i = 0; i < embeddings.size(); i++) {
+      if (duplicate_of[i] == i) cache.put(chunk_keys[i], embeddings[i]);
+    }
+    if (!cache.save() && verbose >= 1) cerr << "Warning: couldn't write embedding cache" << endl;
+  }
+
   HierachicalClustering hc;
   if (verbose >= 1) cerr << "Running hierarchical clustering..." << endl;
   vector<MergeEvent> merges = hc.cluster(embeddings);
@@ -180,6 +411,10 @@ int run_merge_mode(int verbose) {
 
   // Build output JSON
   json output;
+  output["embedding"] = {
+    {"model", embedding_model},
+    {"dimensions", embeddings[0].size()}
+  };
 
   // Dendrogram
   json dendrogram;
@@ -232,7 +467,7 @@ int run_merge_mode(int verbose) {
 }
 
 // Phase 2: Read JSON, apply threshold, create patches, generate commits
-int run_threshold_mode(float threshold, const string& json_path, int verbose) {
+int run_threshold_mode(float threshold, const string& json_path, int verbose, bool stream_tokens, const string& stats_path) {
   string api_key = get_api_key();
   if (api_key.empty()) {
     cerr << "Error: OPENAI_API_KEY not found" << endl;
@@ -318,7 +553,7 @@ int run_threshold_mode(float threshold, const string& json_path, int verbose) {
   // Generate commit messages
   AsyncHTTPSConnection conn(verbose);
   AsyncOpenAIAPI openai_api(conn, api_key);
-  vector<future<string>> message_futures;
+  vector<Task<string>> message_tasks;
   vector<ClusteredCommit> commits;
 
   for (size_t i = 0; i < clusters_patch_paths.size(); i++) {
@@ -352,14 +587,24 @@ int run_threshold_mode(float threshold, const string& json_path, int verbose) {
       commit.patch_files.push_back(path);
     }
 
-    message_futures.push_back(async_generate_commit_message(openai_api, diff_context));
+    // With -s, each token goes to stderr as one "@token {json}" line so the
+    // TUI can show messages forming while the rest of stderr stays readable
+    function<void(const string&)> on_token;
+    if (stream_tokens) {
+      on_token = [cluster_id = commit.cluster_id](const string& token) {
+        cerr << "@token " << json{{"cluster", cluster_id}, {"token", token}}.dump(-1, ' ', false, json::error_handler_t::replace) << endl;
+      };
+    }
+    message_tasks.push_back(async_generate_commit_message(openai_api, diff_context, on_token));
+    message_tasks.back().start();
     commits.push_back(commit);
   }
 
   openai_api.run_requests();
+  report_http_stats(conn, verbose, stats_path);
 
   for (size_t i = 0; i < commits.size(); i++) {
-    commits[i].message = message_futures[i].get();
+    commits[i].message = message_tasks[i].result();
   }
 
   // Build chunk-to-cluster mapping
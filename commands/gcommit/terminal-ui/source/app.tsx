@@ -3,6 +3,7 @@ import { Box, Text, useApp, useInput } from 'ink';
 import { Spinner } from '@inkjs/ui';
 import { fileURLToPath } from 'url';
 import { dirname, join } from 'path';
+import { createInterface } from 'readline';
 import { GitProvider, useGit } from './contexts/GitContext.js';
 import FileTree from './components/FileTree.js';
 import DiffViewer from './components/DiffViewer.js';
@@ -29,6 +30,7 @@ function AppContent({ threshold, verbose, dev }: Props) {
   const [error, setError] = useState<string | null>(null);
   const [statusMessage, setStatusMessage] = useState('Initializing...');
   const [stderr, setStderr] = useState<string>('');
+  const [streamingMessages, setStreamingMessages] = useState<Record<number, string>>({});
 
   // Dendrogram state
   const [dendrogramData, setDendrogramData] = useState<DendrogramData | null>(null);
@@ -157,15 +159,29 @@ function AppContent({ threshold, verbose, dev }: Props) {
 
       const scriptDir = dirname(fileURLToPath(import.meta.url));
       const binaryPath = join(scriptDir, 'git_gcommit.o');
-      const args = ['-t', String(selectedThreshold), mergePhaseJson];
+      const args = ['-t', String(selectedThreshold), mergePhaseJson, '-s'];
       if (verbose) args.push('-v');
 
-      const result = await execa(binaryPath, args, {
+      const subprocess = execa(binaryPath, args, {
         encoding: 'utf8',
       });
 
-      if (result.stderr) {
-        setStderr(prev => prev + '\n' + result.stderr);
+      // Commit messages stream in as "@token {json}" lines on stderr
+      setStreamingMessages({});
+      const stderrLines: string[] = [];
+      createInterface({ input: subprocess.stderr! }).on('line', line => {
+        if (!line.startsWith('@token ')) {
+          stderrLines.push(line);
+          return;
+        }
+        const { cluster, token }: { cluster: number; token: string } = JSON.parse(line.slice('@token '.length));
+        setStreamingMessages(prev => ({ ...prev, [cluster]: (prev[cluster] ?? '') + token }));
+      });
+
+      const result = await subprocess;
+
+      if (stderrLines.length > 0) {
+        setStderr(prev => prev + '\n' + stderrLines.join('\n'));
       }
 
       const data: { commits: ProcessingResult['commits'] } = JSON.parse(result.stdout);
@@ -360,6 +376,16 @@ function AppContent({ threshold, verbose, dev }: Props) {
     return (
       <Box flexDirection="column">
         <Spinner label={statusMessage} />
+        {phase === 'threshold-processing' && Object.keys(streamingMessages).length > 0 && (
+          <Box marginTop={1} flexDirection="column">
+            {Object.entries(streamingMessages).map(([cluster, message]) => (
+              <Text key={cluster}>
+                <Text dimColor>Cluster {Number(cluster) + 1}: </Text>
+                {message}
+              </Text>
+            ))}
+          </Box>
+        )}
         {verbose && stderr && (
           <Box marginTop={1}>
             <Text dimColor>{stderr}</Text>
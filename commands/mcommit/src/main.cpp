@@ -1,5 +1,6 @@
 #include "async_openai_api.hpp"
 #include "utils.hpp"
+#include <unistd.h>
 using namespace std;
 
 int main() {
@@ -42,10 +43,22 @@ int main() {
     AsyncHTTPSConnection conn;
     AsyncOpenAIAPI openai_api(conn, api_key);
 
-    future<string> msg_future = async_generate_commit_message(openai_api, diff);
+    // stdout is the commit message git-mcommit captures, so the live preview
+    // goes to the terminal on stderr
+    function<void(const string&)> on_token;
+    bool show_progress = isatty(STDERR_FILENO);
+    if (show_progress) {
+        on_token = [](const string& token) { cerr << token << flush; };
+    }
+
+    Task<string> msg_task = async_generate_commit_message(openai_api, diff, on_token);
+    msg_task.start();
     openai_api.run_requests();
 
-    string message = msg_future.get();
+    string message = msg_task.result();
+    if (show_progress) {
+        cerr << endl;
+    }
     cout << message << endl;
 
     return 0;
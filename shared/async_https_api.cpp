@@ -1,450 +1,1467 @@
 #include "async_https_api.hpp"
 #include <memory>
-#include <sys/_types/_ssize_t.h>
-#include <sys/event.h>
+#include <sys/types.h>
 #include <fcntl.h>
 #include <iostream>
+#include <climits>
 
 using namespace std;
 
-AsyncHTTPSConnection::AsyncHTTPSConnection(int verbose) : verbose(verbose) {
-    this->kqueue_fd = kqueue();
-    if (kqueue_fd == -1) {
-        perror("kqueue");
-        throw runtime_error("Failed to create kqueue");
+// "http/1.1 200 ok" or "http/2 200" -> 200; 0 without a status line
+static int parse_status(const string& headers) {
+    size_t space = headers.find(' ');
+    if (space == string::npos || space + 4 > headers.size()) return 0;
+
+    int status = 0;
+    for (size_t i = space + 1; i < space + 4; ++i) {
+        if (!isdigit((unsigned char)headers[i])) return 0;
+        status = status * 10 + (headers[i] - '0');
     }
+    return status;
+}
+
+AsyncHTTPSConnection::AsyncHTTPSConnection(int verbose, trigger_mode_t trigger_mode) : verbose(verbose) {
+    this->backend = make_event_backend(trigger_mode);
+    this->tls = TLSContext::shared();
+    backend->watch(resolver.notify_fd(), EVENT_READ, &resolver);
+
+    if (pipe(wake_pipe) == -1) {
+        perror("pipe");
+        throw runtime_error("Failed to create event loop wake pipe");
+    }
+    for (int fd : wake_pipe) {
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    backend->watch(wake_pipe[0], EVENT_READ, wake_pipe);
 }
 AsyncHTTPSConnection::~AsyncHTTPSConnection() {
-    close(this->kqueue_fd);
+    stop_io_thread();
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+    for (auto& [host, conns] : idle_conns) {
+        for (auto& idle : conns) {
+            if (idle.conn) {
+                SSL_shutdown(idle.conn);
+                SSL_free(idle.conn);
+            }
+            close(idle.socket_fd);
+        }
+    }
+    for (auto& [socket_fd, session] : h2_sessions) {
+        SSL_shutdown(session->get_conn());
+        SSL_free(session->get_conn());
+        close(socket_fd);
+    }
+}
+
+void AsyncHTTPSConnection::set_max_connections_per_host(size_t max_conns) {
+    this->max_conns_per_host = max(max_conns, (size_t)1);
+}
+
+void AsyncHTTPSConnection::set_http2_enabled(bool enabled) {
+    this->http2_enabled = enabled;
+}
+
+size_t AsyncHTTPSConnection::http2_connection_count(const string& host) const {
+    auto it = h2_by_host.find(host);
+    return it == h2_by_host.end() ? 0 : it->second.size();
+}
+
+void AsyncHTTPSConnection::set_timeouts(const HTTPSTimeouts& timeouts) {
+    this->timeouts = timeouts;
+}
+
+void AsyncHTTPSConnection::set_adaptive_concurrency(bool enabled) {
+    this->adaptive_concurrency = enabled;
+}
+
+size_t AsyncHTTPSConnection::concurrency_limit(const string& host) const {
+    auto it = limiters.find(host);
+    return it == limiters.end() ? ConcurrencyLimiter().limit() : it->second.limit();
+}
+
+void AsyncHTTPSConnection::set_retry_policy(const HTTPSRetryPolicy& policy) {
+    this->retry_policy = policy;
+    this->retry_policy.max_attempts = max(policy.max_attempts, 1);
+}
+
+size_t AsyncHTTPSConnection::idle_connection_count(const string& host) const {
+    auto it = idle_conns.find(host);
+    return it == idle_conns.end() ? 0 : it->second.size();
+}
+
+TLSHandshakeStats AsyncHTTPSConnection::handshake_stats() const {
+    return tls->stats();
+}
+
+const LatencyStats& AsyncHTTPSConnection::latency_stats() const {
+    return stats;
+}
+
+Resolver& AsyncHTTPSConnection::get_resolver() {
+    return resolver;
 }
 
 void AsyncHTTPSConnection::post_async(const string& host, const string& path, const string& body, const vector<pair<string, string>>& headers, promise<HTTPSResponse> resp) {
-   auto req = make_unique<HTTPSRequest>(host, path);
-   int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-   
-    fcntl(socket_fd, F_SETFL, O_NONBLOCK);
-
-    struct hostent* server = gethostbyname(host.c_str());
-    if (server == nullptr) {
-        if (verbose >= 2) cout << "No such host: " << host << endl;
-        close(socket_fd);
+    post_stream(host, path, body, headers, nullptr, std::move(resp));
+}
+
+void AsyncHTTPSConnection::post_stream(const string& host, const string& path, const string& body, const vector<pair<string, string>>& headers,
+                                       BodyCallback on_data, promise<HTTPSResponse> resp) {
+    auto req = make_unique<HTTPSRequest>(host, path);
+    req->resp = std::move(resp);
+    req->on_data = std::move(on_data);
+    req->body = body;
+    req->headers = headers;
+    hand_off(std::move(req));
+}
+
+HTTPSAwaitable AsyncHTTPSConnection::post(const string& host, const string& path, const string& body, const vector<pair<string, string>>& headers,
+                                          BodyCallback on_data) {
+    return HTTPSAwaitable(*this, host, path, body, headers, std::move(on_data));
+}
+
+void HTTPSAwaitable::await_suspend(coroutine_handle<> handle) {
+    waiting = handle;
+    auto req = make_unique<HTTPSRequest>(host, path);
+    req->awaiter = this;
+    req->on_data = std::move(on_data);
+    req->body = std::move(body);
+    req->headers = std::move(headers);
+    conn.hand_off(std::move(req));
+}
+
+// Safe from any thread. Without an I/O thread, or on it, the request goes
+// straight in; otherwise the I/O thread picks it up from submissions.
+void AsyncHTTPSConnection::hand_off(unique_ptr<HTTPSRequest> req) {
+    {
+        lock_guard<mutex> lock(idle_mtx);
+        outstanding++;
+    }
+    if (!io_thread.joinable() || this_thread::get_id() == io_thread.get_id()) {
+        enqueue(std::move(req));
         return;
     }
+    submissions.push(std::move(req));
+    wake();
+}
+
+// One byte in the pipe is enough to wake the loop however many requests
+// arrive before it gets round to reading
+void AsyncHTTPSConnection::wake() {
+    if (wake_pending.exchange(true)) return;
+    char byte = 1;
+    ssize_t ignored = write(wake_pipe[1], &byte, 1);
+    (void)ignored;
+}
 
-    struct sockaddr_in serv_addr;
-    memset(&serv_addr, 0, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    memcpy(&serv_addr.sin_addr.s_addr, server->h_addr, server->h_length);
-    serv_addr.sin_port = htons(443);
+void AsyncHTTPSConnection::take_submissions() {
+    // Cleared before draining: a push after this point writes again
+    wake_pending.store(false);
+    char drain[64];
+    while (read(wake_pipe[0], drain, sizeof(drain)) > 0) {}
 
-    int result = connect(socket_fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr));
-    if (result == -1 && errno != EINPROGRESS) {
-        close(socket_fd);
-        resp.set_exception(make_exception_ptr(runtime_error("Connection failed")));
+    while (optional<unique_ptr<HTTPSRequest>> req = submissions.pop()) {
+        enqueue(std::move(*req));
+    }
+}
+
+void AsyncHTTPSConnection::request_finished() {
+    lock_guard<mutex> lock(idle_mtx);
+    if (--outstanding == 0) idle_cv.notify_all();
+}
+
+void AsyncHTTPSConnection::start_io_thread() {
+    if (io_thread.joinable()) return;
+    stopping = false;
+    io_thread = thread(&AsyncHTTPSConnection::io_thread_main, this);
+}
+
+void AsyncHTTPSConnection::stop_io_thread() {
+    if (!io_thread.joinable()) return;
+    stopping = true;
+    wake();
+    io_thread.join();
+}
+
+void AsyncHTTPSConnection::io_thread_main() {
+    while (true) {
+        if (!poll_events()) break;
+        if (stopping && !has_work()) {
+            // A request handed over just before stop_io_thread() may not
+            // have been picked up yet
+            take_submissions();
+            if (!has_work()) break;
+        }
+    }
+}
+
+void AsyncHTTPSConnection::enqueue(unique_ptr<HTTPSRequest> req) {
+    req->id = next_request_id++;
+    req->total_deadline = chrono::steady_clock::now() + timeouts.total;
+    deadlines.push({req->total_deadline, req->id});
+    live[req->id] = req.get();
+
+    admit(std::move(req));
+}
+
+// Sends the request on if its host's limiter has a free slot; otherwise it
+// waits behind earlier arrivals until admit_waiting() finds room
+void AsyncHTTPSConnection::admit(unique_ptr<HTTPSRequest> req) {
+    deque<unique_ptr<HTTPSRequest>>& waiting = admission[req->host];
+    if (adaptive_concurrency && (!waiting.empty() || !limiters[req->host].try_acquire())) {
+        if (verbose >= 2) cout << "Concurrency limit (" << limiters[req->host].limit() << ") reached for " << req->host << ", holding request" << endl;
+        req->enter(QUEUED);
+        waiting.push_back(std::move(req));
+        admission_count++;
         return;
     }
 
-    req->socket_fd = socket_fd;
-    req->state = CONNECTING;
-    req->resp = std::move(resp);
+    req->admitted = adaptive_concurrency;
+    req->admitted_at = chrono::steady_clock::now();
+    submit(std::move(req));
+}
+
+void AsyncHTTPSConnection::admit_waiting() {
+    for (auto& [host, waiting] : admission) {
+        ConcurrencyLimiter& limiter = limiters[host];
+        while (!waiting.empty() && (!adaptive_concurrency || limiter.try_acquire())) {
+            unique_ptr<HTTPSRequest> req = std::move(waiting.front());
+            waiting.pop_front();
+            admission_count--;
+            req->admitted = adaptive_concurrency;
+            req->admitted_at = chrono::steady_clock::now();
+            submit(std::move(req));
+        }
+    }
+}
 
-    string request = "POST " + path + " HTTP/1.1\r\n";
-    request += "Host: " + host + "\r\n";
-    request += "Content-Length: " + to_string(body.size()) + "\r\n";
-    for (const auto& header : headers) {
-        request += header.first + ": " + header.second + "\r\n";
+// Gives the request's slot back and feeds its outcome to the limiter
+void AsyncHTTPSConnection::release_admission(HTTPSRequest* req, int status) {
+    if (!req->admitted) return;
+    req->admitted = false;
+
+    ConcurrencyLimiter& limiter = limiters[req->host];
+    if (req->state == DONE) {
+        limiter.on_response(status, chrono::steady_clock::now() - req->admitted_at, req->recv_headers);
+    } else {
+        limiter.on_failure(req->timed_out);
     }
-    request += "\r\n" + body;
-    req->send_buffer = request;
+    if (verbose >= 2) cout << "Concurrency limit for " << req->host << " now " << limiter.limit() << " (" << limiter.in_flight() << " in flight)" << endl;
+}
 
-    struct kevent ev;
-    EV_SET(&ev, socket_fd, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0, req.get());
-    kevent(kqueue_fd, &ev, 1, nullptr, 0, nullptr);
+// Routes a request to an HTTP/2 connection with a free stream, an idle
+// keep-alive connection, a new connection, or the host's wait queue when it
+// already has max_conns_per_host sockets open (or one still negotiating).
+void AsyncHTTPSConnection::submit(unique_ptr<HTTPSRequest> req) {
+    HTTPSRequest* raw = req.get();
 
+    if (HTTP2Session* session = find_http2_session(raw->host)) {
+        arm_phase(raw, timeouts.first_byte);
+        session->submit(std::move(req));
+        session->flush();
+        backend->watch(session->get_fd(), session->interest(), session);
+        return;
+    }
+
+    if (take_idle_connection(raw)) {
+        if (verbose >= 2) cout << "Reusing pooled connection fd=" << raw->socket_fd << " for " << raw->host << endl;
+        raw->enter(WRITING_REQUEST);
+        raw->reused = true;
+        arm_phase(raw, timeouts.first_byte);
+        backend->watch(raw->socket_fd, EVENT_WRITE, raw);
+        reqs[raw->socket_fd] = std::move(req);
+        return;
+    }
+
+    if (awaiting_protocol(raw->host)) {
+        if (verbose >= 2) cout << "Waiting for " << raw->host << " to negotiate a protocol, queueing request" << endl;
+        raw->enter(QUEUED);
+        raw->disarm_phase();
+        pending[raw->host].push_back(std::move(req));
+        pending_count++;
+        return;
+    }
+
+    if (open_conns[raw->host] >= max_conns_per_host) {
+        if (verbose >= 2) cout << "Connection cap reached for " << raw->host << ", queueing request" << endl;
+        raw->enter(QUEUED);
+        raw->disarm_phase();
+        pending[raw->host].push_back(std::move(req));
+        pending_count++;
+        return;
+    }
+
+    open_connection(std::move(req));
+}
+
+bool AsyncHTTPSConnection::take_idle_connection(HTTPSRequest* req) {
+    auto it = idle_conns.find(req->host);
+    if (it == idle_conns.end()) return false;
+
+    auto now = chrono::steady_clock::now();
+    vector<PooledConnection>& conns = it->second;
+    while (!conns.empty()) {
+        PooledConnection idle = std::move(conns.back());
+        conns.pop_back();
+
+        // A peer that closed while we weren't looking leaves EOF (or a TLS
+        // alert) waiting on the socket; anything but EAGAIN means don't use it
+        char probe;
+        ssize_t peeked = recv(idle.socket_fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+        bool alive = peeked == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+
+        if (!alive || now - idle.idle_since > IDLE_CONNECTION_TIMEOUT) {
+            if (verbose >= 2) cout << "Dropping stale pooled connection fd=" << idle.socket_fd << endl;
+            close_connection(req->host, idle.socket_fd, idle.conn);
+            continue;
+        }
+
+        req->socket_fd = idle.socket_fd;
+        req->conn = idle.conn;
+        req->inbuf = std::move(idle.buffer);
+        return true;
+    }
+    return false;
+}
+
+// Reserves a connection slot for the host and starts the DNS lookup; the
+// connect happens as soon as an address is known, which for a cached host is
+// right away.
+void AsyncHTTPSConnection::open_connection(unique_ptr<HTTPSRequest> req) {
+    open_conns[req->host]++;
+    handshaking[req->host]++;
+    req->negotiating = true;
+    arm_phase(req.get(), timeouts.connect);
+
+    ResolveResult result;
+    if (resolver.lookup(req->hostname, result)) {
+        connect_resolved(std::move(req), result);
+        return;
+    }
+
+    if (verbose >= 2) cout << "Resolving " << req->hostname << " in the background" << endl;
+    req->enter(RESOLVING);
+    resolving[req->hostname].push_back(std::move(req));
+    resolving_count++;
+}
+
+void AsyncHTTPSConnection::connect_resolved(unique_ptr<HTTPSRequest> req, const ResolveResult& result) {
+    if (!result.error.empty()) {
+        // Not retried: a name that doesn't resolve won't a second later
+        if (verbose >= 2) cout << result.error << endl;
+        open_conns[req->host]--;
+        finish_negotiation(req.get());
+        complete(req.get(), make_exception_ptr(runtime_error(result.error)));
+        return;
+    }
+
+    req->connect_addresses = Resolver::connection_order(result.addresses);
+    req->next_address = 0;
+    int socket_fd = start_connect_attempt(req.get());
+    if (socket_fd < 0) {
+        string host = req->host;
+        open_conns[host]--;
+        finish_negotiation(req.get());
+        finish(std::move(req), make_exception_ptr(runtime_error("Connection failed")));
+        // Requests queued behind this one's negotiation would otherwise wait forever
+        drain_pending(host);
+        return;
+    }
+
+    req->socket_fd = socket_fd;
+    req->enter(CONNECTING);
+    backend->watch(socket_fd, EVENT_WRITE, req.get());
+    HTTPSRequest* started = req.get();
     reqs[socket_fd] = std::move(req);
+    schedule_next_attempt(started);
 }
 
-void AsyncHTTPSConnection::run_loop(){
-    struct kevent events[64];
+// Opens a non-blocking connect to the next address that takes one; most
+// failures only show up later, as an error on the socket. -1 once no
+// addresses are left.
+int AsyncHTTPSConnection::start_connect_attempt(HTTPSRequest* req) {
+    while (req->next_address < req->connect_addresses.size()) {
+        const ResolvedAddress& address = req->connect_addresses[req->next_address++];
+        int socket_fd = socket(address.family, SOCK_STREAM, 0);
+        if (socket_fd < 0) continue;
+        fcntl(socket_fd, F_SETFL, O_NONBLOCK);
 
-    while (!reqs.empty()) {
-        int n = kevent(kqueue_fd, nullptr, 0, events, 64, nullptr);
-        if (n == -1) {
-            perror("kevent");
-            break;
+        sockaddr_storage serv_addr = address.with_port(req->port);
+        if (connect(socket_fd, (struct sockaddr*)&serv_addr, address.addr_len) == -1 && errno != EINPROGRESS) {
+            if (verbose >= 2) cout << "Connect to " << address.to_string() << " failed: " << strerror(errno) << endl;
+            close(socket_fd);
+            continue;
         }
+        if (verbose >= 2) cout << "Connecting to " << address.to_string() << " port " << req->port << " (fd=" << socket_fd << ")" << endl;
+        return socket_fd;
+    }
+    return -1;
+}
 
-        for (int i = 0; i < n; ++i) {
-            auto *req = static_cast<HTTPSRequest*>(events[i].udata);
-            uint32_t filter = events[i].filter;
-
-            if (verbose >= 2) cout << "Event: state=" << req->state << " filter=" << filter << endl;
-
-            conn_state_t state_before = req->state;
-
-            switch (req->state) {
-                case CONNECTING:
-                    handle_connect(req, filter);
-                    break;
-                case TLS_HANDSHAKE:
-                    handle_tls(req, filter);
-                    break;
-                case WRITING_REQUEST:
-                    handle_write(req, filter);
-                    break;
-                case READING_RESPONSE_HEADERS:
-                    handle_read_response_headers(req, filter);
-                    break;
-                case READING_RESPONSE:
-                    handle_read_response(req, filter);
-                    break;
-                case DONE:
-                    if (verbose >= 2) cout << "Cleaning up DONE request" << endl;
-                    this->cleanup(req);
-                    continue;
-                case ERROR:
-                    if (verbose >= 2) cout << "ERROR occurred in state machine" << endl;
-                    this->cleanup(req);
-                    continue;
-                default:
-                    break;
-            }
+void AsyncHTTPSConnection::schedule_next_attempt(HTTPSRequest* req) {
+    if (req->next_address >= req->connect_addresses.size()) {
+        req->next_attempt_at = chrono::steady_clock::time_point::max();
+        return;
+    }
+    req->next_attempt_at = chrono::steady_clock::now() + CONNECTION_ATTEMPT_DELAY;
+    attempt_timers.push({req->next_attempt_at, req->id});
+}
 
-            if (state_before != DONE && state_before != ERROR) {
-                if (req->state == DONE) {
-                    if (verbose >= 2) cout << "State transitioned to DONE, cleaning up" << endl;
-                    this->cleanup(req);
-                } else if (req->state == ERROR) {
-                    if (verbose >= 2) cout << "State transitioned to ERROR, cleaning up" << endl;
-                    this->cleanup(req);
-                }
+// Starts the next address alongside the attempts already in flight
+void AsyncHTTPSConnection::race_next_address(HTTPSRequest* req) {
+    int socket_fd = start_connect_attempt(req);
+    if (socket_fd >= 0) {
+        req->racing_fds.push_back(socket_fd);
+        racing[socket_fd] = req;
+        backend->watch(socket_fd, EVENT_WRITE, req);
+    }
+    schedule_next_attempt(req);
+}
+
+void AsyncHTTPSConnection::resume_connect_races() {
+    auto now = chrono::steady_clock::now();
+    while (!attempt_timers.empty() && attempt_timers.top().when <= now) {
+        RequestDeadline due = attempt_timers.top();
+        attempt_timers.pop();
+
+        auto it = live.find(due.request_id);
+        if (it == live.end()) continue;
+        HTTPSRequest* req = it->second;
+        // Stale if the request has connected since, or a failed attempt
+        // already brought the next address forward
+        if (req->state != CONNECTING || req->next_attempt_at != due.when) continue;
+        if (verbose >= 2) cout << "No connection to " << req->host << " after " << CONNECTION_ATTEMPT_DELAY.count() << "ms, racing the next address" << endl;
+        race_next_address(req);
+    }
+}
+
+// An event on one of the extra sockets: the first to connect takes over the
+// request, and a failure brings the next address forward
+void AsyncHTTPSConnection::settle_racing_attempt(HTTPSRequest* req, int fd) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len);
+
+    racing.erase(fd);
+    req->racing_fds.erase(find(req->racing_fds.begin(), req->racing_fds.end(), fd));
+    if (error != 0) {
+        if (verbose >= 2) cout << "Racing connection fd=" << fd << " failed with error: " << error << endl;
+        backend->unwatch(fd);
+        close(fd);
+        race_next_address(req);
+        return;
+    }
+
+    if (verbose >= 2) cout << "fd=" << fd << " won the connection race for " << req->host << endl;
+    move_to_socket(req, fd);
+    drive(req, EVENT_WRITE);
+}
+
+// socket_fd failed to connect. Another attempt takes its place: one already
+// racing, or the next address right away. False when nothing is left to try.
+bool AsyncHTTPSConnection::replace_failed_attempt(HTTPSRequest* req) {
+    if (!req->racing_fds.empty()) {
+        int fd = req->racing_fds.front();
+        req->racing_fds.erase(req->racing_fds.begin());
+        racing.erase(fd);
+        move_to_socket(req, fd);
+        race_next_address(req);
+        return true;
+    }
+
+    int fd = start_connect_attempt(req);
+    if (fd < 0) return false;
+    backend->watch(fd, EVENT_WRITE, req);
+    move_to_socket(req, fd);
+    schedule_next_attempt(req);
+    return true;
+}
+
+// Closes the request's current socket and makes fd its socket instead
+void AsyncHTTPSConnection::move_to_socket(HTTPSRequest* req, int fd) {
+    auto node = reqs.extract(req->socket_fd);
+    backend->unwatch(req->socket_fd);
+    close(req->socket_fd);
+    req->socket_fd = fd;
+    node.key() = fd;
+    reqs.insert(std::move(node));
+}
+
+// Closes the attempts that lost, or all the extra ones if the request is
+// giving up
+void AsyncHTTPSConnection::cancel_connect_race(HTTPSRequest* req) {
+    for (int fd : req->racing_fds) {
+        backend->unwatch(fd);
+        close(fd);
+        racing.erase(fd);
+    }
+    req->racing_fds.clear();
+    req->connect_addresses.clear();
+    req->next_address = 0;
+    req->next_attempt_at = chrono::steady_clock::time_point::max();
+}
+
+void AsyncHTTPSConnection::handle_resolved() {
+    for (auto& [host, result] : resolver.take_completed()) {
+        auto it = resolving.find(host);
+        if (it == resolving.end()) continue;
+
+        vector<unique_ptr<HTTPSRequest>> waiting = std::move(it->second);
+        resolving.erase(it);
+        resolving_count -= waiting.size();
+
+        if (verbose >= 2) cout << "Resolved " << host << " (" << result.addresses.size() << " addresses) for " << waiting.size() << " requests" << endl;
+        // Lookups are per hostname; slots and queues are per origin
+        unordered_set<string> origins;
+        for (auto& req : waiting) {
+            origins.insert(req->host);
+            connect_resolved(std::move(req), result);
+        }
+        // Failed connects freed their slots; let queued requests have them
+        for (const string& origin : origins) {
+            drain_pending(origin);
+        }
+    }
+}
+
+// Hands the request's socket back to the idle pool when the response was
+// framed (so we know exactly where it ended) and the server allows reuse;
+// closes it otherwise. Either way the request no longer owns it.
+void AsyncHTTPSConnection::release_connection(HTTPSRequest* req) {
+    cancel_connect_race(req);
+    if (req->socket_fd < 0) return;
+    backend->unwatch(req->socket_fd);
+
+    bool reusable = req->state == DONE && req->keep_alive && req->transfer_mode != CONNECTION_CLOSE && (req->conn != nullptr || !req->tls);
+    if (reusable) {
+        if (verbose >= 2) cout << "Returning fd=" << req->socket_fd << " to pool for " << req->host << endl;
+        req->inbuf.clear();
+        idle_conns[req->host].push_back({req->socket_fd, req->conn, chrono::steady_clock::now(), std::move(req->inbuf)});
+    } else {
+        close_connection(req->host, req->socket_fd, req->conn);
+    }
+    req->socket_fd = -1;
+    req->conn = nullptr;
+}
+
+void AsyncHTTPSConnection::close_connection(const string& host, int socket_fd, SSL* conn) {
+    if (conn) {
+        SSL_shutdown(conn);
+        SSL_free(conn);
+    }
+    close(socket_fd);
+    auto it = open_conns.find(host);
+    if (it != open_conns.end() && it->second > 0) it->second--;
+}
+
+void AsyncHTTPSConnection::drain_pending(const string& host) {
+    auto it = pending.find(host);
+    if (it == pending.end()) return;
+
+    deque<unique_ptr<HTTPSRequest>>& queue = it->second;
+    while (!queue.empty() && can_dispatch(host)) {
+        unique_ptr<HTTPSRequest> req = std::move(queue.front());
+        queue.pop_front();
+        pending_count--;
+        submit(std::move(req));
+    }
+}
+
+bool AsyncHTTPSConnection::can_dispatch(const string& host) {
+    if (find_http2_session(host) != nullptr || idle_connection_count(host) > 0) return true;
+    return !awaiting_protocol(host) && open_conns[host] < max_conns_per_host;
+}
+
+// A host that may speak h2 gets one connection at a time until ALPN answers:
+// if it does, that one connection carries everything queued meanwhile.
+bool AsyncHTTPSConnection::awaiting_protocol(const string& host) {
+    return http2_enabled && http1_hosts.count(host) == 0 && handshaking[host] > 0;
+}
+
+void AsyncHTTPSConnection::finish_negotiation(HTTPSRequest* req) {
+    if (!req->negotiating) return;
+    req->negotiating = false;
+    auto it = handshaking.find(req->host);
+    if (it != handshaking.end() && it->second > 0) it->second--;
+}
+
+// First HTTP/2 connection for the host with a free stream. Idle sessions are
+// read first so a GOAWAY or EOF that arrived between loops is noticed here
+// rather than by losing a request on them.
+HTTP2Session* AsyncHTTPSConnection::find_http2_session(const string& host) {
+    auto it = h2_by_host.find(host);
+    if (it == h2_by_host.end()) return nullptr;
+
+    vector<HTTP2Session*> sessions = it->second;  // teardown edits the list
+    for (HTTP2Session* session : sessions) {
+        if (session->active_streams() == 0) {
+            session->handle_event(EVENT_READ);
+            if (session->is_closed() || session->idle_time() > IDLE_CONNECTION_TIMEOUT) {
+                if (verbose >= 2) cout << "Dropping idle HTTP/2 connection fd=" << session->get_fd() << endl;
+                teardown_session(session);
+                continue;
             }
         }
+        if (session->has_capacity()) return session;
     }
+    return nullptr;
 }
 
-void AsyncHTTPSConnection::handle_connect(HTTPSRequest* req, int16_t filter) {
-    switch (filter) {
-        case EVFILT_WRITE:
-            {
-                int error;
-                socklen_t len = sizeof(error);
-                getsockopt(req->socket_fd, SOL_SOCKET, SO_ERROR, &error, &len);
+// Moves a request whose handshake picked h2 onto a new HTTP2Session, which
+// takes over its socket. Requests queued during negotiation follow it.
+void AsyncHTTPSConnection::start_http2_session(HTTPSRequest* req) {
+    auto node = reqs.extract(req->socket_fd);
+    unique_ptr<HTTPSRequest> owned = std::move(node.mapped());
 
-                if (error == 0) {
-                    req->conn = SSL_new(req->ssl_ctx);
-                    SSL_set_fd(req->conn, req->socket_fd);
-                    SSL_set_tlsext_host_name(req->conn, req->host.c_str());
-                    req->state = TLS_HANDSHAKE;
-                } else {
-                    if (verbose >= 2) cout << "Socket connection failed with error: " << error << endl;
-                    req->state = ERROR;
+    auto session = make_unique<HTTP2Session>(owned->socket_fd, owned->conn, owned->host, verbose);
+    HTTP2Session* raw = session.get();
+    if (verbose >= 2) cout << "Starting HTTP/2 session on fd=" << raw->get_fd() << " for " << raw->get_host() << endl;
+
+    owned->socket_fd = -1;
+    owned->conn = nullptr;
+    h2_by_host[raw->get_host()].push_back(raw);
+    h2_sessions[raw->get_fd()] = std::move(session);
+
+    raw->submit(std::move(owned));
+    run_session(raw, EVENT_WRITE);
+}
+
+void AsyncHTTPSConnection::run_session(HTTP2Session* session, event_filter_t filter) {
+    string host = session->get_host();
+    session->handle_event(filter);
+
+    // Collect everything before finishing requests: a resend can reenter
+    // submit(), which may tear down sessions for this host
+    vector<unique_ptr<HTTPSRequest>> done;
+    if (session->is_closed()) {
+        done = session->take_streams();
+        teardown_session(session);
+    } else {
+        done = session->take_finished();
+        backend->watch(session->get_fd(), session->interest(), session);
+    }
+
+    for (auto& req : done) {
+        finish_http2_request(std::move(req));
+    }
+    drain_pending(host);
+}
+
+void AsyncHTTPSConnection::teardown_session(HTTP2Session* session) {
+    string host = session->get_host();
+    int socket_fd = session->get_fd();
+    if (verbose >= 2) cout << "Closing HTTP/2 connection fd=" << socket_fd << endl;
+
+    backend->unwatch(socket_fd);
+    close_connection(host, socket_fd, session->get_conn());
+
+    vector<HTTP2Session*>& sessions = h2_by_host[host];
+    sessions.erase(remove(sessions.begin(), sessions.end(), session), sessions.end());
+    h2_sessions.erase(socket_fd);
+}
+
+void AsyncHTTPSConnection::finish_http2_request(unique_ptr<HTTPSRequest> req) {
+    // Refused streams, streams past a GOAWAY, and streams on a connection
+    // that died before answering never reached the application; send once more
+    if (req->state == ERROR && req->recv_headers.empty() && !req->replayed) {
+        if (verbose >= 2) cout << "HTTP/2 stream for " << req->path << " got no response, resending" << endl;
+        req->reset_response();
+        req->replayed = true;
+        submit(std::move(req));
+        return;
+    }
+    finish(std::move(req));
+}
+
+size_t AsyncHTTPSConnection::http2_streams_in_flight() const {
+    size_t total = 0;
+    for (const auto& [socket_fd, session] : h2_sessions) {
+        total += session->active_streams();
+    }
+    return total;
+}
+
+bool AsyncHTTPSConnection::has_work() const {
+    return !reqs.empty() || pending_count > 0 || resolving_count > 0 || admission_count > 0 || !backing_off.empty() ||
+           http2_streams_in_flight() > 0 || !ready.empty();
+}
+
+void AsyncHTTPSConnection::run_loop(){
+    if (io_thread.joinable()) {
+        unique_lock<mutex> lock(idle_mtx);
+        idle_cv.wait(lock, [this] { return outstanding == 0; });
+        return;
+    }
+
+    admit_waiting();
+    while (has_work()) {
+        if (!poll_events()) break;
+    }
+}
+
+// One wait on the backend, its events, then the timer and queue work that
+// can follow any batch. False if the backend itself failed.
+bool AsyncHTTPSConnection::poll_events() {
+    IOEvent events[64];
+
+    int n = backend->wait(events, 64, next_timeout_ms());
+    if (n == -1) {
+        if (errno == EINTR) return true;
+        perror("event backend wait");
+        return false;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        if (events[i].udata == &resolver) {
+            handle_resolved();
+            continue;
+        }
+        if (events[i].udata == wake_pipe) {
+            take_submissions();
+            continue;
+        }
+
+        auto session = h2_sessions.find(events[i].fd);
+        if (session != h2_sessions.end() && session->second.get() == events[i].udata) {
+            run_session(session->second.get(), events[i].filter);
+            continue;
+        }
+
+        auto racer = racing.find(events[i].fd);
+        if (racer != racing.end() && racer->second == events[i].udata) {
+            settle_racing_attempt(racer->second, events[i].fd);
+            continue;
+        }
+
+        auto it = reqs.find(events[i].fd);
+        // An earlier event in this batch may already have finished the request
+        if (it == reqs.end() || it->second.get() != events[i].udata) continue;
+        drive(it->second.get(), events[i].filter);
+    }
+
+    expire_deadlines();
+    resume_connect_races();
+    resume_retries();
+    resume_ready();
+    admit_waiting();
+
+    // Nothing is left for the remaining entries to time out
+    if (live.empty()) {
+        deadlines = {};
+        retry_timers = {};
+        attempt_timers = {};
+    }
+    return true;
+}
+
+// Runs a socket event through the request's state machine, then hands it
+// on to wherever its new state belongs
+void AsyncHTTPSConnection::drive(HTTPSRequest* req, event_filter_t filter) {
+    if (verbose >= 2) cout << "Event: state=" << req->state << " filter=" << filter << endl;
+
+    string host = req->host;
+    bool was_negotiating = req->negotiating;
+    dispatch(req, filter);
+
+    if (req->state == STREAMING) {
+        start_http2_session(req);
+    } else if (req->state == DONE) {
+        if (verbose >= 2) cout << "State transitioned to DONE, cleaning up" << endl;
+        this->cleanup(req);
+    } else if (req->state == ERROR) {
+        if (verbose >= 2) cout << "State transitioned to ERROR, cleaning up" << endl;
+        this->cleanup(req);
+    } else if (was_negotiating && !req->negotiating) {
+        // Settled on HTTP/1.1: requests held back for ALPN can open connections
+        drain_pending(host);
+    }
+}
+
+int AsyncHTTPSConnection::next_timeout_ms() const {
+    auto now = chrono::steady_clock::now();
+    auto next = deadlines.empty() ? chrono::steady_clock::time_point::max() : deadlines.top().when;
+    if (!retry_timers.empty()) {
+        next = min(next, retry_timers.top().when);
+    }
+    if (!attempt_timers.empty()) {
+        next = min(next, attempt_timers.top().when);
+    }
+
+    // A rate-limited host resumes admission on a timer, not on an event
+    for (const auto& [host, waiting] : admission) {
+        auto limiter = limiters.find(host);
+        if (waiting.empty() || limiter == limiters.end()) continue;
+        if (limiter->second.paused_until() > now) {
+            next = min(next, limiter->second.paused_until());
+        }
+    }
+
+    if (next == chrono::steady_clock::time_point::max()) return -1;
+    auto wait = next - now;
+    if (wait <= chrono::steady_clock::duration::zero()) return 0;
+    // Round up so we don't wake a hair early and spin on the same deadline
+    auto ms = chrono::ceil<chrono::milliseconds>(wait).count();
+    return (int)min<long long>(ms, INT_MAX);
+}
+
+void AsyncHTTPSConnection::arm_phase(HTTPSRequest* req, chrono::milliseconds timeout) {
+    req->phase_deadline = chrono::steady_clock::now() + timeout;
+    deadlines.push({req->phase_deadline, req->id});
+}
+
+static string phase_name(conn_state_t state) {
+    switch (state) {
+        case RESOLVING:
+        case CONNECTING:
+            return "connect";
+        case TLS_HANDSHAKE:
+            return "tls";
+        default:
+            return "first byte";
+    }
+}
+
+void AsyncHTTPSConnection::expire_deadlines() {
+    auto now = chrono::steady_clock::now();
+    while (!deadlines.empty() && deadlines.top().when <= now) {
+        uint64_t id = deadlines.top().request_id;
+        deadlines.pop();
+
+        auto it = live.find(id);
+        if (it == live.end()) continue;
+        HTTPSRequest* req = it->second;
+
+        if (now >= req->total_deadline) {
+            expire(req, "total");
+        } else if (now >= req->phase_deadline) {
+            expire(req, phase_name(req->state));
+        }
+    }
+}
+
+void AsyncHTTPSConnection::expire(HTTPSRequest* req, const string& phase) {
+    if (verbose >= 2) cout << "Request " << req->id << " to " << req->host << req->path << " hit its " << phase << " timeout (state=" << req->state << ")" << endl;
+
+    unique_ptr<HTTPSRequest> owned = detach(req);
+    if (!owned) return;
+
+    string host = owned->host;
+    finish_negotiation(owned.get());
+    owned->enter(ERROR);
+    owned->timed_out = true;
+    finish(std::move(owned), make_exception_ptr(HTTPSTimeoutError(phase, host)));
+    drain_pending(host);
+}
+
+// Takes the request out of whichever structure currently owns it, closing its
+// connection if it had one of its own
+unique_ptr<HTTPSRequest> AsyncHTTPSConnection::detach(HTTPSRequest* req) {
+    const string& host = req->host;
+    switch (req->state) {
+        case QUEUED:
+            {
+                // Either waiting for a connection slot or for admission
+                deque<unique_ptr<HTTPSRequest>>& queue = pending[host];
+                for (auto it = queue.begin(); it != queue.end(); ++it) {
+                    if (it->get() != req) continue;
+                    unique_ptr<HTTPSRequest> owned = std::move(*it);
+                    queue.erase(it);
+                    pending_count--;
+                    return owned;
+                }
+                deque<unique_ptr<HTTPSRequest>>& waiting = admission[host];
+                for (auto it = waiting.begin(); it != waiting.end(); ++it) {
+                    if (it->get() != req) continue;
+                    unique_ptr<HTTPSRequest> owned = std::move(*it);
+                    waiting.erase(it);
+                    admission_count--;
+                    return owned;
                 }
             }
             break;
-        default:
+        case BACKING_OFF:
             {
-                if (verbose >= 2) cout << "handle_connect: unexpected filter" << endl;
-                req->state = ERROR;
+                auto node = backing_off.extract(req->id);
+                if (!node.empty()) return std::move(node.mapped());
             }
             break;
-    }
-}
-void AsyncHTTPSConnection::handle_tls(HTTPSRequest* req, int16_t filter) {
-    switch (filter) {
-        case EVFILT_WRITE:
-        {
-            int ssl_result = SSL_connect(req->conn);
-            if (verbose >= 2) cout << "SSL_connect result=" << ssl_result << endl;
-            if (ssl_result == 1) {
-                if (verbose >= 2) cout << "TLS handshake complete from WRITE event!" << endl;
-                req->state = WRITING_REQUEST;
-            } else {
-                int ssl_error = SSL_get_error(req->conn, ssl_result);
-                if (verbose >= 2) cout << "SSL_get_error=" << ssl_error << " (WANT_READ=2, WANT_WRITE=3)" << endl;
-                if (ssl_error == SSL_ERROR_WANT_READ) {
-                    struct kevent events[2];
-                    EV_SET(&events[0], req->socket_fd, EVFILT_WRITE, EV_DELETE, 0, 0, nullptr);
-                    EV_SET(&events[1], req->socket_fd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, req);
-                    kevent(kqueue_fd, events, 2, nullptr, 0, nullptr);
-                } else if (ssl_error != SSL_ERROR_WANT_WRITE) {
-                    if (verbose >= 2) cout << "handle_tls WRITE: SSL error " << ssl_error << endl;
-                    req->state = ERROR;
+        case RESOLVING:
+            {
+                vector<unique_ptr<HTTPSRequest>>& waiting = resolving[req->hostname];
+                for (auto it = waiting.begin(); it != waiting.end(); ++it) {
+                    if (it->get() != req) continue;
+                    unique_ptr<HTTPSRequest> owned = std::move(*it);
+                    waiting.erase(it);
+                    resolving_count--;
+                    open_conns[host]--;
+                    return owned;
                 }
             }
             break;
-        }
-        case EVFILT_READ:
-        {
-            int ssl_result = SSL_connect(req->conn);
-            if (verbose >= 2) cout << "SSL_connect (from READ) result=" << ssl_result << endl;
-            if (ssl_result == 1) {
-                if (verbose >= 2) cout << "TLS handshake complete from READ event!" << endl;
-                req->state = WRITING_REQUEST;
-                struct kevent events[2];
-                EV_SET(&events[0], req->socket_fd, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
-                EV_SET(&events[1], req->socket_fd, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0, req);
-                kevent(kqueue_fd, events, 2, nullptr, 0, nullptr);
-            } else {
-                int ssl_error = SSL_get_error(req->conn, ssl_result);
-                if (ssl_error == SSL_ERROR_WANT_WRITE) {
-                    struct kevent events[2];
-                    EV_SET(&events[0], req->socket_fd, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
-                    EV_SET(&events[1], req->socket_fd, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0, req);
-                    kevent(kqueue_fd, events, 2, nullptr, 0, nullptr);
-                } else if (ssl_error != SSL_ERROR_WANT_READ) {
-                    if (verbose >= 2) cout << "handle_tls READ: SSL error " << ssl_error << endl;
-                    req->state = ERROR;
-                }
+        case STREAMING:
+            for (auto& [socket_fd, session] : h2_sessions) {
+                unique_ptr<HTTPSRequest> owned = session->cancel(req);
+                if (!owned) continue;
+                session->flush();
+                backend->watch(socket_fd, session->interest(), session.get());
+                return owned;
             }
             break;
-        }
         default:
-            req->state = ERROR;
-            if (verbose >= 2) cout << "handle_tls: unexpected filter" << endl;
-            break;
+            {
+                auto node = reqs.extract(req->socket_fd);
+                if (node.empty()) break;
+                unique_ptr<HTTPSRequest> owned = std::move(node.mapped());
+                owned->enter(ERROR);  // never pool a socket mid-response
+                release_connection(owned.get());
+                return owned;
+            }
     }
+    return nullptr;
+}
+
+// Runs the handler for the current state, then keeps driving the machine for as
+// long as it makes progress. Under edge triggering the readiness that caused a
+// transition won't be reported again, so the next state has to try its I/O now
+// instead of waiting for another event.
+void AsyncHTTPSConnection::dispatch(HTTPSRequest* req, event_filter_t filter) {
+    conn_state_t state_before;
+    do {
+        state_before = req->state;
+        switch (req->state) {
+            case CONNECTING:
+                handle_connect(req, filter);
+                break;
+            case TLS_HANDSHAKE:
+                handle_tls(req, filter);
+                break;
+            case WRITING_REQUEST:
+                handle_write(req, filter);
+                break;
+            case READING_RESPONSE_HEADERS:
+                handle_read_response_headers(req, filter);
+                break;
+            case READING_RESPONSE:
+                handle_read_response(req, filter);
+                break;
+            default:
+                break;
+        }
+        filter = (req->state == READING_RESPONSE_HEADERS || req->state == READING_RESPONSE) ? EVENT_READ : EVENT_WRITE;
+    } while (req->state != state_before && req->state != DONE && req->state != ERROR);
 }
 
-void AsyncHTTPSConnection::handle_write(HTTPSRequest* req, int16_t filter) {
+void AsyncHTTPSConnection::handle_connect(HTTPSRequest* req, event_filter_t filter) {
     switch (filter) {
-        case EVFILT_WRITE:
+        case EVENT_WRITE:
             {
-                if (verbose >= 2) cout << "handle_write: starting" << endl;
-                const char* data = req->send_buffer.c_str() + req->bytes_sent;
-                size_t remaining = req->send_buffer.size() - req->bytes_sent;
-
-                int bytes_written = SSL_write(req->conn, data, remaining);
-                if (verbose >= 2) cout << "SSL_write result=" << bytes_written << endl;
-
-                if (bytes_written > 0) {
-                    req->bytes_sent += bytes_written;
-                    if (verbose >= 2) cout << "Wrote " << bytes_written << " bytes, total=" << req->bytes_sent << "/" << req->send_buffer.size() << endl;
-                    if (req->bytes_sent >= req->send_buffer.size()) {
-                        if (verbose >= 2) cout << "Request fully sent, transitioning to READING_RESPONSE_HEADERS" << endl;
-                        req->state = READING_RESPONSE_HEADERS;
-                        struct kevent events[2];
-                        EV_SET(&events[0], req->socket_fd, EVFILT_WRITE, EV_DELETE, 0, 0, nullptr);
-                        EV_SET(&events[1], req->socket_fd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, req);
-                        int ret = kevent(kqueue_fd, events, 2, nullptr, 0, nullptr);
-                        if (verbose >= 2) cout << "kevent returned " << ret << endl;
-                    }
+                int error;
+                socklen_t len = sizeof(error);
+                getsockopt(req->socket_fd, SOL_SOCKET, SO_ERROR, &error, &len);
+
+                if (error == 0) {
+                    cancel_connect_race(req);
+                }
+                if (error == 0 && !req->tls) {
+                    // Plaintext: no handshake, and no ALPN, so always HTTP/1.1
+                    finish_negotiation(req);
+                    arm_phase(req, timeouts.first_byte);
+                    if (http2_enabled) http1_hosts.insert(req->host);
+                    req->enter(WRITING_REQUEST);
+                } else if (error == 0) {
+                    req->conn = tls->new_connection(req->socket_fd, req->hostname, http2_enabled);
+                    req->enter(TLS_HANDSHAKE);
+                    arm_phase(req, timeouts.tls);
+                } else if (replace_failed_attempt(req)) {
+                    if (verbose >= 2) cout << "Socket connection failed with error: " << error << ", continuing on fd=" << req->socket_fd << endl;
                 } else {
-                    int ssl_error = SSL_get_error(req->conn, bytes_written);
-                    if (verbose >= 2) cout << "SSL_write failed, ssl_error=" << ssl_error << endl;
-                    if (ssl_error == SSL_ERROR_WANT_READ) {
-                        struct kevent ev;
-                        EV_SET(&ev, req->socket_fd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, req);
-                        kevent(kqueue_fd, &ev, 1, nullptr, 0, nullptr);
-                    } else if (ssl_error != SSL_ERROR_WANT_WRITE) {
-                        req->state = ERROR;
-                    }
+                    if (verbose >= 2) cout << "Socket connection failed with error: " << error << endl;
+                    req->enter(ERROR);
                 }
-                if (verbose >= 2) cout << "handle_write: ending, state=" << req->state << endl;
             }
             break;
         default:
             {
-                req->state = ERROR;
+                if (verbose >= 2) cout << "handle_connect: unexpected filter" << endl;
+                req->enter(ERROR);
             }
             break;
     }
 }
-void AsyncHTTPSConnection::parse_response(HTTPSRequest* req, char buffer[], ssize_t bytes_received, string sentinel) {
-    switch (req->transfer_mode) {
-        case CONTENT_LENGTH:
-            {
-                req->recv_body.append(buffer, bytes_received);
-                if (req->recv_body.size() >= req->content_length) {
-                    req->state = DONE;
-                }
-            }
-            break;
-        case CHUNKED:
-            {
-                req->chunked_buffer.append(buffer, bytes_received);
-
-                size_t pos = 0;
-                while (pos < req->chunked_buffer.size()) {
-                    if (req->chunk_size == 0) {
-                        size_t crlf_pos = req->chunked_buffer.find("\r\n", pos);
-                        if (crlf_pos == string::npos) {
-                            req->chunked_buffer = req->chunked_buffer.substr(pos);
-                            return;
-                        }
+void AsyncHTTPSConnection::handle_tls(HTTPSRequest* req, event_filter_t filter) {
+    // SSL_connect decides which direction it needs next, so either filter
+    // just resumes the handshake
+    int ssl_result = SSL_connect(req->conn);
+    if (verbose >= 2) cout << "SSL_connect (filter=" << filter << ") result=" << ssl_result << endl;
+    if (ssl_result == 1) {
+        tls->record_handshake(req->conn);
+        if (verbose >= 2) cout << "TLS handshake complete! resumed=" << SSL_session_reused(req->conn) << endl;
+        finish_negotiation(req);
+        arm_phase(req, timeouts.first_byte);
+        if (http2_enabled && TLSContext::negotiated_http2(req->conn)) {
+            if (verbose >= 2) cout << "ALPN selected h2 for " << req->host << endl;
+            req->enter(STREAMING);
+            return;
+        }
+        if (http2_enabled) http1_hosts.insert(req->host);
+        req->enter(WRITING_REQUEST);
+        backend->watch(req->socket_fd, EVENT_WRITE, req);
+        return;
+    }
 
-                        string chunk_size_str = req->chunked_buffer.substr(pos, crlf_pos - pos);
-                        if (chunk_size_str.empty()) {
-                            pos = crlf_pos + 2;
-                            continue;
-                        }
+    int ssl_error = SSL_get_error(req->conn, ssl_result);
+    if (verbose >= 2) cout << "SSL_get_error=" << ssl_error << " (WANT_READ=2, WANT_WRITE=3)" << endl;
+    if (ssl_error == SSL_ERROR_WANT_READ) {
+        backend->watch(req->socket_fd, EVENT_READ, req);
+    } else if (ssl_error == SSL_ERROR_WANT_WRITE) {
+        backend->watch(req->socket_fd, EVENT_WRITE, req);
+    } else {
+        if (verbose >= 2) cout << "handle_tls: SSL error " << ssl_error << endl;
+        req->enter(ERROR);
+    }
+}
 
-                        try {
-                            req->chunk_size = stoi(chunk_size_str, nullptr, 16);
-                        } catch (const exception& e) {
-                            pos = crlf_pos + 2;
-                            continue;
-                        }
-                        pos = crlf_pos + 2;
+void AsyncHTTPSConnection::handle_write(HTTPSRequest* req, event_filter_t filter) {
+    // A READ event here means SSL_write asked for it (renegotiation/key update)
+    if (verbose >= 2) cout << "handle_write: starting (filter=" << filter << ")" << endl;
+    if (req->send_buffer.empty()) {
+        req->send_buffer = req->serialize_http1();
+    }
+    while (req->bytes_sent < req->send_buffer.size()) {
+        const char* data = req->send_buffer.c_str() + req->bytes_sent;
+        size_t remaining = req->send_buffer.size() - req->bytes_sent;
 
-                        if (req->chunk_size == 0) {
-                            req->state = DONE;
-                            req->chunked_buffer.clear();
-                            return;
-                        }
-                    } else {
-                        size_t available = req->chunked_buffer.size() - pos;
-                        size_t to_read = min(req->chunk_size, available);
+        int bytes_written = req->write_some(data, remaining);
+        if (verbose >= 2) cout << "SSL_write result=" << bytes_written << endl;
 
-                        req->recv_body.append(req->chunked_buffer, pos, to_read);
-                        pos += to_read;
-                        req->chunk_size -= to_read;
+        if (bytes_written > 0) {
+            req->bytes_sent += bytes_written;
+            if (verbose >= 2) cout << "Wrote " << bytes_written << " bytes, total=" << req->bytes_sent << "/" << req->send_buffer.size() << endl;
+            continue;
+        }
 
-                        if (req->chunk_size == 0) {
-                            if (pos + 2 <= req->chunked_buffer.size()) {
-                                pos += 2;
-                            } else {
-                                req->chunked_buffer = req->chunked_buffer.substr(pos);
-                                return;
-                            }
-                        } else {
-                            req->chunked_buffer = req->chunked_buffer.substr(pos);
-                            return;
-                        }
-                    }
-                }
-                req->chunked_buffer.clear();
+        int ssl_error = req->io_error(bytes_written);
+        if (verbose >= 2) cout << "SSL_write failed, ssl_error=" << ssl_error << endl;
+        if (ssl_error == SSL_ERROR_WANT_READ) {
+            backend->watch(req->socket_fd, EVENT_READ, req);
+        } else if (ssl_error == SSL_ERROR_WANT_WRITE) {
+            backend->watch(req->socket_fd, EVENT_WRITE, req);
+        } else {
+            req->enter(ERROR);
+        }
+        return;
+    }
+
+    if (verbose >= 2) cout << "Request fully sent, transitioning to READING_RESPONSE_HEADERS" << endl;
+    req->enter(READING_RESPONSE_HEADERS);
+    backend->watch(req->socket_fd, EVENT_READ, req);
+}
+
+// Splits the header block off the read buffer and works out how the body is
+// framed. Whatever followed the headers stays in inbuf for the body parser.
+void AsyncHTTPSConnection::parse_headers(HTTPSRequest* req, size_t header_end) {
+    req->recv_headers.assign(req->inbuf.begin(), header_end);
+    req->inbuf.consume(header_end);
+    string& headers = req->recv_headers;
+    transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+
+    if (verbose >= 2) cout << "=== HEADERS ===\n" << headers << "=== END HEADERS ===" << endl;
+    req->stream_body = req->on_data && parse_status(headers) / 100 == 2;
+
+    // Bodies are handed over decoded; the header stays for the caller to see
+    req->decoder = ContentDecoder::create(header_value(headers, "content-encoding"));
+
+    if (header_value(headers, "transfer-encoding").find("chunked") != string::npos) {
+        req->transfer_mode = CHUNKED;
+        if (verbose >= 2) cout << "Using CHUNKED transfer mode" << endl;
+    }
+
+    // HTTP/1.1 keeps the connection by default; 1.0 only on request
+    bool is_http10 = headers.compare(0, 8, "http/1.0") == 0;
+    string connection = header_value(headers, "connection");
+    if (connection.find("close") != string::npos || (is_http10 && connection.find("keep-alive") == string::npos)) {
+        req->keep_alive = false;
+    }
+
+    if (req->transfer_mode != CHUNKED) {
+        string content_length = header_value(headers, "content-length");
+        if (!content_length.empty()) {
+            req->content_length = strtoull(content_length.c_str(), nullptr, 10);
+            req->transfer_mode = CONTENT_LENGTH;
+            if (verbose >= 2) cout << "Using CONTENT_LENGTH mode, length=" << req->content_length << endl;
+
+            if (req->content_length == 0) {
+                req->enter(DONE);
+                return;
             }
-            break;
-        case CONNECTION_CLOSE:
-            {
-                string buffer_str(buffer, bytes_received);
-                req->recv_body.append(buffer_str);
+            // Sized once, so the body is read in place with no regrowth
+            if (!req->stream_body && !req->decoder) {
+                req->body_space(min(req->content_length, MAX_PREALLOCATED_BODY));
             }
-            break;
+        }
+    }
+    req->enter(READING_RESPONSE);
+
+    // Body bytes that arrived in the same read as the headers
+    if (req->transfer_mode == CHUNKED) {
+        parse_chunked(req);
+    } else {
+        drain_body(req);
     }
 }
-void AsyncHTTPSConnection::handle_read_response_headers(HTTPSRequest* req, int16_t filter) {
+
+// Moves an unchunked body's bytes out of the read buffer
+void AsyncHTTPSConnection::drain_body(HTTPSRequest* req) {
+    size_t n = req->inbuf.size();
+    if (req->transfer_mode == CONTENT_LENGTH) {
+        n = min(n, req->content_length - req->body_received);
+    }
+    if (n > 0) {
+        bool decoded = req->emit_body(req->inbuf.begin(), n);
+        req->inbuf.consume(n);
+        if (!decoded) {
+            req->enter(ERROR);
+            return;
+        }
+    }
+    if (req->transfer_mode == CONTENT_LENGTH && req->body_received == req->content_length) {
+        req->enter(DONE);
+    }
+}
+
+// Walks chunk framing in the read buffer, copying each chunk's payload once
+// into the body. Stops at the first incomplete size line and picks up from
+// there on the next read.
+void AsyncHTTPSConnection::parse_chunked(HTTPSRequest* req) {
+    ReadBuffer& in = req->inbuf;
+    while (in.size() > 0) {
+        if (req->chunk_size > 0) {
+            size_t n = min(req->chunk_size, in.size());
+            bool decoded = req->emit_body(in.begin(), n);
+            req->chunk_size -= n;
+            in.consume(n);
+            if (!decoded) {
+                req->enter(ERROR);
+                return;
+            }
+            continue;
+        }
+
+        const char* line = in.begin();
+        const char* crlf = (const char*)memmem(line, in.size(), "\r\n", 2);
+        if (crlf == nullptr) return;
+        size_t line_len = crlf - line;
+        in.consume(line_len + 2);
+        if (line_len == 0) continue;  // the CRLF closing the previous chunk
+
+        // Extensions after ';' are ignored; so is a line that isn't hex
+        char* digits_end;
+        unsigned long long size = strtoull(line, &digits_end, 16);
+        if (digits_end == line) continue;
+        if (size == 0) {
+            req->enter(DONE);
+            in.clear();
+            return;
+        }
+        req->chunk_size = size;
+    }
+}
+
+void AsyncHTTPSConnection::handle_read_response_headers(HTTPSRequest* req, event_filter_t filter) {
     switch (filter) {
-        case EVFILT_READ:
+        case EVENT_READ:
             {
-                char buffer[4096];
-                ssize_t bytes_received = SSL_read(req->conn, &buffer, sizeof(buffer));
-                if (verbose >= 2) cout << "SSL_read (headers) bytes=" << bytes_received << endl;
-                if (bytes_received > 0) {
-                    req->recv_headers.append(buffer, bytes_received);
-                    if (verbose >= 2) cout << "Headers so far (" << req->recv_headers.size() << " bytes)" << endl;
-
-                    size_t pos = req->recv_headers.find("\r\n\r\n");
-                    if (pos != string::npos) {
-                        size_t header_end = pos + 4;
-                        string headers_only = req->recv_headers.substr(0, header_end);
-                        transform(headers_only.begin(), headers_only.end(), headers_only.begin(), ::tolower);
-                        string spillover_body = req->recv_headers.substr(header_end);
-
-                        req->recv_headers = headers_only;
-                        // Don't set recv_body here - parse_response will append it
-
-                        if (verbose >= 2) cout << "=== HEADERS ===\n" << headers_only << "=== END HEADERS ===" << endl;
-
-                        size_t te_pos = headers_only.find("transfer-encoding:");
-                        if (te_pos != string::npos) {
-                            size_t line_end = headers_only.find("\r\n", te_pos);
-                            string te_line = headers_only.substr(te_pos, line_end - te_pos);
-                            if (verbose >= 2) cout << "Found: " << te_line << endl;
-                            if (te_line.find("chunked") != string::npos) {
-                                req->transfer_mode = CHUNKED;
-                                if (verbose >= 2) cout << "Using CHUNKED transfer mode" << endl;
-                            }
+                // Drain until OpenSSL wants more input: decrypted bytes left
+                // inside the SSL object never make the socket readable again
+                while (req->state == READING_RESPONSE_HEADERS) {
+                    int bytes_received = req->read_some(req->inbuf.prepare(READ_CHUNK_SIZE), READ_CHUNK_SIZE);
+                    if (verbose >= 2) cout << "SSL_read (headers) bytes=" << bytes_received << endl;
+                    if (bytes_received > 0) {
+                        if (!req->response_started()) {
+                            req->mark_first_byte();
                         }
+                        req->inbuf.commit(bytes_received);
 
-                        if (req->transfer_mode != CHUNKED) {
-                            size_t cl_pos = headers_only.find("content-length:");
-                            if (cl_pos != string::npos) {
-                                size_t value_start = cl_pos + 15;
-                                size_t line_end = headers_only.find("\r\n", cl_pos);
-                                string cl_value = headers_only.substr(value_start, line_end - value_start);
-
-                                cl_value.erase(0, cl_value.find_first_not_of(" \t"));
-                                req->content_length = stoi(cl_value);
-                                req->transfer_mode = CONTENT_LENGTH;  // Actually set the mode!
-                                if (verbose >= 2) cout << "Using CONTENT_LENGTH mode, length=" << req->content_length << endl;
-
-                                if (req->content_length == 0) {
-                                    req->state = DONE;
-                                    return;
-                                }
-                            }
+                        // Only the new bytes, plus three before them in case the
+                        // terminator straddles two reads, can complete the block
+                        string_view received(req->inbuf.begin(), req->inbuf.size());
+                        size_t from = received.size() > (size_t)bytes_received + 3 ? received.size() - bytes_received - 3 : 0;
+                        size_t pos = received.find("\r\n\r\n", from);
+                        if (pos != string_view::npos) {
+                            parse_headers(req, pos + 4);
                         }
-                        req->state = READING_RESPONSE;
-
-                        if (!spillover_body.empty()) {
-                            parse_response(req, const_cast<char*>(spillover_body.c_str()), spillover_body.size());
+                    } else {
+                        int ssl_error = req->io_error(bytes_received);
+                        if (verbose >= 2) cout << "SSL_read failed, ssl_error=" << ssl_error << endl;
+                        if (ssl_error != SSL_ERROR_WANT_READ) {
+                            if (verbose >= 2) cout << "Setting ERROR state from handle_read_response_headers" << endl;
+                            req->enter(ERROR);
                         }
-                    }
-                } else {
-                    int ssl_error = SSL_get_error(req->conn, bytes_received);
-                    if (verbose >= 2) cout << "SSL_read failed, ssl_error=" << ssl_error << endl;
-                    if (ssl_error != SSL_ERROR_WANT_READ) {
-                        if (verbose >= 2) cout << "Setting ERROR state from handle_read_response_headers" << endl;
-                        req->state = ERROR;
+                        break;
                     }
                 }
-
             }
             break;
         default:
             {
                 if (verbose >= 2) cout << "handle_read_response_headers: unexpected filter" << endl;
-                req->state = ERROR;
+                req->enter(ERROR);
             }
             break;
     }
 
 }
 
-void AsyncHTTPSConnection::handle_read_response(HTTPSRequest* req, int16_t filter) {
+void AsyncHTTPSConnection::handle_read_response(HTTPSRequest* req, event_filter_t filter) {
     switch (filter) {
-        case EVFILT_READ:
+        case EVENT_READ:
             {
-                char buffer[4096];
-                ssize_t bytes_received = SSL_read(req->conn, &buffer, sizeof(buffer));
-                if (verbose >= 2) cout << "SSL_read (body) bytes=" << bytes_received << " transfer_mode=" << req->transfer_mode << endl;
-                if (bytes_received > 0) {
-                    parse_response(req, buffer, bytes_received);
-                    if (verbose >= 2) cout << "After parse_response, state=" << req->state << endl;
-                } else {
-                    int ssl_error = SSL_get_error(req->conn, bytes_received);
-                    if (ssl_error != SSL_ERROR_WANT_READ) {
-                        req->state = ERROR;
+                while (req->state == READING_RESPONSE) {
+                    // Buffered, unchunked, unencoded bodies are read straight into
+                    // recv_body; everything else goes through inbuf first
+                    bool direct = req->transfer_mode != CHUNKED && !req->stream_body && !req->decoder;
+                    size_t room = READ_CHUNK_SIZE;
+                    if (req->transfer_mode == CONTENT_LENGTH) {
+                        room = min(room, req->content_length - req->body_received);
                     }
-                }
+                    char* target = direct ? req->body_space(room) : req->inbuf.prepare(room);
 
+                    int bytes_received = req->read_some(target, room);
+                    if (verbose >= 2) cout << "SSL_read (body) bytes=" << bytes_received << " transfer_mode=" << req->transfer_mode << endl;
+                    if (bytes_received > 0) {
+                        if (direct) {
+                            req->body_bytes += bytes_received;
+                            req->body_received += bytes_received;
+                            if (req->transfer_mode == CONTENT_LENGTH && req->body_received == req->content_length) {
+                                req->enter(DONE);
+                            }
+                        } else {
+                            req->inbuf.commit(bytes_received);
+                            if (req->transfer_mode == CHUNKED) {
+                                parse_chunked(req);
+                            } else {
+                                drain_body(req);
+                            }
+                        }
+                        if (verbose >= 2) cout << "After parsing, state=" << req->state << endl;
+                    } else {
+                        int ssl_error = req->io_error(bytes_received);
+                        if (req->transfer_mode == CONNECTION_CLOSE &&
+                            (ssl_error == SSL_ERROR_ZERO_RETURN || ssl_error == SSL_ERROR_SYSCALL)) {
+                            // Unframed body: the server closing the stream is the end marker
+                            req->enter(DONE);
+                        } else if (ssl_error != SSL_ERROR_WANT_READ) {
+                            req->enter(ERROR);
+                        }
+                        break;
+                    }
+                }
             }
             break;
         default:
             {
-                req->state = ERROR;
+                req->enter(ERROR);
             }
             break;
     }
 }
 
 void AsyncHTTPSConnection::cleanup(HTTPSRequest* req) {
-    if (req->state == DONE){
-        HTTPSResponse resp{req->recv_headers, req->recv_body};
-        req->resp.set_value(resp);
-    } else
-    {
-        req->resp.set_exception(make_exception_ptr(runtime_error("Error with https request")));
-    }
-    
-
-    struct kevent ev;
-    EV_SET(&ev, req->socket_fd, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
-    kevent(kqueue_fd, &ev, 1, nullptr, 0, nullptr);
-    EV_SET(&ev, req->socket_fd, EVFILT_WRITE, EV_DELETE, 0, 0, nullptr);
-    kevent(kqueue_fd, &ev, 1, nullptr, 0, nullptr);
-    
-    reqs.erase(req->socket_fd);
-}
\ No newline at end of file
+    string host = req->host;
+    int socket_fd = req->socket_fd;
+    finish_negotiation(req);
+
+    // A pooled socket the server closed while it sat idle fails before any
+    // response byte arrives. That says nothing about the request itself, so
+    // send it again on another connection.
+    if (req->state == ERROR && req->reused && !req->response_started()) {
+        if (verbose >= 2) cout << "Reused connection fd=" << socket_fd << " failed, resending request" << endl;
+        auto node = reqs.extract(socket_fd);
+        release_connection(req);
+        req->reset_response();
+        submit(std::move(node.mapped()));
+        return;
+    }
+
+    if (req->state == DONE && !req->finish_body()) {
+        if (verbose >= 2) cout << "Compressed body for " << req->path << " ended early" << endl;
+        req->enter(ERROR);
+    }
+    auto node = reqs.extract(socket_fd);
+    release_connection(req);
+    finish(std::move(node.mapped()));
+    drain_pending(host);
+}
+
+// Routes the finished attempt to a retry or to the caller's promise
+void AsyncHTTPSConnection::finish(unique_ptr<HTTPSRequest> req, exception_ptr error) {
+    if (should_retry(req.get(), error)) {
+        double jitter = uniform_real_distribution<double>(0.0, 1.0)(jitter_rng);
+        chrono::milliseconds delay = max(retry_policy.backoff(req->attempts + 1, jitter),
+                                         ConcurrencyLimiter::retry_after(req->recv_headers));
+        if (chrono::steady_clock::now() + delay < req->total_deadline) {
+            schedule_retry(std::move(req), delay);
+            return;
+        }
+        if (verbose >= 2) cout << "Request " << req->id << " would retry past its total deadline, giving up" << endl;
+    }
+    complete(req.get(), error);
+}
+
+bool AsyncHTTPSConnection::should_retry(HTTPSRequest* req, exception_ptr error) const {
+    if (req->attempts >= retry_policy.max_attempts) return false;
+
+    if (error) {
+        try {
+            rethrow_exception(error);
+        } catch (const HTTPSTimeoutError& e) {
+            // A request that timed out waiting for its answer may well have
+            // been processed; only retry if it never reached the server
+            return e.phase == "connect" || e.phase == "tls";
+        } catch (...) {
+            return true;
+        }
+    }
+
+    if (req->state == DONE) {
+        int status = parse_status(req->recv_headers);
+        return status == 429 || status == 500 || status == 502 || status == 503 || status == 504;
+    }
+    // Failed before the server said anything: refused, reset, TLS error
+    return !req->response_started();
+}
+
+// Parks the request until its delay passes. The attempt still gives its
+// admission slot back (and tells the limiter how it went) in the meantime.
+void AsyncHTTPSConnection::schedule_retry(unique_ptr<HTTPSRequest> req, chrono::milliseconds delay) {
+    release_admission(req.get(), parse_status(req->recv_headers));
+    if (verbose >= 2) cout << "Retrying request " << req->id << " to " << req->host << req->path << " in " << delay.count() << "ms (attempt " << req->attempts + 1 << ")" << endl;
+
+    req->attempts++;
+    req->reset_response();
+    req->timed_out = false;
+    req->enter(BACKING_OFF);
+    req->disarm_phase();
+    retry_timers.push({chrono::steady_clock::now() + delay, req->id});
+    backing_off[req->id] = std::move(req);
+}
+
+void AsyncHTTPSConnection::resume_retries() {
+    auto now = chrono::steady_clock::now();
+    while (!retry_timers.empty() && retry_timers.top().when <= now) {
+        uint64_t id = retry_timers.top().request_id;
+        retry_timers.pop();
+
+        // Gone if its total deadline expired while it waited
+        auto node = backing_off.extract(id);
+        if (node.empty()) continue;
+        unique_ptr<HTTPSRequest> req = std::move(node.mapped());
+        req->enter(QUEUED);
+        admit(std::move(req));
+    }
+}
+
+void AsyncHTTPSConnection::complete(HTTPSRequest* req, exception_ptr error) {
+    live.erase(req->id);
+    int status = parse_status(req->recv_headers);
+    release_admission(req, status);
+
+    HTTPSResponse resp;
+    if (!error && req->state != DONE) {
+        error = make_exception_ptr(runtime_error("Error with https request"));
+    }
+    if (error) {
+        stats.record_failure();
+    } else {
+        resp.headers = std::move(req->recv_headers);
+        resp.body = std::move(req->recv_body);
+        resp.status = status;
+        resp.elapsed = chrono::steady_clock::now() - req->submitted_at;
+        resp.timeline = std::move(req->timeline);
+        resp.first_byte = req->first_byte_at;
+        resp.bytes_sent = req->body.size();
+        resp.bytes_received = req->body_received;
+        resp.attempts = req->attempts;
+        // The final attempt rode an existing connection unless it opened one
+        auto opened = find_if(resp.timeline.rbegin(), resp.timeline.rend(), [](const HTTPSStateChange& change) {
+            return change.state == CONNECTING || change.state == BACKING_OFF;
+        });
+        resp.reused = opened == resp.timeline.rend() || opened->state == BACKING_OFF;
+        stats.record(resp);
+        if (verbose >= 2) cout << "Request " << req->id << " to " << req->host << req->path << " took " << chrono::duration<double, milli>(resp.elapsed).count() << "ms" << endl;
+    }
+
+    if (req->awaiter) {
+        req->awaiter->response = std::move(resp);
+        req->awaiter->error = error;
+        ready.push_back(req->awaiter->waiting);
+    } else {
+        if (error) {
+            req->resp->set_exception(error);
+        } else {
+            req->resp->set_value(std::move(resp));
+        }
+        request_finished();
+    }
+}
+
+// Resumes coroutines whose requests finished. Each runs until it next
+// suspends (typically on another request) or completes.
+void AsyncHTTPSConnection::resume_ready() {
+    // Resuming can finish more requests synchronously and append to ready
+    for (size_t i = 0; i < ready.size(); i++) {
+        coroutine_handle<> handle = ready[i];
+        handle.resume();
+        // Only now: the coroutine may have gone on to post another request
+        request_finished();
+    }
+    ready.clear();
+}
+
+HTTPSPhaseTimes HTTPSResponse::phases() const {
+    HTTPSPhaseTimes phases;
+    for (size_t i = 0; i + 1 < timeline.size(); i++) {
+        auto from = timeline[i].at;
+        auto to = timeline[i + 1].at;
+        switch (timeline[i].state) {
+            case QUEUED:
+            case BACKING_OFF:
+                phases.queued += to - from;
+                break;
+            case RESOLVING:
+                phases.dns += to - from;
+                break;
+            case CONNECTING:
+                phases.connect += to - from;
+                break;
+            case TLS_HANDSHAKE:
+                phases.tls += to - from;
+                break;
+            case WRITING_REQUEST:
+                phases.send += to - from;
+                break;
+            case READING_RESPONSE_HEADERS:
+                phases.wait += to - from;
+                break;
+            case READING_RESPONSE:
+                phases.receive += to - from;
+                break;
+            case STREAMING:
+                // Only the final attempt's first byte is known; an earlier
+                // stream that failed counts as all waiting
+                if (first_byte > from && first_byte < to) {
+                    phases.wait += first_byte - from;
+                    phases.receive += to - first_byte;
+                } else {
+                    phases.wait += to - from;
+                }
+                break;
+            case DONE:
+            case ERROR:
+                break;
+        }
+    }
+    return phases;
+}
@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <arpa/inet.h>
+#include <cerrno>
 #include <cstring>
 #include <functional>
 #include <memory>
@@ -10,21 +11,46 @@
 #include <openssl/err.h>
 #include <openssl/ssl.h>
 #include <string>
+#include <string_view>
 #include <unistd.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
-#include <sys/event.h>
-#include <sys/time.h>
 #include <future>
+#include <deque>
+#include <queue>
+#include <stdexcept>
+#include <chrono>
+#include <coroutine>
+#include <optional>
+#include <random>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <sys/socket.h>
+#include "event_backend.hpp"
+#include "tls_context.hpp"
+#include "resolver.hpp"
+#include "http2_session.hpp"
+#include "concurrency_limiter.hpp"
+#include "content_decoder.hpp"
+#include "latency_stats.hpp"
+#include "read_buffer.hpp"
+#include "mpsc_queue.hpp"
 
 using namespace std;
 
 typedef enum {
+    QUEUED,     // waiting for a connection slot
+    BACKING_OFF, // waiting out a retry delay
+    RESOLVING,
     CONNECTING,
     TLS_HANDSHAKE,
     WRITING_REQUEST,
     READING_RESPONSE_HEADERS,
     READING_RESPONSE,
+    STREAMING,  // handed to an HTTP2Session
     DONE,
     ERROR
 } conn_state_t;
@@ -35,74 +61,564 @@ typedef enum {
     CONNECTION_CLOSE,
 } transfer_mode_t;
 
+// Idle connections older than this are closed instead of reused; servers
+// drop keep-alive sockets on their own schedule and we'd rather not find out
+// by losing a request.
+static constexpr chrono::seconds IDLE_CONNECTION_TIMEOUT{30};
+static constexpr size_t DEFAULT_MAX_CONNECTIONS_PER_HOST = 32;
+
+// Happy Eyeballs (RFC 8305): how long one address gets to connect before the
+// next starts racing it, so a dead first address costs this instead of the
+// connect timeout
+static constexpr chrono::milliseconds CONNECTION_ATTEMPT_DELAY{250};
+
+// Cap on what a Content-Length header alone can make us allocate up front
+static constexpr size_t MAX_PREALLOCATED_BODY = 16 * 1024 * 1024;
+
+// Per-request deadlines. Each phase's clock starts when the request enters
+// it; total runs from post_async() and covers time spent queued.
+struct HTTPSTimeouts {
+    chrono::milliseconds connect{10000};      // DNS lookup + TCP connect
+    chrono::milliseconds tls{10000};          // TLS handshake
+    chrono::milliseconds first_byte{60000};   // request sent until the response starts
+    chrono::milliseconds total{120000};
+};
+
+// Set on a request's promise when one of its deadlines passes; phase is
+// "connect", "tls", "first byte" or "total"
+class HTTPSTimeoutError : public runtime_error {
+public:
+    string phase;
+    HTTPSTimeoutError(const string& phase, const string& host)
+        : runtime_error(phase + " timeout for " + host), phase(phase) {}
+};
+
+// Failed attempts are retried when nothing reached the application (connect,
+// TLS or connection errors before a response, connect/TLS timeouts) or the
+// server answered 429, 500, 502, 503 or 504. Delays double per attempt up to
+// max_delay, with jitter, and never undercut the server's Retry-After.
+struct HTTPSRetryPolicy {
+    int max_attempts = 4;  // including the first
+    chrono::milliseconds base_delay{500};
+    chrono::milliseconds max_delay{30000};
+
+    // Delay before attempt number `attempt` (2 for the first retry). jitter
+    // is uniform in [0, 1) and spreads the wait over the upper half of the
+    // backoff, so retries from one burst don't arrive together.
+    chrono::milliseconds backoff(int attempt, double jitter) const {
+        auto cap = max_delay.count();
+        if (attempt - 2 < 31) {
+            cap = min(cap, base_delay.count() << max(attempt - 2, 0));
+        }
+        return chrono::milliseconds((long long)(cap * (0.5 + jitter / 2)));
+    }
+};
+
+// Receives a streamed response body one decoded fragment at a time. Runs on
+// the event loop thread, so it should return quickly and must not throw.
+using BodyCallback = function<void(string_view fragment)>;
+
+// A request entering a state, on the steady clock
+struct HTTPSStateChange {
+    conn_state_t state;
+    chrono::steady_clock::time_point at;
+};
+
+// Where a request's time went. Each state's share runs until the next
+// transition and is summed over attempts: queued covers QUEUED and
+// BACKING_OFF, wait is request sent until the first response byte. An
+// HTTP/2 exchange is one STREAMING state, split at the first byte into send
+// + wait (reported as wait) and receive.
+struct HTTPSPhaseTimes {
+    chrono::steady_clock::duration queued{};
+    chrono::steady_clock::duration dns{};
+    chrono::steady_clock::duration connect{};
+    chrono::steady_clock::duration tls{};
+    chrono::steady_clock::duration send{};
+    chrono::steady_clock::duration wait{};
+    chrono::steady_clock::duration receive{};
+};
+
 struct HTTPSResponse {
     string headers;
     string body;
+    int status = 0;
+    // From post_async to completion, including queueing and retries
+    chrono::steady_clock::duration elapsed{};
+
+    // Every state the request went through, starting with QUEUED at
+    // post_async and ending with DONE
+    vector<HTTPSStateChange> timeline;
+    chrono::steady_clock::time_point first_byte{};  // of the final attempt
+    size_t bytes_sent = 0;      // request body
+    size_t bytes_received = 0;  // response body as transferred, before decoding
+    int attempts = 1;
+    bool reused = false;        // final attempt rode an existing connection
+
+    HTTPSPhaseTimes phases() const;
 };
 
+class HTTPSAwaitable;
+
 struct HTTPSRequest {
-    int socket_fd;
-    SSL* conn;
-    SSL_CTX* ssl_ctx;
+    int socket_fd = -1;
+    SSL* conn;  // stays null on a plaintext connection
+    int plain_error = 0;
 
     // HTTP State
-    conn_state_t state;
-    sockaddr_in serv_addr;
+    conn_state_t state = QUEUED;
+    // host is the origin as the caller gave it ("api.openai.com",
+    // "localhost:8443", "http://127.0.0.1:8080") and keys every per-host
+    // table, so different ports and schemes never share a connection
     string host;
+    string hostname;   // for DNS and SNI
+    string authority;  // Host header
+    uint16_t port = 443;
+    bool tls = true;
     string path;
+    chrono::steady_clock::time_point submitted_at = chrono::steady_clock::now();
+    // State changes as they happen (see enter()), and when the current
+    // attempt's response started arriving
+    vector<HTTPSStateChange> timeline;
+    chrono::steady_clock::time_point first_byte_at{};
 
-    // Request data
+    // Request data. send_buffer holds the HTTP/1.1 serialization and is only
+    // built if the request ends up on an HTTP/1.1 connection.
+    string body;
+    vector<pair<string, string>> headers;
     string send_buffer;
     size_t bytes_sent = 0;
     
-    // Response data
+    // Response data. HTTP/1.1 bodies are read straight into recv_body, which
+    // runs ahead of body_bytes (the part actually filled) until cleanup trims it.
+    // body_received counts the body as sent, before any Content-Encoding is
+    // undone, and is what Content-Length framing is checked against.
     string recv_headers;
     string recv_body;
+    size_t body_bytes = 0;
+    size_t body_received = 0;
+    ReadBuffer inbuf;  // headers and chunk framing waiting to be parsed
+    unique_ptr<ContentDecoder> decoder;  // set for gzip/deflate bodies
+
+    // post_stream: a 2xx body goes to on_data as it arrives instead of into
+    // recv_body (which then stays empty). Error bodies are still buffered.
+    BodyCallback on_data;
+    bool stream_body = false;
 
-    promise<HTTPSResponse> resp;
+    // How the outcome gets back: a promise from post_async/post_stream, or
+    // the coroutine awaiting post()
+    optional<promise<HTTPSResponse>> resp;
+    HTTPSAwaitable* awaiter = nullptr;
 
 
     transfer_mode_t transfer_mode = CONNECTION_CLOSE;
     size_t content_length = 0;
     size_t chunk_size = 0;
-    string chunked_buffer;
+
+    // Connection racing while CONNECTING: socket_fd is one attempt, racing_fds
+    // the rest. Addresses from next_address on haven't been tried yet; the
+    // next one starts at next_attempt_at or as soon as an attempt fails.
+    vector<ResolvedAddress> connect_addresses;
+    size_t next_address = 0;
+    vector<int> racing_fds;
+    chrono::steady_clock::time_point next_attempt_at = chrono::steady_clock::time_point::max();
+
+    // Connection reuse
+    bool reused = false;      // socket came out of the idle pool
+    bool keep_alive = true;   // server didn't ask us to close
+    bool negotiating = false; // counted in handshaking until ALPN settles
+    bool replayed = false;    // already resent after a dead HTTP/2 connection
+    int attempts = 1;         // counts retries scheduled by HTTPSRetryPolicy
+
+    // Deadlines: phase_deadline belongs to the current state and is cleared
+    // once the response starts arriving
+    uint64_t id = 0;
+    bool timed_out = false;
+    chrono::steady_clock::time_point phase_deadline = chrono::steady_clock::time_point::max();
+    chrono::steady_clock::time_point total_deadline = chrono::steady_clock::time_point::max();
+
+    // Admission: holds a ConcurrencyLimiter slot from admitted_at on
+    bool admitted = false;
+    chrono::steady_clock::time_point admitted_at;
+
+    // Passes n body bytes, decoded if need be, to the stream callback or
+    // recv_body. False if the body doesn't decode.
+    bool emit_body(const char* data, size_t n) {
+        body_received += n;
+        if (decoder) {
+            return decoder->feed(data, n, [this](string_view decoded) { deliver_body(decoded.data(), decoded.size()); });
+        }
+        deliver_body(data, n);
+        return true;
+    }
+
+    void deliver_body(const char* data, size_t n) {
+        if (stream_body) {
+            on_data(string_view(data, n));
+        } else {
+            memcpy(body_space(n), data, n);
+            body_bytes += n;
+        }
+    }
+
+    // Once the response has ended: trims the read-ahead space and checks that
+    // a compressed body wasn't cut short
+    bool finish_body() {
+        if (!stream_body) {
+            recv_body.resize(body_bytes);
+        }
+        return !decoder || decoder->finished();
+    }
+
+    // Writable space for n more body bytes at body_bytes
+    char* body_space(size_t n) {
+        if (recv_body.size() < body_bytes + n) {
+            recv_body.resize(max(body_bytes + n, recv_body.size() * 2));
+        }
+        return recv_body.data() + body_bytes;
+    }
+
+    // Whether any of the response has arrived
+    bool response_started() const {
+        return !recv_headers.empty() || inbuf.size() > 0;
+    }
+
+    void disarm_phase() {
+        phase_deadline = chrono::steady_clock::time_point::max();
+    }
+
+    void enter(conn_state_t next) {
+        state = next;
+        timeline.push_back({next, chrono::steady_clock::now()});
+    }
+
+    void mark_first_byte() {
+        first_byte_at = chrono::steady_clock::now();
+        disarm_phase();
+    }
+
+    // Clears everything learned from a response so the request can be sent
+    // again on another connection
+    void reset_response() {
+        state = CONNECTING;
+        bytes_sent = 0;
+        recv_headers.clear();
+        recv_body.clear();
+        body_bytes = 0;
+        body_received = 0;
+        inbuf.clear();
+        decoder.reset();
+        stream_body = false;
+        transfer_mode = CONNECTION_CLOSE;
+        content_length = 0;
+        chunk_size = 0;
+        first_byte_at = {};
+        reused = false;
+        keep_alive = true;
+    }
+
+    // SSL_read/SSL_write, or plain recv/send on an http:// origin. Failures
+    // are reported through io_error() as SSL_ERROR_* codes either way.
+    int read_some(void* buffer, int n) {
+        if (tls) return SSL_read(conn, buffer, n);
+        ssize_t got = recv(socket_fd, buffer, n, 0);
+        plain_error = got > 0 ? SSL_ERROR_NONE : got == 0 ? SSL_ERROR_ZERO_RETURN
+                    : (errno == EAGAIN || errno == EWOULDBLOCK) ? SSL_ERROR_WANT_READ : SSL_ERROR_SYSCALL;
+        return (int)got;
+    }
+
+    int write_some(const void* data, int n) {
+        if (tls) return SSL_write(conn, data, n);
+        ssize_t sent = send(socket_fd, data, n, MSG_NOSIGNAL);
+        plain_error = sent > 0 ? SSL_ERROR_NONE
+                    : (errno == EAGAIN || errno == EWOULDBLOCK) ? SSL_ERROR_WANT_WRITE : SSL_ERROR_SYSCALL;
+        return (int)sent;
+    }
+
+    int io_error(int result) const {
+        return tls ? SSL_get_error(conn, result) : plain_error;
+    }
+
+    string serialize_http1() const {
+        string request = "POST " + path + " HTTP/1.1\r\n";
+        request += "Host: " + authority + "\r\n";
+        request += "Content-Length: " + to_string(body.size()) + "\r\n";
+        for (const auto& header : headers) {
+            request += header.first + ": " + header.second + "\r\n";
+        }
+        request += "\r\n" + body;
+        return request;
+    }
 
     HTTPSRequest(const string& h, const string& p) : host(h), path(p) {
-        SSL_load_error_strings();
-        SSL_library_init();
-        ssl_ctx = SSL_CTX_new(TLS_client_method());
         conn = nullptr;
+        timeline.reserve(12);  // a first attempt on a new connection needs 9
+        timeline.push_back({QUEUED, submitted_at});
+        authority = h;
+        if (authority.compare(0, 7, "http://") == 0) {
+            tls = false;
+            port = 80;
+            authority.erase(0, 7);
+        } else if (authority.compare(0, 8, "https://") == 0) {
+            authority.erase(0, 8);
+        }
+
+        // "[v6]:port" keeps its brackets in the Host header but not for DNS
+        size_t host_end = authority[0] == '[' ? authority.find(']') + 1 : 0;
+        size_t colon = authority.find(':', host_end);
+        hostname = authority.substr(0, colon);
+        if (colon != string::npos) {
+            port = (uint16_t)atoi(authority.c_str() + colon + 1);
+        }
+        if (hostname.size() > 1 && hostname[0] == '[') {
+            hostname = hostname.substr(1, hostname.size() - 2);
+        }
     }
     ~HTTPSRequest() {
         if (conn) {
             SSL_shutdown(conn);
             SSL_free(conn);
         }
-        if (ssl_ctx) {
-            SSL_CTX_free(ssl_ctx);
-        }
         if (socket_fd >= 0) {
             close(socket_fd);
         }
+        for (int fd : racing_fds) {
+            close(fd);
+        }
+    }
+};
+
+// Min-heap entry; stale entries (request finished or moved on to another
+// phase) are skipped when they surface
+struct RequestDeadline {
+    chrono::steady_clock::time_point when;
+    uint64_t request_id;
+    bool operator>(const RequestDeadline& other) const { return when > other.when; }
+};
+
+// A keep-alive TLS connection parked between requests. Its read buffer
+// goes with it so the next request doesn't allocate another.
+struct PooledConnection {
+    int socket_fd;
+    SSL* conn;
+    chrono::steady_clock::time_point idle_since;
+    ReadBuffer buffer;
+};
+
+class AsyncHTTPSConnection;
+
+// co_await conn.post(...) sends the request when the coroutine suspends and
+// resumes it from run_loop() with the response, or throws what the future
+// would have. The result lands in the awaitable itself, which lives in the
+// awaiting coroutine's frame, so no promise or future is involved.
+class HTTPSAwaitable {
+private:
+    friend class AsyncHTTPSConnection;
+
+    AsyncHTTPSConnection& conn;
+    string host;
+    string path;
+    string body;
+    vector<pair<string, string>> headers;
+    BodyCallback on_data;
+
+    coroutine_handle<> waiting;
+    HTTPSResponse response;
+    exception_ptr error;
+
+public:
+    HTTPSAwaitable(AsyncHTTPSConnection& conn, string host, string path, string body,
+                   vector<pair<string, string>> headers, BodyCallback on_data)
+        : conn(conn), host(std::move(host)), path(std::move(path)), body(std::move(body)),
+          headers(std::move(headers)), on_data(std::move(on_data)) {}
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(coroutine_handle<> handle);
+    HTTPSResponse await_resume() {
+        if (error) rethrow_exception(error);
+        return std::move(response);
     }
 };
 
 class AsyncHTTPSConnection {
 private:
-    int kqueue_fd;
+    unique_ptr<EventBackend> backend;
+    shared_ptr<TLSContext> tls;
     int verbose;
     unordered_map<int, unique_ptr<HTTPSRequest>> reqs;
-    void handle_connect(HTTPSRequest* req, int16_t filter);
-    void handle_tls(HTTPSRequest* req, int16_t filter);
-    void handle_write(HTTPSRequest* req, int16_t filter);
-    void parse_response(HTTPSRequest* req, char buffer[], ssize_t bytes_recieved, string sentinel="\r\n");
-    void handle_read_response_headers(HTTPSRequest* req, int16_t filter);
-    void handle_read_response(HTTPSRequest* req, int16_t filter);
+
+    // Per-host keep-alive pool. open_conns counts both busy and idle sockets
+    // so max_conns_per_host bounds what we hold open against a host.
+    size_t max_conns_per_host = DEFAULT_MAX_CONNECTIONS_PER_HOST;
+    unordered_map<string, vector<PooledConnection>> idle_conns;
+    unordered_map<string, size_t> open_conns;
+    unordered_map<string, deque<unique_ptr<HTTPSRequest>>> pending;
+    size_t pending_count = 0;
+
+    // Requests parked until their hostname's lookup finishes
+    Resolver resolver;
+    unordered_map<string, vector<unique_ptr<HTTPSRequest>>> resolving;
+    size_t resolving_count = 0;
+
+    // HTTP/2 connections by socket, and by host for routing new requests.
+    // Until a host's first handshake says whether it speaks h2, further
+    // requests wait rather than open sockets that may turn out unnecessary.
+    bool http2_enabled = true;
+    unordered_map<int, unique_ptr<HTTP2Session>> h2_sessions;
+    unordered_map<string, vector<HTTP2Session*>> h2_by_host;
+    unordered_map<string, size_t> handshaking;
+    unordered_set<string> http1_hosts;
+
+    // Every request whose promise is still unset, wherever it currently
+    // lives, plus the deadlines that drive the wait timeout
+    HTTPSTimeouts timeouts;
+    uint64_t next_request_id = 1;
+    unordered_map<uint64_t, HTTPSRequest*> live;
+    priority_queue<RequestDeadline, vector<RequestDeadline>, greater<RequestDeadline>> deadlines;
+
+    // Admission control in front of submit(): requests wait here until the
+    // host's limiter has a free slot
+    bool adaptive_concurrency = true;
+    unordered_map<string, ConcurrencyLimiter> limiters;
+    unordered_map<string, deque<unique_ptr<HTTPSRequest>>> admission;
+    size_t admission_count = 0;
+
+    // Requests waiting out a retry delay; retry_timers wakes them
+    HTTPSRetryPolicy retry_policy;
+    unordered_map<uint64_t, unique_ptr<HTTPSRequest>> backing_off;
+    priority_queue<RequestDeadline, vector<RequestDeadline>, greater<RequestDeadline>> retry_timers;
+    mt19937 jitter_rng{random_device{}()};
+
+    // Extra sockets racing a CONNECTING request's socket_fd, by fd, and
+    // when each request's next address is due
+    unordered_map<int, HTTPSRequest*> racing;
+    priority_queue<RequestDeadline, vector<RequestDeadline>, greater<RequestDeadline>> attempt_timers;
+
+    // Timing breakdown of every request completed so far
+    LatencyStats stats;
+
+    // Coroutines whose request finished. run_loop resumes them between
+    // event batches rather than from inside the handler that completed the
+    // request, since they may well post more requests.
+    vector<coroutine_handle<>> ready;
+
+    // Optional background I/O thread (start_io_thread). While it runs, only
+    // it touches the state above; other threads hand requests over through
+    // submissions and write to wake_pipe so its wait returns.
+    thread io_thread;
+    atomic<bool> stopping{false};
+    MPSCQueue<unique_ptr<HTTPSRequest>> submissions;
+    int wake_pipe[2] = {-1, -1};
+    atomic<bool> wake_pending{false};
+
+    // Requests handed over and not finished yet; run_loop() waits on this
+    // while the I/O thread owns the loop
+    mutex idle_mtx;
+    condition_variable idle_cv;
+    size_t outstanding = 0;
+
+    friend class HTTPSAwaitable;
+    void hand_off(unique_ptr<HTTPSRequest> req);
+    void enqueue(unique_ptr<HTTPSRequest> req);
+    void wake();
+    void take_submissions();
+    void request_finished();
+    void resume_ready();
+    bool has_work() const;
+    bool poll_events();
+    void io_thread_main();
+
+    void submit(unique_ptr<HTTPSRequest> req);
+    bool take_idle_connection(HTTPSRequest* req);
+    void open_connection(unique_ptr<HTTPSRequest> req);
+    void connect_resolved(unique_ptr<HTTPSRequest> req, const ResolveResult& result);
+    int start_connect_attempt(HTTPSRequest* req);
+    void schedule_next_attempt(HTTPSRequest* req);
+    void race_next_address(HTTPSRequest* req);
+    void settle_racing_attempt(HTTPSRequest* req, int fd);
+    bool replace_failed_attempt(HTTPSRequest* req);
+    void move_to_socket(HTTPSRequest* req, int fd);
+    void cancel_connect_race(HTTPSRequest* req);
+    void resume_connect_races();
+    void handle_resolved();
+    void release_connection(HTTPSRequest* req);
+    void close_connection(const string& host, int socket_fd, SSL* conn);
+    void drain_pending(const string& host);
+    bool can_dispatch(const string& host);
+    bool awaiting_protocol(const string& host);
+    void finish_negotiation(HTTPSRequest* req);
+    HTTP2Session* find_http2_session(const string& host);
+    void start_http2_session(HTTPSRequest* req);
+    void run_session(HTTP2Session* session, event_filter_t filter);
+    void teardown_session(HTTP2Session* session);
+    void finish_http2_request(unique_ptr<HTTPSRequest> req);
+    size_t http2_streams_in_flight() const;
+    void finish(unique_ptr<HTTPSRequest> req, exception_ptr error = nullptr);
+    bool should_retry(HTTPSRequest* req, exception_ptr error) const;
+    void schedule_retry(unique_ptr<HTTPSRequest> req, chrono::milliseconds delay);
+    void resume_retries();
+    void complete(HTTPSRequest* req, exception_ptr error = nullptr);
+    void arm_phase(HTTPSRequest* req, chrono::milliseconds timeout);
+    int next_timeout_ms() const;
+    void expire_deadlines();
+    void expire(HTTPSRequest* req, const string& phase);
+    unique_ptr<HTTPSRequest> detach(HTTPSRequest* req);
+    void admit(unique_ptr<HTTPSRequest> req);
+    void admit_waiting();
+    void release_admission(HTTPSRequest* req, int status);
+    void drive(HTTPSRequest* req, event_filter_t filter);
+    void dispatch(HTTPSRequest* req, event_filter_t filter);
+    void handle_connect(HTTPSRequest* req, event_filter_t filter);
+    void handle_tls(HTTPSRequest* req, event_filter_t filter);
+    void handle_write(HTTPSRequest* req, event_filter_t filter);
+    void parse_headers(HTTPSRequest* req, size_t header_end);
+    void parse_chunked(HTTPSRequest* req);
+    void drain_body(HTTPSRequest* req);
+    void handle_read_response_headers(HTTPSRequest* req, event_filter_t filter);
+    void handle_read_response(HTTPSRequest* req, event_filter_t filter);
     void cleanup(HTTPSRequest* req);
 public:
-    AsyncHTTPSConnection(int verbose = 0);
+    AsyncHTTPSConnection(int verbose = 0, trigger_mode_t trigger_mode = LEVEL_TRIGGERED);
+    // host is an origin: "name" or "name:port" for HTTPS, or
+    // "http://name[:port]" for plaintext HTTP/1.1 (local test servers)
     void post_async(const string& host, const string& path, const string& body, const vector<pair<string, string>>& headers, promise<HTTPSResponse> resp);
+    // Like post_async, but a successful response's body is handed to on_data
+    // fragment by fragment as it's decoded. The promise still resolves (with
+    // headers and status, and an empty body) when the response ends.
+    void post_stream(const string& host, const string& path, const string& body, const vector<pair<string, string>>& headers,
+                     BodyCallback on_data, promise<HTTPSResponse> resp);
+    // Awaitable form of post_stream (or post_async, without on_data) for
+    // coroutines running on this connection's loop
+    HTTPSAwaitable post(const string& host, const string& path, const string& body, const vector<pair<string, string>>& headers,
+                        BodyCallback on_data = nullptr);
+    // Drives every request posted so far to completion. With the I/O thread
+    // running it just waits for that to happen.
     void run_loop();
+    // Moves the event loop onto a background thread until stop_io_thread()
+    // or destruction. Requests then start the moment they're posted, from
+    // any thread, while the caller carries on; futures resolve, and
+    // callbacks and awaiting coroutines run, on the I/O thread. Configure
+    // the connection first: the setters and accessors below aren't
+    // thread-safe, and latency_stats() is only settled after run_loop().
+    void start_io_thread();
+    // Lets outstanding requests finish, then joins the thread
+    void stop_io_thread();
+    void set_max_connections_per_host(size_t max_conns);
+    // Offer h2 via ALPN (on by default); off forces HTTP/1.1 everywhere
+    void set_http2_enabled(bool enabled);
+    size_t http2_connection_count(const string& host) const;
+    // Applies to requests posted after the call
+    void set_timeouts(const HTTPSTimeouts& timeouts);
+    // AIMD cap on in-flight requests per host (on by default); off admits
+    // everything and leaves only the connection cap
+    void set_adaptive_concurrency(bool enabled);
+    size_t concurrency_limit(const string& host) const;
+    // max_attempts = 1 turns retries off
+    void set_retry_policy(const HTTPSRetryPolicy& policy);
+    size_t idle_connection_count(const string& host) const;
+    TLSHandshakeStats handshake_stats() const;
+    const LatencyStats& latency_stats() const;
+    Resolver& get_resolver();
     ~AsyncHTTPSConnection();
 };
 
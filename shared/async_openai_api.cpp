@@ -1,52 +1,221 @@
 #include "async_openai_api.hpp"
 #include "utils.hpp"
+#include "sse_decoder.hpp"
 
 using json = nlohmann::json;
 using namespace std;
 
+bool embedding_model_takes_dimensions(const string& model) {
+    return model.starts_with("text-embedding-3");
+}
+
 AsyncOpenAIAPI::AsyncOpenAIAPI(AsyncHTTPSConnection& api_connection, const string& api_key) : api_connection(api_connection), api_key(api_key) {};
 
-future<HTTPSResponse> AsyncOpenAIAPI::async_embedding(string text) {
-    const vector<pair<string, string>> headers = {
-        {"Authorization", "Bearer " + this->api_key},
-        {"Content-Type", "application/json"}
-    };
+void AsyncOpenAIAPI::set_endpoint(const string& scheme, const string& host, uint16_t port) {
+    bool plaintext = scheme == "http";
+    this->origin = plaintext ? "http://" + host : host;
+    if (port != (plaintext ? 80 : 443)) {
+        this->origin += ":" + to_string(port);
+    }
+}
 
-    text = utf8_substr(text, MAX_EMBEDDING_BYTES);
+void AsyncOpenAIAPI::set_embedding_model(const string& model, size_t dimensions) {
+    this->model = model;
+    this->dimensions = dimensions;
+}
 
-    json request_body = {
-        {"model", "text-embedding-3-small"},
-        {"input", text}
-    };
-    string body = request_body.dump();
+void AsyncOpenAIAPI::set_tokenizer(shared_ptr<const BPETokenizer> tokenizer) {
+    this->tokenizer = std::move(tokenizer);
+}
 
-    promise<HTTPSResponse> prom;
-    future<HTTPSResponse> fut = prom.get_future();
-    this->api_connection.post_async("api.openai.com", "/v1/embeddings", body, headers, std::move(prom));
-    return fut;
+string AsyncOpenAIAPI::embedding_input(const string& text, size_t* tokens) const {
+    if (this->tokenizer) {
+        return this->tokenizer->truncate(text, MAX_EMBEDDING_TOKENS, tokens);
+    }
+    string input = utf8_substr(text, MAX_EMBEDDING_BYTES);
+    if (tokens) *tokens = input.size();
+    return input;
 }
 
-future<HTTPSResponse> AsyncOpenAIAPI::async_chat(const nlohmann::json& messages, int max_tokens, float temperature) {
-    const vector<pair<string, string>> headers = {
+vector<pair<string, string>> AsyncOpenAIAPI::request_headers(bool event_stream) const {
+    vector<pair<string, string>> headers = {
         {"Authorization", "Bearer " + this->api_key},
-        {"Content-Type", "application/json"}
+        {"Content-Type", "application/json"},
+        {"Accept-Encoding", ACCEPT_ENCODING}
+    };
+    if (event_stream) {
+        headers.emplace_back("Accept", "text/event-stream");
+    }
+    return headers;
+}
+
+// input is one string or an array of them, already cut by embedding_input().
+// Vectors come back base64-encoded: a third of the size of a JSON number
+// array, and decoded without parsing a float at a time.
+string AsyncOpenAIAPI::embedding_body(nlohmann::json input) const {
+    json request_body = {
+        {"model", this->model},
+        {"input", std::move(input)},
+        {"encoding_format", "base64"}
     };
+    if (this->dimensions > 0) {
+        request_body["dimensions"] = this->dimensions;
+    }
+    return request_body.dump();
+}
 
+string AsyncOpenAIAPI::chat_body(const nlohmann::json& messages, int max_tokens, float temperature, bool stream) const {
     json request_body = {
         {"model", "gpt-4o-mini"},
         {"messages", messages},
         {"max_tokens", max_tokens},
         {"temperature", temperature}
     };
+    if (stream) {
+        request_body["stream"] = true;
+    }
+    return request_body.dump();
+}
+
+// Each data event is a chat.completion.chunk; the stream ends with [DONE]
+BodyCallback AsyncOpenAIAPI::token_stream(function<void(const string&)> on_token) const {
+    auto decoder = make_shared<SSEDecoder>([on_token = std::move(on_token)](const SSEEvent& event) {
+        if (event.data == "[DONE]") return;
+        json chunk = json::parse(event.data, nullptr, false);
+        if (chunk.is_discarded() || !chunk.contains("choices") || chunk["choices"].empty()) return;
+        const json& delta = chunk["choices"][0]["delta"];
+        if (delta.contains("content") && delta["content"].is_string()) {
+            on_token(delta["content"].get<string>());
+        }
+    });
+    return [decoder](string_view fragment) { decoder->feed(fragment); };
+}
+
+future<HTTPSResponse> AsyncOpenAIAPI::async_embedding(string text) {
+    promise<HTTPSResponse> prom;
+    future<HTTPSResponse> fut = prom.get_future();
+    size_t tokens = 0;
+    string input = embedding_input(text, &tokens);
+    this->tokens_sent += tokens;
+    this->api_connection.post_async(this->origin, "/v1/embeddings", embedding_body(std::move(input)), request_headers(), std::move(prom));
+    return fut;
+}
 
-    string body = request_body.dump();
+future<HTTPSResponse> AsyncOpenAIAPI::async_chat(const nlohmann::json& messages, int max_tokens, float temperature) {
+    promise<HTTPSResponse> prom;
+    future<HTTPSResponse> fut = prom.get_future();
+    this->api_connection.post_async(this->origin, "/v1/chat/completions", chat_body(messages, max_tokens, temperature, false),
+                                    request_headers(), std::move(prom));
+    return fut;
+}
 
+future<HTTPSResponse> AsyncOpenAIAPI::async_chat_stream(const nlohmann::json& messages, function<void(const string&)> on_token,
+                                                        int max_tokens, float temperature) {
     promise<HTTPSResponse> prom;
     future<HTTPSResponse> fut = prom.get_future();
-    this->api_connection.post_async("api.openai.com", "/v1/chat/completions", body, headers, std::move(prom));
+    this->api_connection.post_stream(this->origin, "/v1/chat/completions", chat_body(messages, max_tokens, temperature, true),
+                                     request_headers(true), token_stream(std::move(on_token)), std::move(prom));
     return fut;
 }
 
+HTTPSAwaitable AsyncOpenAIAPI::embedding(string text) {
+    size_t tokens = 0;
+    string input = embedding_input(text, &tokens);
+    this->tokens_sent += tokens;
+    return this->api_connection.post(this->origin, "/v1/embeddings", embedding_body(std::move(input)), request_headers());
+}
+
+HTTPSAwaitable AsyncOpenAIAPI::chat(const nlohmann::json& messages, int max_tokens, float temperature) {
+    return this->api_connection.post(this->origin, "/v1/chat/completions", chat_body(messages, max_tokens, temperature, false),
+                                     request_headers());
+}
+
+HTTPSAwaitable AsyncOpenAIAPI::chat_stream(const nlohmann::json& messages, function<void(const string&)> on_token,
+                                           int max_tokens, float temperature) {
+    return this->api_connection.post(this->origin, "/v1/chat/completions", chat_body(messages, max_tokens, temperature, true),
+                                     request_headers(true), token_stream(std::move(on_token)));
+}
+
+vector<future<vector<float>>> AsyncOpenAIAPI::async_embedding_batch(const vector<string>& texts, EmbeddingBatchLimits limits) {
+    vector<string> inputs;
+    vector<size_t> input_tokens(texts.size());
+    inputs.reserve(texts.size());
+    for (size_t i = 0; i < texts.size(); i++) {
+        inputs.push_back(embedding_input(texts[i], &input_tokens[i]));
+    }
+    return async_embedding_batch(std::move(inputs), input_tokens, limits);
+}
+
+vector<future<vector<float>>> AsyncOpenAIAPI::async_embedding_batch(vector<string> inputs, const vector<size_t>& input_tokens,
+                                                                     EmbeddingBatchLimits limits) {
+    vector<future<vector<float>>> futures;
+    futures.reserve(inputs.size());
+
+    json batch_inputs = json::array();
+    vector<promise<vector<float>>> embeddings;
+    size_t tokens = 0;
+    auto send = [&]() {
+        if (embeddings.empty()) return;
+        this->tokens_sent += tokens;
+        Task<> batch = embed_batch(embedding_body(std::move(batch_inputs)), std::move(embeddings));
+        lock_guard<mutex> lock(batches_mtx);
+        // With the I/O thread running, run_requests() may never be called
+        // between batches; finished ones are dropped here so they don't pile up
+        erase_if(batches, [](const Task<>& batch) { return batch.done(); });
+        batches.push_back(std::move(batch));
+        batches.back().start();
+        batch_inputs = json::array();
+        embeddings.clear();
+        tokens = 0;
+    };
+
+    for (size_t i = 0; i < inputs.size(); i++) {
+        if (embeddings.size() >= limits.max_inputs || (!embeddings.empty() && tokens + input_tokens[i] > limits.max_tokens)) {
+            send();
+        }
+        batch_inputs.push_back(std::move(inputs[i]));
+        tokens += input_tokens[i];
+        embeddings.emplace_back();
+        futures.push_back(embeddings.back().get_future());
+    }
+    send();
+    return futures;
+}
+
+// data[] carries an index per input and needn't be in input order
+Task<> AsyncOpenAIAPI::embed_batch(string body, vector<promise<vector<float>>> embeddings) {
+    exception_ptr error;
+    try {
+        HTTPSResponse response = co_await this->api_connection.post(this->origin, "/v1/embeddings", body, request_headers());
+        if (response.status != 200) {
+            throw runtime_error("HTTP " + to_string(response.status) + ": " + response.body);
+        }
+        vector<vector<float>> parsed = parse_embeddings(response.body, embeddings.size());
+        for (size_t i = 0; i < embeddings.size(); i++) {
+            if (parsed[i].empty()) {
+                embeddings[i].set_exception(make_exception_ptr(runtime_error("response has no embedding for input " + to_string(i))));
+            } else {
+                normalize_embedding(parsed[i], this->dimensions);
+                embeddings[i].set_value(std::move(parsed[i]));
+            }
+        }
+        co_return;
+    } catch (...) {
+        error = current_exception();
+    }
+    for (auto& embedding : embeddings) {
+        embedding.set_exception(error);
+    }
+}
+
 void AsyncOpenAIAPI::run_requests() {
     this->api_connection.run_loop();
+    lock_guard<mutex> lock(batches_mtx);
+    erase_if(batches, [](const Task<>& batch) { return batch.done(); });
+}
+
+AsyncOpenAIAPI::~AsyncOpenAIAPI() {
+    if (!batches.empty()) {
+        run_requests();
+    }
 }
@@ -2,23 +2,120 @@
 #define ASYNC_OPENAI_API_HPP
 
 #include "async_https_api.hpp"
+#include "bpe_tokenizer.hpp"
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
 #include <future>
+#include <functional>
+#include <mutex>
 #include <nlohmann/json.hpp>
+#include "task.hpp"
 
 using namespace std;
+// The most tokens the embedding models take from one input. Without a
+// tokenizer inputs are cut to MAX_EMBEDDING_BYTES instead: about 4000
+// tokens of code, so the cut usually comes well before the model's.
+static constexpr size_t MAX_EMBEDDING_TOKENS = 8191;
 static constexpr size_t MAX_EMBEDDING_BYTES = 16000;
 
+// The default embedding model and the length of the vectors it returns.
+// set_embedding_model() picks others; the pair decides whether a cached
+// vector can be reused.
+static constexpr const char* EMBEDDING_MODEL = "text-embedding-3-small";
+static constexpr size_t EMBEDDING_DIMENSIONS = 1536;
+
+// Whether the API accepts "dimensions" for model. Only the text-embedding-3
+// models can shorten their vectors; older ones such as text-embedding-ada-002
+// reject any request that sets it.
+bool embedding_model_takes_dimensions(const string& model);
+
+// What /v1/embeddings accepts in one request: this many inputs, and this
+// many tokens across all of them
+static constexpr size_t MAX_EMBEDDING_BATCH_INPUTS = 2048;
+static constexpr size_t MAX_EMBEDDING_BATCH_TOKENS = 300000;
+
+// How async_embedding_batch splits its texts into requests
+struct EmbeddingBatchLimits {
+    size_t max_inputs = MAX_EMBEDDING_BATCH_INPUTS;
+    size_t max_tokens = MAX_EMBEDDING_BATCH_TOKENS;
+};
+
 class AsyncOpenAIAPI {
   private:
     AsyncHTTPSConnection& api_connection;
     string api_key;
+    string origin = "api.openai.com";
+    string model = EMBEDDING_MODEL;
+    size_t dimensions = 0;
+    shared_ptr<const BPETokenizer> tokenizer;
+    atomic<size_t> tokens_sent{0};
+
+    // Batched requests, each a coroutine that fans the response out to its
+    // inputs' promises. Kept until run_requests() or the next batch sent
+    // finds them done.
+    mutex batches_mtx;
+    vector<Task<>> batches;
+
+    vector<pair<string, string>> request_headers(bool event_stream = false) const;
+    string embedding_body(nlohmann::json input) const;
+    Task<> embed_batch(string body, vector<promise<vector<float>>> embeddings);
+    string chat_body(const nlohmann::json& messages, int max_tokens, float temperature, bool stream) const;
+    BodyCallback token_stream(function<void(const string&)> on_token) const;
   public:
     AsyncOpenAIAPI(AsyncHTTPSConnection& api_connection, const string& api_key);
+    // Where requests go; defaults to https://api.openai.com. scheme is
+    // "https" or "http" (plaintext, for local mock servers).
+    void set_endpoint(const string& scheme, const string& host, uint16_t port);
+    // Model and vector length for embedding requests. The text-embedding-3
+    // models shorten their vectors to any dimensions asked for, which makes
+    // clustering cheaper at little cost in quality; 0, the default, sends no
+    // dimensions and takes the model's full length. Only pass dimensions
+    // when embedding_model_takes_dimensions(model).
+    void set_embedding_model(const string& model, size_t dimensions);
+    const string& embedding_model() const { return model; }
+    size_t embedding_dimensions() const { return dimensions; }
+    // Counts and truncates embedding inputs by tokens rather than bytes:
+    // each input keeps up to MAX_EMBEDDING_TOKENS, and batches pack up to
+    // their token limit exactly. Use the vocabulary of the embedding model
+    // (cl100k_base for OpenAI's). nullptr goes back to byte bounds.
+    void set_tokenizer(shared_ptr<const BPETokenizer> tokenizer);
+    bool has_tokenizer() const { return tokenizer != nullptr; }
+    // What an embedding request sends for text, cut to fit one input.
+    // tokens receives its count: exact with a tokenizer, else its length in
+    // bytes, an upper bound since no token is shorter than a byte.
+    string embedding_input(const string& text, size_t* tokens = nullptr) const;
+    // Tokens in every embedding input sent so far, counted as above
+    size_t embedding_tokens_sent() const { return tokens_sent; }
     future<HTTPSResponse> async_embedding(string text);
+    // Embeds every text using as few requests as limits allows, and returns
+    // one future per text, in order. Each holds that text's unit-length
+    // vector, cut to embedding_dimensions() if the server sent more, or the
+    // error its request failed with. Requests are sent as the call returns.
+    vector<future<vector<float>>> async_embedding_batch(const vector<string>& texts, EmbeddingBatchLimits limits = {});
+    // The same for inputs already cut by embedding_input(), with the token
+    // counts it gave, so they aren't tokenized twice
+    vector<future<vector<float>>> async_embedding_batch(vector<string> inputs, const vector<size_t>& input_tokens,
+                                                        EmbeddingBatchLimits limits = {});
     future<HTTPSResponse> async_chat(const nlohmann::json& messages, int max_tokens = 100, float temperature = 0.7);
+    // Streamed completion: on_token gets each content delta as the server
+    // sends it. On success the response body is empty; an error response
+    // keeps its body for the caller.
+    future<HTTPSResponse> async_chat_stream(const nlohmann::json& messages, function<void(const string&)> on_token,
+                                            int max_tokens = 100, float temperature = 0.7);
+
+    // Awaitable versions for coroutines on the connection's loop; the
+    // request goes out when the result is co_awaited
+    HTTPSAwaitable embedding(string text);
+    HTTPSAwaitable chat(const nlohmann::json& messages, int max_tokens = 100, float temperature = 0.7);
+    HTTPSAwaitable chat_stream(const nlohmann::json& messages, function<void(const string&)> on_token,
+                               int max_tokens = 100, float temperature = 0.7);
+
     void run_requests();
+    // Outstanding batches still point into this object, so they're run to
+    // completion first
+    ~AsyncOpenAIAPI();
 };
 
 #endif // ASYNC_OPENAI_API_HPP
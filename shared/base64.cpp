@@ -0,0 +1,201 @@
+#include "base64.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+
+static constexpr char BASE64_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static constexpr int8_t BASE64_INVALID = -1;
+
+static constexpr array<int8_t, 256> BASE64_VALUES = [] {
+    array<int8_t, 256> values{};
+    values.fill(BASE64_INVALID);
+    for (int i = 0; i < 64; i++) {
+        values[(unsigned char)BASE64_ALPHABET[i]] = i;
+    }
+    return values;
+}();
+
+// Vector decoding, after Muła and Lemire: each character's low nibble and
+// high nibble look up bit sets that only intersect for characters outside
+// the alphabet, and the high nibble (nudged for '/', the one character that
+// shares its nibble with another range) picks the offset that maps the
+// character to its 6-bit value. '=' counts as invalid here, so a padded
+// final block stops the vector loop and is left to decode_tail.
+static constexpr uint8_t NIBBLE_LO_LUT[16] = {
+    0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A
+};
+static constexpr uint8_t NIBBLE_HI_LUT[16] = {
+    0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10
+};
+static constexpr int8_t ROLL_LUT[16] = {
+    0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+#if defined(__x86_64__)
+
+static bool cpu_has_avx2() {
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+}
+
+// 32 characters to 24 bytes per step; each store writes 32 bytes, so it
+// stops while there's still that much room in out
+__attribute__((target("avx2")))
+static void decode_blocks(const char* in, size_t len, unsigned char* out, size_t out_len, size_t& i, size_t& o) {
+    const __m256i lut_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(NIBBLE_LO_LUT)));
+    const __m256i lut_hi = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(NIBBLE_HI_LUT)));
+    const __m256i lut_roll = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ROLL_LUT)));
+    const __m256i nibble_mask = _mm256_set1_epi8(0x0f);
+    const __m256i slash = _mm256_set1_epi8('/');
+    const __m256i pack_bytes = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i pack_lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+
+    while (i + 32 <= len && o + 32 <= out_len) {
+        __m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi32(chars, 4), nibble_mask);
+        __m256i lo = _mm256_and_si256(chars, nibble_mask);
+        __m256i lo_bits = _mm256_shuffle_epi8(lut_lo, lo);
+        __m256i hi_bits = _mm256_shuffle_epi8(lut_hi, hi);
+        if (!_mm256_testz_si256(lo_bits, hi_bits)) return;
+
+        __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(chars, slash), hi));
+        __m256i values = _mm256_add_epi8(chars, roll);
+        // Four 6-bit values per 32-bit lane become one 24-bit value, then
+        // its three bytes are moved together, big end first
+        __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        merged = _mm256_shuffle_epi8(merged, pack_bytes);
+        merged = _mm256_permutevar8x32_epi32(merged, pack_lanes);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + o), merged);
+        i += 32;
+        o += 24;
+    }
+}
+
+#elif defined(__aarch64__)
+
+static uint8x16_t translate(uint8x16_t chars, uint8x16_t& invalid) {
+    const uint8x16_t lut_lo = vld1q_u8(NIBBLE_LO_LUT);
+    const uint8x16_t lut_hi = vld1q_u8(NIBBLE_HI_LUT);
+    const uint8x16_t lut_roll = vreinterpretq_u8_s8(vld1q_s8(ROLL_LUT));
+    uint8x16_t hi = vshrq_n_u8(chars, 4);
+    uint8x16_t lo = vandq_u8(chars, vdupq_n_u8(0x0f));
+    invalid = vorrq_u8(invalid, vandq_u8(vqtbl1q_u8(lut_lo, lo), vqtbl1q_u8(lut_hi, hi)));
+    uint8x16_t roll = vqtbl1q_u8(lut_roll, vaddq_u8(vceqq_u8(chars, vdupq_n_u8('/')), hi));
+    return vaddq_u8(chars, roll);
+}
+
+// 64 characters to 48 bytes per step; the structured load splits them by
+// position within each group of four, so packing is plain shifts
+static void decode_blocks(const char* in, size_t len, unsigned char* out, size_t out_len, size_t& i, size_t& o) {
+    while (i + 64 <= len && o + 48 <= out_len) {
+        uint8x16x4_t chars = vld4q_u8(reinterpret_cast<const uint8_t*>(in + i));
+        uint8x16_t invalid = vdupq_n_u8(0);
+        uint8x16_t a = translate(chars.val[0], invalid);
+        uint8x16_t b = translate(chars.val[1], invalid);
+        uint8x16_t c = translate(chars.val[2], invalid);
+        uint8x16_t d = translate(chars.val[3], invalid);
+        if (vmaxvq_u8(invalid) != 0) return;
+
+        uint8x16x3_t bytes;
+        bytes.val[0] = vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b, 4));
+        bytes.val[1] = vorrq_u8(vshlq_n_u8(b, 4), vshrq_n_u8(c, 2));
+        bytes.val[2] = vorrq_u8(vshlq_n_u8(c, 6), d);
+        vst3q_u8(out + o, bytes);
+        i += 64;
+        o += 48;
+    }
+}
+
+#endif
+
+// Groups of four from i to the end; only the last may carry padding
+static bool decode_tail(const char* in, size_t len, unsigned char* out, size_t i, size_t o) {
+    for (; i < len; i += 4) {
+        bool last = i + 4 == len;
+        size_t padding = 0;
+        if (last && in[i + 3] == '=') padding = in[i + 2] == '=' ? 2 : 1;
+
+        uint32_t group = 0;
+        for (size_t k = 0; k < 4 - padding; k++) {
+            int8_t value = BASE64_VALUES[(unsigned char)in[i + k]];
+            if (value == BASE64_INVALID) return false;
+            group = group << 6 | value;
+        }
+        group <<= 6 * padding;
+
+        out[o++] = group >> 16;
+        if (padding < 2) out[o++] = group >> 8;
+        if (padding < 1) out[o++] = group;
+    }
+    return true;
+}
+
+size_t base64_decoded_size(const char* in, size_t len) {
+    if (len % 4 != 0) return SIZE_MAX;
+    if (len == 0) return 0;
+    size_t padding = in[len - 1] == '=' ? (in[len - 2] == '=' ? 2 : 1) : 0;
+    return len / 4 * 3 - padding;
+}
+
+bool base64_decode(const char* in, size_t len, unsigned char* out) {
+    size_t out_len = base64_decoded_size(in, len);
+    if (out_len == SIZE_MAX) return false;
+
+    size_t i = 0, o = 0;
+#if defined(__x86_64__)
+    if (cpu_has_avx2()) decode_blocks(in, len, out, out_len, i, o);
+#elif defined(__aarch64__)
+    decode_blocks(in, len, out, out_len, i, o);
+#endif
+    return decode_tail(in, len, out, i, o);
+}
+
+bool base64_decode_floats(const string& in, vector<float>& out) {
+    size_t bytes = base64_decoded_size(in.data(), in.size());
+    if (bytes == SIZE_MAX || bytes % sizeof(float) != 0) return false;
+
+    out.resize(bytes / sizeof(float));
+    if (!base64_decode(in.data(), in.size(), reinterpret_cast<unsigned char*>(out.data()))) {
+        out.clear();
+        return false;
+    }
+    if constexpr (endian::native == endian::big) {
+        for (float& value : out) {
+            uint32_t word;
+            memcpy(&word, &value, sizeof(word));
+            word = __builtin_bswap32(word);
+            memcpy(&value, &word, sizeof(word));
+        }
+    }
+    return true;
+}
+
+string base64_encode(const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    string out;
+    out.reserve((size + 2) / 3 * 4);
+    for (size_t i = 0; i < size; i += 3) {
+        size_t take = min<size_t>(3, size - i);
+        uint32_t group = bytes[i] << 16;
+        if (take > 1) group |= bytes[i + 1] << 8;
+        if (take > 2) group |= bytes[i + 2];
+
+        out += BASE64_ALPHABET[group >> 18 & 63];
+        out += BASE64_ALPHABET[group >> 12 & 63];
+        out += take > 1 ? BASE64_ALPHABET[group >> 6 & 63] : '=';
+        out += take > 2 ? BASE64_ALPHABET[group & 63] : '=';
+    }
+    return out;
+}
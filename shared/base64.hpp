@@ -0,0 +1,30 @@
+#ifndef BASE64_HPP
+#define BASE64_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Bytes that len characters of padded base64 decode to, or SIZE_MAX if
+// len isn't a whole number of 4-character groups
+size_t base64_decoded_size(const char* in, size_t len);
+
+// Decodes standard (RFC 4648, padded) base64 into out, which must hold
+// base64_decoded_size() bytes. Returns false on any character outside the
+// alphabet or misplaced padding; out is then partly written.
+//
+// Blocks of 32 characters go through AVX2 on x86-64 CPUs that have it
+// (checked at runtime, so the build needs no -m flags) or NEON on arm64;
+// the tail and anything the vector path can't vouch for are decoded
+// bytewise.
+bool base64_decode(const char* in, size_t len, unsigned char* out);
+
+// Decodes base64 of little-endian float32s, as the embeddings endpoint
+// sends with encoding_format "base64", straight into out's storage
+bool base64_decode_floats(const string& in, vector<float>& out);
+
+string base64_encode(const void* data, size_t size);
+
+#endif // BASE64_HPP
@@ -0,0 +1,77 @@
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+using namespace std;
+
+// Blocking queue of fixed capacity for pipelines between threads: push()
+// waits while the queue is full, so a fast stage can only run so far ahead
+// of a slow one after it, and pop() waits while it's empty. close() ends
+// the stream: pushes fail, and pops drain what's queued and then return
+// nullopt. A consumer that gives up closes the queue to release producers
+// blocked on it.
+template <typename T>
+class BoundedQueue {
+private:
+    mutex mtx;
+    condition_variable not_empty;
+    condition_variable not_full;
+    deque<T> items;
+    size_t capacity;
+    bool closed = false;
+
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // False if the queue was closed, before or while waiting; value is dropped
+    bool push(T value) {
+        unique_lock<mutex> lock(mtx);
+        not_full.wait(lock, [this]() { return closed || items.size() < capacity; });
+        if (closed) return false;
+        items.push_back(std::move(value));
+        lock.unlock();
+        not_empty.notify_one();
+        return true;
+    }
+
+    // nullopt once the queue is closed and empty
+    optional<T> pop() {
+        unique_lock<mutex> lock(mtx);
+        not_empty.wait(lock, [this]() { return closed || !items.empty(); });
+        if (items.empty()) return nullopt;
+        optional<T> value(std::move(items.front()));
+        items.pop_front();
+        lock.unlock();
+        not_full.notify_one();
+        return value;
+    }
+
+    // nullopt if nothing is queued right now; never waits
+    optional<T> try_pop() {
+        unique_lock<mutex> lock(mtx);
+        if (items.empty()) return nullopt;
+        optional<T> value(std::move(items.front()));
+        items.pop_front();
+        lock.unlock();
+        not_full.notify_one();
+        return value;
+    }
+
+    void close() {
+        {
+            lock_guard<mutex> lock(mtx);
+            closed = true;
+        }
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+};
+
+#endif // BOUNDED_QUEUE_HPP
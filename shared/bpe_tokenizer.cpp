@@ -0,0 +1,423 @@
+#include "bpe_tokenizer.hpp"
+#include "base64.hpp"
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <queue>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+// What the splitting rules need to know about a character. MARK is a
+// combining mark: not a letter to cl100k, part of a word to o200k.
+enum CharClass : uint8_t { UPPER, LOWER, OTHER_LETTER, MARK, NUMBER, SPACE, NEWLINE, PUNCT };
+
+struct Char {
+    size_t offset;
+    uint32_t codepoint;
+    CharClass cls;
+};
+
+struct Range {
+    uint32_t first, last;
+};
+
+static constexpr Range SPACE_RANGES[] = {
+    {0x85, 0x85}, {0xA0, 0xA0}, {0x1680, 0x1680}, {0x2000, 0x200A}, {0x2028, 0x2029},
+    {0x202F, 0x202F}, {0x205F, 0x205F}, {0x3000, 0x3000},
+};
+static constexpr Range NUMBER_RANGES[] = {
+    {0xB2, 0xB3}, {0xB9, 0xB9}, {0xBC, 0xBE}, {0x660, 0x669}, {0x6F0, 0x6F9}, {0x966, 0x96F},
+    {0x2070, 0x2070}, {0x2074, 0x2079}, {0x2080, 0x2089}, {0x2150, 0x2189}, {0x2460, 0x249B},
+    {0xFF10, 0xFF19},
+};
+static constexpr Range PUNCT_RANGES[] = {
+    {0xA1, 0xA9}, {0xAB, 0xB1}, {0xB4, 0xB4}, {0xB6, 0xB8}, {0xBB, 0xBB}, {0xBF, 0xBF},
+    {0xD7, 0xD7}, {0xF7, 0xF7}, {0x2010, 0x2027}, {0x2030, 0x205E}, {0x20A0, 0x20CF},
+    {0x2190, 0x245F}, {0x249C, 0x24FF}, {0x2500, 0x2BFF}, {0x3001, 0x3003}, {0x3008, 0x3020},
+    {0x3030, 0x3030}, {0xFE30, 0xFE4F}, {0xFF01, 0xFF0F}, {0xFF1A, 0xFF20}, {0xFF3B, 0xFF40},
+    {0xFF5B, 0xFF65}, {0x1F000, 0x1FAFF},
+};
+static constexpr Range MARK_RANGES[] = {
+    {0x300, 0x36F}, {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF}, {0x20D0, 0x20FF}, {0xFE20, 0xFE2F},
+};
+
+template <size_t N>
+static bool in_ranges(uint32_t codepoint, const Range (&ranges)[N]) {
+    for (const Range& range : ranges) {
+        if (codepoint >= range.first && codepoint <= range.last) return true;
+    }
+    return false;
+}
+
+static CharClass classify(uint32_t codepoint) {
+    if (codepoint < 0x80) {
+        if (codepoint >= 'A' && codepoint <= 'Z') return UPPER;
+        if (codepoint >= 'a' && codepoint <= 'z') return LOWER;
+        if (codepoint >= '0' && codepoint <= '9') return NUMBER;
+        if (codepoint == '\r' || codepoint == '\n') return NEWLINE;
+        if (codepoint == ' ' || (codepoint >= '\t' && codepoint <= '\f')) return SPACE;
+        return PUNCT;
+    }
+    if (in_ranges(codepoint, SPACE_RANGES)) return SPACE;
+    if (in_ranges(codepoint, NUMBER_RANGES)) return NUMBER;
+    if (in_ranges(codepoint, PUNCT_RANGES)) return PUNCT;
+    if (in_ranges(codepoint, MARK_RANGES)) return MARK;
+    // Case only matters to o200k's word splitting; the common alphabets
+    // are told apart, anything else counts as both cases
+    if ((codepoint >= 0xC0 && codepoint <= 0xDE) || (codepoint >= 0x391 && codepoint <= 0x3A9) ||
+        (codepoint >= 0x410 && codepoint <= 0x42F)) {
+        return UPPER;
+    }
+    if ((codepoint >= 0xDF && codepoint <= 0xFF) || (codepoint >= 0x3B1 && codepoint <= 0x3C9) ||
+        (codepoint >= 0x430 && codepoint <= 0x44F)) {
+        return LOWER;
+    }
+    if (codepoint >= 0x100 && codepoint <= 0x17F) return codepoint % 2 == 0 ? UPPER : LOWER;
+    return OTHER_LETTER;
+}
+
+// Malformed UTF-8 comes out one byte at a time, as punctuation
+static vector<Char> decode(string_view text) {
+    vector<Char> chars;
+    chars.reserve(text.size());
+    for (size_t i = 0; i < text.size();) {
+        unsigned char lead = text[i];
+        size_t length = lead < 0x80 ? 1 : (lead >> 5) == 0x6 ? 2 : (lead >> 4) == 0xE ? 3 : (lead >> 3) == 0x1E ? 4 : 0;
+        uint32_t codepoint = length == 1 ? lead : length == 2 ? lead & 0x1F : length == 3 ? lead & 0x0F : lead & 0x07;
+        bool valid = length > 0 && i + length <= text.size();
+        for (size_t k = 1; valid && k < length; k++) {
+            unsigned char next = text[i + k];
+            valid = (next & 0xC0) == 0x80;
+            codepoint = codepoint << 6 | (next & 0x3F);
+        }
+        if (!valid) {
+            chars.push_back({i, lead, PUNCT});
+            i++;
+            continue;
+        }
+        chars.push_back({i, codepoint, classify(codepoint)});
+        i += length;
+    }
+    return chars;
+}
+
+class Splitter {
+public:
+    Splitter(string_view text, Pretokenizer rules) : text(text), chars(decode(text)), o200k(rules == Pretokenizer::O200K) {}
+
+    vector<string_view> split() {
+        vector<string_view> pieces;
+        size_t n = chars.size();
+        for (size_t i = 0; i < n;) {
+            size_t end = next_piece(i);
+            if (end <= i) end = i + 1;
+            size_t from = chars[i].offset;
+            size_t to = end < n ? chars[end].offset : text.size();
+            pieces.push_back(text.substr(from, to - from));
+            i = end;
+        }
+        return pieces;
+    }
+
+private:
+    string_view text;
+    vector<Char> chars;
+    bool o200k;
+
+    CharClass cls(size_t i) const { return chars[i].cls; }
+    bool letter(size_t i) const {
+        CharClass c = cls(i);
+        return c == UPPER || c == LOWER || c == OTHER_LETTER || (o200k && c == MARK);
+    }
+    bool space(size_t i) const { return cls(i) == SPACE || cls(i) == NEWLINE; }
+    bool punct(size_t i) const { return !space(i) && !letter(i) && cls(i) != NUMBER; }
+    bool upperish(size_t i) const { return cls(i) == UPPER || cls(i) == OTHER_LETTER || cls(i) == MARK; }
+    bool lowerish(size_t i) const { return cls(i) == LOWER || cls(i) == OTHER_LETTER || cls(i) == MARK; }
+
+    char lower_ascii(size_t i) const {
+        uint32_t c = chars[i].codepoint;
+        return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c < 0x80 ? char(c) : '\0';
+    }
+
+    // (?i:'s|'t|'re|'ve|'m|'ll|'d) at i; the end, or i if there's none
+    size_t contraction(size_t i) const {
+        size_t n = chars.size();
+        if (i + 1 >= n || chars[i].codepoint != '\'') return i;
+        char a = lower_ascii(i + 1);
+        if (a == 's' || a == 't' || a == 'm' || a == 'd') return i + 2;
+        if (i + 2 >= n) return i;
+        char b = lower_ascii(i + 2);
+        if ((a == 'r' && b == 'e') || (a == 'v' && b == 'e') || (a == 'l' && b == 'l')) return i + 3;
+        return i;
+    }
+
+    // [^\r\n\p{L}\p{N}]? before a word: where its letters start
+    size_t word_start(size_t i) const {
+        size_t n = chars.size();
+        if (cls(i) != NEWLINE && !letter(i) && cls(i) != NUMBER && i + 1 < n && letter(i + 1)) return i + 1;
+        return i;
+    }
+
+    size_t cl100k_word(size_t i) const {
+        size_t end = contraction(i);
+        if (end > i) return end;
+        size_t start = word_start(i);
+        end = start;
+        while (end < chars.size() && letter(end)) end++;
+        return end > start ? end : i;
+    }
+
+    // Uppercase-ish run then lowercase-ish run (either may be empty, not
+    // both), as the two letter alternatives of the o200k pattern resolve
+    size_t o200k_word(size_t i) const {
+        size_t n = chars.size();
+        size_t start = word_start(i);
+        if (start >= n || !letter(start)) return i;
+
+        size_t upper_end = start;
+        while (upper_end < n && upperish(upper_end)) upper_end++;
+        size_t lower_end = upper_end;
+        while (lower_end < n && lowerish(lower_end)) lower_end++;
+
+        size_t end;
+        if (lower_end > upper_end) {
+            end = lower_end;
+        } else {
+            // No lowercase after the capitals: [Lu]*[Ll]+ backtracks to end
+            // at the last character that is both, else [Lu]+[Ll]* takes them all
+            end = upper_end;
+            for (size_t k = upper_end; k > start; k--) {
+                if (lowerish(k - 1)) {
+                    end = k;
+                    break;
+                }
+            }
+            if (upper_end == start) return i;
+        }
+        return max(end, contraction(end));
+    }
+
+    size_t number(size_t i) const {
+        size_t end = i;
+        while (end < chars.size() && end - i < 3 && cls(end) == NUMBER) end++;
+        return end;
+    }
+
+    //  ?[^\s\p{L}\p{N}]+[\r\n]*   (o200k also takes '/' in the tail)
+    size_t punctuation(size_t i) const {
+        size_t n = chars.size();
+        size_t start = i;
+        if (chars[i].codepoint == ' ' && i + 1 < n && punct(i + 1)) start = i + 1;
+        if (!punct(start)) return i;
+        size_t end = start;
+        while (end < n && punct(end)) end++;
+        while (end < n && (cls(end) == NEWLINE || (o200k && chars[end].codepoint == '/'))) end++;
+        return end;
+    }
+
+    // \s*[\r\n]+ | \s+(?!\S) | \s+
+    size_t whitespace(size_t i) const {
+        size_t n = chars.size();
+        size_t run_end = i;
+        while (run_end < n && space(run_end)) run_end++;
+        if (run_end == i) return i;
+        for (size_t k = run_end; k > i; k--) {
+            if (cls(k - 1) == NEWLINE) return k;
+        }
+        // Leave the last space to start the next word, as " word"
+        if (run_end < n && run_end - i >= 2) return run_end - 1;
+        return run_end;
+    }
+
+    size_t next_piece(size_t i) const {
+        size_t end = o200k ? o200k_word(i) : cl100k_word(i);
+        if (end > i) return end;
+        if ((end = number(i)) > i) return end;
+        if ((end = punctuation(i)) > i) return end;
+        return whitespace(i);
+    }
+};
+
+}  // namespace
+
+BPETokenizer::BPETokenizer(TokenRanks ranks, Pretokenizer pretokenizer) : ranks(std::move(ranks)), pretokenizer(pretokenizer) {
+    for (int byte = 0; byte < 256; byte++) {
+        if (!this->ranks.count(string(1, char(byte)))) {
+            throw runtime_error("BPE vocabulary has no token for byte " + to_string(byte));
+        }
+    }
+}
+
+static TokenRanks load_ranks(const string& path) {
+    ifstream in(path);
+    if (!in) throw runtime_error("Cannot open tokenizer file " + path);
+
+    TokenRanks ranks;
+    string line;
+    size_t line_number = 0;
+    while (getline(in, line)) {
+        line_number++;
+        if (line.empty()) continue;
+        size_t space = line.find(' ');
+        string token;
+        size_t decoded = space == string::npos ? SIZE_MAX : base64_decoded_size(line.data(), space);
+        if (decoded != SIZE_MAX) {
+            token.resize(decoded);
+            if (!base64_decode(line.data(), space, reinterpret_cast<unsigned char*>(token.data()))) decoded = SIZE_MAX;
+        }
+        char* rank_end = nullptr;
+        unsigned long rank = decoded == SIZE_MAX ? 0 : strtoul(line.c_str() + space + 1, &rank_end, 10);
+        if (decoded == SIZE_MAX || rank_end == line.c_str() + space + 1 || rank > UINT32_MAX) {
+            throw runtime_error("Malformed tokenizer file " + path + " at line " + to_string(line_number));
+        }
+        ranks.emplace(std::move(token), uint32_t(rank));
+    }
+    return ranks;
+}
+
+BPETokenizer::BPETokenizer(const string& path)
+    : BPETokenizer(load_ranks(path), path.find("o200k") != string::npos ? Pretokenizer::O200K : Pretokenizer::CL100K) {}
+
+vector<string_view> BPETokenizer::split(string_view text) const {
+    return Splitter(text, pretokenizer).split();
+}
+
+// Pieces longer than this merge through a heap instead of rescanning every
+// pair after each merge; long letter runs (minified code, hex and base64
+// blobs) would otherwise cost quadratic time
+static constexpr size_t HEAP_MERGE_BYTES = 256;
+
+// tiktoken's byte_pair_merge: start from single bytes and keep merging the
+// adjacent pair whose joined bytes have the lowest rank (the leftmost on a
+// tie) until none has one
+void BPETokenizer::encode_piece(string_view piece, vector<uint32_t>& tokens, vector<size_t>& lengths) const {
+    auto whole = ranks.find(piece);
+    if (whole != ranks.end()) {
+        tokens.push_back(whole->second);
+        lengths.push_back(piece.size());
+        return;
+    }
+    auto rank_of = [&](size_t start, size_t end) {
+        auto found = ranks.find(piece.substr(start, end - start));
+        return found == ranks.end() ? UINT32_MAX : found->second;
+    };
+    auto emit = [&](size_t start, size_t end) {
+        tokens.push_back(rank_of(start, end));
+        lengths.push_back(end - start);
+    };
+
+    size_t n = piece.size();
+    if (n <= HEAP_MERGE_BYTES) {
+        // Short pieces: a scan over the pair ranks beats a heap
+        vector<size_t> bounds(n + 1);
+        for (size_t i = 0; i <= n; i++) bounds[i] = i;
+        vector<uint32_t> pair_ranks(n - 1);
+        for (size_t i = 0; i + 1 < n; i++) pair_ranks[i] = rank_of(i, i + 2);
+        while (!pair_ranks.empty()) {
+            size_t best = 0;
+            for (size_t i = 1; i < pair_ranks.size(); i++) {
+                if (pair_ranks[i] < pair_ranks[best]) best = i;
+            }
+            if (pair_ranks[best] == UINT32_MAX) break;
+
+            bounds.erase(bounds.begin() + best + 1);
+            pair_ranks.erase(pair_ranks.begin() + best);
+            if (best < pair_ranks.size()) pair_ranks[best] = rank_of(bounds[best], bounds[best + 2]);
+            if (best > 0) pair_ranks[best - 1] = rank_of(bounds[best - 1], bounds[best + 1]);
+        }
+        for (size_t i = 0; i + 1 < bounds.size(); i++) emit(bounds[i], bounds[i + 1]);
+        return;
+    }
+
+    // Parts form a linked list by start offset; the heap holds (rank, start)
+    // for every pair, and entries a merge made stale are skipped when popped.
+    // Popping the lowest (rank, start) picks the same pair the scan would.
+    vector<size_t> next(n), prev(n);
+    vector<uint32_t> pair_rank(n, UINT32_MAX);
+    vector<bool> live(n, true);
+    priority_queue<pair<uint32_t, size_t>, vector<pair<uint32_t, size_t>>, greater<>> heap;
+    auto update = [&](size_t start) {
+        size_t second = next[start];
+        pair_rank[start] = second < n ? rank_of(start, next[second]) : UINT32_MAX;
+        if (pair_rank[start] != UINT32_MAX) heap.emplace(pair_rank[start], start);
+    };
+    for (size_t i = 0; i < n; i++) {
+        next[i] = i + 1;
+        prev[i] = i - 1;
+    }
+    for (size_t i = 0; i + 1 < n; i++) update(i);
+
+    while (!heap.empty()) {
+        auto [rank, start] = heap.top();
+        heap.pop();
+        if (!live[start] || pair_rank[start] != rank) continue;
+
+        size_t second = next[start];
+        live[second] = false;
+        next[start] = next[second];
+        if (next[start] < n) prev[next[start]] = start;
+        update(start);
+        if (start > 0) update(prev[start]);
+    }
+    for (size_t start = 0; start < n; start = next[start]) emit(start, next[start]);
+}
+
+size_t BPETokenizer::encode_prefix(const string& text, size_t max_tokens, vector<uint32_t>& tokens) const {
+    size_t covered = 0;
+    vector<uint32_t> piece_tokens;
+    vector<size_t> piece_lengths;
+    for (string_view piece : split(text)) {
+        piece_tokens.clear();
+        piece_lengths.clear();
+        encode_piece(piece, piece_tokens, piece_lengths);
+        for (size_t i = 0; i < piece_tokens.size(); i++) {
+            if (tokens.size() >= max_tokens) return covered;
+            tokens.push_back(piece_tokens[i]);
+            covered += piece_lengths[i];
+        }
+    }
+    return covered;
+}
+
+vector<uint32_t> BPETokenizer::encode(const string& text) const {
+    vector<uint32_t> tokens;
+    encode_prefix(text, SIZE_MAX, tokens);
+    return tokens;
+}
+
+size_t BPETokenizer::count(const string& text) const {
+    return encode(text).size();
+}
+
+string BPETokenizer::truncate(const string& text, size_t max_tokens, size_t* tokens) const {
+    vector<uint32_t> encoded;
+    size_t length = encode_prefix(text, max_tokens, encoded);
+    if (length == text.size()) {
+        if (tokens) *tokens = encoded.size();
+        return text;
+    }
+    // A token can end inside a multibyte character; cut before it instead
+    bool backed_off = false;
+    while (length > 0 && (text[length] & 0xC0) == 0x80) {
+        length--;
+        backed_off = true;
+    }
+    string prefix = text.substr(0, length);
+    if (tokens) *tokens = backed_off ? count(prefix) : encoded.size();
+    return prefix;
+}
+
+string default_tokenizer_path() {
+    const char* xdg_data = getenv("XDG_DATA_HOME");
+    if (xdg_data && *xdg_data) {
+        return string(xdg_data) + "/gcommit/cl100k_base.tiktoken";
+    }
+    const char* home = getenv("HOME");
+    if (home && *home) {
+        return string(home) + "/.local/share/gcommit/cl100k_base.tiktoken";
+    }
+    return "";
+}
@@ -0,0 +1,70 @@
+#ifndef BPE_TOKENIZER_HPP
+#define BPE_TOKENIZER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// Rules for splitting text into pieces before BPE merges run; each
+// mirrors the regex tiktoken uses for that encoding
+enum class Pretokenizer {
+    CL100K,  // cl100k_base: text-embedding-3-*, ada-002, gpt-4, gpt-3.5
+    O200K    // o200k_base: gpt-4o; also splits letter runs at case changes
+};
+
+// Token bytes to rank, looked up by string_view without a copy
+struct TokenHash {
+    using is_transparent = void;
+    size_t operator()(string_view bytes) const { return hash<string_view>()(bytes); }
+};
+using TokenRanks = unordered_map<string, uint32_t, TokenHash, equal_to<>>;
+
+// Byte-level BPE compatible with tiktoken, loaded from one of its rank
+// files ("<base64 token bytes> <rank>" per line). Text is split into
+// pieces (words, numbers, punctuation, whitespace) and each piece is
+// merged from single bytes, lowest-ranked pair first, the same way
+// tiktoken does.
+//
+// The splitting rules classify ASCII exactly. For other characters
+// they use a table of common whitespace, punctuation, symbol and digit
+// ranges and treat everything else as a letter. Counts for unusual
+// scripts can differ from tiktoken's by a token here and there.
+class BPETokenizer {
+private:
+    TokenRanks ranks;
+    Pretokenizer pretokenizer;
+
+    // Appends piece's tokens, with each one's length in bytes
+    void encode_piece(string_view piece, vector<uint32_t>& tokens, vector<size_t>& lengths) const;
+    // Encodes until max_tokens would be exceeded; returns how many bytes of
+    // text the tokens cover
+    size_t encode_prefix(const string& text, size_t max_tokens, vector<uint32_t>& tokens) const;
+
+public:
+    // Throws runtime_error if the file is missing or malformed. The splitting
+    // rules follow the file name: o200k if it contains "o200k", else cl100k.
+    explicit BPETokenizer(const string& path);
+    // ranks must hold every single byte, so any text can be encoded
+    BPETokenizer(TokenRanks ranks, Pretokenizer pretokenizer);
+
+    // The pieces merges run within, in order; they concatenate to text
+    vector<string_view> split(string_view text) const;
+    vector<uint32_t> encode(const string& text) const;
+    size_t count(const string& text) const;
+    // The longest prefix of text that is at most max_tokens tokens, cut at
+    // a UTF-8 character boundary; tokens receives its count when given
+    string truncate(const string& text, size_t max_tokens, size_t* tokens = nullptr) const;
+
+    size_t vocabulary_size() const { return ranks.size(); }
+};
+
+// Where gcommit looks for cl100k_base.tiktoken: $XDG_DATA_HOME/gcommit/,
+// else ~/.local/share/gcommit/; empty if neither is set
+string default_tokenizer_path();
+
+#endif // BPE_TOKENIZER_HPP
@@ -0,0 +1,168 @@
+#include "concurrency_limiter.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+
+using namespace std;
+
+string header_value(const string& headers, const string& name) {
+    string needle = "\n" + name + ":";
+    size_t pos = headers.find(needle);
+    if (pos == string::npos) return "";
+
+    size_t start = headers.find_first_not_of(" \t", pos + needle.size());
+    if (start == string::npos) return "";
+    size_t end = headers.find("\r", start);
+    return headers.substr(start, end == string::npos ? string::npos : end - start);
+}
+
+// Leading integer of a header value; -1 if it doesn't start with one or
+// doesn't fit, as if the server hadn't sent it
+static long long header_number(const string& value) {
+    if (value.empty() || !isdigit((unsigned char)value[0])) return -1;
+    errno = 0;
+    long long number = strtoll(value.c_str(), nullptr, 10);
+    return errno == ERANGE ? -1 : number;
+}
+
+ConcurrencyLimiter::ConcurrencyLimiter(size_t initial, size_t min_limit, size_t max_limit)
+    : window((double)initial), min_limit(max(min_limit, (size_t)1)), max_limit(max(max_limit, min_limit)) {}
+
+size_t ConcurrencyLimiter::limit() const {
+    return clamp((size_t)window, min_limit, max_limit);
+}
+
+bool ConcurrencyLimiter::try_acquire(chrono::steady_clock::time_point now) {
+    if (now < pause_end || inflight >= limit()) return false;
+    inflight++;
+    peak_inflight = max(peak_inflight, inflight);
+    return true;
+}
+
+void ConcurrencyLimiter::on_response(int status, chrono::steady_clock::duration latency, const string& headers,
+                                     chrono::steady_clock::time_point now) {
+    // Whether the window has actually been in use; growing it while the
+    // caller can't fill it would only overshoot later
+    bool window_used = peak_inflight * 2 >= limit();
+    if (inflight > 0) inflight--;
+
+    bool overloaded = status == 429 || status == 503;
+    // Rejections come back fast; counting them would drag the baseline
+    // down and make every real response look congested
+    if (!overloaded && status < 500) {
+        double ms = chrono::duration<double, milli>(latency).count();
+        smoothed_ms = smoothed_ms == 0 ? ms : 0.8 * smoothed_ms + 0.2 * ms;
+        if (baseline_ms == 0 || ms < baseline_ms) {
+            baseline_ms = ms;
+        } else {
+            // Forget the best case over about LIMITER_BASELINE_WINDOW, however
+            // many responses arrive in that time
+            double elapsed = chrono::duration<double>(now - last_sample).count();
+            double drift = min(elapsed / LIMITER_BASELINE_WINDOW.count(), 1.0);
+            baseline_ms += (ms - baseline_ms) * drift;
+        }
+        last_sample = now;
+    }
+
+    if (overloaded) {
+        decrease(LIMITER_BACKOFF, now);
+
+        pause_for(retry_after(headers), now);
+    } else if (smoothed_ms > baseline_ms * LIMITER_LATENCY_TOLERANCE) {
+        decrease(LIMITER_LATENCY_BACKOFF, now);
+    } else if (status < 500 && window_used) {
+        // Slow start doubles the window each round trip until the first
+        // overload signal; after that, +1 per full window of responses
+        if (slow_start) {
+            window = min(window + 1, (double)max_limit);
+        } else if (++acked >= limit()) {
+            window = min(window + 1, (double)max_limit);
+            acked = 0;
+            peak_inflight = inflight;
+        }
+    }
+
+    apply_rate_limit_headers(headers, now);
+}
+
+void ConcurrencyLimiter::on_failure(bool timed_out, chrono::steady_clock::time_point now) {
+    if (inflight > 0) inflight--;
+    // A timeout is the server drowning; a refused or reset connection says
+    // nothing about load
+    if (timed_out) {
+        decrease(LIMITER_BACKOFF, now);
+    }
+}
+
+void ConcurrencyLimiter::decrease(double factor, chrono::steady_clock::time_point now) {
+    // Responses from the same round trip report the same overload
+    auto recovery = chrono::duration<double, milli>(max(smoothed_ms, 1.0));
+    if (now - last_decrease < recovery) return;
+
+    window = max(window * factor, (double)min_limit);
+    last_decrease = now;
+    slow_start = false;
+    acked = 0;
+}
+
+void ConcurrencyLimiter::pause_for(chrono::milliseconds duration, chrono::steady_clock::time_point now) {
+    pause_end = max(pause_end, now + duration);
+}
+
+void ConcurrencyLimiter::apply_rate_limit_headers(const string& headers, chrono::steady_clock::time_point now) {
+    long long requests_left = header_number(header_value(headers, "x-ratelimit-remaining-requests"));
+    if (requests_left == 0) {
+        pause_for(parse_reset_duration(header_value(headers, "x-ratelimit-reset-requests")), now);
+    } else if (requests_left > 0 && requests_left < window) {
+        // Don't have more in flight than the budget left before the reset
+        window = max((double)requests_left, (double)min_limit);
+    }
+
+    long long tokens_left = header_number(header_value(headers, "x-ratelimit-remaining-tokens"));
+    if (tokens_left == 0) {
+        pause_for(parse_reset_duration(header_value(headers, "x-ratelimit-reset-tokens")), now);
+    }
+}
+
+chrono::milliseconds ConcurrencyLimiter::retry_after(const string& headers) {
+    long long retry_ms = header_number(header_value(headers, "retry-after-ms"));
+    if (retry_ms >= 0) return min(chrono::milliseconds(retry_ms), chrono::milliseconds(MAX_SERVER_WAIT));
+    // An HTTP-date here isn't worth a date parser; backoff covers it
+    long long retry_s = header_number(header_value(headers, "retry-after"));
+    if (retry_s >= 0) return chrono::milliseconds(min(chrono::seconds(retry_s), chrono::seconds(MAX_SERVER_WAIT)));
+    return chrono::milliseconds(0);
+}
+
+chrono::milliseconds ConcurrencyLimiter::parse_reset_duration(const string& value) {
+    double total_ms = 0;
+    size_t i = 0;
+    while (i < value.size()) {
+        size_t start = i;
+        while (i < value.size() && (isdigit((unsigned char)value[i]) || value[i] == '.')) i++;
+        if (start == i) break;
+        // "." or "1.2.3" is no duration at all
+        string number = value.substr(start, i - start);
+        char* end = nullptr;
+        errno = 0;
+        double amount = strtod(number.c_str(), &end);
+        if (end != number.c_str() + number.size() || errno == ERANGE) return chrono::milliseconds(0);
+
+        if (value.compare(i, 2, "ms") == 0) {
+            total_ms += amount;
+            i += 2;
+        } else if (i < value.size() && value[i] == 'h') {
+            total_ms += amount * 3600000;
+            i++;
+        } else if (i < value.size() && value[i] == 'm') {
+            total_ms += amount * 60000;
+            i++;
+        } else {
+            // "s", or a bare number of seconds
+            total_ms += amount * 1000;
+            if (i < value.size() && value[i] == 's') i++;
+        }
+    }
+    return chrono::milliseconds(llround(min(total_ms, (double)chrono::milliseconds(MAX_SERVER_WAIT).count())));
+}
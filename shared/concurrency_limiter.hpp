@@ -0,0 +1,82 @@
+#ifndef CONCURRENCY_LIMITER_HPP
+#define CONCURRENCY_LIMITER_HPP
+
+#include <chrono>
+#include <string>
+
+using namespace std;
+
+static constexpr size_t DEFAULT_INITIAL_CONCURRENCY = 16;
+static constexpr size_t DEFAULT_MAX_CONCURRENCY = 512;
+
+// Multiplicative decrease on 429/503/timeouts, and a gentler one when latency
+// climbs well above the uncongested baseline (requests queueing server-side)
+static constexpr double LIMITER_BACKOFF = 0.5;
+static constexpr double LIMITER_LATENCY_BACKOFF = 0.9;
+static constexpr double LIMITER_LATENCY_TOLERANCE = 2.5;
+static constexpr chrono::seconds LIMITER_BASELINE_WINDOW{60};
+
+// Longest pause taken from a server's retry-after or rate-limit reset
+// headers. Daily budgets reset within a day; anything longer is a broken
+// server or proxy.
+static constexpr chrono::hours MAX_SERVER_WAIT{24};
+
+// Value of `name` in a lowercased "name: value\r\n" header block, or "".
+// Only matches at the start of a line, so "x-upstream-content-length" is
+// never taken for "content-length".
+string header_value(const string& headers, const string& name);
+
+// AIMD limit on requests in flight to one host. The window starts in slow
+// start (doubling per round trip) and after the first overload signal grows
+// by one per full window of successes, as long as it's in use. Overload
+// signals shrink it, at most once per smoothed round trip so a burst of 429s
+// from one window counts once. Rate-limit headers cap the window to the
+// remaining request budget and pause admission entirely when it hits zero.
+class ConcurrencyLimiter {
+private:
+    double window;
+    size_t min_limit;
+    size_t max_limit;
+    size_t inflight = 0;
+    size_t peak_inflight = 0;
+    bool slow_start = true;
+    size_t acked = 0;        // successes toward the next additive step
+
+    double smoothed_ms = 0;  // EWMA of response latency
+    double baseline_ms = 0;  // best latency seen, drifting up slowly
+    chrono::steady_clock::time_point last_sample;
+    chrono::steady_clock::time_point last_decrease;
+    chrono::steady_clock::time_point pause_end;
+
+    void decrease(double factor, chrono::steady_clock::time_point now);
+    void pause_for(chrono::milliseconds duration, chrono::steady_clock::time_point now);
+    void apply_rate_limit_headers(const string& headers, chrono::steady_clock::time_point now);
+
+public:
+    ConcurrencyLimiter(size_t initial = DEFAULT_INITIAL_CONCURRENCY, size_t min_limit = 1,
+                       size_t max_limit = DEFAULT_MAX_CONCURRENCY);
+
+    // Takes a slot if one is free and admission isn't paused
+    bool try_acquire(chrono::steady_clock::time_point now = chrono::steady_clock::now());
+
+    // Release the slot with what the request saw. headers is the lowercased
+    // header block ("x-ratelimit-remaining-requests: 12\r\n...").
+    void on_response(int status, chrono::steady_clock::duration latency, const string& headers,
+                     chrono::steady_clock::time_point now = chrono::steady_clock::now());
+    void on_failure(bool timed_out, chrono::steady_clock::time_point now = chrono::steady_clock::now());
+
+    size_t limit() const;
+    size_t in_flight() const { return inflight; }
+    chrono::steady_clock::time_point paused_until() const { return pause_end; }
+
+    // Wait the server asked for in retry-after-ms or retry-after (whole
+    // seconds), at most MAX_SERVER_WAIT; zero when it didn't or the value
+    // doesn't parse
+    static chrono::milliseconds retry_after(const string& headers);
+
+    // OpenAI-style reset durations: "20ms", "1.5s", "6m0s", "1h2m3s", at
+    // most MAX_SERVER_WAIT; zero for a malformed one
+    static chrono::milliseconds parse_reset_duration(const string& value);
+};
+
+#endif // CONCURRENCY_LIMITER_HPP
@@ -0,0 +1,76 @@
+#include "content_decoder.hpp"
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+using namespace std;
+
+ContentDecoder::ContentDecoder(bool deflate) : deflate(deflate) {
+    // +16 makes zlib expect the gzip wrapper instead of the zlib one
+    if (inflateInit2(&zs, deflate ? MAX_WBITS : MAX_WBITS + 16) != Z_OK) {
+        throw runtime_error("Failed to initialize zlib");
+    }
+}
+
+ContentDecoder::~ContentDecoder() {
+    inflateEnd(&zs);
+}
+
+unique_ptr<ContentDecoder> ContentDecoder::create(const string& content_encoding) {
+    string encoding;
+    for (char c : content_encoding) {
+        if (!isspace((unsigned char)c)) encoding += tolower((unsigned char)c);
+    }
+    if (encoding == "gzip" || encoding == "x-gzip") {
+        return unique_ptr<ContentDecoder>(new ContentDecoder(false));
+    }
+    if (encoding == "deflate") {
+        return unique_ptr<ContentDecoder>(new ContentDecoder(true));
+    }
+    return nullptr;
+}
+
+bool ContentDecoder::feed(const char* data, size_t n, const function<void(string_view)>& out) {
+    if (n == 0) return true;
+    bool first_bytes = !fed;
+    fed = true;
+
+    zs.next_in = (Bytef*)data;
+    zs.avail_in = n;
+    char buffer[DECODE_CHUNK_SIZE];
+    while (zs.avail_in > 0) {
+        if (ended) {
+            // gzip allows several members back to back; anything else after
+            // the end of the stream is padding and ignored
+            if (deflate || zs.next_in[0] != 0x1f) return true;
+            inflateReset(&zs);
+            ended = false;
+        }
+
+        zs.next_out = (Bytef*)buffer;
+        zs.avail_out = sizeof(buffer);
+        int rc = inflate(&zs, Z_NO_FLUSH);
+
+        if (rc == Z_DATA_ERROR && deflate && first_bytes && zs.total_out == 0) {
+            // "deflate" is meant to be zlib-wrapped, but some servers send
+            // the raw stream; start over without the header
+            inflateReset2(&zs, -MAX_WBITS);
+            zs.next_in = (Bytef*)data;
+            zs.avail_in = n;
+            first_bytes = false;
+            continue;
+        }
+        if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) return false;
+
+        size_t produced = sizeof(buffer) - zs.avail_out;
+        if (produced > 0) {
+            out(string_view(buffer, produced));
+        }
+        if (rc == Z_STREAM_END) {
+            ended = true;
+        } else if (produced == 0 && zs.avail_in > 0 && rc == Z_BUF_ERROR) {
+            return false;  // no progress possible
+        }
+    }
+    return true;
+}
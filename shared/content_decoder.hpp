@@ -0,0 +1,46 @@
+#ifndef CONTENT_DECODER_HPP
+#define CONTENT_DECODER_HPP
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <zlib.h>
+
+using namespace std;
+
+static constexpr size_t DECODE_CHUNK_SIZE = 16384;
+
+// Encodings we ask servers for; both are inflated with zlib
+static constexpr const char* ACCEPT_ENCODING = "gzip, deflate";
+
+// Streaming Content-Encoding decoder. Feed it the body as it comes off the
+// wire (already de-chunked), in pieces of any size; decoded output is passed
+// to `out` in pieces of at most DECODE_CHUNK_SIZE.
+class ContentDecoder {
+private:
+    z_stream zs{};
+    bool deflate;           // "deflate": zlib-wrapped, or raw from some servers
+    bool fed = false;
+    bool ended = false;     // saw the end of the compressed stream
+
+    ContentDecoder(bool deflate);
+
+public:
+    // Decoder for a Content-Encoding value (any case); nullptr for identity
+    // or an encoding we don't handle, in which case the body passes through
+    static unique_ptr<ContentDecoder> create(const string& content_encoding);
+
+    ContentDecoder(const ContentDecoder&) = delete;
+    ContentDecoder& operator=(const ContentDecoder&) = delete;
+    ~ContentDecoder();
+
+    // False when the data isn't valid for the encoding
+    bool feed(const char* data, size_t n, const function<void(string_view)>& out);
+
+    // Whether the compressed stream ran to completion (or never started, for
+    // bodiless responses); false means the body was cut short
+    bool finished() const { return ended || !fed; }
+};
+
+#endif // CONTENT_DECODER_HPP
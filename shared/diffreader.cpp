@@ -7,14 +7,18 @@ DiffReader::DiffReader(istream& in, bool verbose)
     : in(in),
       verbose(verbose),
       diff_header_regex(regex("^diff --git a/(.*) b/(.*)")),
+      deleted_regex(regex("^deleted file mode")),
+      new_file_regex(regex("^new file mode")),
+      hunk_regex(regex("^@@ -(\\d+),?(\\d*) \\+(\\d+),?(\\d*) @@")),
       in_file(false),
       in_chunk(false),
       curr_line_num(0),
       current_is_deleted(false),
-      current_is_new(false)
+      current_is_new(false),
+      at_end(false)
 {}
 vector<DiffChunk> DiffReader::getChunks() const {
-    return this->chunks;
+    return vector<DiffChunk>(this->chunks.begin(), this->chunks.end());
 }
 
 void DiffReader::flushPendingRename() {
@@ -37,8 +41,11 @@ void DiffReader::flushPendingRename() {
 
 void DiffReader::ingestDiffLine(string line) {
     smatch match;
+    // Most of a diff is hunk lines, and none of them can be a header
+    bool hunk_line = this->in_chunk && !line.empty() &&
+                     (line[0] == '+' || line[0] == '-' || line[0] == ' ' || line[0] == '\\');
 
-    if (regex_match(line, match, this->diff_header_regex)) {
+    if (!hunk_line && regex_match(line, match, this->diff_header_regex)) {
         this->flushPendingRename();
 
         this->current_old_filepath = match[1].str();
@@ -54,8 +61,7 @@ void DiffReader::ingestDiffLine(string line) {
         return;
     }
 
-    regex deleted_regex("^deleted file mode");
-    if (this->in_file && regex_search(line, deleted_regex)) {
+    if (!hunk_line && this->in_file && regex_search(line, this->deleted_regex)) {
         this->current_is_deleted = true;
         if (this->verbose){
             cout << "FILE MARKED AS DELETED: " << line << endl;
@@ -63,8 +69,7 @@ void DiffReader::ingestDiffLine(string line) {
         return;
     }
 
-    regex new_file_regex("^new file mode");
-    if (this->in_file && regex_search(line, new_file_regex)) {
+    if (!hunk_line && this->in_file && regex_search(line, this->new_file_regex)) {
         this->current_is_new = true;
         if (this->verbose){
             cout << "FILE MARKED AS NEW: " << line << endl;
@@ -81,9 +86,8 @@ void DiffReader::ingestDiffLine(string line) {
         current_chunk.is_deleted = this->current_is_deleted;
         current_chunk.is_new = this->current_is_new;
 
-        regex hunk_regex("^@@ -(\\d+),?(\\d*) \\+(\\d+),?(\\d*) @@");
         smatch m;
-        if (regex_search(line, m, hunk_regex)) {
+        if (regex_search(line, m, this->hunk_regex)) {
             current_chunk.start = stoi(m[1].str());
         }
 
@@ -121,11 +125,30 @@ void DiffReader::ingestDiffLine(string line) {
 }
 
 void DiffReader::ingestDiff() {
+    if (this->at_end) return;
     string line;
     while (getline(this->in, line)) {
         this->ingestDiffLine(line);
     }
     this->flushPendingRename();
+    this->at_end = true;
+}
+
+// Only the last hunk can still gain lines, so any before it is finished
+bool DiffReader::nextChunk(DiffChunk& chunk) {
+    string line;
+    while (this->chunks.size() < 2 && !this->at_end) {
+        if (getline(this->in, line)) {
+            this->ingestDiffLine(line);
+        } else {
+            this->flushPendingRename();
+            this->at_end = true;
+        }
+    }
+    if (this->chunks.empty()) return false;
+    chunk = std::move(this->chunks.front());
+    this->chunks.pop_front();
+    return true;
 }
 
 DiffReader::~DiffReader() {}
@@ -7,6 +7,7 @@
 #include <vector>
 #include <unordered_map>
 #include <algorithm>
+#include <deque>
 using namespace std;
 enum DiffMode {
     EQ = 0,
@@ -36,6 +37,9 @@ private:
     bool verbose;
 
     regex diff_header_regex;
+    regex deleted_regex;
+    regex new_file_regex;
+    regex hunk_regex;
 
     bool in_file;
     bool in_chunk;
@@ -45,7 +49,10 @@ private:
     bool current_is_deleted;   // Track if current file is being deleted
     bool current_is_new;       // Track if current file is being created
 
-    vector<DiffChunk> chunks;
+    bool at_end;
+
+    // Parsed hunks not yet taken by nextChunk(); lines go to the last one
+    deque<DiffChunk> chunks;
 
     void ingestDiffLine(string line);
     void flushPendingRename();
@@ -54,6 +61,12 @@ public:
     DiffReader(istream& in, bool verbose = false);
     vector<DiffChunk> getChunks() const;
     void ingestDiff();
+    // Reads just far enough to finish the next hunk (until the line that
+    // starts another, or the end of the input) and moves it out, so hunks
+    // can be worked on while the rest of the diff is still arriving. False
+    // once the input is done and every hunk taken. getChunks() only returns
+    // hunks this hasn't.
+    bool nextChunk(DiffChunk& chunk);
     ~DiffReader();
 };
 
@@ -0,0 +1,269 @@
+#include "embedding_cache.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <functional>
+#include <openssl/evp.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static constexpr char CACHE_MAGIC[8] = {'G', 'C', 'E', 'M', 'B', 'E', 'D', '\0'};
+static constexpr uint32_t CACHE_VERSION = 1;
+// Written in native order; a file from a machine of the other byte order
+// reads back as 0x04030201 and is discarded
+static constexpr uint32_t CACHE_BYTE_ORDER = 0x01020304;
+static constexpr size_t CACHE_HEADER_BYTES = 16;
+static constexpr size_t RECORD_HEADER_BYTES = sizeof(EmbeddingKey) + sizeof(uint32_t);
+
+static void write_header(unsigned char* out) {
+    memcpy(out, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    memcpy(out + 8, &CACHE_VERSION, sizeof(CACHE_VERSION));
+    memcpy(out + 12, &CACHE_BYTE_ORDER, sizeof(CACHE_BYTE_ORDER));
+}
+
+// Walks the records in data, passing each to on_record, and returns where
+// the last complete one ends; 0 if the header itself doesn't match
+static size_t scan_records(const unsigned char* data, size_t size,
+                           const function<void(const EmbeddingKey&, size_t, uint32_t)>& on_record) {
+    unsigned char header[CACHE_HEADER_BYTES];
+    write_header(header);
+    if (size < CACHE_HEADER_BYTES || memcmp(data, header, CACHE_HEADER_BYTES) != 0) return 0;
+
+    size_t offset = CACHE_HEADER_BYTES;
+    while (size - offset >= RECORD_HEADER_BYTES) {
+        EmbeddingKey key;
+        uint32_t dimensions;
+        memcpy(key.data(), data + offset, key.size());
+        memcpy(&dimensions, data + offset + key.size(), sizeof(dimensions));
+        size_t vector_bytes = size_t(dimensions) * sizeof(float);
+        if (dimensions == 0 || size - offset - RECORD_HEADER_BYTES < vector_bytes) break;
+        on_record(key, offset + RECORD_HEADER_BYTES, dimensions);
+        offset += RECORD_HEADER_BYTES + vector_bytes;
+    }
+    return offset;
+}
+
+static bool write_all(int fd, const unsigned char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+// Opens path and takes the exclusive lock on it. A run that held the lock
+// may have replaced the file while this one waited, leaving it locking an
+// inode nothing reads any more, so the lock only counts once it's on the
+// file that path names.
+static int open_locked(const string& path) {
+    for (int attempt = 0; attempt < 8; attempt++) {
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) return -1;
+        if (flock(fd, LOCK_EX) != 0) {
+            close(fd);
+            return -1;
+        }
+        struct stat locked, named;
+        if (fstat(fd, &locked) == 0 && stat(path.c_str(), &named) == 0 && locked.st_dev == named.st_dev &&
+            locked.st_ino == named.st_ino) {
+            return fd;
+        }
+        close(fd);
+    }
+    return -1;
+}
+
+// Writes data to a new file beside path and renames it over path. Other
+// runs keep reading their mappings of the old file, which lives on until
+// they unmap it; truncating it in place would turn their reads past the new
+// end into SIGBUS.
+static bool replace_file(const string& path, const vector<unsigned char>& data) {
+    string temp = path + ".XXXXXX";
+    int fd = mkstemp(temp.data());
+    if (fd < 0) return false;
+    bool written = fchmod(fd, 0644) == 0 && write_all(fd, data.data(), data.size()) &&
+                   rename(temp.c_str(), path.c_str()) == 0;
+    close(fd);
+    if (!written) unlink(temp.c_str());
+    return written;
+}
+
+EmbeddingCache::EmbeddingCache(string path) : path(std::move(path)) {
+    load();
+}
+
+EmbeddingCache::~EmbeddingCache() {
+    unload();
+}
+
+void EmbeddingCache::load() {
+    if (path.empty()) return;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            mapped = static_cast<const unsigned char*>(data);
+            mapped_size = st.st_size;
+        }
+    }
+    close(fd);
+    if (mapped == nullptr) return;
+
+    // Records written later win, though a key only repeats when two runs
+    // missed on it at once and both vectors are the same anyway
+    scan_records(mapped, mapped_size, [&](const EmbeddingKey& key, size_t offset, uint32_t dimensions) {
+        index[key] = Entry{offset, dimensions};
+    });
+}
+
+void EmbeddingCache::unload() {
+    if (mapped != nullptr) munmap(const_cast<unsigned char*>(mapped), mapped_size);
+    mapped = nullptr;
+    mapped_size = 0;
+    index.clear();
+}
+
+EmbeddingKey EmbeddingCache::key(const string& model, size_t dimensions, const string& text) {
+    // NUL separators keep ("ab", "c") and ("a", "bc") apart; model names
+    // and the decimal dimension count never contain one
+    string dimensions_text = to_string(dimensions);
+    const char separator = '\0';
+
+    EmbeddingKey digest;
+    unsigned int length = 0;
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr);
+    EVP_DigestUpdate(ctx, model.data(), model.size());
+    EVP_DigestUpdate(ctx, &separator, 1);
+    EVP_DigestUpdate(ctx, dimensions_text.data(), dimensions_text.size());
+    EVP_DigestUpdate(ctx, &separator, 1);
+    EVP_DigestUpdate(ctx, text.data(), text.size());
+    EVP_DigestFinal_ex(ctx, digest.data(), &length);
+    EVP_MD_CTX_free(ctx);
+    return digest;
+}
+
+bool EmbeddingCache::get(const EmbeddingKey& key, vector<float>& out) {
+    auto stored = index.find(key);
+    if (stored != index.end()) {
+        const float* values = reinterpret_cast<const float*>(mapped + stored->second.offset);
+        out.assign(values, values + stored->second.dimensions);
+        hit_count++;
+        return true;
+    }
+    auto waiting = pending.find(key);
+    if (waiting != pending.end()) {
+        out = waiting->second;
+        hit_count++;
+        return true;
+    }
+    miss_count++;
+    return false;
+}
+
+void EmbeddingCache::put(const EmbeddingKey& key, vector<float> embedding) {
+    if (embedding.empty() || index.count(key)) return;
+    pending[key] = std::move(embedding);
+}
+
+bool EmbeddingCache::save() {
+    if (pending.empty()) return true;
+    if (path.empty()) return false;
+
+    error_code ec;
+    filesystem::create_directories(filesystem::path(path).parent_path(), ec);
+    // Held until close(); another run saving at the same time waits here
+    int fd = open_locked(path);
+    if (fd < 0) return false;
+
+    // The file may have grown since load(), so what's already on disk is
+    // worked out again under the lock
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    size_t valid_end = 0;
+    vector<EmbeddingKey> on_disk;
+    if (size > 0) {
+        void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            valid_end = scan_records(static_cast<const unsigned char*>(data), size,
+                                     [&](const EmbeddingKey& key, size_t, uint32_t) { on_disk.push_back(key); });
+            munmap(data, size);
+        }
+    }
+    if (valid_end + RECORD_HEADER_BYTES > MAX_EMBEDDING_CACHE_BYTES) {
+        valid_end = 0;
+        on_disk.clear();
+    }
+    for (const EmbeddingKey& key : on_disk) {
+        pending.erase(key);
+    }
+
+    vector<unsigned char> out;
+    if (valid_end == 0) {
+        out.resize(CACHE_HEADER_BYTES);
+        write_header(out.data());
+    }
+    for (const auto& [key, embedding] : pending) {
+        uint32_t dimensions = embedding.size();
+        size_t at = out.size();
+        out.resize(at + RECORD_HEADER_BYTES + embedding.size() * sizeof(float));
+        memcpy(out.data() + at, key.data(), key.size());
+        memcpy(out.data() + at + key.size(), &dimensions, sizeof(dimensions));
+        memcpy(out.data() + at + RECORD_HEADER_BYTES, embedding.data(), embedding.size() * sizeof(float));
+    }
+
+    bool written;
+    if (valid_end == 0 && size > 0) {
+        // A full file, or one that isn't ours, is started over as a new file
+        // while this run still holds the lock on the old one
+        written = replace_file(path, out);
+    } else {
+        // Drops a tail torn by a run that died mid-write. Nobody has indexed
+        // a record there, so no reader looks past the new end.
+        if (valid_end != size && ftruncate(fd, valid_end) != 0) {
+            close(fd);
+            return false;
+        }
+        written = lseek(fd, valid_end, SEEK_SET) >= 0 && write_all(fd, out.data(), out.size());
+        if (!written) {
+            // Leave the file as it was rather than with half a record
+            if (ftruncate(fd, valid_end) != 0) {}
+        }
+    }
+    close(fd);
+    if (!written) return false;
+
+    pending.clear();
+    unload();
+    load();
+    return true;
+}
+
+string default_embedding_cache_path() {
+    const char* xdg_cache = getenv("XDG_CACHE_HOME");
+    if (xdg_cache && *xdg_cache) {
+        return string(xdg_cache) + "/gcommit/embeddings.bin";
+    }
+    const char* home = getenv("HOME");
+    if (home && *home) {
+        return string(home) + "/.cache/gcommit/embeddings.bin";
+    }
+    return "";
+}
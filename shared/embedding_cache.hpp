@@ -0,0 +1,85 @@
+#ifndef EMBEDDING_CACHE_HPP
+#define EMBEDDING_CACHE_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// SHA-256 of (model, dimensions, input text): an embedding is a pure
+// function of the three, so a matching key can stand in for the request
+using EmbeddingKey = array<unsigned char, 32>;
+
+struct EmbeddingKeyHash {
+    size_t operator()(const EmbeddingKey& key) const {
+        size_t hash;
+        memcpy(&hash, key.data(), sizeof(hash));
+        return hash;
+    }
+};
+
+// Past this the file is started over rather than grown; ~43k embeddings at
+// 1536 dimensions
+static constexpr size_t MAX_EMBEDDING_CACHE_BYTES = 256 << 20;
+
+// Append-only file of embeddings keyed by content hash. Opening it maps the
+// file read-only and indexes its records, so a lookup is a hash probe and a
+// copy out of the page cache; new vectors are held in memory until save()
+// appends them under an exclusive lock, which lets concurrent runs share one
+// file. A torn or foreign file is never an error: the unreadable part is
+// ignored and rewritten on the next save(). A file that's started over is
+// replaced with rename(), never truncated, so runs that mapped the old one
+// keep reading it.
+//
+// Layout: a 16-byte header (magic and version), then records of a 32-byte
+// key, a uint32 dimension count and that many floats. Every field is 4-byte
+// aligned, so vectors are read straight from the mapping.
+class EmbeddingCache {
+private:
+    struct Entry {
+        size_t offset;     // of the first float, in the mapping
+        uint32_t dimensions;
+    };
+
+    string path;
+    const unsigned char* mapped = nullptr;
+    size_t mapped_size = 0;
+    unordered_map<EmbeddingKey, Entry, EmbeddingKeyHash> index;
+    unordered_map<EmbeddingKey, vector<float>, EmbeddingKeyHash> pending;
+    size_t hit_count = 0;
+    size_t miss_count = 0;
+
+    void load();
+    void unload();
+
+public:
+    // A missing or unreadable file gives an empty cache
+    explicit EmbeddingCache(string path);
+    ~EmbeddingCache();
+    EmbeddingCache(const EmbeddingCache&) = delete;
+    EmbeddingCache& operator=(const EmbeddingCache&) = delete;
+
+    static EmbeddingKey key(const string& model, size_t dimensions, const string& text);
+
+    // Fills out and counts a hit if the key is stored or pending
+    bool get(const EmbeddingKey& key, vector<float>& out);
+    void put(const EmbeddingKey& key, vector<float> embedding);
+    // Appends everything put() since the last save; false if the file
+    // couldn't be written, in which case the vectors stay pending
+    bool save();
+
+    size_t size() const { return index.size() + pending.size(); }
+    size_t hits() const { return hit_count; }
+    size_t misses() const { return miss_count; }
+};
+
+// $XDG_CACHE_HOME/gcommit/embeddings.bin, else ~/.cache/gcommit/embeddings.bin;
+// empty if neither is set
+string default_embedding_cache_path();
+
+#endif // EMBEDDING_CACHE_HPP
@@ -0,0 +1,180 @@
+#include "event_backend.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+
+#ifdef CUSTOM_GIT_HAVE_KQUEUE
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+#ifdef CUSTOM_GIT_HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+using namespace std;
+
+#ifdef CUSTOM_GIT_HAVE_KQUEUE
+KqueueBackend::KqueueBackend(trigger_mode_t mode) : EventBackend(mode) {
+    this->kqueue_fd = kqueue();
+    if (kqueue_fd == -1) {
+        perror("kqueue");
+        throw runtime_error("Failed to create kqueue");
+    }
+}
+
+KqueueBackend::~KqueueBackend() {
+    close(this->kqueue_fd);
+}
+
+void KqueueBackend::watch(int fd, int interest, void* udata) {
+    int previous = 0;
+    auto it = interests.find(fd);
+    if (it != interests.end()) previous = it->second;
+
+    uint16_t add_flags = EV_ADD | EV_ENABLE;
+    if (trigger_mode == EDGE_TRIGGERED) add_flags |= EV_CLEAR;
+
+    struct kevent changes[2];
+    int n = 0;
+    if (interest & EVENT_READ) {
+        EV_SET(&changes[n++], fd, EVFILT_READ, add_flags, 0, 0, udata);
+    } else if (previous & EVENT_READ) {
+        EV_SET(&changes[n++], fd, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
+    }
+    if (interest & EVENT_WRITE) {
+        EV_SET(&changes[n++], fd, EVFILT_WRITE, add_flags, 0, 0, udata);
+    } else if (previous & EVENT_WRITE) {
+        EV_SET(&changes[n++], fd, EVFILT_WRITE, EV_DELETE, 0, 0, nullptr);
+    }
+    if (n > 0) kevent(kqueue_fd, changes, n, nullptr, 0, nullptr);
+
+    interests[fd] = interest;
+}
+
+void KqueueBackend::unwatch(int fd) {
+    auto it = interests.find(fd);
+    if (it == interests.end()) return;
+
+    struct kevent changes[2];
+    int n = 0;
+    if (it->second & EVENT_READ) EV_SET(&changes[n++], fd, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
+    if (it->second & EVENT_WRITE) EV_SET(&changes[n++], fd, EVFILT_WRITE, EV_DELETE, 0, 0, nullptr);
+    if (n > 0) kevent(kqueue_fd, changes, n, nullptr, 0, nullptr);
+
+    interests.erase(it);
+}
+
+int KqueueBackend::wait(IOEvent* events, int max_events, int timeout_ms) {
+    vector<struct kevent> kevents(max_events);
+    struct timespec ts;
+    struct timespec* tsp = nullptr;
+    if (timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+        tsp = &ts;
+    }
+
+    int n = kevent(kqueue_fd, nullptr, 0, kevents.data(), max_events, tsp);
+    if (n == -1) return -1;
+
+    for (int i = 0; i < n; i++) {
+        events[i].fd = static_cast<int>(kevents[i].ident);
+        events[i].filter = kevents[i].filter == EVFILT_READ ? EVENT_READ : EVENT_WRITE;
+        events[i].udata = kevents[i].udata;
+        events[i].eof = (kevents[i].flags & EV_EOF) != 0;
+    }
+    return n;
+}
+#endif
+
+#ifdef CUSTOM_GIT_HAVE_EPOLL
+static uint32_t epoll_mask(int interest, trigger_mode_t mode) {
+    uint32_t mask = 0;
+    if (interest & EVENT_READ) mask |= EPOLLIN | EPOLLRDHUP;
+    if (interest & EVENT_WRITE) mask |= EPOLLOUT;
+    if (mode == EDGE_TRIGGERED) mask |= EPOLLET;
+    return mask;
+}
+
+EpollBackend::EpollBackend(trigger_mode_t mode) : EventBackend(mode) {
+    this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        perror("epoll_create1");
+        throw runtime_error("Failed to create epoll instance");
+    }
+}
+
+EpollBackend::~EpollBackend() {
+    close(this->epoll_fd);
+}
+
+void EpollBackend::watch(int fd, int interest, void* udata) {
+    auto it = registrations.find(fd);
+    int op = EPOLL_CTL_MOD;
+    if (it == registrations.end()) {
+        it = registrations.emplace(fd, make_unique<Registration>()).first;
+        op = EPOLL_CTL_ADD;
+    }
+    Registration* reg = it->second.get();
+    reg->fd = fd;
+    reg->interest = interest;
+    reg->udata = udata;
+
+    struct epoll_event ev;
+    ev.events = epoll_mask(interest, trigger_mode);
+    ev.data.ptr = reg;
+    if (epoll_ctl(epoll_fd, op, fd, &ev) == -1 && op == EPOLL_CTL_MOD && errno == ENOENT) {
+        // fd was closed and reused without an unwatch; register it fresh
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+void EpollBackend::unwatch(int fd) {
+    auto it = registrations.find(fd);
+    if (it == registrations.end()) return;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    registrations.erase(it);
+}
+
+int EpollBackend::wait(IOEvent* events, int max_events, int timeout_ms) {
+    // A single epoll_event may expand to a READ and a WRITE IOEvent
+    int max_epoll = max_events > 1 ? max_events / 2 : 1;
+    vector<struct epoll_event> ep_events(max_epoll);
+
+    int n = epoll_wait(epoll_fd, ep_events.data(), max_epoll, timeout_ms);
+    if (n == -1) return -1;
+
+    int out = 0;
+    for (int i = 0; i < n; i++) {
+        auto* reg = static_cast<Registration*>(ep_events[i].data.ptr);
+        uint32_t flags = ep_events[i].events;
+        bool eof = (flags & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) != 0;
+
+        // Errors and hangups are reported on every filter the caller is
+        // waiting on, matching kqueue's EV_EOF on each registered filter
+        bool readable = (flags & EPOLLIN) || (eof && (reg->interest & EVENT_READ));
+        bool writable = (flags & EPOLLOUT) || (eof && (reg->interest & EVENT_WRITE));
+
+        if (readable && out < max_events) {
+            events[out++] = IOEvent{reg->fd, EVENT_READ, reg->udata, eof};
+        }
+        if (writable && out < max_events) {
+            events[out++] = IOEvent{reg->fd, EVENT_WRITE, reg->udata, eof};
+        }
+    }
+    return out;
+}
+#endif
+
+unique_ptr<EventBackend> make_event_backend(trigger_mode_t mode) {
+#if defined(CUSTOM_GIT_HAVE_EPOLL)
+    return make_unique<EpollBackend>(mode);
+#elif defined(CUSTOM_GIT_HAVE_KQUEUE)
+    return make_unique<KqueueBackend>(mode);
+#else
+#error "No event backend available for this platform (need epoll or kqueue)"
+#endif
+}
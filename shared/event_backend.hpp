@@ -0,0 +1,91 @@
+#ifndef EVENT_BACKEND_HPP
+#define EVENT_BACKEND_HPP
+
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+
+using namespace std;
+
+// Interest flags, combinable as a bitmask
+typedef enum {
+    EVENT_NONE = 0,
+    EVENT_READ = 1 << 0,
+    EVENT_WRITE = 1 << 1,
+} event_filter_t;
+
+typedef enum {
+    LEVEL_TRIGGERED,
+    EDGE_TRIGGERED,
+} trigger_mode_t;
+
+// One readiness notification. Backends that report read and write readiness
+// together (epoll) are split into one IOEvent per filter so callers see the
+// same shape kqueue produces.
+struct IOEvent {
+    int fd;
+    event_filter_t filter;
+    void* udata;
+    bool eof;
+};
+
+class EventBackend {
+protected:
+    trigger_mode_t trigger_mode;
+public:
+    EventBackend(trigger_mode_t mode) : trigger_mode(mode) {}
+    virtual ~EventBackend() = default;
+
+    // Replace the interest set for fd with `interest` (a mask of EVENT_READ /
+    // EVENT_WRITE). Registers fd on first use; EVENT_NONE keeps fd registered
+    // but silent.
+    virtual void watch(int fd, int interest, void* udata) = 0;
+    virtual void unwatch(int fd) = 0;
+    // Blocks for at most timeout_ms (-1 = forever). Returns number of events
+    // written, or -1 on error (errno set).
+    virtual int wait(IOEvent* events, int max_events, int timeout_ms) = 0;
+
+    trigger_mode_t mode() const { return trigger_mode; }
+};
+
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+#define CUSTOM_GIT_HAVE_KQUEUE 1
+class KqueueBackend : public EventBackend {
+private:
+    int kqueue_fd;
+    unordered_map<int, int> interests;
+public:
+    KqueueBackend(trigger_mode_t mode = LEVEL_TRIGGERED);
+    void watch(int fd, int interest, void* udata) override;
+    void unwatch(int fd) override;
+    int wait(IOEvent* events, int max_events, int timeout_ms) override;
+    ~KqueueBackend();
+};
+#endif
+
+#if defined(__linux__)
+#define CUSTOM_GIT_HAVE_EPOLL 1
+class EpollBackend : public EventBackend {
+private:
+    // epoll_data is a union, so it can't carry both the fd and the caller's
+    // udata; it points at one of these instead.
+    struct Registration {
+        int fd;
+        int interest;
+        void* udata;
+    };
+    int epoll_fd;
+    unordered_map<int, unique_ptr<Registration>> registrations;
+public:
+    EpollBackend(trigger_mode_t mode = LEVEL_TRIGGERED);
+    void watch(int fd, int interest, void* udata) override;
+    void unwatch(int fd) override;
+    int wait(IOEvent* events, int max_events, int timeout_ms) override;
+    ~EpollBackend();
+};
+#endif
+
+// Picks the native backend for the platform
+unique_ptr<EventBackend> make_event_backend(trigger_mode_t mode = LEVEL_TRIGGERED);
+
+#endif // EVENT_BACKEND_HPP
@@ -0,0 +1,275 @@
+#include "http2_session.hpp"
+#include "async_https_api.hpp"
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+HTTP2Session::HTTP2Session(int socket_fd, SSL* conn, const string& host, int verbose)
+    : socket_fd(socket_fd), conn(conn), host(host), verbose(verbose) {
+    nghttp2_session_callbacks* callbacks;
+    nghttp2_session_callbacks_new(&callbacks);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, &HTTP2Session::on_header);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, &HTTP2Session::on_data_chunk);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, &HTTP2Session::on_stream_close);
+    int rv = nghttp2_session_client_new(&session, callbacks, this);
+    nghttp2_session_callbacks_del(callbacks);
+    if (rv != 0) {
+        throw runtime_error(string("Failed to create HTTP/2 session: ") + nghttp2_strerror(rv));
+    }
+
+    // The client preface and SETTINGS go out with the first flush()
+    nghttp2_settings_entry settings[] = {
+        {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, (uint32_t)MAX_STREAMS_PER_SESSION},
+        {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, (uint32_t)HTTP2_STREAM_WINDOW},
+    };
+    nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, settings, 2);
+    nghttp2_session_set_local_window_size(session, NGHTTP2_FLAG_NONE, 0, HTTP2_CONNECTION_WINDOW);
+    idle_since = chrono::steady_clock::now();
+}
+
+HTTP2Session::~HTTP2Session() {
+    nghttp2_session_del(session);
+}
+
+void HTTP2Session::submit(unique_ptr<HTTPSRequest> req) {
+    req->enter(STREAMING);
+
+    vector<pair<string, string>> fields = {
+        {":method", "POST"},
+        {":scheme", "https"},
+        {":authority", req->authority},
+        {":path", req->path},
+        {"content-length", to_string(req->body.size())},
+    };
+    for (const auto& [name, value] : req->headers) {
+        string lower = name;
+        transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        // Connection-specific headers are illegal in HTTP/2
+        if (lower == "host" || lower == "connection" || lower == "keep-alive" || lower == "content-length") continue;
+        fields.emplace_back(std::move(lower), value);
+    }
+
+    vector<nghttp2_nv> nva;
+    nva.reserve(fields.size());
+    for (auto& [name, value] : fields) {
+        nva.push_back({(uint8_t*)name.data(), (uint8_t*)value.data(), name.size(), value.size(), NGHTTP2_NV_FLAG_NONE});
+    }
+
+    nghttp2_data_provider body;
+    body.source.ptr = nullptr;  // read_body finds the request through the stream
+    body.read_callback = &HTTP2Session::read_body;
+
+    int32_t stream_id = nghttp2_submit_request(session, nullptr, nva.data(), nva.size(), &body, req.get());
+    if (stream_id < 0) {
+        if (verbose >= 2) cout << "HTTP/2 submit failed: " << nghttp2_strerror(stream_id) << endl;
+        req->enter(ERROR);
+        finished.push_back(std::move(req));
+        return;
+    }
+
+    if (verbose >= 2) cout << "HTTP/2 stream " << stream_id << " opened for " << req->path << " on fd=" << socket_fd << endl;
+    streams[stream_id] = std::move(req);
+}
+
+void HTTP2Session::handle_event(event_filter_t filter) {
+    // SSL may need the opposite direction to make progress (key updates),
+    // so both halves run regardless of which filter fired
+    if (verbose >= 2) cout << "HTTP/2 event fd=" << socket_fd << " filter=" << filter << endl;
+    read_frames();
+    flush();
+}
+
+void HTTP2Session::read_frames() {
+    while (!failed) {
+        uint8_t buffer[16384];
+        int bytes_received = SSL_read(conn, buffer, sizeof(buffer));
+        if (bytes_received > 0) {
+            ssize_t consumed = nghttp2_session_mem_recv(session, buffer, bytes_received);
+            if (consumed < 0) {
+                fail(string("HTTP/2 protocol error: ") + nghttp2_strerror((int)consumed));
+            }
+            continue;
+        }
+
+        int ssl_error = SSL_get_error(conn, bytes_received);
+        if (ssl_error != SSL_ERROR_WANT_READ && ssl_error != SSL_ERROR_WANT_WRITE) {
+            fail("connection closed by peer");
+        }
+        return;
+    }
+}
+
+void HTTP2Session::flush() {
+    while (!failed) {
+        if (out_sent == outbuf.size()) {
+            const uint8_t* data;
+            ssize_t len = nghttp2_session_mem_send(session, &data);
+            if (len < 0) {
+                fail(string("HTTP/2 send error: ") + nghttp2_strerror((int)len));
+                return;
+            }
+            if (len == 0) return;
+            // SSL_write must be retried with the same bytes, so nghttp2's
+            // buffer (only valid until the next call) is copied out
+            outbuf.assign((const char*)data, len);
+            out_sent = 0;
+        }
+
+        int bytes_written = SSL_write(conn, outbuf.data() + out_sent, outbuf.size() - out_sent);
+        if (bytes_written > 0) {
+            out_sent += bytes_written;
+            continue;
+        }
+
+        int ssl_error = SSL_get_error(conn, bytes_written);
+        if (ssl_error != SSL_ERROR_WANT_READ && ssl_error != SSL_ERROR_WANT_WRITE) {
+            fail("write failed");
+        }
+        return;
+    }
+}
+
+void HTTP2Session::fail(const string& reason) {
+    if (verbose >= 2) cout << "HTTP/2 connection fd=" << socket_fd << " failed: " << reason << endl;
+    failed = true;
+}
+
+int HTTP2Session::interest() const {
+    int mask = EVENT_READ;
+    // Finished streams and failures have to reach the owner even if the
+    // server goes quiet, and a writable socket reports immediately
+    if (failed || out_sent < outbuf.size() || nghttp2_session_want_write(session) || !finished.empty()) {
+        mask |= EVENT_WRITE;
+    }
+    return mask;
+}
+
+bool HTTP2Session::has_capacity() const {
+    if (is_closed() || !nghttp2_session_check_request_allowed(session)) return false;
+    size_t limit = min((size_t)nghttp2_session_get_remote_settings(session, NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS),
+                       MAX_STREAMS_PER_SESSION);
+    return streams.size() < limit;
+}
+
+bool HTTP2Session::is_closed() const {
+    return failed || (!nghttp2_session_want_read(session) && !nghttp2_session_want_write(session));
+}
+
+size_t HTTP2Session::active_streams() const {
+    return streams.size() + finished.size();
+}
+
+chrono::steady_clock::duration HTTP2Session::idle_time() const {
+    if (!streams.empty()) return chrono::steady_clock::duration::zero();
+    return chrono::steady_clock::now() - idle_since;
+}
+
+vector<unique_ptr<HTTPSRequest>> HTTP2Session::take_finished() {
+    vector<unique_ptr<HTTPSRequest>> done;
+    done.swap(finished);
+    return done;
+}
+
+unique_ptr<HTTPSRequest> HTTP2Session::cancel(HTTPSRequest* req) {
+    for (auto it = streams.begin(); it != streams.end(); ++it) {
+        if (it->second.get() != req) continue;
+
+        // Callbacks for frames already in flight must not touch the request
+        nghttp2_session_set_stream_user_data(session, it->first, nullptr);
+        nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, it->first, NGHTTP2_CANCEL);
+        unique_ptr<HTTPSRequest> owned = std::move(it->second);
+        streams.erase(it);
+        if (streams.empty()) {
+            idle_since = chrono::steady_clock::now();
+        }
+        return owned;
+    }
+    return nullptr;
+}
+
+vector<unique_ptr<HTTPSRequest>> HTTP2Session::take_streams() {
+    vector<unique_ptr<HTTPSRequest>> open = take_finished();
+    for (auto& [stream_id, req] : streams) {
+        req->enter(ERROR);
+        open.push_back(std::move(req));
+    }
+    streams.clear();
+    return open;
+}
+
+int HTTP2Session::on_header(nghttp2_session* session, const nghttp2_frame* frame, const uint8_t* name, size_t namelen,
+                            const uint8_t* value, size_t valuelen, uint8_t, void*) {
+    if (frame->hd.type != NGHTTP2_HEADERS) return 0;
+    auto* req = static_cast<HTTPSRequest*>(nghttp2_session_get_stream_user_data(session, frame->hd.stream_id));
+    if (req == nullptr) return 0;
+
+    if (req->recv_headers.empty()) {
+        req->mark_first_byte();
+    }
+
+    string field((const char*)name, namelen);
+    string field_value((const char*)value, valuelen);
+    if (field == ":status") {
+        // A final status replaces any 1xx block that came before it
+        req->recv_headers = "http/2 " + field_value + "\r\n";
+        req->stream_body = req->on_data && field_value[0] == '2';
+    } else {
+        if (field == "content-encoding") {
+            req->decoder = ContentDecoder::create(field_value);
+        }
+        req->recv_headers += field + ": " + field_value + "\r\n";
+    }
+    return 0;
+}
+
+int HTTP2Session::on_data_chunk(nghttp2_session* session, uint8_t, int32_t stream_id, const uint8_t* data, size_t len,
+                                void*) {
+    auto* req = static_cast<HTTPSRequest*>(nghttp2_session_get_stream_user_data(session, stream_id));
+    if (req == nullptr) return 0;
+    if (!req->emit_body((const char*)data, len)) {
+        // Only this stream is bad; on_stream_close sees the error code
+        nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_INTERNAL_ERROR);
+    }
+    return 0;
+}
+
+int HTTP2Session::on_stream_close(nghttp2_session*, int32_t stream_id, uint32_t error_code, void* user_data) {
+    auto* self = static_cast<HTTP2Session*>(user_data);
+    auto it = self->streams.find(stream_id);
+    if (it == self->streams.end()) return 0;
+
+    unique_ptr<HTTPSRequest> req = std::move(it->second);
+    self->streams.erase(it);
+
+    if (error_code == NGHTTP2_NO_ERROR && !req->recv_headers.empty() && req->finish_body()) {
+        req->recv_headers += "\r\n";
+        req->enter(DONE);
+    } else {
+        // REFUSED_STREAM and streams above a GOAWAY's last id leave
+        // recv_headers empty, which marks them safe to send again
+        req->enter(ERROR);
+    }
+    if (self->verbose >= 2) cout << "HTTP/2 stream " << stream_id << " closed, error_code=" << error_code << endl;
+
+    self->finished.push_back(std::move(req));
+    if (self->streams.empty()) {
+        self->idle_since = chrono::steady_clock::now();
+    }
+    return 0;
+}
+
+ssize_t HTTP2Session::read_body(nghttp2_session* session, int32_t stream_id, uint8_t* buf, size_t length,
+                                uint32_t* data_flags, nghttp2_data_source*, void*) {
+    auto* req = static_cast<HTTPSRequest*>(nghttp2_session_get_stream_user_data(session, stream_id));
+    if (req == nullptr) return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;  // cancelled
+
+    size_t remaining = req->body.size() - req->bytes_sent;
+    size_t n = min(length, remaining);
+    memcpy(buf, req->body.data() + req->bytes_sent, n);
+    req->bytes_sent += n;
+    if (req->bytes_sent == req->body.size()) {
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    }
+    return n;
+}
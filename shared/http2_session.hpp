@@ -0,0 +1,96 @@
+#ifndef HTTP2_SESSION_HPP
+#define HTTP2_SESSION_HPP
+
+#include <openssl/ssl.h>
+#include <nghttp2/nghttp2.h>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "event_backend.hpp"
+
+using namespace std;
+
+struct HTTPSRequest;
+
+// Streams we open on one connection even if the server allows more
+static constexpr size_t MAX_STREAMS_PER_SESSION = 100;
+// Receive windows: per stream, and for the connection as a whole, large
+// enough that a burst of embedding responses isn't throttled by flow control
+static constexpr int32_t HTTP2_STREAM_WINDOW = 1 << 20;
+static constexpr int32_t HTTP2_CONNECTION_WINDOW = 1 << 24;
+
+// One HTTP/2 connection multiplexing many requests as streams. nghttp2 does
+// the framing and HPACK; this class moves bytes between it and the
+// non-blocking SSL object. The socket and SSL object stay owned by
+// AsyncHTTPSConnection, which closes them when the session goes away.
+//
+// Requests handed to submit() come back through take_finished() in state
+// DONE or ERROR with recv_headers/recv_body filled in the same shape the
+// HTTP/1.1 path produces ("http/2 200\r\nname: value\r\n...\r\n").
+class HTTP2Session {
+private:
+    int socket_fd;
+    SSL* conn;
+    string host;
+    int verbose;
+    nghttp2_session* session = nullptr;
+    bool failed = false;
+
+    unordered_map<int32_t, unique_ptr<HTTPSRequest>> streams;
+    vector<unique_ptr<HTTPSRequest>> finished;
+    chrono::steady_clock::time_point idle_since;
+
+    // Serialized frames nghttp2 produced that SSL_write hasn't taken yet
+    string outbuf;
+    size_t out_sent = 0;
+
+    void read_frames();
+    void fail(const string& reason);
+
+    static int on_header(nghttp2_session* session, const nghttp2_frame* frame, const uint8_t* name, size_t namelen,
+                         const uint8_t* value, size_t valuelen, uint8_t flags, void* user_data);
+    static int on_data_chunk(nghttp2_session* session, uint8_t flags, int32_t stream_id, const uint8_t* data, size_t len,
+                             void* user_data);
+    static int on_stream_close(nghttp2_session* session, int32_t stream_id, uint32_t error_code, void* user_data);
+    static ssize_t read_body(nghttp2_session* session, int32_t stream_id, uint8_t* buf, size_t length,
+                             uint32_t* data_flags, nghttp2_data_source* source, void* user_data);
+
+public:
+    HTTP2Session(int socket_fd, SSL* conn, const string& host, int verbose = 0);
+    HTTP2Session(const HTTP2Session&) = delete;
+    HTTP2Session& operator=(const HTTP2Session&) = delete;
+
+    // Opens a stream for the request. A request nghttp2 refuses is finished
+    // with ERROR straight away.
+    void submit(unique_ptr<HTTPSRequest> req);
+    // Reads whatever frames are available, then sends what's queued
+    void handle_event(event_filter_t filter);
+    // Writes queued frames until the socket would block
+    void flush();
+
+    // Interest mask to register with the EventBackend
+    int interest() const;
+    // Room for another stream right now
+    bool has_capacity() const;
+    // Failed, or the server sent GOAWAY and every stream has finished
+    bool is_closed() const;
+    size_t active_streams() const;
+    chrono::steady_clock::duration idle_time() const;
+
+    vector<unique_ptr<HTTPSRequest>> take_finished();
+    // Resets the request's stream and hands it back; nullptr if it isn't
+    // an open stream here
+    unique_ptr<HTTPSRequest> cancel(HTTPSRequest* req);
+    // Streams still open, marked ERROR; for tearing down a dead connection
+    vector<unique_ptr<HTTPSRequest>> take_streams();
+
+    int get_fd() const { return socket_fd; }
+    SSL* get_conn() const { return conn; }
+    const string& get_host() const { return host; }
+    ~HTTP2Session();
+};
+
+#endif // HTTP2_SESSION_HPP
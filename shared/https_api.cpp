@@ -1,42 +1,41 @@
 #include "https_api.hpp"
+#include <poll.h>
 
 using namespace std;
 
 void APIConnection::start_conn() {
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-        perror("Socket creation failed");
-        return;
+    // host may name a port ("localhost:8443"); the Host header keeps it
+    string hostname = this->host;
+    uint16_t port = 443;
+    size_t colon = hostname.find(':');
+    if (colon != string::npos && hostname.find(':', colon + 1) == string::npos) {
+        port = (uint16_t)atoi(hostname.c_str() + colon + 1);
+        hostname.erase(colon);
     }
 
-    struct hostent* server = gethostbyname(this->host.c_str());
-    if (server == nullptr) {
-        cerr << "No such host: " << this->host << endl;
-        close(sockfd);
+    ResolveResult resolved = Resolver::resolve_now(hostname);
+    if (!resolved.error.empty()) {
+        cerr << resolved.error << endl;
         return;
     }
+    const ResolvedAddress& address = resolved.addresses.front();
 
-    struct sockaddr_in serv_addr;
-    memset(&serv_addr, 0, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    memcpy(&serv_addr.sin_addr.s_addr, server->h_addr, server->h_length);
-    serv_addr.sin_port = htons(443);
+    int sockfd = socket(address.family, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        perror("Socket creation failed");
+        return;
+    }
 
-    if (connect(sockfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
+    sockaddr_storage serv_addr = address.with_port(port);
+    if (connect(sockfd, (struct sockaddr*)&serv_addr, address.addr_len) < 0) {
         perror("Connection failed");
         close(sockfd);
         return;
     }
 
-    //For HTTPS as it needs encryption
-    SSL_load_error_strings();
-    SSL_library_init();
-    this->ssl_ctx = SSL_CTX_new(SSLv23_client_method());
-
-    this->conn = SSL_new(this->ssl_ctx);
-    SSL_set_fd(this->conn, sockfd);
-
-    SSL_set_tlsext_host_name(this->conn, this->host.c_str());
+    //For HTTPS as it needs encryption; the context (and its session cache) is shared process-wide.
+    //Its socket BIO writes without SIGPIPE, so a dropped connection fails send() with EPIPE
+    this->conn = this->tls->new_connection(sockfd, hostname);
 
     this->fd = sockfd;
 
@@ -46,66 +45,115 @@ void APIConnection::start_conn() {
         char err_buf[256];
         ERR_error_string_n(ssl_err, err_buf, sizeof(err_buf));
         cerr << "SSL connection failed: " << err_buf << endl;
+        SSL_free(this->conn);
+        this->conn = nullptr;
         close(sockfd);
+        this->fd = -1;
         return;
     }
+    this->tls->record_handshake(this->conn);
 }
 
 APIConnection::APIConnection(string url, string path) {
     this->host = url;
     this->path = path;
+    this->conn = nullptr;
+    this->fd = -1;
+    this->tls = TLSContext::shared();
     start_conn();
 }
 
+void APIConnection::close_conn() {
+    if (conn) {
+        SSL_shutdown(conn);
+        SSL_free(conn);
+        conn = nullptr;
+    }
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    inbuf.clear();
+    requests_on_conn = 0;
+}
+
+// An idle keep-alive connection has nothing to read. If it's readable the
+// server has closed it (or is about to), and writing to it would fail.
+bool APIConnection::idle_connection_usable() const {
+    pollfd pfd = {this->fd, POLLIN, 0};
+    return poll(&pfd, 1, 0) == 0;
+}
+
 void APIConnection::send(string request) {
-    char buffer[4096];
-    memset(buffer, 0, sizeof(buffer));
-    int total_bytes = 0;
-    while(total_bytes < request.size()){
-      memcpy(buffer, request.c_str() + total_bytes, min(sizeof(buffer), request.size() - total_bytes));
-      int bytes_written = SSL_write(this->conn, buffer, min(sizeof(buffer), request.size() - total_bytes));
+    size_t total_bytes = 0;
+    while (!failed && total_bytes < request.size()) {
+      int bytes_written = this->conn ? SSL_write(this->conn, request.data() + total_bytes, request.size() - total_bytes) : -1;
       if (bytes_written <= 0) {
         cerr << "Error writing to socket. Code: " << bytes_written << endl;
+        failed = true;
         return;
       }
       total_bytes += bytes_written;
     }
 }
 
+// Reads whatever the next TLS record holds into inbuf. False at end of
+// stream or on error, which also marks the connection failed.
+bool APIConnection::fill() {
+  if (failed || !this->conn) {
+    failed = true;
+    return false;
+  }
+  int bytes_received = SSL_read(this->conn, inbuf.prepare(READ_CHUNK_SIZE), READ_CHUNK_SIZE);
+  if (bytes_received <= 0) {
+    failed = true;
+    return false;
+  }
+  inbuf.commit(bytes_received);
+  return true;
+}
+
 string APIConnection::recieve_length(int n) {
   string response;
-  char buffer[4096];
-  int total_bytes = 0;
-  while (total_bytes < n) {
-    memset(buffer, 0, sizeof(buffer));
-    // Only read as many bytes as we need, not more
-    int bytes_to_read = min((int)(sizeof(buffer) - 1), n - total_bytes);
-    ssize_t bytes_received = SSL_read(this->conn, buffer, bytes_to_read);
+  if (n <= 0) return response;
+
+  // Whatever is already buffered first, then read the rest straight into
+  // the result
+  size_t filled = min(inbuf.size(), (size_t)n);
+  response.resize(n);
+  memcpy(response.data(), inbuf.begin(), filled);
+  inbuf.consume(filled);
+  while (filled < (size_t)n && !failed && this->conn) {
+    int bytes_received = SSL_read(this->conn, response.data() + filled, n - filled);
     if (bytes_received <= 0) {
+      failed = true;
       break;
     }
-    total_bytes += bytes_received;
-    response.append(buffer, bytes_received);  // Use append with size to avoid null terminator issues
+    filled += bytes_received;
   }
+  response.resize(filled);
   return response;
 }
-string APIConnection::recieve_sentinel(string sentinel) {
-  string response;
-  char buffer; 
-  bool found_sentinel = false;
 
-  while (!found_sentinel) { 
-      ssize_t bytes_received = SSL_read(this->conn, &buffer, 1); 
-      if (bytes_received <= 0) { 
-          break;
-      }
-      response += buffer;
-      
-      if (response.size() >= sentinel.size() && response.substr(response.size() - sentinel.size()) == sentinel) {
-        found_sentinel = true;
-      }
+string APIConnection::recieve_sentinel(string sentinel) {
+  // Only unsearched bytes, plus a sentinel's length before them in case it
+  // straddles two reads, can complete the match
+  size_t searched = 0;
+  while (true) {
+    string_view buffered(inbuf.begin(), inbuf.size());
+    size_t pos = buffered.find(sentinel, searched);
+    if (pos != string_view::npos) {
+      string response(buffered.substr(0, pos + sentinel.size()));
+      inbuf.consume(pos + sentinel.size());
+      return response;
+    }
+    searched = buffered.size() >= sentinel.size() ? buffered.size() - sentinel.size() + 1 : 0;
+    if (!fill()) {
+      string response(inbuf.begin(), inbuf.size());
+      inbuf.clear();
+      return response;
+    }
   }
-  return response;
 }
 
 string APIConnection::post(string body, vector<pair<string, string>> headers) {
@@ -119,40 +167,113 @@ string APIConnection::post(string body, vector<pair<string, string>> headers) {
 
     request += "\r\n" + body;
 
-    send(request);
-    string response_headers = recieve_sentinel("\r\n\r\n");
+    // A kept-alive connection the server closed while we were idle fails
+    // before any response arrives; the request never got processed, so it
+    // goes out once more on a fresh connection
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool reused = this->conn && requests_on_conn > 0;
+        if (reused && !idle_connection_usable()) {
+            close_conn();
+            reused = false;
+        }
+        if (!this->conn) {
+            start_conn();
+            if (!this->conn) return "";
+        }
+
+        failed = false;
+        send(request);
+        string response_headers = recieve_sentinel("\r\n\r\n");
+        if (failed && response_headers.empty() && reused) {
+            close_conn();
+            continue;
+        }
+
+        requests_on_conn++;
+        string result = read_body(response_headers);
+
+        string lowered = response_headers;
+        transform(lowered.begin(), lowered.end(), lowered.begin(), ::tolower);
+        if (failed || lowered.find("\nconnection: close") != string::npos) {
+            close_conn();
+        }
+        return result;
+    }
+    return "";
+}
+
+string APIConnection::read_body(const string& response_headers) {
+    string lowered = response_headers;
+    transform(lowered.begin(), lowered.end(), lowered.begin(), ::tolower);
+
+    // gzip/deflate bodies are inflated as they're read
+    unique_ptr<ContentDecoder> decoder;
+    size_t encoding_pos = lowered.find("\ncontent-encoding:");
+    if (encoding_pos != string::npos) {
+        size_t value_start = encoding_pos + 18;
+        decoder = ContentDecoder::create(lowered.substr(value_start, lowered.find("\r\n", value_start) - value_start));
+    }
 
     // Check if using chunked transfer encoding
-    if (response_headers.find("Transfer-Encoding: chunked") != string::npos) {
-        return recieve_chunked();
+    if (lowered.find("\ntransfer-encoding: chunked") != string::npos) {
+        return recieve_chunked(decoder.get());
     }
 
     // Try Content-Length method
-    size_t length_header_pos = response_headers.find("Content-Length: ");
+    size_t length_header_pos = lowered.find("\ncontent-length:");
     if (length_header_pos != string::npos) {
-        int length_start = length_header_pos + 16;
-        int length_end = response_headers.find("\r\n", length_start);
+        size_t length_start = length_header_pos + 16;
+        size_t length_end = lowered.find("\r\n", length_start);
 
         if (length_end != string::npos) {
-            string length_str = response_headers.substr(length_start, length_end - length_start);
+            string length_str = lowered.substr(length_start, length_end - length_start);
             try {
                 int length = stoi(length_str);
-                return recieve_length(length);
+                string body;
+                if (!append_decoded(body, recieve_length(length), decoder.get())) {
+                    // The body was read in full, so the connection is still usable
+                    return "";
+                }
+                return body;
             } catch (const exception& e) {
                 // Fall through to error handling
             }
         }
     }
-    
+
+    // Neither: the body runs until the server closes the connection
+    if (lowered.find("\nconnection: close") != string::npos) {
+        while (fill()) {}
+        string body;
+        bool decoded = append_decoded(body, string(inbuf.begin(), inbuf.size()), decoder.get());
+        inbuf.clear();
+        return decoded ? body : "";
+    }
+
     cerr << "Error: Unsupported response encoding" << endl;
     cerr << "Response headers: " << response_headers << endl;
+    failed = true;  // unknown framing leaves the connection at an unknown position
     return "";
 }
 
-string APIConnection::recieve_chunked() {
+// Appends data to body, inflating it first when the response is compressed
+bool APIConnection::append_decoded(string& body, const string& data, ContentDecoder* decoder) {
+    if (decoder == nullptr) {
+        body += data;
+        return true;
+    }
+    if (!decoder->feed(data.data(), data.size(), [&body](string_view out) { body.append(out); })) {
+        cerr << "Error: response body is not valid for its Content-Encoding" << endl;
+        return false;
+    }
+    return true;
+}
+
+string APIConnection::recieve_chunked(ContentDecoder* decoder) {
     string result;
+    bool decoded = true;
 
-    while (true) {
+    while (!failed) {
         // Read chunk size (hex number followed by \r\n)
         string chunk_size_line = recieve_sentinel("\r\n");
         
@@ -172,36 +293,38 @@ string APIConnection::recieve_chunked() {
             chunk_size = stoi(chunk_size_line, nullptr, 16);  // Parse as hex
         } catch (const exception& e) {
             cerr << "Error parsing chunk size: '" << chunk_size_line << "'" << endl;
+            failed = true;
             break;
         }
         
         // If chunk size is 0, we're done
         if (chunk_size == 0) {
             // Read final \r\n (may be empty)
-            try {
-                recieve_sentinel("\r\n");
-            } catch (...) {
-                // Ignore errors reading final chunk terminator
-            }
+            recieve_sentinel("\r\n");
             break;
         }
         
         // Read the chunk data
         string chunk_data = recieve_length(chunk_size);
-        result += chunk_data;
+        // After a decode error keep reading, so the connection is left at
+        // the end of the response
+        if (decoded && !append_decoded(result, chunk_data, decoder)) {
+            decoded = false;
+        }
         
         // Read trailing \r\n after chunk data
         recieve_sentinel("\r\n");
     }
     
-    return result;
+    return decoded && !failed ? result : "";
+}
+
+TLSHandshakeStats APIConnection::handshake_stats() const {
+    return this->tls->stats();
 }
 
 APIConnection::~APIConnection() {
-    SSL_shutdown(conn);
-    SSL_free(conn);
-    SSL_CTX_free(ssl_ctx);
-    close(fd);
+    close_conn();
 }
 
 // int main() { 
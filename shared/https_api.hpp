@@ -1,6 +1,7 @@
 #ifndef HTTPS_API_HPP
 #define HTTPS_API_HPP
 
+#include <algorithm>
 #include <arpa/inet.h>
 #include <cstring>
 #include <iostream>
@@ -10,26 +11,44 @@
 #include <string>
 #include <unistd.h>
 #include <vector>
+#include <memory>
+#include "tls_context.hpp"
+#include "resolver.hpp"
+#include "content_decoder.hpp"
+#include "read_buffer.hpp"
 
 using namespace std;
 
+// Blocking HTTPS/1.1 client for one host and path. The connection is kept
+// alive across post() calls and reopened when the server has closed it.
+// Every read goes through inbuf, a record at a time, so headers and chunk
+// framing are scanned in place rather than read byte by byte.
 class APIConnection {
 private:
     int fd;
     SSL *conn;
-    SSL_CTX *ssl_ctx;
+    shared_ptr<TLSContext> tls;
     string host;
     string path;
+    ReadBuffer inbuf;
+    bool failed = false;          // a read or write on conn failed
+    size_t requests_on_conn = 0;  // responses read off the current connection
 
     void start_conn();
+    void close_conn();
+    bool idle_connection_usable() const;
+    bool fill();
+    string read_body(const string& response_headers);
+    bool append_decoded(string& body, const string& data, ContentDecoder* decoder);
 
 public:
     APIConnection(string url, string path);
     string recieve_length(int n);
     string recieve_sentinel(string sentinel);
-    string recieve_chunked();
+    string recieve_chunked(ContentDecoder* decoder = nullptr);
     void send(string request);
     string post(string body, vector<pair<string, string>> headers);
+    TLSHandshakeStats handshake_stats() const;
     ~APIConnection();
 };
 
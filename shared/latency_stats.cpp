@@ -0,0 +1,144 @@
+#include "latency_stats.hpp"
+#include "async_https_api.hpp"
+#include <algorithm>
+#include <iomanip>
+
+using namespace std;
+
+size_t LatencyHistogram::bucket_for(uint64_t us) {
+    if (us < HISTOGRAM_SUB_BUCKETS) return us;
+    // The top bit picks the power of two, the bits below it the slice of it
+    int msb = 63 - __builtin_clzll(us);
+    size_t sub = (us >> (msb - HISTOGRAM_SUB_BUCKET_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return min(HISTOGRAM_SUB_BUCKETS * (msb - HISTOGRAM_SUB_BUCKET_BITS + 1) + sub, HISTOGRAM_BUCKETS - 1);
+}
+
+uint64_t LatencyHistogram::bucket_low(size_t index) {
+    if (index < HISTOGRAM_SUB_BUCKETS) return index;
+    int msb = index / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKET_BITS - 1;
+    return (HISTOGRAM_SUB_BUCKETS + index % HISTOGRAM_SUB_BUCKETS) << (msb - HISTOGRAM_SUB_BUCKET_BITS);
+}
+
+void LatencyHistogram::record(chrono::steady_clock::duration value) {
+    uint64_t us = max<int64_t>(chrono::duration_cast<chrono::microseconds>(value).count(), 0);
+    buckets[bucket_for(us)]++;
+    samples++;
+    sum_us += us;
+    min_us = min(min_us, us);
+    max_us = max(max_us, us);
+}
+
+double LatencyHistogram::mean_ms() const {
+    return samples ? sum_us / 1000.0 / samples : 0;
+}
+
+double LatencyHistogram::min_ms() const {
+    return samples ? min_us / 1000.0 : 0;
+}
+
+double LatencyHistogram::max_ms() const {
+    return max_us / 1000.0;
+}
+
+double LatencyHistogram::percentile_ms(double p) const {
+    if (samples == 0) return 0;
+    uint64_t rank = max<uint64_t>(1, (uint64_t)(p * samples + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            double low = bucket_low(i);
+            double high = i + 1 < HISTOGRAM_BUCKETS ? bucket_low(i + 1) : low;
+            double mid = clamp((low + high) / 2, (double)min_us, (double)max_us);
+            return mid / 1000.0;
+        }
+    }
+    return max_ms();
+}
+
+nlohmann::json LatencyHistogram::to_json() const {
+    return {
+        {"count", samples},
+        {"mean_ms", mean_ms()},
+        {"min_ms", min_ms()},
+        {"p50_ms", percentile_ms(0.50)},
+        {"p90_ms", percentile_ms(0.90)},
+        {"p99_ms", percentile_ms(0.99)},
+        {"max_ms", max_ms()},
+    };
+}
+
+void LatencyStats::record(const HTTPSResponse& response) {
+    HTTPSPhaseTimes phases = response.phases();
+    total.record(response.elapsed);
+    queued.record(phases.queued);
+    // Phases a request skipped (a pooled connection needs no DNS, connect or
+    // TLS) would only drag the percentiles toward zero
+    if (phases.dns.count() > 0) dns.record(phases.dns);
+    if (phases.connect.count() > 0) connect.record(phases.connect);
+    if (phases.tls.count() > 0) tls.record(phases.tls);
+    send.record(phases.send);
+    wait.record(phases.wait);
+    receive.record(phases.receive);
+
+    responses++;
+    retries += response.attempts - 1;
+    if (response.reused) reused++;
+    bytes_sent += response.bytes_sent;
+    bytes_received += response.bytes_received;
+    statuses[response.status]++;
+}
+
+void LatencyStats::print(ostream& out) const {
+    ios_base::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+    out << fixed << setprecision(1);
+
+    out << "HTTP: " << responses << " responses, " << failures << " failed, " << retries << " retries, "
+        << reused << " on reused connections, " << bytes_sent << " bytes sent, " << bytes_received << " received" << endl;
+    out << "  status:";
+    for (const auto& [status, count] : statuses) {
+        out << " " << status << "=" << count;
+    }
+    out << endl;
+    out << "  phase      count     mean      p50      p90      p99      max  (ms)" << endl;
+    const pair<const char*, const LatencyHistogram*> rows[] = {
+        {"queued", &queued}, {"dns", &dns}, {"connect", &connect}, {"tls", &tls},
+        {"send", &send}, {"wait", &wait}, {"receive", &receive}, {"total", &total},
+    };
+    for (const auto& [name, histogram] : rows) {
+        out << "  " << left << setw(8) << name << right << setw(8) << histogram->count()
+            << setw(9) << histogram->mean_ms() << setw(9) << histogram->percentile_ms(0.50)
+            << setw(9) << histogram->percentile_ms(0.90) << setw(9) << histogram->percentile_ms(0.99)
+            << setw(9) << histogram->max_ms() << endl;
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+nlohmann::json LatencyStats::to_json() const {
+    nlohmann::json status_counts = nlohmann::json::object();
+    for (const auto& [status, count] : statuses) {
+        status_counts[to_string(status)] = count;
+    }
+    return {
+        {"responses", responses},
+        {"failures", failures},
+        {"retries", retries},
+        {"reused_connections", reused},
+        {"bytes_sent", bytes_sent},
+        {"bytes_received", bytes_received},
+        {"statuses", status_counts},
+        {"phases", {
+            {"queued", queued.to_json()},
+            {"dns", dns.to_json()},
+            {"connect", connect.to_json()},
+            {"tls", tls.to_json()},
+            {"send", send.to_json()},
+            {"wait", wait.to_json()},
+            {"receive", receive.to_json()},
+            {"total", total.to_json()},
+        }},
+    };
+}
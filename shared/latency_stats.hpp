@@ -0,0 +1,79 @@
+#ifndef LATENCY_STATS_HPP
+#define LATENCY_STATS_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <nlohmann/json.hpp>
+
+using namespace std;
+
+struct HTTPSResponse;
+
+// Log-linear buckets: eight per power of two microseconds, so a reported
+// percentile is within about 6% of the true value, from 1us up to ~12 days
+static constexpr int HISTOGRAM_SUB_BUCKET_BITS = 3;
+static constexpr size_t HISTOGRAM_SUB_BUCKETS = 1 << HISTOGRAM_SUB_BUCKET_BITS;
+static constexpr size_t HISTOGRAM_BUCKETS = 40 * HISTOGRAM_SUB_BUCKETS;
+
+// Fixed-size latency histogram; recording is a few integer ops and never
+// allocates, so it's cheap enough to run on every request
+class LatencyHistogram {
+private:
+    array<uint64_t, HISTOGRAM_BUCKETS> buckets{};
+    uint64_t samples = 0;
+    uint64_t sum_us = 0;
+    uint64_t min_us = UINT64_MAX;
+    uint64_t max_us = 0;
+
+    static size_t bucket_for(uint64_t us);
+    static uint64_t bucket_low(size_t index);
+
+public:
+    void record(chrono::steady_clock::duration value);
+
+    uint64_t count() const { return samples; }
+    double mean_ms() const;
+    double min_ms() const;
+    double max_ms() const;
+    // p in [0, 1]; the midpoint of the bucket holding that rank, clamped to
+    // the observed min and max
+    double percentile_ms(double p) const;
+
+    nlohmann::json to_json() const;
+};
+
+// Aggregate over every request an AsyncHTTPSConnection completes: total
+// latency and the per-phase breakdown from HTTPSResponse::phases(), plus
+// status, retry, reuse and byte counts
+class LatencyStats {
+public:
+    LatencyHistogram total;
+    LatencyHistogram queued;
+    LatencyHistogram dns;
+    LatencyHistogram connect;
+    LatencyHistogram tls;
+    LatencyHistogram send;
+    LatencyHistogram wait;
+    LatencyHistogram receive;
+
+    size_t responses = 0;
+    size_t failures = 0;   // requests that ended in an exception
+    size_t retries = 0;    // extra attempts behind the responses
+    size_t reused = 0;     // responses that didn't open a connection
+    size_t bytes_sent = 0;
+    size_t bytes_received = 0;
+    map<int, size_t> statuses;
+
+    void record(const HTTPSResponse& response);
+    void record_failure() { failures++; }
+
+    // One line per phase with count, mean and p50/p90/p99/max in ms
+    void print(ostream& out) const;
+    nlohmann::json to_json() const;
+};
+
+#endif // LATENCY_STATS_HPP
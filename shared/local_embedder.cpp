@@ -0,0 +1,146 @@
+#include "local_embedder.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+
+static constexpr uint64_t FNV_OFFSET = 1469598103934665603ull;
+static constexpr uint64_t FNV_PRIME = 1099511628211ull;
+
+// Identifier and trigram features hash from different seeds, so "abc" the
+// identifier and "abc" the trigram stay separate features
+static constexpr unsigned char IDENTIFIER_FEATURE = 'i';
+static constexpr unsigned char TRIGRAM_FEATURE = 't';
+
+using FeatureCounts = unordered_map<uint64_t, uint32_t>;
+
+static uint64_t feature_hash(unsigned char kind, const char* data, size_t size) {
+    uint64_t hash = (FNV_OFFSET ^ kind) * FNV_PRIME;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ (unsigned char)data[i]) * FNV_PRIME;
+    }
+    // FNV's low bits mix poorly for short keys; finish with a multiply-shift
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static bool is_identifier_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+// The identifier lowercased, plus its parts when '_' or a lower-to-upper
+// case change splits it (parse_http_response -> parse, http, response;
+// parseHTTPResponse -> parse, httpresponse)
+static void add_identifier(const string& text, size_t start, size_t end, FeatureCounts& counts) {
+    string lowered(text, start, end - start);
+    for (char& c : lowered) c = tolower((unsigned char)c);
+    counts[feature_hash(IDENTIFIER_FEATURE, lowered.data(), lowered.size())]++;
+
+    size_t part_start = start;
+    bool split = false;
+    for (size_t i = start; i <= end; i++) {
+        bool boundary = i == end || text[i] == '_' ||
+                        (i > start && islower((unsigned char)text[i - 1]) && isupper((unsigned char)text[i]));
+        if (!boundary) continue;
+        if (i < end) split = true;
+        if (split && i > part_start) {
+            size_t offset = part_start - start;
+            counts[feature_hash(IDENTIFIER_FEATURE, lowered.data() + offset, i - part_start)]++;
+        }
+        if (i < end) part_start = text[i] == '_' ? i + 1 : i;
+    }
+}
+
+static FeatureCounts extract_features(const string& text) {
+    FeatureCounts counts;
+
+    for (size_t i = 0; i < text.size();) {
+        if (!is_identifier_char(text[i])) {
+            i++;
+            continue;
+        }
+        size_t end = i;
+        while (end < text.size() && is_identifier_char(text[end])) end++;
+        // Bare numbers say little about what code does
+        if (!isdigit((unsigned char)text[i])) add_identifier(text, i, end, counts);
+        i = end;
+    }
+
+    // Trigrams over the lowercased text with whitespace runs collapsed, so
+    // reindenting doesn't change them
+    string squeezed;
+    squeezed.reserve(text.size());
+    for (char c : text) {
+        if (isspace((unsigned char)c)) {
+            if (!squeezed.empty() && squeezed.back() != ' ') squeezed += ' ';
+        } else {
+            squeezed += tolower((unsigned char)c);
+        }
+    }
+    for (size_t i = 0; i + 3 <= squeezed.size(); i++) {
+        counts[feature_hash(TRIGRAM_FEATURE, squeezed.data() + i, 3)]++;
+    }
+    return counts;
+}
+
+// Runs work(i) for every i below count, spread over up to threads workers
+static void parallel_for(size_t count, size_t threads, const function<void(size_t)>& work) {
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+    threads = min(threads, count);
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; i++) work(i);
+        return;
+    }
+
+    atomic<size_t> next{0};
+    vector<thread> workers;
+    for (size_t t = 0; t < threads; t++) {
+        workers.emplace_back([&]() {
+            for (size_t i = next++; i < count; i = next++) work(i);
+        });
+    }
+    for (thread& worker : workers) worker.join();
+}
+
+LocalEmbedder::LocalEmbedder(size_t dimensions) : dimensions(dimensions > 0 ? dimensions : LOCAL_EMBEDDING_DIMENSIONS) {}
+
+vector<vector<float>> LocalEmbedder::embed(const vector<string>& texts, size_t threads) const {
+    vector<FeatureCounts> features(texts.size());
+    parallel_for(texts.size(), threads, [&](size_t i) { features[i] = extract_features(texts[i]); });
+
+    FeatureCounts document_frequency;
+    for (const FeatureCounts& counts : features) {
+        for (const auto& [feature, count] : counts) document_frequency[feature]++;
+    }
+
+    // Smoothed IDF: a feature in every text still counts for a little
+    double documents = texts.size();
+    vector<vector<float>> embeddings(texts.size());
+    parallel_for(texts.size(), threads, [&](size_t i) {
+        vector<float>& embedding = embeddings[i];
+        embedding.assign(dimensions, 0.0f);
+        for (const auto& [feature, count] : features[i]) {
+            double idf = log((1 + documents) / (1 + document_frequency.at(feature))) + 1;
+            double weight = (1 + log(double(count))) * idf;
+            // The top bit signs the contribution, so bucket collisions
+            // cancel out on average instead of piling up
+            float sign = feature >> 63 ? -1.0f : 1.0f;
+            embedding[feature % dimensions] += sign * float(weight);
+        }
+
+        double norm = 0;
+        for (float x : embedding) norm += double(x) * x;
+        if (norm == 0) return;
+        float scale = 1 / sqrt(norm);
+        for (float& x : embedding) x *= scale;
+    });
+    return embeddings;
+}
@@ -0,0 +1,37 @@
+#ifndef LOCAL_EMBEDDER_HPP
+#define LOCAL_EMBEDDER_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Names the local vectors in output and logs, next to the OpenAI models
+static constexpr const char* LOCAL_EMBEDDING_MODEL = "local-ngram-tfidf";
+static constexpr size_t LOCAL_EMBEDDING_DIMENSIONS = 1024;
+
+// Embeds text without a network or a model file: identifiers (whole and
+// split at '_' and camelCase) and character trigrams are hashed into a
+// fixed number of signed buckets, weighted by sublinear term frequency
+// times inverse document frequency across the texts of one call, and
+// scaled to unit length. Similar code shares identifiers and trigrams, so
+// cos_sim still ranks it closer than unrelated code, though with far less
+// sense of meaning than a trained model.
+//
+// The IDF weights depend on every text in the call, so vectors from
+// different calls aren't comparable (or cacheable): embed a whole diff at
+// once. Texts are processed in parallel.
+class LocalEmbedder {
+private:
+    size_t dimensions;
+
+public:
+    explicit LocalEmbedder(size_t dimensions = LOCAL_EMBEDDING_DIMENSIONS);
+
+    // One vector per text, in order. threads = 0 uses every core. A text
+    // with no features (empty) gets an all-zero vector.
+    vector<vector<float>> embed(const vector<string>& texts, size_t threads = 0) const;
+};
+
+#endif // LOCAL_EMBEDDER_HPP
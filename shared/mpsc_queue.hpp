@@ -0,0 +1,60 @@
+#ifndef MPSC_QUEUE_HPP
+#define MPSC_QUEUE_HPP
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+using namespace std;
+
+// Unbounded lock-free queue for many producers and a single consumer
+// (Vyukov's node-based design). push() is one atomic exchange and never
+// blocks; pop() is only ever called from the consumer's thread.
+//
+// A push that's halfway done (head swapped, link not yet stored) hides
+// itself and anything pushed after it from pop() until it finishes, so the
+// consumer can see the queue as empty for a moment. Producers signal the
+// consumer after pushing, which then looks again.
+template <typename T>
+class MPSCQueue {
+private:
+    struct Node {
+        atomic<Node*> next{nullptr};
+        optional<T> value;
+    };
+
+    atomic<Node*> head;  // most recently pushed; producers swap it
+    Node* tail;          // consumer's side, always a node whose value is gone
+
+public:
+    MPSCQueue() {
+        Node* stub = new Node();
+        head.store(stub, memory_order_relaxed);
+        tail = stub;
+    }
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator=(const MPSCQueue&) = delete;
+    ~MPSCQueue() {
+        while (pop()) {}
+        delete tail;
+    }
+
+    void push(T value) {
+        Node* node = new Node();
+        node->value.emplace(std::move(value));
+        Node* prev = head.exchange(node, memory_order_acq_rel);
+        prev->next.store(node, memory_order_release);
+    }
+
+    optional<T> pop() {
+        Node* next = tail->next.load(memory_order_acquire);
+        if (next == nullptr) return nullopt;
+        optional<T> value = std::move(next->value);
+        next->value.reset();
+        delete tail;
+        tail = next;
+        return value;
+    }
+};
+
+#endif // MPSC_QUEUE_HPP
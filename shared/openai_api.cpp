@@ -1,26 +1,30 @@
 #include "openai_api.hpp"
+#include "utils.hpp"
 
 using namespace std;
 using json = nlohmann::json;
 
-OpenAIAPI::OpenAIAPI(const string api_key) 
-    : api_connection("api.openai.com", "/v1/embeddings"), api_key(api_key) {}
+OpenAIAPI::OpenAIAPI(const string api_key, const string& origin)
+    : api_connection(origin, "/v1/embeddings"), api_key(api_key) {}
 
 vector<float> OpenAIAPI::post_embedding(string text) {
     const vector<pair<string, string>> headers = {
         {"Authorization", "Bearer " + this->api_key}, 
-        {"Content-Type", "application/json"}
+        {"Content-Type", "application/json"},
+        {"Accept-Encoding", ACCEPT_ENCODING}
     };
     
     json request_body = {
         {"model", "text-embedding-3-small"},
-        {"input", text}
+        {"input", text},
+        {"encoding_format", "base64"}
     };
     string body = request_body.dump();
     string raw_response = this->api_connection.post(body, headers);
-
-    // vector<float> embedding = this->parse_embedding(raw_response);
-    return {};
+    if (raw_response.empty()) {
+        return {};
+    }
+    return parse_embedding(raw_response);
 }
 
 // TODO: post_chat is not currently functional as it requires a different endpoint path
@@ -13,7 +13,9 @@ class OpenAIAPI {
     APIConnection api_connection;
     string api_key;
   public:
-    OpenAIAPI(const string api_key);
+    // origin is "host" or "host:port", for pointing at a local test server
+    OpenAIAPI(const string api_key, const string& origin = "api.openai.com");
+    // Empty if the request failed or the response has no embedding
     vector<float> post_embedding(string text);
     // TODO: Chat functionality commented out - see openai_api.cpp
     // string post_chat(const nlohmann::json& messages, int max_tokens = 100, float temperature = 0.7);
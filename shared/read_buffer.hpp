@@ -0,0 +1,46 @@
+#ifndef READ_BUFFER_HPP
+#define READ_BUFFER_HPP
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+// One TLS record; SSL_read never returns more than this at once
+static constexpr size_t READ_CHUNK_SIZE = 16384;
+
+// Bytes read off a connection but not parsed yet. SSL_read writes straight
+// into the space after `end` and parsing advances `start`; the unread tail
+// only slides back to the front when a read needs the room, so framing is
+// parsed in place instead of re-copying the remainder after every chunk.
+struct ReadBuffer {
+    string data;
+    size_t start = 0;
+    size_t end = 0;
+
+    // At least `want` writable bytes after end
+    char* prepare(size_t want) {
+        if (data.size() - end < want) {
+            if (start > 0) {
+                memmove(data.data(), data.data() + start, end - start);
+                end -= start;
+                start = 0;
+            }
+            if (data.size() - end < want) {
+                data.resize(max(data.size() * 2, end + want));
+            }
+        }
+        return data.data() + end;
+    }
+    void commit(size_t n) { end += n; }
+    void consume(size_t n) {
+        start += n;
+        if (start == end) start = end = 0;
+    }
+    void clear() { start = end = 0; }
+    const char* begin() const { return data.data() + start; }
+    size_t size() const { return end - start; }
+};
+
+#endif // READ_BUFFER_HPP
@@ -0,0 +1,251 @@
+#include "resolver.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+sockaddr_storage ResolvedAddress::with_port(uint16_t port) const {
+    sockaddr_storage out = addr;
+    if (family == AF_INET) {
+        reinterpret_cast<sockaddr_in*>(&out)->sin_port = htons(port);
+    } else if (family == AF_INET6) {
+        reinterpret_cast<sockaddr_in6*>(&out)->sin6_port = htons(port);
+    }
+    return out;
+}
+
+string ResolvedAddress::to_string() const {
+    char text[INET6_ADDRSTRLEN] = "";
+    if (family == AF_INET) {
+        inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in*>(&addr)->sin_addr, text, sizeof(text));
+    } else if (family == AF_INET6) {
+        inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6*>(&addr)->sin6_addr, text, sizeof(text));
+    }
+    return text;
+}
+
+static bool parse_literal(const string& address, ResolvedAddress& out) {
+    memset(&out.addr, 0, sizeof(out.addr));
+
+    auto* v4 = reinterpret_cast<sockaddr_in*>(&out.addr);
+    if (inet_pton(AF_INET, address.c_str(), &v4->sin_addr) == 1) {
+        v4->sin_family = AF_INET;
+        out.family = AF_INET;
+        out.addr_len = sizeof(sockaddr_in);
+        return true;
+    }
+
+    auto* v6 = reinterpret_cast<sockaddr_in6*>(&out.addr);
+    if (inet_pton(AF_INET6, address.c_str(), &v6->sin6_addr) == 1) {
+        v6->sin6_family = AF_INET6;
+        out.family = AF_INET6;
+        out.addr_len = sizeof(sockaddr_in6);
+        return true;
+    }
+    return false;
+}
+
+// Process-wide override table, seeded once from CUSTOM_GIT_RESOLVE
+struct ResolverOverrides {
+    mutex mtx;
+    unordered_map<string, vector<ResolvedAddress>> hosts;
+
+    ResolverOverrides() {
+        const char* env = getenv("CUSTOM_GIT_RESOLVE");
+        if (env == nullptr) return;
+
+        stringstream ss(env);
+        string entry;
+        while (getline(ss, entry, ',')) {
+            size_t eq = entry.find('=');
+            if (eq == string::npos) continue;
+            ResolvedAddress addr;
+            if (parse_literal(entry.substr(eq + 1), addr)) {
+                hosts[entry.substr(0, eq)].push_back(addr);
+            }
+        }
+    }
+};
+
+static ResolverOverrides& overrides() {
+    static ResolverOverrides instance;
+    return instance;
+}
+
+void Resolver::add_override(const string& host, const string& address) {
+    add_override(host, vector<string>{address});
+}
+
+void Resolver::add_override(const string& host, const vector<string>& addresses) {
+    vector<ResolvedAddress> parsed;
+    for (const string& address : addresses) {
+        ResolvedAddress addr;
+        if (!parse_literal(address, addr)) {
+            throw invalid_argument("Resolver override is not an IP literal: " + address);
+        }
+        parsed.push_back(addr);
+    }
+    ResolverOverrides& o = overrides();
+    lock_guard<mutex> lock(o.mtx);
+    o.hosts[host] = std::move(parsed);
+}
+
+void Resolver::clear_overrides() {
+    ResolverOverrides& o = overrides();
+    lock_guard<mutex> lock(o.mtx);
+    o.hosts.clear();
+}
+
+bool Resolver::find_override(const string& host, ResolveResult& result) {
+    ResolverOverrides& o = overrides();
+    lock_guard<mutex> lock(o.mtx);
+    auto it = o.hosts.find(host);
+    if (it == o.hosts.end()) return false;
+    result.addresses = it->second;
+    result.error.clear();
+    return true;
+}
+
+Resolver::State::State() {
+    if (pipe(notify_pipe) == -1) {
+        perror("pipe");
+        throw runtime_error("Failed to create resolver notify pipe");
+    }
+    for (int fd : notify_pipe) {
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+}
+
+Resolver::State::~State() {
+    close(notify_pipe[0]);
+    close(notify_pipe[1]);
+}
+
+Resolver::Resolver(chrono::seconds ttl) : state(make_shared<State>()), ttl(ttl) {}
+
+Resolver::~Resolver() {}
+
+int Resolver::notify_fd() const {
+    return state->notify_pipe[0];
+}
+
+ResolveResult Resolver::resolve_now(const string& host) {
+    ResolveResult result;
+    if (find_override(host, result)) return result;
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+
+    struct addrinfo* res = nullptr;
+    int rc = getaddrinfo(host.c_str(), nullptr, &hints, &res);
+    if (rc != 0) {
+        result.error = "No such host: " + host + " (" + gai_strerror(rc) + ")";
+        return result;
+    }
+
+    for (struct addrinfo* ai = res; ai != nullptr; ai = ai->ai_next) {
+        if (ai->ai_family != AF_INET && ai->ai_family != AF_INET6) continue;
+        ResolvedAddress addr;
+        memset(&addr.addr, 0, sizeof(addr.addr));
+        memcpy(&addr.addr, ai->ai_addr, ai->ai_addrlen);
+        addr.addr_len = ai->ai_addrlen;
+        addr.family = ai->ai_family;
+        result.addresses.push_back(addr);
+    }
+    freeaddrinfo(res);
+
+    if (result.addresses.empty()) {
+        result.error = "No usable addresses for host: " + host;
+    }
+    return result;
+}
+
+vector<ResolvedAddress> Resolver::connection_order(const vector<ResolvedAddress>& addresses) {
+    vector<const ResolvedAddress*> v6, v4;
+    for (const ResolvedAddress& address : addresses) {
+        (address.family == AF_INET6 ? v6 : v4).push_back(&address);
+    }
+
+    vector<ResolvedAddress> ordered;
+    ordered.reserve(addresses.size());
+    for (size_t i = 0; i < max(v6.size(), v4.size()); i++) {
+        if (i < v6.size()) ordered.push_back(*v6[i]);
+        if (i < v4.size()) ordered.push_back(*v4[i]);
+    }
+    return ordered;
+}
+
+bool Resolver::lookup(const string& host, ResolveResult& result) {
+    if (find_override(host, result)) return true;
+
+    auto now = chrono::steady_clock::now();
+    auto it = cache.find(host);
+    if (it != cache.end()) {
+        if (now < it->second.expires) {
+            result.addresses = it->second.addresses;
+            result.error.clear();
+            return true;
+        }
+        cache.erase(it);
+    }
+
+    // Literals never need a lookup
+    ResolvedAddress literal;
+    if (parse_literal(host, literal)) {
+        result.addresses = {literal};
+        result.error.clear();
+        return true;
+    }
+
+    if (in_flight.insert(host).second) {
+        shared_ptr<State> shared_state = state;
+        thread([shared_state, host]() {
+            ResolveResult answer = resolve_now(host);
+            {
+                lock_guard<mutex> lock(shared_state->mtx);
+                shared_state->completed.emplace_back(host, std::move(answer));
+            }
+            char byte = 1;
+            ssize_t ignored = write(shared_state->notify_pipe[1], &byte, 1);
+            (void)ignored;
+        }).detach();
+    }
+    return false;
+}
+
+vector<pair<string, ResolveResult>> Resolver::take_completed() {
+    char drain[64];
+    while (read(state->notify_pipe[0], drain, sizeof(drain)) > 0) {}
+
+    vector<pair<string, ResolveResult>> done;
+    {
+        lock_guard<mutex> lock(state->mtx);
+        done.swap(state->completed);
+    }
+
+    auto expires = chrono::steady_clock::now() + ttl;
+    for (const auto& [host, result] : done) {
+        in_flight.erase(host);
+        // Failures aren't cached so the next request retries the lookup
+        if (result.error.empty()) {
+            cache[host] = CacheEntry{result.addresses, expires};
+        }
+    }
+    return done;
+}
+
+void Resolver::clear_cache() {
+    cache.clear();
+}
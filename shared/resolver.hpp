@@ -0,0 +1,91 @@
+#ifndef RESOLVER_HPP
+#define RESOLVER_HPP
+
+#include <sys/socket.h>
+#include <netdb.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+// getaddrinfo doesn't surface record TTLs, so cached answers live this long
+static constexpr chrono::seconds DEFAULT_DNS_TTL{60};
+
+struct ResolvedAddress {
+    sockaddr_storage addr;
+    socklen_t addr_len;
+    int family;
+
+    // Copy of the address with the port filled in, ready for connect()
+    sockaddr_storage with_port(uint16_t port) const;
+    // "192.0.2.1" or "2001:db8::1", for logs
+    string to_string() const;
+};
+
+struct ResolveResult {
+    vector<ResolvedAddress> addresses;
+    string error;  // empty on success
+};
+
+// Resolves hostnames off the event loop. Lookups run getaddrinfo on a
+// background thread (coalesced per host) and signal completion through
+// notify_fd(), which the owner registers with its EventBackend for READ.
+// Answers are cached for the TTL, and overrides short-circuit resolution
+// entirely for tests.
+class Resolver {
+private:
+    struct CacheEntry {
+        vector<ResolvedAddress> addresses;
+        chrono::steady_clock::time_point expires;
+    };
+
+    // Shared with worker threads so a lookup that outlives the Resolver
+    // still has somewhere to write its answer
+    struct State {
+        mutex mtx;
+        vector<pair<string, ResolveResult>> completed;
+        int notify_pipe[2];
+        State();
+        ~State();
+    };
+
+    shared_ptr<State> state;
+    chrono::seconds ttl;
+    unordered_map<string, CacheEntry> cache;
+    unordered_set<string> in_flight;
+
+public:
+    Resolver(chrono::seconds ttl = DEFAULT_DNS_TTL);
+
+    // Fills `result` and returns true on a cache or override hit. Otherwise
+    // starts a background lookup and returns false; the answer shows up in
+    // take_completed() once notify_fd() becomes readable.
+    bool lookup(const string& host, ResolveResult& result);
+    int notify_fd() const;
+    vector<pair<string, ResolveResult>> take_completed();
+    void clear_cache();
+
+    // Synchronous getaddrinfo (overrides still apply) for blocking callers
+    static ResolveResult resolve_now(const string& host);
+
+    // The order to try connecting in (RFC 8305 section 4): families
+    // alternate, IPv6 first, each keeping getaddrinfo's order within it
+    static vector<ResolvedAddress> connection_order(const vector<ResolvedAddress>& addresses);
+
+    // Test hook: answer `host` with the literal `address` (IPv4 or IPv6)
+    // process-wide. CUSTOM_GIT_RESOLVE="host=addr,host2=addr2" does the same
+    // from the environment.
+    static void add_override(const string& host, const string& address);
+    static void add_override(const string& host, const vector<string>& addresses);
+    static void clear_overrides();
+    static bool find_override(const string& host, ResolveResult& result);
+
+    ~Resolver();
+};
+
+#endif // RESOLVER_HPP
@@ -0,0 +1,67 @@
+#include "sse_decoder.hpp"
+
+using namespace std;
+
+SSEDecoder::SSEDecoder(function<void(const SSEEvent&)> on_event) : on_event(std::move(on_event)) {}
+
+void SSEDecoder::feed(string_view fragment) {
+    size_t i = 0;
+    if (skip_lf && !fragment.empty()) {
+        if (fragment[0] == '\n') i = 1;
+        skip_lf = false;
+    }
+
+    while (i < fragment.size()) {
+        size_t eol = fragment.find_first_of("\r\n", i);
+        if (eol == string_view::npos) {
+            line.append(fragment.substr(i));
+            return;
+        }
+        line.append(fragment.substr(i, eol - i));
+        process_line();
+        line.clear();
+
+        i = eol + 1;
+        if (fragment[eol] == '\r') {
+            if (i == fragment.size()) {
+                skip_lf = true;
+            } else if (fragment[i] == '\n') {
+                i++;
+            }
+        }
+    }
+}
+
+void SSEDecoder::process_line() {
+    if (line.empty()) {
+        if (has_data) {
+            pending.id = last_event_id;
+            on_event(pending);
+        }
+        pending = SSEEvent();
+        has_data = false;
+        return;
+    }
+    if (line[0] == ':') return;
+
+    string_view field = line;
+    string_view value;
+    size_t colon = field.find(':');
+    if (colon != string_view::npos) {
+        value = field.substr(colon + 1);
+        if (!value.empty() && value[0] == ' ') value.remove_prefix(1);
+        field = field.substr(0, colon);
+    }
+
+    if (field == "data") {
+        if (has_data) pending.data += '\n';
+        pending.data.append(value);
+        has_data = true;
+    } else if (field == "event") {
+        pending.event = value;
+    } else if (field == "id") {
+        // An id containing NUL is ignored
+        if (value.find('\0') == string_view::npos) last_event_id = value;
+    }
+    // "retry" only matters to a reconnecting client, which this isn't
+}
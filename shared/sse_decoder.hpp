@@ -0,0 +1,37 @@
+#ifndef SSE_DECODER_HPP
+#define SSE_DECODER_HPP
+
+#include <functional>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+struct SSEEvent {
+    string event = "message";
+    string data;  // multiple data: lines joined with '\n'
+    string id;
+};
+
+// Incremental text/event-stream parser. Feed it body fragments as they
+// arrive, split anywhere (mid-line or between a CR and its LF); each event
+// is dispatched on the blank line that ends it. Comment lines (":...") and
+// events with no data are dropped, as the spec says.
+class SSEDecoder {
+private:
+    function<void(const SSEEvent&)> on_event;
+    string line;             // partial line carried between fragments
+    SSEEvent pending;
+    bool has_data = false;
+    bool skip_lf = false;    // last fragment ended on CR; a leading LF belongs to it
+    string last_event_id;
+
+    void process_line();
+
+public:
+    explicit SSEDecoder(function<void(const SSEEvent&)> on_event);
+
+    void feed(string_view fragment);
+};
+
+#endif // SSE_DECODER_HPP
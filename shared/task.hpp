@@ -0,0 +1,130 @@
+#ifndef TASK_HPP
+#define TASK_HPP
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+using namespace std;
+
+template <typename T = void>
+class Task;
+
+namespace task_detail {
+
+// When a task finishes, control passes straight to whoever co_awaited it
+// (symmetric transfer, so long chains don't grow the stack), or back to
+// the caller of start() for an outermost task. finished is set last: from
+// then on another thread may destroy the frame.
+struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+    template <typename Promise>
+    coroutine_handle<> await_suspend(coroutine_handle<Promise> handle) noexcept {
+        coroutine_handle<> continuation = handle.promise().continuation;
+        handle.promise().finished.store(true, memory_order_release);
+        return continuation ? continuation : noop_coroutine();
+    }
+    void await_resume() const noexcept {}
+};
+
+struct PromiseBase {
+    coroutine_handle<> continuation;
+    exception_ptr error;
+    atomic<bool> finished{false};
+
+    suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() { error = current_exception(); }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+    optional<T> value;
+
+    Task<T> get_return_object();
+    template <typename U>
+    void return_value(U&& result) { value.emplace(std::forward<U>(result)); }
+    T take() {
+        if (error) rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object();
+    void return_void() const noexcept {}
+    void take() const {
+        if (error) rethrow_exception(error);
+    }
+};
+
+}  // namespace task_detail
+
+// Lazily started coroutine returning T. Awaiting it from another coroutine
+// runs it and resumes the awaiter with its result (or rethrows its
+// exception). The outermost task is started with start(), runs until it
+// first suspends on I/O, and is finished by AsyncHTTPSConnection::run_loop();
+// result() then holds its value. A Task owns its frame, so it has to outlive
+// run_loop() while anything inside it is still waiting on a request.
+template <typename T>
+class [[nodiscard]] Task {
+public:
+    using promise_type = task_detail::Promise<T>;
+
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle) handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if (handle) handle.destroy();
+    }
+
+    void start() { handle.resume(); }
+    // Safe to call from any thread, while the task runs on another
+    bool done() const { return handle && handle.promise().finished.load(memory_order_acquire); }
+    // Only once done()
+    T result() { return handle.promise().take(); }
+
+    auto operator co_await() && noexcept {
+        struct Awaiter {
+            coroutine_handle<promise_type> handle;
+            bool await_ready() const noexcept { return false; }
+            coroutine_handle<> await_suspend(coroutine_handle<> awaiting) noexcept {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+            T await_resume() { return handle.promise().take(); }
+        };
+        return Awaiter{handle};
+    }
+
+private:
+    friend promise_type;
+    explicit Task(coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    coroutine_handle<promise_type> handle;
+};
+
+namespace task_detail {
+
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+    return Task<T>(coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() {
+    return Task<void>(coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+}  // namespace task_detail
+
+#endif // TASK_HPP
@@ -160,6 +160,24 @@ TEST_F(AsyncHTTPSConnectionTest, ContentLengthTransferMode) {
     event_loop.join();
 }
 
+TEST_F(AsyncHTTPSConnectionTest, ReadBufferReusesConsumedSpace) {
+    ReadBuffer buffer;
+    memcpy(buffer.prepare(8), "abcdefgh", 8);
+    buffer.commit(8);
+    buffer.consume(6);
+    EXPECT_EQ(string(buffer.begin(), buffer.size()), "gh");
+
+    // Sliding the two unread bytes forward makes room without growing
+    size_t capacity = buffer.data.size();
+    memcpy(buffer.prepare(6), "ijklmn", 6);
+    buffer.commit(6);
+    EXPECT_EQ(buffer.data.size(), capacity);
+    EXPECT_EQ(string(buffer.begin(), buffer.size()), "ghijklmn");
+
+    buffer.consume(8);
+    EXPECT_EQ(buffer.size(), 0);
+}
+
 // ============================================================================
 // RESPONSE SIZE TESTS
 // ============================================================================
@@ -354,6 +372,191 @@ TEST_F(AsyncHTTPSConnectionTest, DISABLED_MultipleConcurrentRequests) {
     event_loop.join();
 }
 
+// ============================================================================
+// CONNECTION POOL TESTS
+// ============================================================================
+
+TEST_F(AsyncHTTPSConnectionTest, KeepAliveConnectionIsPooledAndReused) {
+    // The idle pool only holds HTTP/1.1 connections
+    conn->set_http2_enabled(false);
+
+    // First request opens a connection that should be parked afterwards
+    promise<HTTPSResponse> first;
+    future<HTTPSResponse> first_fut = first.get_future();
+    conn->post_async("httpbin.org", "/post", R"({"n": 1})", {{"Content-Type", "application/json"}}, std::move(first));
+    conn->run_loop();
+
+    HTTPSResponse first_response = first_fut.get();
+    EXPECT_THAT(first_response.body, HasSubstr("httpbin.org"));
+    EXPECT_EQ(conn->idle_connection_count("httpbin.org"), 1) << "Connection should be returned to the pool";
+
+    // Second request should take the pooled connection instead of opening a new one
+    promise<HTTPSResponse> second;
+    future<HTTPSResponse> second_fut = second.get_future();
+    conn->post_async("httpbin.org", "/post", R"({"n": 2})", {{"Content-Type", "application/json"}}, std::move(second));
+    conn->run_loop();
+
+    HTTPSResponse second_response = second_fut.get();
+    EXPECT_THAT(second_response.body, HasSubstr("httpbin.org"));
+    EXPECT_EQ(conn->idle_connection_count("httpbin.org"), 1) << "Reused connection should be pooled again";
+}
+
+TEST_F(AsyncHTTPSConnectionTest, ConnectionCapQueuesExtraRequests) {
+    conn->set_http2_enabled(false);
+    conn->set_max_connections_per_host(1);
+
+    const int num_requests = 3;
+    vector<future<HTTPSResponse>> futures;
+    for (int i = 0; i < num_requests; ++i) {
+        promise<HTTPSResponse> prom;
+        futures.push_back(prom.get_future());
+        conn->post_async("httpbin.org", "/post", "{}", {{"Content-Type", "application/json"}}, std::move(prom));
+    }
+
+    thread event_loop([this]() {
+        conn->run_loop();
+    });
+
+    for (int i = 0; i < num_requests; ++i) {
+        auto status = futures[i].wait_for(chrono::seconds(30));
+        ASSERT_EQ(status, future_status::ready) << "Request " << i << " timed out";
+        EXPECT_THAT(futures[i].get().body, HasSubstr("httpbin.org"));
+    }
+
+    event_loop.join();
+    EXPECT_EQ(conn->idle_connection_count("httpbin.org"), 1) << "All requests should share one connection";
+}
+
+// ============================================================================
+// TIMEOUT TESTS
+// ============================================================================
+
+TEST_F(AsyncHTTPSConnectionTest, FirstByteTimeoutFailsWithTimeoutError) {
+    HTTPSTimeouts timeouts;
+    timeouts.first_byte = chrono::seconds(1);
+    conn->set_timeouts(timeouts);
+
+    promise<HTTPSResponse> prom;
+    future<HTTPSResponse> fut = prom.get_future();
+    conn->post_async("httpbin.org", "/delay/5", "{}", {{"Content-Type", "application/json"}}, std::move(prom));
+
+    auto start = chrono::steady_clock::now();
+    conn->run_loop();
+    EXPECT_LT(chrono::steady_clock::now() - start, chrono::seconds(4)) << "run_loop should return at the deadline";
+
+    try {
+        fut.get();
+        FAIL() << "Expected HTTPSTimeoutError";
+    } catch (const HTTPSTimeoutError& e) {
+        EXPECT_EQ(e.phase, "first byte");
+    }
+}
+
+TEST_F(AsyncHTTPSConnectionTest, ConnectTimeoutOnUnroutableAddress) {
+    // Packets to this address are dropped, so connect() never completes
+    Resolver::add_override("unroutable.test", "10.255.255.1");
+    HTTPSTimeouts timeouts;
+    timeouts.connect = chrono::milliseconds(500);
+    conn->set_timeouts(timeouts);
+    HTTPSRetryPolicy no_retries;
+    no_retries.max_attempts = 1;
+    conn->set_retry_policy(no_retries);
+
+    promise<HTTPSResponse> prom;
+    future<HTTPSResponse> fut = prom.get_future();
+    conn->post_async("unroutable.test", "/", "", {}, std::move(prom));
+    conn->run_loop();
+    Resolver::clear_overrides();
+
+    try {
+        fut.get();
+        FAIL() << "Expected HTTPSTimeoutError";
+    } catch (const HTTPSTimeoutError& e) {
+        EXPECT_EQ(e.phase, "connect");
+    }
+}
+
+// ============================================================================
+// RETRY TESTS
+// ============================================================================
+
+TEST_F(AsyncHTTPSConnectionTest, RetryBackoffDoublesAndCaps) {
+    HTTPSRetryPolicy policy;
+    policy.base_delay = chrono::milliseconds(100);
+    policy.max_delay = chrono::milliseconds(1000);
+
+    EXPECT_EQ(policy.backoff(2, 0.0), chrono::milliseconds(50));
+    EXPECT_EQ(policy.backoff(3, 0.0), chrono::milliseconds(100));
+    EXPECT_EQ(policy.backoff(4, 0.0), chrono::milliseconds(200));
+    EXPECT_LT(policy.backoff(4, 0.99), chrono::milliseconds(400));
+    EXPECT_EQ(policy.backoff(20, 0.0), chrono::milliseconds(500));
+    EXPECT_EQ(policy.backoff(100, 0.0), chrono::milliseconds(500));
+}
+
+TEST_F(AsyncHTTPSConnectionTest, ServerErrorsAreRetriedThenReturned) {
+    HTTPSRetryPolicy policy;
+    policy.max_attempts = 3;
+    policy.base_delay = chrono::milliseconds(200);
+    conn->set_retry_policy(policy);
+
+    promise<HTTPSResponse> prom;
+    future<HTTPSResponse> fut = prom.get_future();
+    auto start = chrono::steady_clock::now();
+    conn->post_async("httpbin.org", "/status/503", "", {}, std::move(prom));
+    conn->run_loop();
+
+    // Two backoffs of at least 100ms and 200ms before the last 503 is handed back
+    EXPECT_GE(chrono::steady_clock::now() - start, chrono::milliseconds(300));
+    HTTPSResponse response = fut.get();
+    EXPECT_EQ(response.status, 503);
+}
+
+// ============================================================================
+// HTTP/2 TESTS
+// ============================================================================
+
+TEST_F(AsyncHTTPSConnectionTest, HTTP2RequestsShareOneConnection) {
+    // nghttp2.org always negotiates h2, so every request should become a
+    // stream on the first connection instead of opening its own
+    const int num_requests = 20;
+    vector<future<HTTPSResponse>> futures;
+    for (int i = 0; i < num_requests; ++i) {
+        promise<HTTPSResponse> prom;
+        futures.push_back(prom.get_future());
+        conn->post_async("nghttp2.org", "/httpbin/post", R"({"n": )" + to_string(i) + "}",
+                         {{"Content-Type", "application/json"}}, std::move(prom));
+    }
+
+    thread event_loop([this]() {
+        conn->run_loop();
+    });
+
+    for (int i = 0; i < num_requests; ++i) {
+        auto status = futures[i].wait_for(chrono::seconds(30));
+        ASSERT_EQ(status, future_status::ready) << "Request " << i << " timed out";
+        HTTPSResponse response = futures[i].get();
+        EXPECT_THAT(response.headers, ::testing::StartsWith("http/2 200"));
+        EXPECT_THAT(response.body, HasSubstr("\"n\": " + to_string(i)));
+    }
+
+    event_loop.join();
+    EXPECT_EQ(conn->http2_connection_count("nghttp2.org"), 1);
+    EXPECT_EQ(conn->idle_connection_count("nghttp2.org"), 0) << "HTTP/2 connections aren't pooled as HTTP/1.1";
+}
+
+TEST_F(AsyncHTTPSConnectionTest, HTTP2DisabledFallsBackToHTTP1) {
+    conn->set_http2_enabled(false);
+
+    promise<HTTPSResponse> prom;
+    future<HTTPSResponse> fut = prom.get_future();
+    conn->post_async("nghttp2.org", "/httpbin/post", "{}", {{"Content-Type", "application/json"}}, std::move(prom));
+    conn->run_loop();
+
+    HTTPSResponse response = fut.get();
+    EXPECT_THAT(response.headers, ::testing::StartsWith("http/1.1 200"));
+    EXPECT_EQ(conn->http2_connection_count("nghttp2.org"), 0);
+}
+
 // ============================================================================
 // SSL/TLS SPECIFIC TESTS
 // ============================================================================
@@ -386,6 +589,30 @@ TEST_F(AsyncHTTPSConnectionTest, TLSHandshakeSuccess) {
     event_loop.join();
 }
 
+TEST_F(AsyncHTTPSConnectionTest, NewConnectionResumesTLSSession) {
+    // Prime the process-wide session cache with one full handshake
+    promise<HTTPSResponse> first;
+    future<HTTPSResponse> first_fut = first.get_future();
+    conn->post_async("httpbin.org", "/get", "", {}, std::move(first));
+    conn->run_loop();
+    first_fut.get();
+
+    TLSHandshakeStats before = conn->handshake_stats();
+
+    // A second client has an empty pool, so it must open a new socket; the
+    // shared SSL_CTX should let that handshake resume the cached session
+    AsyncHTTPSConnection other;
+    promise<HTTPSResponse> second;
+    future<HTTPSResponse> second_fut = second.get_future();
+    other.post_async("httpbin.org", "/get", "", {}, std::move(second));
+    other.run_loop();
+    second_fut.get();
+
+    TLSHandshakeStats after = other.handshake_stats();
+    EXPECT_EQ(after.resumed, before.resumed + 1) << "Second connection should resume the TLS session";
+    EXPECT_EQ(after.full, before.full) << "No additional full handshake expected";
+}
+
 // ============================================================================
 // EDGE CASE TESTS
 // ============================================================================
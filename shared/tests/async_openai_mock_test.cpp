@@ -0,0 +1,618 @@
+/**
+ * Offline Tests for AsyncOpenAIAPI
+ *
+ * The same client paths as async_openai_api_test, against a MockOpenAIServer
+ * on localhost instead of the live API, so they run anywhere and can inject
+ * failures the real service only produces under load.
+ */
+
+#include "async_openai_api.hpp"
+#include "mock_openai_server.hpp"
+#include "utils.hpp"
+#include <gtest/gtest.h>
+#include <cmath>
+#include <thread>
+
+using namespace std;
+using json = nlohmann::json;
+
+class AsyncOpenAIMockTest : public ::testing::Test {
+protected:
+    AsyncHTTPSConnection conn;
+    AsyncOpenAIAPI api{conn, "mock-key"};
+
+    void point_at(const MockOpenAIServer& server, bool tls = true) {
+        api.set_endpoint(tls ? "https" : "http", "127.0.0.1", server.port());
+    }
+};
+
+TEST_F(AsyncOpenAIMockTest, EmbeddingOverTLS) {
+    MockOpenAIServer server;
+    point_at(server);
+
+    future<HTTPSResponse> response_future = api.async_embedding("int main() {}");
+    api.run_requests();
+    HTTPSResponse response = response_future.get();
+
+    ASSERT_EQ(response.status, 200);
+    vector<float> embedding = parse_embedding(response.body);
+    ASSERT_EQ(embedding.size(), 1536);
+    float norm = 0;
+    for (float x : embedding) norm += x * x;
+    EXPECT_NEAR(sqrt(norm), 1.0f, 1e-4);
+}
+
+TEST_F(AsyncOpenAIMockTest, EmbeddingsArriveAsBase64AndDecodeToTheSameFloats) {
+    MockOpenAIServer server;
+    point_at(server);
+
+    future<HTTPSResponse> encoded_future = api.async_embedding("same text");
+    // The same request without encoding_format gets a JSON number array
+    promise<HTTPSResponse> floats_promise;
+    future<HTTPSResponse> floats_future = floats_promise.get_future();
+    json float_request = {{"model", EMBEDDING_MODEL}, {"input", "same text"}};
+    conn.post_async(server.origin(), "/v1/embeddings", float_request.dump(),
+                    {{"Content-Type", "application/json"}}, std::move(floats_promise));
+    api.run_requests();
+
+    HTTPSResponse encoded = encoded_future.get();
+    HTTPSResponse floats = floats_future.get();
+    EXPECT_TRUE(json::parse(encoded.body)["data"][0]["embedding"].is_string());
+    EXPECT_TRUE(json::parse(floats.body)["data"][0]["embedding"].is_array());
+    EXPECT_LT(encoded.body.size(), floats.body.size() / 2);
+
+    vector<float> decoded = parse_embedding(encoded.body);
+    ASSERT_EQ(decoded.size(), 1536);
+    EXPECT_EQ(decoded, parse_embedding(floats.body));
+}
+
+TEST_F(AsyncOpenAIMockTest, PlaintextChunkedGzipBodiesMatchPlainOnes) {
+    MockServerOptions options;
+    options.tls = false;
+    options.chunked = true;
+    options.gzip = true;
+    MockOpenAIServer compressed(options);
+    MockOpenAIServer plain;
+
+    point_at(compressed, false);
+    future<HTTPSResponse> from_compressed = api.async_embedding("same text");
+    point_at(plain);
+    future<HTTPSResponse> from_plain = api.async_embedding("same text");
+    api.run_requests();
+
+    HTTPSResponse a = from_compressed.get();
+    HTTPSResponse b = from_plain.get();
+    EXPECT_NE(a.headers.find("content-encoding: gzip"), string::npos);
+    EXPECT_EQ(parse_embedding(a.body), parse_embedding(b.body));
+}
+
+// Proxies add headers whose names end in a framing header's name. Taking
+// one for the real thing misreads the body, and on a pooled connection the
+// rest of it would then be parsed as the next response.
+TEST_F(AsyncOpenAIMockTest, FramingIgnoresHeadersThatOnlyEndWithTheName) {
+    MockServerOptions options;
+    options.tls = false;
+    options.extra_headers = "X-Upstream-Content-Length: 0\r\n"
+                            "X-Forwarded-Transfer-Encoding: chunked\r\n"
+                            "X-Proxy-Connection: close\r\n";
+    MockOpenAIServer server(options);
+    point_at(server, false);
+
+    for (int i = 0; i < 3; i++) {
+        future<HTTPSResponse> response_future = api.async_embedding("input " + to_string(i));
+        api.run_requests();
+        HTTPSResponse response = response_future.get();
+        ASSERT_EQ(response.status, 200);
+        EXPECT_EQ(parse_embedding(response.body).size(), 1536);
+    }
+    EXPECT_EQ(server.stats().connections, 1);
+}
+
+TEST_F(AsyncOpenAIMockTest, InjectedErrorsAreRetried) {
+    MockServerOptions options;
+    options.fail_first = 2;
+    options.error_status = 429;
+    options.retry_after = chrono::milliseconds(10);
+    MockOpenAIServer server(options);
+    point_at(server);
+    HTTPSRetryPolicy policy;
+    policy.base_delay = chrono::milliseconds(5);
+    conn.set_retry_policy(policy);
+
+    future<HTTPSResponse> response_future = api.async_embedding("retry me");
+    api.run_requests();
+
+    EXPECT_EQ(response_future.get().status, 200);
+    EXPECT_EQ(server.stats().requests, 3);
+}
+
+// Far bigger than the socket buffers, so the client is still writing when
+// the server hangs up (embedding inputs are truncated, so post directly)
+static future<HTTPSResponse> post_large_upload(AsyncHTTPSConnection& conn, const MockOpenAIServer& server) {
+    promise<HTTPSResponse> response;
+    future<HTTPSResponse> response_future = response.get_future();
+    json body = {{"model", EMBEDDING_MODEL}, {"input", string(4 << 20, 'x')}};
+    conn.post_async(server.origin(), "/v1/embeddings", body.dump(), {{"Content-Type", "application/json"}}, std::move(response));
+    return response_future;
+}
+
+// A server that hangs up partway through a large upload makes the next
+// write fail with EPIPE. Over TLS that has to surface as a failed write,
+// not as SIGPIPE killing the process, so the request can be retried.
+TEST_F(AsyncOpenAIMockTest, ServerClosingDuringUploadIsRetried) {
+    MockServerOptions options;
+    options.drop_uploads = 1;
+    MockOpenAIServer server(options);
+    point_at(server);
+    HTTPSRetryPolicy policy;
+    policy.base_delay = chrono::milliseconds(5);
+    conn.set_retry_policy(policy);
+
+    future<HTTPSResponse> response_future = post_large_upload(conn, server);
+    api.run_requests();
+
+    EXPECT_EQ(response_future.get().status, 200);
+    EXPECT_EQ(server.stats().connections, 2);
+}
+
+TEST_F(AsyncOpenAIMockTest, ServerClosingDuringEveryUploadFailsCleanly) {
+    MockServerOptions options;
+    options.drop_uploads = 100;
+    MockOpenAIServer server(options);
+    point_at(server);
+    HTTPSRetryPolicy policy;
+    policy.max_attempts = 2;
+    policy.base_delay = chrono::milliseconds(5);
+    conn.set_retry_policy(policy);
+
+    future<HTTPSResponse> response_future = post_large_upload(conn, server);
+    api.run_requests();
+
+    EXPECT_THROW(response_future.get(), runtime_error);
+}
+
+TEST_F(AsyncOpenAIMockTest, ManyConcurrentRequestsShareFewConnections) {
+    MockServerOptions options;
+    options.latency = chrono::milliseconds(5);
+    MockOpenAIServer server(options);
+    point_at(server);
+
+    vector<future<HTTPSResponse>> futures;
+    for (int i = 0; i < 500; i++) {
+        futures.push_back(api.async_embedding("input " + to_string(i)));
+    }
+    api.run_requests();
+
+    for (auto& f : futures) {
+        EXPECT_EQ(f.get().status, 200);
+    }
+    EXPECT_LE(server.stats().connections, DEFAULT_MAX_CONNECTIONS_PER_HOST);
+}
+
+TEST_F(AsyncOpenAIMockTest, StreamedChatDeliversTokens) {
+    MockOpenAIServer server;
+    point_at(server);
+
+    vector<string> tokens;
+    json messages = {{{"role", "user"}, {"content", "hi"}}};
+    future<HTTPSResponse> response_future = api.async_chat_stream(messages, [&](const string& token) { tokens.push_back(token); });
+    api.run_requests();
+
+    EXPECT_EQ(response_future.get().status, 200);
+    EXPECT_GT(tokens.size(), 1);
+    string message;
+    for (const string& token : tokens) message += token;
+    EXPECT_EQ(message, "add mock server for offline load tests");
+}
+
+TEST_F(AsyncOpenAIMockTest, ResponsesCarryTimingBreakdown) {
+    MockServerOptions options;
+    options.latency = chrono::milliseconds(20);
+    MockOpenAIServer server(options);
+    point_at(server);
+
+    future<HTTPSResponse> first = api.async_embedding("first");
+    api.run_requests();
+    future<HTTPSResponse> second = api.async_embedding("second");
+    api.run_requests();
+
+    HTTPSResponse fresh = first.get();
+    HTTPSResponse pooled = second.get();
+    ASSERT_EQ(fresh.status, 200);
+    EXPECT_EQ(fresh.timeline.front().state, QUEUED);
+    EXPECT_EQ(fresh.timeline.back().state, DONE);
+    EXPECT_FALSE(fresh.reused);
+    EXPECT_TRUE(pooled.reused);
+    EXPECT_GT(fresh.phases().tls.count(), 0);
+    EXPECT_EQ(pooled.phases().tls.count(), 0);
+    // The server's 20ms runs from its read; the wait phase only starts once
+    // our write returns, which a busy scheduler can delay by a few ms
+    EXPECT_GE(pooled.phases().wait, chrono::milliseconds(15));
+    EXPECT_GT(pooled.bytes_received, 0);
+
+    const LatencyStats& stats = conn.latency_stats();
+    EXPECT_EQ(stats.responses, 2);
+    EXPECT_EQ(stats.reused, 1);
+    EXPECT_EQ(stats.statuses.at(200), 2);
+}
+
+TEST_F(AsyncOpenAIMockTest, AwaitedRequestsRunInsideOneTask) {
+    MockOpenAIServer server;
+    point_at(server);
+
+    // Embeds, then asks for a message, one after the other within a task
+    auto embed_then_chat = [](AsyncOpenAIAPI& api) -> Task<pair<size_t, int>> {
+        HTTPSResponse embedded = co_await api.embedding("int main() {}");
+        json messages = {{{"role", "user"}, {"content", "hi"}}};
+        HTTPSResponse chatted = co_await api.chat(messages);
+        co_return pair<size_t, int>{parse_embedding(embedded.body).size(), chatted.status};
+    };
+    Task<pair<size_t, int>> task = embed_then_chat(api);
+    task.start();
+    EXPECT_FALSE(task.done());
+    api.run_requests();
+
+    ASSERT_TRUE(task.done());
+    auto [dimensions, chat_status] = task.result();
+    EXPECT_EQ(dimensions, 1536);
+    EXPECT_EQ(chat_status, 200);
+    EXPECT_EQ(server.stats().connections, 1);
+}
+
+TEST_F(AsyncOpenAIMockTest, ManyTasksShareTheLoop) {
+    MockServerOptions options;
+    options.latency = chrono::milliseconds(5);
+    MockOpenAIServer server(options);
+    point_at(server);
+
+    int finished = 0;
+    auto embed = [](AsyncOpenAIAPI& api, int i, int& finished) -> Task<> {
+        HTTPSResponse response = co_await api.embedding("input " + to_string(i));
+        EXPECT_EQ(response.status, 200);
+        finished++;
+    };
+    vector<Task<>> tasks;
+    for (int i = 0; i < 200; i++) {
+        tasks.push_back(embed(api, i, finished));
+        tasks.back().start();
+    }
+    api.run_requests();
+
+    EXPECT_EQ(finished, 200);
+    EXPECT_EQ(server.stats().requests, 200);
+}
+
+TEST_F(AsyncOpenAIMockTest, FailuresAreThrownFromCoAwait) {
+    // Nothing listens on the port of a server that has shut down
+    uint16_t port;
+    {
+        MockOpenAIServer server;
+        port = server.port();
+    }
+    api.set_endpoint("https", "127.0.0.1", port);
+    HTTPSRetryPolicy policy;
+    policy.max_attempts = 1;
+    conn.set_retry_policy(policy);
+
+    auto embed = [](AsyncOpenAIAPI& api) -> Task<string> {
+        try {
+            co_await api.embedding("nowhere");
+        } catch (const exception& e) {
+            co_return string("caught: ") + e.what();
+        }
+        co_return string("no error");
+    };
+    Task<string> task = embed(api);
+    task.start();
+    api.run_requests();
+
+    EXPECT_EQ(task.result().rfind("caught: ", 0), 0);
+}
+
+TEST_F(AsyncOpenAIMockTest, CommitMessageTaskStreamsTokens) {
+    MockOpenAIServer server;
+    point_at(server);
+
+    string streamed;
+    Task<string> task = async_generate_commit_message(api, "Insertion: +int x;\n",
+                                                      [&](const string& token) { streamed += token; });
+    task.start();
+    api.run_requests();
+
+    EXPECT_EQ(task.result(), "add mock server for offline load tests");
+    EXPECT_EQ(streamed, "add mock server for offline load tests");
+}
+
+TEST_F(AsyncOpenAIMockTest, IOThreadTakesRequestsFromManyThreads) {
+    MockServerOptions options;
+    options.latency = chrono::milliseconds(2);
+    MockOpenAIServer server(options);
+    point_at(server);
+    conn.start_io_thread();
+
+    constexpr int producers = 4;
+    constexpr int per_producer = 50;
+    vector<vector<future<HTTPSResponse>>> futures(producers);
+    vector<thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([this, &futures, p]() {
+            for (int i = 0; i < per_producer; i++) {
+                futures[p].push_back(api.async_embedding("thread " + to_string(p) + " input " + to_string(i)));
+            }
+        });
+    }
+    for (thread& t : threads) t.join();
+    api.run_requests();
+
+    for (auto& from_thread : futures) {
+        for (auto& f : from_thread) {
+            ASSERT_EQ(f.wait_for(chrono::seconds(0)), future_status::ready);
+            EXPECT_EQ(f.get().status, 200);
+        }
+    }
+    EXPECT_EQ(server.stats().requests, producers * per_producer);
+    EXPECT_LE(server.stats().connections, DEFAULT_MAX_CONNECTIONS_PER_HOST);
+}
+
+TEST_F(AsyncOpenAIMockTest, IOThreadStartsRequestsWithoutRunLoop) {
+    MockOpenAIServer server;
+    point_at(server);
+    conn.start_io_thread();
+
+    // The response arrives while this thread only waits on the future
+    future<HTTPSResponse> response_future = api.async_embedding("background");
+    ASSERT_EQ(response_future.wait_for(chrono::seconds(10)), future_status::ready);
+    EXPECT_EQ(response_future.get().status, 200);
+
+    // Coroutines started here carry on on the I/O thread
+    auto twice = [](AsyncOpenAIAPI& api) -> Task<int> {
+        HTTPSResponse first = co_await api.embedding("one");
+        HTTPSResponse second = co_await api.embedding("two");
+        co_return first.status + second.status;
+    };
+    Task<int> task = twice(api);
+    task.start();
+    api.run_requests();
+    ASSERT_TRUE(task.done());
+    EXPECT_EQ(task.result(), 400);
+
+    conn.stop_io_thread();
+    EXPECT_EQ(conn.latency_stats().responses, 3);
+}
+
+TEST_F(AsyncOpenAIMockTest, StoppingIOThreadFinishesOutstandingRequests) {
+    MockServerOptions options;
+    options.latency = chrono::milliseconds(20);
+    MockOpenAIServer server(options);
+    point_at(server);
+    conn.start_io_thread();
+
+    vector<future<HTTPSResponse>> futures;
+    for (int i = 0; i < 20; i++) {
+        futures.push_back(api.async_embedding("input " + to_string(i)));
+    }
+    conn.stop_io_thread();
+
+    for (auto& f : futures) {
+        ASSERT_EQ(f.wait_for(chrono::seconds(0)), future_status::ready);
+        EXPECT_EQ(f.get().status, 200);
+    }
+}
+
+TEST_F(AsyncOpenAIMockTest, RacesPastAnAddressThatNeverConnects) {
+    MockOpenAIServer server;
+    // 100::/64 is discard-only, so the IPv6 attempt hangs; IPv4 starts
+    // CONNECTION_ATTEMPT_DELAY later and wins
+    Resolver::add_override("dual-stack.test", vector<string>{"100::1", "127.0.0.1"});
+    api.set_endpoint("https", "dual-stack.test", server.port());
+    HTTPSTimeouts timeouts;
+    timeouts.connect = chrono::seconds(5);
+    conn.set_timeouts(timeouts);
+
+    auto start = chrono::steady_clock::now();
+    future<HTTPSResponse> response_future = api.async_embedding("race");
+    api.run_requests();
+    Resolver::clear_overrides();
+
+    HTTPSResponse response = response_future.get();
+    EXPECT_EQ(response.status, 200);
+    EXPECT_GE(response.phases().connect, CONNECTION_ATTEMPT_DELAY);
+    EXPECT_LT(chrono::steady_clock::now() - start, timeouts.connect / 2);
+    EXPECT_EQ(server.stats().connections, 1);
+}
+
+TEST_F(AsyncOpenAIMockTest, RefusedAddressFallsThroughWithoutWaiting) {
+    MockOpenAIServer server;
+    // The mock server only listens on IPv4, so ::1 refuses straight away
+    Resolver::add_override("dual-stack.test", vector<string>{"127.0.0.1", "::1"});
+    api.set_endpoint("https", "dual-stack.test", server.port());
+
+    future<HTTPSResponse> response_future = api.async_embedding("refused");
+    api.run_requests();
+    Resolver::clear_overrides();
+
+    HTTPSResponse response = response_future.get();
+    EXPECT_EQ(response.status, 200);
+    EXPECT_LT(response.phases().connect, CONNECTION_ATTEMPT_DELAY);
+}
+
+TEST_F(AsyncOpenAIMockTest, EmbeddingBatchMapsVectorsBackByIndex) {
+    MockServerOptions options;
+    options.shuffle_embeddings = true;
+    MockOpenAIServer batched(options);
+    MockOpenAIServer single;
+
+    vector<string> texts;
+    for (int i = 0; i < 10; i++) texts.push_back("chunk " + to_string(i));
+
+    point_at(batched);
+    EmbeddingBatchLimits limits;
+    limits.max_inputs = 4;
+    vector<future<vector<float>>> embeddings = api.async_embedding_batch(texts, limits);
+    point_at(single);
+    vector<future<HTTPSResponse>> expected;
+    for (const string& text : texts) expected.push_back(api.async_embedding(text));
+    api.run_requests();
+
+    ASSERT_EQ(embeddings.size(), texts.size());
+    for (size_t i = 0; i < texts.size(); i++) {
+        EXPECT_EQ(embeddings[i].get(), parse_embedding(expected[i].get().body)) << texts[i];
+    }
+    EXPECT_EQ(batched.stats().requests, 3);
+}
+
+TEST_F(AsyncOpenAIMockTest, EmbeddingBatchRespectsTokenLimit) {
+    MockOpenAIServer server;
+    point_at(server);
+
+    // Each input costs at most 100 tokens, so two fit under 250
+    vector<string> texts(5, string(100, 'x'));
+    EmbeddingBatchLimits limits;
+    limits.max_tokens = 250;
+    vector<future<vector<float>>> embeddings = api.async_embedding_batch(texts, limits);
+    api.run_requests();
+
+    for (auto& embedding : embeddings) {
+        EXPECT_EQ(embedding.get().size(), 1536);
+    }
+    EXPECT_EQ(server.stats().requests, 3);
+}
+
+// Every byte, plus "xx" so a run of x's costs a token per two bytes
+static shared_ptr<const BPETokenizer> pairs_tokenizer() {
+    TokenRanks ranks;
+    for (int byte = 0; byte < 256; byte++) ranks.emplace(string(1, char(byte)), byte);
+    ranks.emplace("xx", 256);
+    return make_shared<BPETokenizer>(std::move(ranks), Pretokenizer::CL100K);
+}
+
+TEST_F(AsyncOpenAIMockTest, TokenizerPacksBatchesByExactTokenCount) {
+    MockOpenAIServer server;
+    point_at(server);
+    api.set_tokenizer(pairs_tokenizer());
+
+    // The same inputs as above, but counted at 50 tokens each all five fit
+    vector<string> texts(5, string(100, 'x'));
+    EmbeddingBatchLimits limits;
+    limits.max_tokens = 250;
+    vector<future<vector<float>>> embeddings = api.async_embedding_batch(texts, limits);
+    api.run_requests();
+
+    for (auto& embedding : embeddings) {
+        EXPECT_EQ(embedding.get().size(), 1536);
+    }
+    EXPECT_EQ(server.stats().requests, 1);
+    EXPECT_EQ(api.embedding_tokens_sent(), 250);
+}
+
+TEST_F(AsyncOpenAIMockTest, TokenizerTruncatesToTheModelLimit) {
+    string text(20000, 'x');
+    size_t tokens = 0;
+    EXPECT_EQ(api.embedding_input(text, &tokens).size(), MAX_EMBEDDING_BYTES);
+    EXPECT_EQ(tokens, MAX_EMBEDDING_BYTES);
+
+    api.set_tokenizer(pairs_tokenizer());
+    EXPECT_EQ(api.embedding_input(text, &tokens).size(), 2 * MAX_EMBEDDING_TOKENS);
+    EXPECT_EQ(tokens, MAX_EMBEDDING_TOKENS);
+    EXPECT_EQ(api.embedding_input("short", &tokens), "short");
+    EXPECT_EQ(tokens, 5);
+}
+
+// The way gcommit sends them: batch after batch with the I/O thread
+// running and no run_requests() in between, so each call drops the batches
+// that thread has finished
+TEST_F(AsyncOpenAIMockTest, EmbeddingBatchesSentFromTheIOThreadComplete) {
+    MockServerOptions options;
+    options.latency = chrono::milliseconds(1);
+    MockOpenAIServer server(options);
+    point_at(server);
+    conn.start_io_thread();
+
+    vector<future<vector<float>>> embeddings;
+    for (int i = 0; i < 50; i++) {
+        for (auto& embedding : api.async_embedding_batch({"batch " + to_string(i)})) {
+            embeddings.push_back(std::move(embedding));
+        }
+        if (i % 2 == 0) embeddings.back().wait();
+    }
+    for (auto& embedding : embeddings) {
+        ASSERT_EQ(embedding.wait_for(chrono::seconds(10)), future_status::ready);
+        EXPECT_EQ(embedding.get().size(), 1536);
+    }
+    conn.stop_io_thread();
+    EXPECT_EQ(server.stats().requests, 50);
+}
+
+TEST_F(AsyncOpenAIMockTest, EmbeddingBatchFailureReachesEveryInput) {
+    MockServerOptions options;
+    options.fail_first = 100;
+    options.error_status = 400;  // not retried
+    MockOpenAIServer server(options);
+    point_at(server);
+
+    vector<future<vector<float>>> embeddings = api.async_embedding_batch({"a", "b", "c"});
+    api.run_requests();
+
+    for (auto& embedding : embeddings) {
+        try {
+            embedding.get();
+            FAIL() << "Expected the request's error";
+        } catch (const runtime_error& e) {
+            EXPECT_EQ(string(e.what()).rfind("HTTP 400", 0), 0) << e.what();
+        }
+    }
+    EXPECT_EQ(server.stats().requests, 1);
+}
+
+TEST_F(AsyncOpenAIMockTest, EmbeddingBatchAsksForReducedDimensions) {
+    MockOpenAIServer server;
+    point_at(server);
+    api.set_embedding_model(EMBEDDING_MODEL, 256);
+
+    vector<future<vector<float>>> embeddings = api.async_embedding_batch({"int a;", "int b;"});
+    api.run_requests();
+
+    for (auto& embedding : embeddings) {
+        vector<float> values = embedding.get();
+        ASSERT_EQ(values.size(), 256);
+        float norm = 0;
+        for (float x : values) norm += x * x;
+        EXPECT_NEAR(sqrt(norm), 1.0f, 1e-4);
+    }
+}
+
+// Without set_embedding_model() no dimensions are sent, so a model that
+// can't shorten its vectors (and would reject the field) still works
+TEST_F(AsyncOpenAIMockTest, EmbeddingDefaultsToTheModelsOwnLength) {
+    MockServerOptions options;
+    options.embedding_dimensions = 3072;
+    MockOpenAIServer server(options);
+    point_at(server);
+    EXPECT_EQ(api.embedding_dimensions(), 0);
+
+    vector<future<vector<float>>> embeddings = api.async_embedding_batch({"int a;"});
+    api.run_requests();
+    EXPECT_EQ(embeddings[0].get().size(), 3072);
+}
+
+TEST(EmbeddingModelTest, OnlyTextEmbedding3TakesDimensions) {
+    EXPECT_TRUE(embedding_model_takes_dimensions(EMBEDDING_MODEL));
+    EXPECT_TRUE(embedding_model_takes_dimensions("text-embedding-3-large"));
+    EXPECT_FALSE(embedding_model_takes_dimensions("text-embedding-ada-002"));
+}
+
+TEST(NormalizeEmbeddingTest, TruncatesAndRestoresUnitLength) {
+    vector<float> embedding = {0.6f, 0.0f, 0.8f, 0.0f};
+    normalize_embedding(embedding, 2);
+    ASSERT_EQ(embedding.size(), 2);
+    EXPECT_FLOAT_EQ(embedding[0], 1.0f);
+    EXPECT_FLOAT_EQ(embedding[1], 0.0f);
+
+    // Already short enough, or no limit: only rescaled
+    vector<float> longer = {3.0f, 4.0f};
+    normalize_embedding(longer, 8);
+    EXPECT_EQ(longer, (vector<float>{0.6f, 0.8f}));
+    vector<float> zero = {0.0f, 0.0f};
+    normalize_embedding(zero);
+    EXPECT_EQ(zero, (vector<float>{0.0f, 0.0f}));
+}
@@ -0,0 +1,103 @@
+/**
+ * Unit Tests for base64 decoding
+ *
+ * Inputs long enough to go through the vector path are checked against the
+ * bytewise decode, including invalid characters at every position of a
+ * block so both paths have to reject them.
+ */
+
+#include "base64.hpp"
+#include <gtest/gtest.h>
+#include <random>
+
+using namespace std;
+
+static vector<unsigned char> random_bytes(size_t size, unsigned seed) {
+    mt19937 rng(seed);
+    vector<unsigned char> bytes(size);
+    for (unsigned char& byte : bytes) byte = rng();
+    return bytes;
+}
+
+static bool decode(const string& text, vector<unsigned char>& out) {
+    size_t size = base64_decoded_size(text.data(), text.size());
+    if (size == SIZE_MAX) return false;
+    out.assign(size, 0);
+    return base64_decode(text.data(), text.size(), out.data());
+}
+
+TEST(Base64Test, KnownVectors) {
+    EXPECT_EQ(base64_encode("", 0), "");
+    EXPECT_EQ(base64_encode("f", 1), "Zg==");
+    EXPECT_EQ(base64_encode("fo", 2), "Zm8=");
+    EXPECT_EQ(base64_encode("foo", 3), "Zm9v");
+    EXPECT_EQ(base64_encode("foobar", 6), "Zm9vYmFy");
+
+    vector<unsigned char> out;
+    ASSERT_TRUE(decode("Zm9vYg==", out));
+    EXPECT_EQ(string(out.begin(), out.end()), "foob");
+    ASSERT_TRUE(decode("Zm9vYmE=", out));
+    EXPECT_EQ(string(out.begin(), out.end()), "fooba");
+    ASSERT_TRUE(decode("", out));
+    EXPECT_TRUE(out.empty());
+}
+
+TEST(Base64Test, RoundTripsEveryLengthAcrossBlockBoundaries) {
+    // Up to a few vector blocks plus every tail length
+    for (size_t size = 0; size <= 200; size++) {
+        vector<unsigned char> bytes = random_bytes(size, size);
+        string text = base64_encode(bytes.data(), bytes.size());
+        vector<unsigned char> out;
+        ASSERT_TRUE(decode(text, out)) << size;
+        EXPECT_EQ(out, bytes) << size;
+    }
+}
+
+TEST(Base64Test, AllSixtyFourCharactersDecode) {
+    // Each character of the alphabet in every position of a long input
+    string alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    string text;
+    for (int shift = 0; shift < 4; shift++) {
+        text += alphabet.substr(shift) + alphabet.substr(0, shift);
+    }
+    vector<unsigned char> out;
+    ASSERT_TRUE(decode(text, out));
+    EXPECT_EQ(base64_encode(out.data(), out.size()), text);
+}
+
+TEST(Base64Test, RejectsCharactersOutsideTheAlphabet) {
+    vector<unsigned char> bytes = random_bytes(300, 7);
+    string valid = base64_encode(bytes.data(), bytes.size());
+    vector<unsigned char> out;
+
+    for (char bad : {'-', '_', '.', ' ', '\n', '=', '\0', '\x80', '\xff', '@', '[', '`', '{'}) {
+        for (size_t at = 0; at < valid.size() - 4; at += 7) {
+            string text = valid;
+            text[at] = bad;
+            EXPECT_FALSE(decode(text, out)) << "char " << int((unsigned char)bad) << " at " << at;
+        }
+    }
+}
+
+TEST(Base64Test, RejectsBadLengthAndPadding) {
+    vector<unsigned char> out;
+    EXPECT_FALSE(decode("Zm9", out));
+    EXPECT_FALSE(decode("Zm9vY", out));
+    EXPECT_FALSE(decode("Z===", out));
+    EXPECT_FALSE(decode("Zg==Zm9v", out));
+    EXPECT_FALSE(decode("Zm=v", out));
+}
+
+TEST(Base64Test, DecodesFloatsInPlace) {
+    vector<float> values(1536);
+    for (size_t i = 0; i < values.size(); i++) values[i] = (float(i) - 768.0f) / 1000.0f;
+    string text = base64_encode(values.data(), values.size() * sizeof(float));
+
+    vector<float> out;
+    ASSERT_TRUE(base64_decode_floats(text, out));
+    EXPECT_EQ(out, values);
+
+    // Five bytes isn't a whole number of floats
+    EXPECT_FALSE(base64_decode_floats(base64_encode("abcde", 5), out));
+    EXPECT_FALSE(base64_decode_floats("not base64!", out));
+}
@@ -0,0 +1,102 @@
+/**
+ * Unit Tests for BoundedQueue
+ *
+ * The queue sits between pipeline stages, so these check what a stage
+ * relies on: order, a producer held back at capacity, and close() waking
+ * whoever is blocked on either end.
+ */
+
+#include "bounded_queue.hpp"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+TEST(BoundedQueueTest, PopsInPushOrder) {
+    BoundedQueue<int> queue(4);
+    EXPECT_FALSE(queue.try_pop().has_value());
+    for (int i = 0; i < 4; i++) EXPECT_TRUE(queue.push(i));
+    for (int i = 0; i < 4; i++) EXPECT_EQ(queue.pop(), i);
+    EXPECT_FALSE(queue.try_pop().has_value());
+}
+
+TEST(BoundedQueueTest, PushWaitsWhileFull) {
+    BoundedQueue<unique_ptr<int>> queue(2);
+    queue.push(make_unique<int>(0));
+    queue.push(make_unique<int>(1));
+
+    atomic<bool> pushed{false};
+    thread producer([&]() {
+        queue.push(make_unique<int>(2));
+        pushed = true;
+    });
+    this_thread::sleep_for(chrono::milliseconds(50));
+    EXPECT_FALSE(pushed);
+
+    EXPECT_EQ(*queue.pop().value(), 0);
+    producer.join();
+    EXPECT_TRUE(pushed);
+    EXPECT_EQ(*queue.pop().value(), 1);
+    EXPECT_EQ(*queue.pop().value(), 2);
+}
+
+TEST(BoundedQueueTest, CloseDrainsThenEnds) {
+    BoundedQueue<int> queue(4);
+    queue.push(1);
+    queue.push(2);
+    queue.close();
+    EXPECT_FALSE(queue.push(3));
+    EXPECT_EQ(queue.pop(), 1);
+    EXPECT_EQ(queue.pop(), 2);
+    EXPECT_FALSE(queue.pop().has_value());
+}
+
+TEST(BoundedQueueTest, CloseReleasesBlockedThreads) {
+    BoundedQueue<int> full(1);
+    full.push(0);
+    BoundedQueue<int> empty(1);
+
+    thread producer([&]() { EXPECT_FALSE(full.push(1)); });
+    thread consumer([&]() { EXPECT_FALSE(empty.pop().has_value()); });
+    this_thread::sleep_for(chrono::milliseconds(20));
+    full.close();
+    empty.close();
+    producer.join();
+    consumer.join();
+}
+
+TEST(BoundedQueueTest, ConcurrentStagesLoseNothing) {
+    constexpr int producers = 4;
+    constexpr int per_producer = 20000;
+    BoundedQueue<int> queue(8);
+
+    vector<thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&queue, p]() {
+            for (int i = 0; i < per_producer; i++) queue.push(p * per_producer + i);
+        });
+    }
+
+    atomic<long long> sum{0};
+    atomic<int> received{0};
+    vector<thread> consumers;
+    for (int c = 0; c < 3; c++) {
+        consumers.emplace_back([&]() {
+            while (optional<int> item = queue.pop()) {
+                sum += *item;
+                received++;
+            }
+        });
+    }
+    for (thread& t : threads) t.join();
+    queue.close();
+    for (thread& t : consumers) t.join();
+
+    long long total = (long long)producers * per_producer;
+    EXPECT_EQ(received, total);
+    EXPECT_EQ(sum, total * (total - 1) / 2);
+}
@@ -0,0 +1,139 @@
+/**
+ * Unit Tests for BPETokenizer
+ *
+ * Uses a small made-up vocabulary (every byte plus a few merges) written in
+ * tiktoken's file format, so the tests need no downloaded rank file.
+ */
+
+#include "bpe_tokenizer.hpp"
+#include "base64.hpp"
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <unistd.h>
+
+using namespace std;
+
+static const vector<string> MERGES = {"he", "ll", "llo", "hello", " w", "or", " wor", "ld", " world", "12", "123"};
+
+static TokenRanks test_ranks() {
+    TokenRanks ranks;
+    for (int byte = 0; byte < 256; byte++) ranks.emplace(string(1, char(byte)), byte);
+    for (size_t i = 0; i < MERGES.size(); i++) ranks.emplace(MERGES[i], 256 + i);
+    return ranks;
+}
+
+static vector<string> pieces(const BPETokenizer& tokenizer, const string& text) {
+    vector<string> result;
+    for (string_view piece : tokenizer.split(text)) result.emplace_back(piece);
+    return result;
+}
+
+class BPETokenizerTest : public ::testing::Test {
+protected:
+    BPETokenizer tokenizer{test_ranks(), Pretokenizer::CL100K};
+};
+
+TEST_F(BPETokenizerTest, SplitsLikeCl100k) {
+    EXPECT_EQ(pieces(tokenizer, "hello world"), (vector<string>{"hello", " world"}));
+    EXPECT_EQ(pieces(tokenizer, "123456"), (vector<string>{"123", "456"}));
+    EXPECT_EQ(pieces(tokenizer, "don't"), (vector<string>{"don", "'t"}));
+    EXPECT_EQ(pieces(tokenizer, "x\n\n  y"), (vector<string>{"x", "\n\n", " ", " y"}));
+    EXPECT_EQ(pieces(tokenizer, "f(a, b);\n"), (vector<string>{"f", "(a", ",", " b", ");\n"}));
+    EXPECT_EQ(pieces(tokenizer, "caf\xC3\xA9 na\xC3\xAFve"), (vector<string>{"caf\xC3\xA9", " na\xC3\xAFve"}));
+}
+
+TEST_F(BPETokenizerTest, O200kSplitsAtCaseChanges) {
+    BPETokenizer o200k(test_ranks(), Pretokenizer::O200K);
+    EXPECT_EQ(pieces(o200k, "parseHttpResponse"), (vector<string>{"parse", "Http", "Response"}));
+    EXPECT_EQ(pieces(o200k, "parseHTTPResponse"), (vector<string>{"parse", "HTTPResponse"}));
+    EXPECT_EQ(pieces(o200k, "HTTP"), (vector<string>{"HTTP"}));
+    EXPECT_EQ(pieces(o200k, "a/b\n"), (vector<string>{"a", "/b", "\n"}));
+}
+
+TEST_F(BPETokenizerTest, MergesLowestRankFirst) {
+    EXPECT_EQ(tokenizer.encode("hello world"), (vector<uint32_t>{256 + 3, 256 + 8}));
+    EXPECT_EQ(tokenizer.encode("hell"), (vector<uint32_t>{256 + 0, 256 + 1}));
+    EXPECT_EQ(tokenizer.encode("12345"), (vector<uint32_t>{256 + 10, '4', '5'}));
+    EXPECT_EQ(tokenizer.count(""), 0);
+    EXPECT_EQ(tokenizer.count("hello hello"), 3);
+}
+
+TEST_F(BPETokenizerTest, LongPiecesMergeTheSameWay) {
+    // One letter run well past the length where merging switches to a heap
+    string repeated;
+    for (int i = 0; i < 200; i++) repeated += "hello";
+    EXPECT_EQ(tokenizer.encode(repeated), vector<uint32_t>(200, 256 + 3));
+    vector<uint32_t> expected(200, 256 + 3);
+    expected.insert(expected.end(), {256 + 0, 256 + 1});
+    EXPECT_EQ(tokenizer.encode(repeated + "hell"), expected);
+}
+
+TEST_F(BPETokenizerTest, SplitPiecesCoverTheText) {
+    string text = "int main(int argc, char** argv) {\r\n\treturn 0x1F;  // \xE2\x9C\x93 done\n}\n\n\xFF";
+    string joined;
+    for (string_view piece : tokenizer.split(text)) joined += piece;
+    EXPECT_EQ(joined, text);
+}
+
+TEST_F(BPETokenizerTest, TruncatesToTheTokenBudget) {
+    size_t tokens = 0;
+    EXPECT_EQ(tokenizer.truncate("hello world hello", 2, &tokens), "hello world");
+    EXPECT_EQ(tokens, 2);
+    EXPECT_EQ(tokenizer.truncate("hello", 5, &tokens), "hello");
+    EXPECT_EQ(tokens, 1);
+    EXPECT_EQ(tokenizer.truncate("hello", 0, &tokens), "");
+    EXPECT_EQ(tokens, 0);
+}
+
+TEST_F(BPETokenizerTest, TruncationNeverSplitsACharacter) {
+    // Unmerged, "é" is two byte tokens; a budget of one token must drop it
+    size_t tokens = 0;
+    string truncated = tokenizer.truncate("\xC3\xA9", 1, &tokens);
+    EXPECT_EQ(truncated, "");
+    EXPECT_EQ(tokens, 0);
+    EXPECT_EQ(tokenizer.truncate("hello \xC3\xA9", 3, &tokens), "hello ");
+    EXPECT_EQ(tokens, 2);
+}
+
+class BPETokenizerFileTest : public ::testing::Test {
+protected:
+    string path;
+
+    void SetUp() override {
+        char pattern[] = "/tmp/bpe_tokenizer_test_XXXXXX";
+        int fd = mkstemp(pattern);
+        ASSERT_GE(fd, 0);
+        close(fd);
+        path = pattern;
+    }
+
+    void TearDown() override {
+        remove(path.c_str());
+    }
+
+    void write(const string& content) {
+        ofstream(path, ios::binary) << content;
+    }
+};
+
+TEST_F(BPETokenizerFileTest, LoadsTiktokenFormat) {
+    string content;
+    for (const auto& [token, rank] : test_ranks()) {
+        content += base64_encode(token.data(), token.size()) + " " + to_string(rank) + "\n";
+    }
+    write(content);
+    BPETokenizer loaded(path);
+    EXPECT_EQ(loaded.vocabulary_size(), 256 + MERGES.size());
+    EXPECT_EQ(loaded.encode("hello world"), (vector<uint32_t>{256 + 3, 256 + 8}));
+}
+
+TEST_F(BPETokenizerFileTest, RejectsBadFiles) {
+    EXPECT_THROW(BPETokenizer(path + ".missing"), runtime_error);
+    write("aGk= 0\nnot base64!\n");
+    EXPECT_THROW(BPETokenizer{path}, runtime_error);
+    // Well formed, but bytes other than 'h' and 'i' can't be encoded
+    write("aA== 0\naQ== 1\n");
+    EXPECT_THROW(BPETokenizer{path}, runtime_error);
+}
@@ -0,0 +1,208 @@
+/**
+ * Unit Tests for ConcurrencyLimiter
+ *
+ * Drives the AIMD window with synthetic responses and an explicit clock, so
+ * nothing here depends on timing.
+ */
+
+#include "concurrency_limiter.hpp"
+#include <gtest/gtest.h>
+
+using namespace std;
+using namespace std::chrono;
+
+class ConcurrencyLimiterTest : public ::testing::Test {
+protected:
+    steady_clock::time_point now = steady_clock::now();
+
+    // Fills the window, then answers every request with `status`
+    void round_trip(ConcurrencyLimiter& limiter, int status, milliseconds latency = milliseconds(100),
+                    const string& headers = "http/1.1 200 ok\r\n\r\n") {
+        size_t acquired = 0;
+        while (limiter.try_acquire(now)) acquired++;
+        for (size_t i = 0; i < acquired; ++i) {
+            limiter.on_response(status, latency, headers, now);
+        }
+        now += latency;
+    }
+};
+
+TEST_F(ConcurrencyLimiterTest, AcquireStopsAtLimit) {
+    ConcurrencyLimiter limiter(4);
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(limiter.try_acquire(now));
+    }
+    EXPECT_FALSE(limiter.try_acquire(now));
+    EXPECT_EQ(limiter.in_flight(), 4);
+}
+
+TEST_F(ConcurrencyLimiterTest, SlowStartDoublesPerRoundTrip) {
+    ConcurrencyLimiter limiter(8);
+    round_trip(limiter, 200);
+    EXPECT_EQ(limiter.limit(), 16);
+    round_trip(limiter, 200);
+    EXPECT_EQ(limiter.limit(), 32);
+}
+
+TEST_F(ConcurrencyLimiterTest, AfterBackoffGrowsByOnePerRoundTrip) {
+    ConcurrencyLimiter limiter(16);
+    round_trip(limiter, 429);
+    ASSERT_EQ(limiter.limit(), 8);
+
+    round_trip(limiter, 200);
+    EXPECT_EQ(limiter.limit(), 9);
+    round_trip(limiter, 200);
+    EXPECT_EQ(limiter.limit(), 10);
+}
+
+TEST_F(ConcurrencyLimiterTest, IdleWindowDoesNotGrow) {
+    ConcurrencyLimiter limiter(16);
+    // One request at a time never uses the window, so it shouldn't widen
+    for (int i = 0; i < 50; ++i) {
+        ASSERT_TRUE(limiter.try_acquire(now));
+        limiter.on_response(200, milliseconds(100), "", now);
+        now += milliseconds(100);
+    }
+    EXPECT_EQ(limiter.limit(), 16);
+}
+
+TEST_F(ConcurrencyLimiterTest, TooManyRequestsHalvesOncePerRoundTrip) {
+    ConcurrencyLimiter limiter(16);
+    round_trip(limiter, 200);  // establish a latency estimate
+    size_t before = limiter.limit();
+
+    // A whole window of 429s from the same moment is one overload signal
+    round_trip(limiter, 429);
+    EXPECT_EQ(limiter.limit(), before / 2);
+}
+
+TEST_F(ConcurrencyLimiterTest, ServiceUnavailableAlsoBacksOff) {
+    ConcurrencyLimiter limiter(20);
+    round_trip(limiter, 503);
+    EXPECT_EQ(limiter.limit(), 10);
+}
+
+TEST_F(ConcurrencyLimiterTest, StopsAtMaximum) {
+    ConcurrencyLimiter limiter(8, 1, 20);
+    for (int i = 0; i < 5; ++i) {
+        round_trip(limiter, 200);
+    }
+    EXPECT_EQ(limiter.limit(), 20);
+}
+
+TEST_F(ConcurrencyLimiterTest, NeverDropsBelowMinimum) {
+    ConcurrencyLimiter limiter(4, 2);
+    for (int i = 0; i < 10; ++i) {
+        round_trip(limiter, 429);
+        now += seconds(1);
+    }
+    EXPECT_EQ(limiter.limit(), 2);
+}
+
+TEST_F(ConcurrencyLimiterTest, TimeoutBacksOffButConnectionErrorDoesNot) {
+    ConcurrencyLimiter limiter(16);
+    ASSERT_TRUE(limiter.try_acquire(now));
+    limiter.on_failure(false, now);
+    EXPECT_EQ(limiter.limit(), 16);
+
+    ASSERT_TRUE(limiter.try_acquire(now));
+    limiter.on_failure(true, now);
+    EXPECT_EQ(limiter.limit(), 8);
+    EXPECT_EQ(limiter.in_flight(), 0);
+}
+
+TEST_F(ConcurrencyLimiterTest, RisingLatencyShrinksWindow) {
+    ConcurrencyLimiter limiter(20);
+    for (int i = 0; i < 5; ++i) {
+        round_trip(limiter, 200, milliseconds(100));
+    }
+    size_t before = limiter.limit();
+
+    // Same responses, ten times slower: requests are queueing somewhere
+    for (int i = 0; i < 5; ++i) {
+        round_trip(limiter, 200, milliseconds(1000));
+    }
+    EXPECT_LT(limiter.limit(), before);
+}
+
+TEST_F(ConcurrencyLimiterTest, RetryAfterPausesAdmission) {
+    ConcurrencyLimiter limiter(8);
+    ASSERT_TRUE(limiter.try_acquire(now));
+    limiter.on_response(429, milliseconds(10), "http/1.1 429 too many requests\r\nretry-after-ms: 250\r\n\r\n", now);
+
+    EXPECT_FALSE(limiter.try_acquire(now + milliseconds(100)));
+    EXPECT_TRUE(limiter.try_acquire(now + milliseconds(250)));
+}
+
+TEST_F(ConcurrencyLimiterTest, ExhaustedRequestBudgetPausesUntilReset) {
+    ConcurrencyLimiter limiter(8);
+    ASSERT_TRUE(limiter.try_acquire(now));
+    limiter.on_response(200, milliseconds(10),
+                        "http/2 200\r\nx-ratelimit-remaining-requests: 0\r\nx-ratelimit-reset-requests: 1.5s\r\n\r\n", now);
+
+    EXPECT_FALSE(limiter.try_acquire(now + milliseconds(1400)));
+    EXPECT_TRUE(limiter.try_acquire(now + milliseconds(1500)));
+}
+
+TEST_F(ConcurrencyLimiterTest, LowRequestBudgetCapsWindow) {
+    ConcurrencyLimiter limiter(32);
+    ASSERT_TRUE(limiter.try_acquire(now));
+    limiter.on_response(200, milliseconds(10), "http/2 200\r\nx-ratelimit-remaining-requests: 5\r\n\r\n", now);
+    EXPECT_EQ(limiter.limit(), 5);
+}
+
+TEST_F(ConcurrencyLimiterTest, ExhaustedTokenBudgetPauses) {
+    ConcurrencyLimiter limiter(8);
+    ASSERT_TRUE(limiter.try_acquire(now));
+    limiter.on_response(200, milliseconds(10),
+                        "http/2 200\r\nx-ratelimit-remaining-tokens: 0\r\nx-ratelimit-reset-tokens: 20ms\r\n\r\n", now);
+    EXPECT_FALSE(limiter.try_acquire(now));
+    EXPECT_EQ(limiter.paused_until(), now + milliseconds(20));
+}
+
+TEST_F(ConcurrencyLimiterTest, ParsesResetDurations) {
+    EXPECT_EQ(ConcurrencyLimiter::parse_reset_duration("20ms"), milliseconds(20));
+    EXPECT_EQ(ConcurrencyLimiter::parse_reset_duration("1s"), milliseconds(1000));
+    EXPECT_EQ(ConcurrencyLimiter::parse_reset_duration("1.5s"), milliseconds(1500));
+    EXPECT_EQ(ConcurrencyLimiter::parse_reset_duration("6m0s"), milliseconds(360000));
+    EXPECT_EQ(ConcurrencyLimiter::parse_reset_duration("1h2m3s"), milliseconds(3723000));
+    EXPECT_EQ(ConcurrencyLimiter::parse_reset_duration("7"), milliseconds(7000));
+    EXPECT_EQ(ConcurrencyLimiter::parse_reset_duration(""), milliseconds(0));
+    EXPECT_EQ(ConcurrencyLimiter::parse_reset_duration("."), milliseconds(0));
+    EXPECT_EQ(ConcurrencyLimiter::parse_reset_duration("1.2.3s"), milliseconds(0));
+    EXPECT_EQ(ConcurrencyLimiter::parse_reset_duration("1" + string(400, '0') + "s"), milliseconds(0));
+    EXPECT_EQ(ConcurrencyLimiter::parse_reset_duration("1000h"), MAX_SERVER_WAIT);
+}
+
+TEST_F(ConcurrencyLimiterTest, ParsesRetryAfter) {
+    EXPECT_EQ(ConcurrencyLimiter::retry_after("http/1.1 429 x\r\nretry-after-ms: 250\r\nretry-after: 1\r\n\r\n"),
+              milliseconds(250));
+    EXPECT_EQ(ConcurrencyLimiter::retry_after("http/1.1 503 x\r\nretry-after: 2\r\n\r\n"), milliseconds(2000));
+    EXPECT_EQ(ConcurrencyLimiter::retry_after("http/1.1 503 x\r\nretry-after: wed, 21 oct 2015 07:28:00 gmt\r\n\r\n"),
+              milliseconds(0));
+    EXPECT_EQ(ConcurrencyLimiter::retry_after("http/1.1 503 x\r\n\r\n"), milliseconds(0));
+}
+
+// Headers come from whatever server or proxy answered, so a bad value must
+// read as no header (or the longest wait) rather than throw on the event loop
+TEST_F(ConcurrencyLimiterTest, MalformedHeadersDoNotThrow) {
+    EXPECT_EQ(ConcurrencyLimiter::retry_after("http/1.1 503 x\r\nretry-after: 99999999999999999999\r\n\r\n"),
+              milliseconds(0));
+    EXPECT_EQ(ConcurrencyLimiter::retry_after("http/1.1 503 x\r\nretry-after: 9999999999999\r\n\r\n"),
+              MAX_SERVER_WAIT);
+    EXPECT_EQ(ConcurrencyLimiter::retry_after("http/1.1 429 x\r\nretry-after-ms: 99999999999999999999\r\n\r\n"),
+              milliseconds(0));
+
+    ConcurrencyLimiter limiter(8);
+    ASSERT_TRUE(limiter.try_acquire(now));
+    EXPECT_NO_THROW(limiter.on_response(
+        200, milliseconds(10), "http/2 200\r\nx-ratelimit-remaining-tokens: 0\r\nx-ratelimit-reset-tokens: .\r\n\r\n", now));
+    EXPECT_TRUE(limiter.try_acquire(now));
+
+    ASSERT_TRUE(limiter.try_acquire(now));
+    EXPECT_NO_THROW(limiter.on_response(
+        429, milliseconds(10), "http/1.1 429 x\r\nretry-after: 99999999999999999999\r\n\r\n", now));
+    EXPECT_NO_THROW(limiter.on_response(
+        503, milliseconds(10), "http/1.1 503 x\r\nretry-after: 9999999999999\r\n\r\n", now));
+    EXPECT_EQ(limiter.paused_until(), now + MAX_SERVER_WAIT);
+}
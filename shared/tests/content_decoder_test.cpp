@@ -0,0 +1,101 @@
+/**
+ * Unit Tests for ContentDecoder
+ *
+ * Compresses bodies with zlib in each wrapper HTTP servers use, then feeds
+ * them back in arbitrary pieces the way they come off the socket.
+ */
+
+#include "content_decoder.hpp"
+#include <gtest/gtest.h>
+
+using namespace std;
+
+// window_bits: 15 + 16 for gzip, 15 for zlib-wrapped deflate, -15 for raw
+static string compress(const string& input, int window_bits) {
+    z_stream zs{};
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY);
+    string out(deflateBound(&zs, input.size()) + 32, '\0');
+    zs.next_in = (Bytef*)input.data();
+    zs.avail_in = input.size();
+    zs.next_out = (Bytef*)out.data();
+    zs.avail_out = out.size();
+    deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return out;
+}
+
+static string sample_body() {
+    string body = "{\"data\":[{\"embedding\":[";
+    for (int i = 0; i < 1536; ++i) {
+        body += to_string(i * 0.000731 - 0.5) + ",";
+    }
+    body += "0]}]}";
+    return body;
+}
+
+// Feeds `encoded` in pieces of `piece` bytes and returns the decoded body
+static string decode(ContentDecoder& decoder, const string& encoded, size_t piece, bool* ok = nullptr) {
+    string out;
+    bool all_ok = true;
+    for (size_t i = 0; i < encoded.size(); i += piece) {
+        size_t n = min(piece, encoded.size() - i);
+        all_ok &= decoder.feed(encoded.data() + i, n, [&out](string_view s) { out.append(s); });
+    }
+    if (ok) *ok = all_ok;
+    return out;
+}
+
+TEST(ContentDecoderTest, IdentityAndUnknownEncodingsPassThrough) {
+    EXPECT_EQ(ContentDecoder::create(""), nullptr);
+    EXPECT_EQ(ContentDecoder::create("identity"), nullptr);
+    EXPECT_EQ(ContentDecoder::create("br"), nullptr);
+    EXPECT_NE(ContentDecoder::create(" GZIP"), nullptr);
+    EXPECT_NE(ContentDecoder::create("deflate"), nullptr);
+}
+
+TEST(ContentDecoderTest, DecodesGzipFedInAnyPieceSize) {
+    string body = sample_body();
+    string encoded = compress(body, MAX_WBITS + 16);
+    ASSERT_LT(encoded.size(), body.size() / 2);
+
+    for (size_t piece : {(size_t)1, (size_t)7, (size_t)1000, encoded.size()}) {
+        auto decoder = ContentDecoder::create("gzip");
+        bool ok;
+        EXPECT_EQ(decode(*decoder, encoded, piece, &ok), body) << "piece " << piece;
+        EXPECT_TRUE(ok);
+        EXPECT_TRUE(decoder->finished());
+    }
+}
+
+TEST(ContentDecoderTest, DecodesZlibAndRawDeflate) {
+    string body = sample_body();
+    for (int window_bits : {MAX_WBITS, -MAX_WBITS}) {
+        auto decoder = ContentDecoder::create("deflate");
+        EXPECT_EQ(decode(*decoder, compress(body, window_bits), 4096), body) << "window_bits " << window_bits;
+        EXPECT_TRUE(decoder->finished());
+    }
+}
+
+TEST(ContentDecoderTest, DecodesConcatenatedGzipMembers) {
+    string encoded = compress("first,", MAX_WBITS + 16) + compress("second", MAX_WBITS + 16);
+    auto decoder = ContentDecoder::create("gzip");
+    EXPECT_EQ(decode(*decoder, encoded, 5), "first,second");
+}
+
+TEST(ContentDecoderTest, TruncatedBodyIsNotFinished) {
+    string encoded = compress(sample_body(), MAX_WBITS + 16);
+    auto decoder = ContentDecoder::create("gzip");
+    decode(*decoder, encoded.substr(0, encoded.size() / 2), 512);
+    EXPECT_FALSE(decoder->finished());
+
+    auto empty = ContentDecoder::create("gzip");
+    EXPECT_TRUE(empty->finished());  // bodiless responses (204, HEAD)
+}
+
+TEST(ContentDecoderTest, CorruptBodyFails) {
+    auto decoder = ContentDecoder::create("gzip");
+    bool ok;
+    decode(*decoder, "this was never gzip", 4, &ok);
+    EXPECT_FALSE(ok);
+}
@@ -0,0 +1,207 @@
+/**
+ * Unit Tests for EmbeddingCache
+ *
+ * Each test works on its own file in a scratch directory, so nothing here
+ * touches the user's real cache.
+ */
+
+#include "embedding_cache.hpp"
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+
+using namespace std;
+
+class EmbeddingCacheTest : public ::testing::Test {
+protected:
+    filesystem::path dir;
+    string path;
+
+    void SetUp() override {
+        dir = filesystem::temp_directory_path() / ("embedding_cache_test_" + to_string(getpid()));
+        filesystem::remove_all(dir);
+        path = (dir / "nested" / "embeddings.bin").string();
+    }
+
+    void TearDown() override {
+        filesystem::remove_all(dir);
+    }
+};
+
+TEST_F(EmbeddingCacheTest, MissingFileGivesAnEmptyCache) {
+    EmbeddingCache cache(path);
+    vector<float> out;
+    EXPECT_EQ(cache.size(), 0u);
+    EXPECT_FALSE(cache.get(EmbeddingCache::key("model", 3, "text"), out));
+    EXPECT_EQ(cache.misses(), 1u);
+}
+
+TEST_F(EmbeddingCacheTest, SavedVectorsAreReadBackByTheNextInstance) {
+    EmbeddingKey first = EmbeddingCache::key("model", 3, "first");
+    EmbeddingKey second = EmbeddingCache::key("model", 3, "second");
+    {
+        EmbeddingCache cache(path);
+        cache.put(first, {1.0f, 2.0f, 3.0f});
+        cache.put(second, {-0.5f, 0.25f, 0.0f});
+
+        // Pending vectors are served before they're saved
+        vector<float> out;
+        ASSERT_TRUE(cache.get(first, out));
+        EXPECT_EQ(out, (vector<float>{1.0f, 2.0f, 3.0f}));
+        ASSERT_TRUE(cache.save());
+    }
+
+    EmbeddingCache cache(path);
+    EXPECT_EQ(cache.size(), 2u);
+    vector<float> out;
+    ASSERT_TRUE(cache.get(first, out));
+    EXPECT_EQ(out, (vector<float>{1.0f, 2.0f, 3.0f}));
+    ASSERT_TRUE(cache.get(second, out));
+    EXPECT_EQ(out, (vector<float>{-0.5f, 0.25f, 0.0f}));
+    EXPECT_EQ(cache.hits(), 2u);
+}
+
+TEST_F(EmbeddingCacheTest, KeyDependsOnModelDimensionsAndText) {
+    EmbeddingKey base = EmbeddingCache::key("text-embedding-3-small", 1536, "int x;");
+    EXPECT_EQ(base, EmbeddingCache::key("text-embedding-3-small", 1536, "int x;"));
+    EXPECT_NE(base, EmbeddingCache::key("text-embedding-3-large", 1536, "int x;"));
+    EXPECT_NE(base, EmbeddingCache::key("text-embedding-3-small", 512, "int x;"));
+    EXPECT_NE(base, EmbeddingCache::key("text-embedding-3-small", 1536, "int x; "));
+    // Field boundaries count, not just the concatenation
+    EXPECT_NE(EmbeddingCache::key("ab", 1, "c"), EmbeddingCache::key("a", 1, "bc"));
+}
+
+TEST_F(EmbeddingCacheTest, SavesFromSeparateRunsAccumulate) {
+    EmbeddingKey first = EmbeddingCache::key("model", 2, "first");
+    EmbeddingKey second = EmbeddingCache::key("model", 2, "second");
+
+    // Both open before either saves, like two overlapping runs
+    EmbeddingCache one(path);
+    EmbeddingCache two(path);
+    one.put(first, {1.0f, 1.0f});
+    two.put(second, {2.0f, 2.0f});
+    two.put(first, {1.0f, 1.0f});
+    ASSERT_TRUE(one.save());
+    ASSERT_TRUE(two.save());
+
+    EmbeddingCache cache(path);
+    EXPECT_EQ(cache.size(), 2u);
+    vector<float> out;
+    EXPECT_TRUE(cache.get(first, out));
+    EXPECT_TRUE(cache.get(second, out));
+}
+
+TEST_F(EmbeddingCacheTest, TornTailIsIgnoredAndRepairedOnSave) {
+    EmbeddingKey kept = EmbeddingCache::key("model", 4, "kept");
+    {
+        EmbeddingCache cache(path);
+        cache.put(kept, {1.0f, 2.0f, 3.0f, 4.0f});
+        ASSERT_TRUE(cache.save());
+    }
+    uintmax_t complete_size = filesystem::file_size(path);
+    {
+        // Half a record, as left by a run killed mid-write
+        ofstream out(path, ios::binary | ios::app);
+        out.write("partial record", 14);
+    }
+
+    EmbeddingCache torn(path);
+    EXPECT_EQ(torn.size(), 1u);
+    vector<float> out;
+    ASSERT_TRUE(torn.get(kept, out));
+    EXPECT_EQ(out.size(), 4u);
+
+    EmbeddingKey added = EmbeddingCache::key("model", 4, "added");
+    torn.put(added, {5.0f, 6.0f, 7.0f, 8.0f});
+    ASSERT_TRUE(torn.save());
+    EXPECT_EQ(filesystem::file_size(path), complete_size + 32 + 4 + 4 * sizeof(float));
+
+    EmbeddingCache repaired(path);
+    EXPECT_EQ(repaired.size(), 2u);
+    ASSERT_TRUE(repaired.get(added, out));
+    EXPECT_EQ(out, (vector<float>{5.0f, 6.0f, 7.0f, 8.0f}));
+}
+
+TEST_F(EmbeddingCacheTest, ForeignFileIsReplaced) {
+    filesystem::create_directories(filesystem::path(path).parent_path());
+    {
+        ofstream out(path, ios::binary);
+        out << "not an embedding cache, just some text that happens to be here";
+    }
+
+    EmbeddingCache cache(path);
+    EXPECT_EQ(cache.size(), 0u);
+    EmbeddingKey key = EmbeddingCache::key("model", 1, "text");
+    cache.put(key, {0.5f});
+    ASSERT_TRUE(cache.save());
+
+    EmbeddingCache reopened(path);
+    vector<float> out;
+    ASSERT_TRUE(reopened.get(key, out));
+    EXPECT_EQ(out, (vector<float>{0.5f}));
+}
+
+// Starting over a full file mustn't pull it out from under a run that
+// mapped it earlier: reads past the new end of a truncated file are SIGBUS
+TEST_F(EmbeddingCacheTest, FullFileIsReplacedWithoutBreakingOpenReaders) {
+    EmbeddingKey late = EmbeddingCache::key("model", 2, "late");
+    {
+        EmbeddingCache cache(path);
+        cache.put(EmbeddingCache::key("model", 2, "early"), {1.0f, 1.0f});
+        ASSERT_TRUE(cache.save());
+    }
+    {
+        // One huge record (sparse on disk) past MAX_EMBEDDING_CACHE_BYTES,
+        // then a small one that only a reader of the old file can reach
+        uint32_t huge = MAX_EMBEDDING_CACHE_BYTES / sizeof(float);
+        EmbeddingKey filler = EmbeddingCache::key("model", huge, "filler");
+        {
+            ofstream out(path, ios::binary | ios::app);
+            out.write(reinterpret_cast<const char*>(filler.data()), filler.size());
+            out.write(reinterpret_cast<const char*>(&huge), sizeof(huge));
+        }
+        filesystem::resize_file(path, filesystem::file_size(path) + size_t(huge) * sizeof(float));
+        ofstream out(path, ios::binary | ios::app);
+        uint32_t dimensions = 2;
+        float values[2] = {3.0f, 4.0f};
+        out.write(reinterpret_cast<const char*>(late.data()), late.size());
+        out.write(reinterpret_cast<const char*>(&dimensions), sizeof(dimensions));
+        out.write(reinterpret_cast<const char*>(values), sizeof(values));
+    }
+
+    EmbeddingCache reader(path);
+    EXPECT_EQ(reader.size(), 3u);
+
+    EmbeddingCache writer(path);
+    EmbeddingKey added = EmbeddingCache::key("model", 2, "added");
+    writer.put(added, {5.0f, 5.0f});
+    ASSERT_TRUE(writer.save());
+    EXPECT_LT(filesystem::file_size(path), 1024u);
+
+    vector<float> out;
+    ASSERT_TRUE(reader.get(late, out));
+    EXPECT_EQ(out, (vector<float>{3.0f, 4.0f}));
+
+    EmbeddingCache reopened(path);
+    EXPECT_EQ(reopened.size(), 1u);
+    EXPECT_TRUE(reopened.get(added, out));
+    // The replacement was renamed into place, not left beside it
+    EXPECT_EQ(distance(filesystem::directory_iterator(dir / "nested"), filesystem::directory_iterator()), 1);
+}
+
+TEST_F(EmbeddingCacheTest, DefaultPathFollowsXdgCacheHome) {
+    const char* saved_xdg = getenv("XDG_CACHE_HOME");
+    const char* saved_home = getenv("HOME");
+    string restore_xdg = saved_xdg ? saved_xdg : "";
+    string restore_home = saved_home ? saved_home : "";
+
+    setenv("XDG_CACHE_HOME", "/tmp/xdg", 1);
+    EXPECT_EQ(default_embedding_cache_path(), "/tmp/xdg/gcommit/embeddings.bin");
+    unsetenv("XDG_CACHE_HOME");
+    setenv("HOME", "/home/someone", 1);
+    EXPECT_EQ(default_embedding_cache_path(), "/home/someone/.cache/gcommit/embeddings.bin");
+
+    if (saved_xdg) setenv("XDG_CACHE_HOME", restore_xdg.c_str(), 1);
+    if (saved_home) setenv("HOME", restore_home.c_str(), 1);
+}
@@ -0,0 +1,123 @@
+/**
+ * Unit Tests for LatencyStats
+ *
+ * Feeds hand-built timelines and durations through the phase breakdown and
+ * the histograms, so nothing here depends on timing.
+ */
+
+#include "async_https_api.hpp"
+#include "latency_stats.hpp"
+#include <gtest/gtest.h>
+#include <sstream>
+
+using namespace std;
+using namespace std::chrono;
+
+class LatencyStatsTest : public ::testing::Test {
+protected:
+    steady_clock::time_point start = steady_clock::now();
+
+    // A response whose timeline enters each state `ms` after start
+    HTTPSResponse response_with(const vector<pair<conn_state_t, int>>& steps) {
+        HTTPSResponse response;
+        response.status = 200;
+        for (const auto& [state, ms] : steps) {
+            response.timeline.push_back({state, start + milliseconds(ms)});
+        }
+        response.elapsed = response.timeline.back().at - start;
+        return response;
+    }
+};
+
+TEST_F(LatencyStatsTest, PhasesFollowHTTP1Timeline) {
+    HTTPSResponse response = response_with({
+        {QUEUED, 0}, {RESOLVING, 5}, {CONNECTING, 15}, {TLS_HANDSHAKE, 35},
+        {WRITING_REQUEST, 75}, {READING_RESPONSE_HEADERS, 76}, {READING_RESPONSE, 276}, {DONE, 300},
+    });
+    HTTPSPhaseTimes phases = response.phases();
+
+    EXPECT_EQ(phases.queued, milliseconds(5));
+    EXPECT_EQ(phases.dns, milliseconds(10));
+    EXPECT_EQ(phases.connect, milliseconds(20));
+    EXPECT_EQ(phases.tls, milliseconds(40));
+    EXPECT_EQ(phases.send, milliseconds(1));
+    EXPECT_EQ(phases.wait, milliseconds(200));
+    EXPECT_EQ(phases.receive, milliseconds(24));
+}
+
+TEST_F(LatencyStatsTest, StreamingSplitsAtFirstByte) {
+    HTTPSResponse response = response_with({{QUEUED, 0}, {STREAMING, 2}, {DONE, 102}});
+    response.first_byte = start + milliseconds(82);
+    HTTPSPhaseTimes phases = response.phases();
+
+    EXPECT_EQ(phases.queued, milliseconds(2));
+    EXPECT_EQ(phases.wait, milliseconds(80));
+    EXPECT_EQ(phases.receive, milliseconds(20));
+}
+
+TEST_F(LatencyStatsTest, RetriedAttemptsAddUp) {
+    HTTPSResponse response = response_with({
+        {QUEUED, 0}, {WRITING_REQUEST, 0}, {READING_RESPONSE_HEADERS, 1}, {DONE, 50},
+        {BACKING_OFF, 50}, {QUEUED, 150}, {WRITING_REQUEST, 150}, {READING_RESPONSE_HEADERS, 151}, {DONE, 201},
+    });
+    HTTPSPhaseTimes phases = response.phases();
+
+    EXPECT_EQ(phases.queued, milliseconds(100));
+    EXPECT_EQ(phases.send, milliseconds(2));
+    EXPECT_EQ(phases.wait, milliseconds(99));
+}
+
+TEST_F(LatencyStatsTest, PercentilesWithinBucketPrecision) {
+    LatencyHistogram histogram;
+    for (int ms = 1; ms <= 1000; ms++) {
+        histogram.record(milliseconds(ms));
+    }
+
+    EXPECT_EQ(histogram.count(), 1000);
+    EXPECT_NEAR(histogram.mean_ms(), 500.5, 0.01);
+    EXPECT_DOUBLE_EQ(histogram.min_ms(), 1.0);
+    EXPECT_DOUBLE_EQ(histogram.max_ms(), 1000.0);
+    EXPECT_NEAR(histogram.percentile_ms(0.50), 500, 500 * 0.07);
+    EXPECT_NEAR(histogram.percentile_ms(0.99), 990, 990 * 0.07);
+    EXPECT_LE(histogram.percentile_ms(1.0), 1000.0);
+}
+
+TEST_F(LatencyStatsTest, SingleValueIsExact) {
+    LatencyHistogram histogram;
+    histogram.record(microseconds(12345));
+    EXPECT_DOUBLE_EQ(histogram.percentile_ms(0.5), 12.345);
+    EXPECT_DOUBLE_EQ(histogram.percentile_ms(0.99), 12.345);
+}
+
+TEST_F(LatencyStatsTest, RecordsCountsAndSkipsUnusedPhases) {
+    LatencyStats stats;
+    HTTPSResponse fresh = response_with({{QUEUED, 0}, {CONNECTING, 1}, {TLS_HANDSHAKE, 11}, {STREAMING, 31}, {DONE, 81}});
+    fresh.bytes_sent = 100;
+    fresh.bytes_received = 1000;
+    HTTPSResponse pooled = response_with({{QUEUED, 0}, {STREAMING, 0}, {DONE, 40}});
+    pooled.reused = true;
+    pooled.attempts = 2;
+    pooled.status = 429;
+
+    stats.record(fresh);
+    stats.record(pooled);
+    stats.record_failure();
+
+    EXPECT_EQ(stats.responses, 2);
+    EXPECT_EQ(stats.failures, 1);
+    EXPECT_EQ(stats.retries, 1);
+    EXPECT_EQ(stats.reused, 1);
+    EXPECT_EQ(stats.bytes_received, 1000);
+    EXPECT_EQ(stats.total.count(), 2);
+    EXPECT_EQ(stats.tls.count(), 1);
+    EXPECT_EQ(stats.dns.count(), 0);
+
+    nlohmann::json dumped = stats.to_json();
+    EXPECT_EQ(dumped["statuses"]["429"], 1);
+    EXPECT_EQ(dumped["phases"]["tls"]["count"], 1);
+    EXPECT_DOUBLE_EQ(dumped["phases"]["tls"]["p50_ms"].get<double>(), 20.0);
+
+    ostringstream printed;
+    stats.print(printed);
+    EXPECT_NE(printed.str().find("total"), string::npos);
+}
@@ -0,0 +1,118 @@
+/**
+ * Load Test for AsyncHTTPSConnection
+ *
+ * Pushes N embedding requests at once through AsyncOpenAIAPI to a local
+ * MockOpenAIServer and reports throughput and latency percentiles. Needs no
+ * network or API key.
+ *
+ * Usage: async_https_load_test [-n requests] [-c max_connections] [--plain]
+ *            [--chunked] [--gzip] [--latency ms] [--jitter ms]
+ *            [--error-rate fraction] [--fixed-window]
+ */
+
+#include "async_openai_api.hpp"
+#include "mock_openai_server.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+using namespace std;
+
+static double percentile_ms(const vector<chrono::steady_clock::duration>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t index = min(sorted.size() - 1, (size_t)(p * sorted.size()));
+    return chrono::duration<double, milli>(sorted[index]).count();
+}
+
+int main(int argc, char* argv[]) {
+    size_t total = 1000;
+    size_t max_connections = DEFAULT_MAX_CONNECTIONS_PER_HOST;
+    bool adaptive = true;
+    MockServerOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-n" && has_value) {
+            total = stoul(argv[++i]);
+        } else if (arg == "-c" && has_value) {
+            max_connections = stoul(argv[++i]);
+        } else if (arg == "--plain") {
+            options.tls = false;
+        } else if (arg == "--chunked") {
+            options.chunked = true;
+        } else if (arg == "--gzip") {
+            options.gzip = true;
+        } else if (arg == "--latency" && has_value) {
+            options.latency = chrono::milliseconds(stoi(argv[++i]));
+        } else if (arg == "--jitter" && has_value) {
+            options.latency_jitter = chrono::milliseconds(stoi(argv[++i]));
+        } else if (arg == "--error-rate" && has_value) {
+            options.error_rate = stod(argv[++i]);
+        } else if (arg == "--fixed-window") {
+            adaptive = false;
+        } else {
+            cerr << "Usage: " << argv[0] << " [-n requests] [-c max_connections] [--plain] [--chunked] [--gzip]" << endl;
+            cerr << "       [--latency ms] [--jitter ms] [--error-rate fraction] [--fixed-window]" << endl;
+            return 1;
+        }
+    }
+
+    MockOpenAIServer server(options);
+    AsyncHTTPSConnection conn;
+    conn.set_max_connections_per_host(max_connections);
+    conn.set_adaptive_concurrency(adaptive);
+    HTTPSRetryPolicy retries;
+    retries.base_delay = chrono::milliseconds(20);
+    conn.set_retry_policy(retries);
+
+    AsyncOpenAIAPI api(conn, "mock-key");
+    api.set_endpoint(options.tls ? "https" : "http", "127.0.0.1", server.port());
+
+    vector<future<HTTPSResponse>> futures;
+    futures.reserve(total);
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < total; i++) {
+        futures.push_back(api.async_embedding("load test input " + to_string(i)));
+    }
+    api.run_requests();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<chrono::steady_clock::duration> latencies;
+    map<string, size_t> outcomes;
+    size_t ok = 0;
+    for (auto& future : futures) {
+        try {
+            HTTPSResponse response = future.get();
+            outcomes[to_string(response.status)]++;
+            if (response.status == 200) {
+                ok++;
+                latencies.push_back(response.elapsed);
+            }
+        } catch (const exception& e) {
+            outcomes[e.what()]++;
+        }
+    }
+    sort(latencies.begin(), latencies.end());
+
+    MockServerStats stats = server.stats();
+    cout << fixed << setprecision(1);
+    cout << "requests:    " << total << " (" << (options.tls ? "https" : "http")
+         << (options.chunked ? ", chunked" : "") << (options.gzip ? ", gzip" : "") << ")" << endl;
+    cout << "elapsed:     " << seconds * 1000 << " ms" << endl;
+    cout << "throughput:  " << ok / seconds << " req/s" << endl;
+    cout << "latency ms:  p50=" << percentile_ms(latencies, 0.50) << " p90=" << percentile_ms(latencies, 0.90)
+         << " p99=" << percentile_ms(latencies, 0.99) << " max=" << percentile_ms(latencies, 1.0) << endl;
+    cout << "outcomes:   ";
+    for (const auto& [outcome, count] : outcomes) {
+        cout << " " << outcome << "=" << count;
+    }
+    cout << endl;
+    cout << "server:      connections=" << stats.connections << " requests=" << stats.requests
+         << " injected_errors=" << stats.errors << endl;
+    conn.latency_stats().print(cout);
+
+    // Injected errors may outlast the retry budget; anything else is a bug
+    return ok == total || options.error_rate > 0 ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+/**
+ * Unit Tests for LocalEmbedder
+ *
+ * Checks the properties clustering relies on (unit length, determinism,
+ * related code scoring closer than unrelated code) rather than exact values.
+ */
+
+#include "local_embedder.hpp"
+#include <gtest/gtest.h>
+#include <cmath>
+
+using namespace std;
+
+static float dot(const vector<float>& a, const vector<float>& b) {
+    float sum = 0;
+    for (size_t i = 0; i < a.size(); i++) sum += a[i] * b[i];
+    return sum;
+}
+
+static const vector<string> SAMPLES = {
+    "int parse_http_response(const char* buffer, size_t length) {\n    return parse_status_line(buffer, length);\n}",
+    "int parseHttpResponse(const char *buffer, size_t len) { return parseStatusLine(buffer, len); }",
+    "def render_scatter_plot(points):\n    for point in points:\n        draw_marker(point.x, point.y)",
+    "# Installation\n\nRun the setup script to build and install every command.",
+    "",
+};
+
+TEST(LocalEmbedderTest, VectorsHaveTheRequestedLengthAndUnitNorm) {
+    LocalEmbedder embedder(256);
+    vector<vector<float>> embeddings = embedder.embed(SAMPLES);
+    ASSERT_EQ(embeddings.size(), SAMPLES.size());
+    for (size_t i = 0; i + 1 < embeddings.size(); i++) {
+        ASSERT_EQ(embeddings[i].size(), 256);
+        EXPECT_NEAR(sqrt(dot(embeddings[i], embeddings[i])), 1.0f, 1e-5) << i;
+    }
+    // Nothing to hash in an empty text
+    EXPECT_EQ(embeddings.back(), vector<float>(256, 0.0f));
+}
+
+TEST(LocalEmbedderTest, ZeroDimensionsMeansTheDefault) {
+    vector<vector<float>> embeddings = LocalEmbedder(0).embed({"x = 1"});
+    EXPECT_EQ(embeddings[0].size(), LOCAL_EMBEDDING_DIMENSIONS);
+}
+
+TEST(LocalEmbedderTest, RelatedCodeIsCloserThanUnrelated) {
+    vector<vector<float>> embeddings = LocalEmbedder().embed(SAMPLES);
+    float same_function = dot(embeddings[0], embeddings[1]);
+    EXPECT_GT(same_function, dot(embeddings[0], embeddings[2]));
+    EXPECT_GT(same_function, dot(embeddings[0], embeddings[3]));
+    EXPECT_GT(same_function, dot(embeddings[1], embeddings[3]));
+}
+
+TEST(LocalEmbedderTest, IdenticalTextsGetIdenticalVectors) {
+    vector<vector<float>> embeddings = LocalEmbedder().embed({"return a + b;", "x", "return a + b;"});
+    EXPECT_EQ(embeddings[0], embeddings[2]);
+    EXPECT_NEAR(dot(embeddings[0], embeddings[2]), 1.0f, 1e-5);
+}
+
+TEST(LocalEmbedderTest, ParallelMatchesSerial) {
+    vector<string> texts;
+    for (int i = 0; i < 200; i++) {
+        texts.push_back("void handler_" + to_string(i % 17) + "(Request& request) { respond(request, " + to_string(i) + "); }");
+    }
+    LocalEmbedder embedder;
+    EXPECT_EQ(embedder.embed(texts, 1), embedder.embed(texts, 8));
+}
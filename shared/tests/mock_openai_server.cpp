@@ -0,0 +1,447 @@
+#include "mock_openai_server.hpp"
+#include "base64.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cmath>
+#include <deque>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <nlohmann/json.hpp>
+#include <openssl/err.h>
+#include <openssl/x509.h>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <zlib.h>
+
+using namespace std;
+using json = nlohmann::json;
+
+static constexpr size_t MOCK_CHUNK_SIZE = 4096;
+static constexpr const char* MOCK_CHAT_REPLY = "add mock server for offline load tests";
+
+struct MockOpenAIServer::Connection {
+    int fd;
+    SSL* ssl = nullptr;
+    bool handshaken = false;
+    bool close_after = false;  // client sent "connection: close"
+    size_t received = 0;
+    string in;
+    string out;
+    size_t out_sent = 0;
+    // Responses still waiting out their latency, in request order
+    deque<pair<chrono::steady_clock::time_point, string>> queued;
+
+    Connection(int fd, SSL* ssl) : fd(fd), ssl(ssl), handshaken(ssl == nullptr) {}
+    ~Connection() {
+        if (ssl) SSL_free(ssl);
+        close(fd);
+    }
+
+    // > 0 bytes moved, 0 would block, -1 closed or failed
+    int read_some(char* buffer, int n) {
+        if (ssl) {
+            int got = SSL_read(ssl, buffer, n);
+            if (got > 0) return got;
+            return SSL_get_error(ssl, got) == SSL_ERROR_WANT_READ ? 0 : -1;
+        }
+        ssize_t got = recv(fd, buffer, n, 0);
+        if (got > 0) return (int)got;
+        return got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+
+    int write_some(const char* data, int n) {
+        if (ssl) {
+            int sent = SSL_write(ssl, data, n);
+            if (sent > 0) return sent;
+            int error = SSL_get_error(ssl, sent);
+            return error == SSL_ERROR_WANT_WRITE || error == SSL_ERROR_WANT_READ ? 0 : -1;
+        }
+        ssize_t sent = send(fd, data, n, MSG_NOSIGNAL);
+        if (sent > 0) return (int)sent;
+        return sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+};
+
+// Throwaway P-256 key and certificate for "localhost", good for a day. The
+// client doesn't verify peers, so nothing needs to trust it.
+static SSL_CTX* make_server_context() {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    EVP_PKEY* key = EVP_EC_gen("P-256");
+    X509* cert = X509_new();
+    if (ctx == nullptr || key == nullptr || cert == nullptr) {
+        throw runtime_error("Failed to create mock server TLS context");
+    }
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 86400);
+    X509_set_pubkey(cert, key);
+    X509_NAME* name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    X509_sign(cert, key, EVP_sha256());
+
+    SSL_CTX_use_certificate(ctx, cert);
+    SSL_CTX_use_PrivateKey(ctx, key);
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    return ctx;
+}
+
+static string gzip_compress(const string& input) {
+    z_stream zs{};
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
+    string out(deflateBound(&zs, input.size()) + 32, '\0');
+    zs.next_in = (Bytef*)input.data();
+    zs.avail_in = input.size();
+    zs.next_out = (Bytef*)out.data();
+    zs.avail_out = out.size();
+    deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return out;
+}
+
+// Same text, same vector, so caching and dedup are observable
+static vector<float> mock_embedding(const string& text, size_t dimensions) {
+    mt19937 rng((uint32_t)hash<string>()(text));
+    normal_distribution<float> normal;
+    vector<float> v(dimensions);
+    double norm = 0;
+    for (float& x : v) {
+        x = normal(rng);
+        norm += x * x;
+    }
+    norm = sqrt(norm);
+    for (float& x : v) x /= norm;
+    return v;
+}
+
+static string status_text(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 429: return "Too Many Requests";
+        case 500: return "Internal Server Error";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+        default: return "Error";
+    }
+}
+
+static string frame_response(int status, const string& content_type, const string& extra_headers, const string& body,
+                             bool chunked) {
+    string response = "HTTP/1.1 " + to_string(status) + " " + status_text(status) + "\r\n";
+    response += "Content-Type: " + content_type + "\r\n";
+    response += extra_headers;
+    if (!chunked) {
+        response += "Content-Length: " + to_string(body.size()) + "\r\n\r\n" + body;
+        return response;
+    }
+    response += "Transfer-Encoding: chunked\r\n\r\n";
+    char size_line[32];
+    for (size_t i = 0; i < body.size(); i += MOCK_CHUNK_SIZE) {
+        size_t n = min(MOCK_CHUNK_SIZE, body.size() - i);
+        snprintf(size_line, sizeof(size_line), "%zx\r\n", n);
+        response += size_line;
+        response.append(body, i, n);
+        response += "\r\n";
+    }
+    return response + "0\r\n\r\n";
+}
+
+static string chat_response(const json& request) {
+    if (!request.value("stream", false)) {
+        json reply = {
+            {"id", "chatcmpl-mock"},
+            {"object", "chat.completion"},
+            {"model", request.value("model", "gpt-4o-mini")},
+            {"choices", {{{"index", 0}, {"message", {{"role", "assistant"}, {"content", MOCK_CHAT_REPLY}}}, {"finish_reason", "stop"}}}}
+        };
+        return reply.dump();
+    }
+
+    // One event per word, the way the real API trickles tokens
+    string events;
+    string reply = MOCK_CHAT_REPLY;
+    size_t start = 0;
+    while (start < reply.size()) {
+        size_t end = reply.find(' ', start + 1);
+        if (end == string::npos) end = reply.size();
+        json chunk = {{"object", "chat.completion.chunk"}, {"choices", {{{"index", 0}, {"delta", {{"content", reply.substr(start, end - start)}}}}}}};
+        events += "data: " + chunk.dump() + "\n\n";
+        start = end;
+    }
+    return events + "data: [DONE]\n\n";
+}
+
+static string embeddings_response(const json& request, const MockServerOptions& options) {
+    vector<string> inputs;
+    const json& input = request["input"];
+    if (input.is_array()) {
+        for (const json& item : input) inputs.push_back(item.get<string>());
+    } else {
+        inputs.push_back(input.get<string>());
+    }
+    size_t dimensions = request.value("dimensions", options.embedding_dimensions);
+    bool base64 = request.value("encoding_format", "float") == "base64";
+
+    vector<json> data;
+    size_t tokens = 0;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        vector<float> embedding = mock_embedding(inputs[i], dimensions);
+        json encoded = base64 ? json(base64_encode(embedding.data(), embedding.size() * sizeof(float))) : json(embedding);
+        data.push_back({{"object", "embedding"}, {"index", i}, {"embedding", std::move(encoded)}});
+        tokens += inputs[i].size() / 4 + 1;
+    }
+    if (options.shuffle_embeddings) {
+        mt19937 shuffler(options.seed);
+        shuffle(data.begin(), data.end(), shuffler);
+    }
+    json reply = {
+        {"object", "list"},
+        {"data", data},
+        {"model", request.value("model", "text-embedding-3-small")},
+        {"usage", {{"prompt_tokens", tokens}, {"total_tokens", tokens}}}
+    };
+    return reply.dump();
+}
+
+MockOpenAIServer::MockOpenAIServer(MockServerOptions options) : options(options) {
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, SOMAXCONN) != 0) {
+        close(listen_fd);
+        throw runtime_error("Mock server could not listen on port " + to_string(options.port) + ": " + strerror(errno));
+    }
+    socklen_t len = sizeof(addr);
+    getsockname(listen_fd, (sockaddr*)&addr, &len);
+    bound_port = ntohs(addr.sin_port);
+    fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+
+    if (pipe(wake_pipe) != 0) {
+        close(listen_fd);
+        throw runtime_error("Mock server could not create its wakeup pipe");
+    }
+    if (options.tls) {
+        ssl_ctx = make_server_context();
+    }
+    loop = thread(&MockOpenAIServer::run, this);
+}
+
+MockOpenAIServer::~MockOpenAIServer() {
+    char stop = 1;
+    (void)write(wake_pipe[1], &stop, 1);
+    loop.join();
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+    close(listen_fd);
+    if (ssl_ctx) SSL_CTX_free(ssl_ctx);
+}
+
+string MockOpenAIServer::origin() const {
+    return string(options.tls ? "" : "http://") + "127.0.0.1:" + to_string(bound_port);
+}
+
+MockServerStats MockOpenAIServer::stats() const {
+    return MockServerStats{connections.load(), requests.load(), errors.load()};
+}
+
+void MockOpenAIServer::run() {
+    unique_ptr<EventBackend> backend = make_event_backend();
+    backend->watch(listen_fd, EVENT_READ, nullptr);
+    backend->watch(wake_pipe[0], EVENT_READ, nullptr);
+
+    unordered_map<int, unique_ptr<Connection>> conns;
+    using Timer = pair<chrono::steady_clock::time_point, int>;
+    priority_queue<Timer, vector<Timer>, greater<Timer>> timers;
+    mt19937 rng(options.seed);
+    uniform_real_distribution<double> unit(0.0, 1.0);
+    size_t uploads_dropped = 0;
+
+    auto drop = [&](Connection* conn) {
+        backend->unwatch(conn->fd);
+        conns.erase(conn->fd);
+    };
+
+    // Moves due responses to the output buffer and writes what the socket takes
+    auto flush = [&](Connection* conn) -> bool {
+        auto now = chrono::steady_clock::now();
+        while (!conn->queued.empty() && conn->queued.front().first <= now) {
+            conn->out += conn->queued.front().second;
+            conn->queued.pop_front();
+        }
+        while (conn->out_sent < conn->out.size()) {
+            int sent = conn->write_some(conn->out.data() + conn->out_sent, conn->out.size() - conn->out_sent);
+            if (sent < 0) return false;
+            if (sent == 0) break;
+            conn->out_sent += sent;
+        }
+        if (conn->out_sent == conn->out.size()) {
+            conn->out.clear();
+            conn->out_sent = 0;
+            if (conn->close_after && conn->queued.empty()) return false;
+        }
+        backend->watch(conn->fd, conn->out.empty() ? EVENT_READ : EVENT_READ | EVENT_WRITE, conn);
+        return true;
+    };
+
+    auto frame = [&](int status, const string& content_type, const string& extra_headers, const string& body, bool chunked) {
+        return frame_response(status, content_type, options.extra_headers + extra_headers, body, chunked);
+    };
+
+    auto respond = [&](const string& request_line, const string& headers, const string& body) {
+        size_t number = ++requests;
+        bool accepts_gzip = options.gzip && headers.find("accept-encoding:") != string::npos &&
+                            headers.find("gzip", headers.find("accept-encoding:")) != string::npos;
+
+        if (number <= options.fail_first || unit(rng) < options.error_rate) {
+            errors++;
+            string extra = options.retry_after.count() > 0 ? "retry-after-ms: " + to_string(options.retry_after.count()) + "\r\n" : "";
+            json error = {{"error", {{"message", "mock server injected error"}, {"type", "server_error"}}}};
+            return frame(options.error_status, "application/json", extra, error.dump(), options.chunked);
+        }
+
+        json request = json::parse(body, nullptr, false);
+        string path = request_line.substr(request_line.find(' ') + 1);
+        path = path.substr(0, path.find(' '));
+        if (request.is_discarded() || !request.is_object()) {
+            return frame(400, "application/json", "", R"({"error":{"message":"invalid JSON body"}})", options.chunked);
+        }
+
+        if (path == "/v1/chat/completions" && request.value("stream", false)) {
+            return frame(200, "text/event-stream", "", chat_response(request), true);
+        }
+        string reply;
+        if (path == "/v1/chat/completions") {
+            reply = chat_response(request);
+        } else if (path == "/v1/embeddings" && request.contains("input")) {
+            reply = embeddings_response(request, options);
+        } else {
+            return frame(404, "application/json", "", R"({"error":{"message":"unknown endpoint"}})", options.chunked);
+        }
+        if (accepts_gzip) {
+            return frame(200, "application/json", "Content-Encoding: gzip\r\n", gzip_compress(reply), options.chunked);
+        }
+        return frame(200, "application/json", "", reply, options.chunked);
+    };
+
+    // Handshake, read, and answer every complete request in the buffer
+    auto drive = [&](Connection* conn) -> bool {
+        if (!conn->handshaken) {
+            int result = SSL_accept(conn->ssl);
+            if (result != 1) {
+                int error = SSL_get_error(conn->ssl, result);
+                if (error == SSL_ERROR_WANT_READ) backend->watch(conn->fd, EVENT_READ, conn);
+                else if (error == SSL_ERROR_WANT_WRITE) backend->watch(conn->fd, EVENT_WRITE, conn);
+                else return false;
+                return true;
+            }
+            conn->handshaken = true;
+        }
+
+        char buffer[16384];
+        while (true) {
+            int got = conn->read_some(buffer, sizeof(buffer));
+            if (got < 0) return false;
+            if (got == 0) break;
+            conn->in.append(buffer, got);
+            conn->received += got;
+        }
+        if (conn->received >= options.drop_after_bytes && uploads_dropped < options.drop_uploads) {
+            uploads_dropped++;
+            return false;
+        }
+
+        while (true) {
+            size_t header_end = conn->in.find("\r\n\r\n");
+            if (header_end == string::npos) break;
+            string headers = conn->in.substr(0, header_end + 2);
+            transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+            size_t length = 0;
+            size_t cl = headers.find("\ncontent-length:");
+            if (cl != string::npos) length = strtoull(headers.c_str() + cl + 16, nullptr, 10);
+            if (conn->in.size() < header_end + 4 + length) break;
+
+            string request_line = conn->in.substr(0, conn->in.find("\r\n"));
+            string body = conn->in.substr(header_end + 4, length);
+            conn->in.erase(0, header_end + 4 + length);
+            if (headers.find("\nconnection: close") != string::npos) conn->close_after = true;
+
+            auto delay = options.latency;
+            if (options.latency_jitter.count() > 0) {
+                delay += chrono::milliseconds((long long)(unit(rng) * options.latency_jitter.count()));
+            }
+            auto ready = chrono::steady_clock::now() + delay;
+            conn->queued.emplace_back(ready, respond(request_line, headers, body));
+            if (delay.count() > 0) timers.emplace(ready, conn->fd);
+        }
+        return flush(conn);
+    };
+
+    IOEvent events[256];
+    bool running = true;
+    while (running) {
+        int timeout_ms = -1;
+        if (!timers.empty()) {
+            auto wait = chrono::ceil<chrono::milliseconds>(timers.top().first - chrono::steady_clock::now());
+            timeout_ms = (int)max<long long>(wait.count(), 0);
+        }
+        int n = backend->wait(events, 256, timeout_ms);
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].fd;
+            if (fd == wake_pipe[0]) {
+                running = false;
+            } else if (fd == listen_fd) {
+                while (true) {
+                    int client = accept(listen_fd, nullptr, nullptr);
+                    if (client < 0) break;
+                    fcntl(client, F_SETFL, O_NONBLOCK);
+                    int one = 1;
+                    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    SSL* ssl = nullptr;
+                    if (ssl_ctx) {
+                        ssl = SSL_new(ssl_ctx);
+                        SSL_set_fd(ssl, client);
+                        SSL_set_accept_state(ssl);
+                    }
+                    auto conn = make_unique<Connection>(client, ssl);
+                    backend->watch(client, EVENT_READ, conn.get());
+                    conns[client] = std::move(conn);
+                    connections++;
+                }
+            } else {
+                auto it = conns.find(fd);
+                if (it != conns.end() && !drive(it->second.get())) {
+                    drop(it->second.get());
+                }
+            }
+        }
+
+        auto now = chrono::steady_clock::now();
+        while (!timers.empty() && timers.top().first <= now) {
+            auto it = conns.find(timers.top().second);
+            timers.pop();
+            if (it != conns.end() && !flush(it->second.get())) {
+                drop(it->second.get());
+            }
+        }
+    }
+    for (auto& [fd, conn] : conns) {
+        backend->unwatch(fd);
+    }
+}
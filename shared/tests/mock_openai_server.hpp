@@ -0,0 +1,76 @@
+#ifndef MOCK_OPENAI_SERVER_HPP
+#define MOCK_OPENAI_SERVER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <openssl/ssl.h>
+#include "event_backend.hpp"
+
+using namespace std;
+
+struct MockServerOptions {
+    bool tls = true;                          // false serves plaintext HTTP/1.1
+    uint16_t port = 0;                        // 0 picks a free port
+    chrono::milliseconds latency{0};          // added before every response
+    chrono::milliseconds latency_jitter{0};   // plus a uniform 0..jitter on top
+    bool chunked = false;                     // chunked instead of content-length framing
+    bool gzip = false;                        // compress when the client accepts gzip
+    double error_rate = 0;                    // fraction of requests answered with error_status
+    size_t fail_first = 0;                    // the first N requests always get error_status
+    int error_status = 503;
+    chrono::milliseconds retry_after{0};      // sent as retry-after-ms with errors when set
+    size_t embedding_dimensions = 1536;
+    bool shuffle_embeddings = false;          // data[] out of input order (index still says which)
+    size_t drop_uploads = 0;                  // the first N connections are closed mid-request,
+    size_t drop_after_bytes = 65536;          // unanswered, once this many bytes have arrived
+    string extra_headers;                     // "name: value\r\n" lines added to every response
+    unsigned seed = 1;
+};
+
+struct MockServerStats {
+    size_t connections = 0;
+    size_t requests = 0;
+    size_t errors = 0;  // injected error responses
+};
+
+// Stand-in for api.openai.com on localhost, so the HTTP engine can be tested
+// and load-tested offline. Serves HTTP/1.1 keep-alive from its own thread on
+// an EventBackend, over TLS with a throwaway self-signed certificate or in
+// plaintext:
+//   POST /v1/embeddings        deterministic unit vectors per input string,
+//                              base64 when encoding_format asks for it
+//   POST /v1/chat/completions  a fixed message, as SSE when "stream": true
+class MockOpenAIServer {
+private:
+    struct Connection;
+    struct Delayed;
+
+    MockServerOptions options;
+    uint16_t bound_port = 0;
+    int listen_fd = -1;
+    int wake_pipe[2] = {-1, -1};
+    SSL_CTX* ssl_ctx = nullptr;
+    thread loop;
+    atomic<size_t> connections{0};
+    atomic<size_t> requests{0};
+    atomic<size_t> errors{0};
+
+    void run();
+
+public:
+    explicit MockOpenAIServer(MockServerOptions options = MockServerOptions());
+    ~MockOpenAIServer();
+
+    MockOpenAIServer(const MockOpenAIServer&) = delete;
+    MockOpenAIServer& operator=(const MockOpenAIServer&) = delete;
+
+    uint16_t port() const { return bound_port; }
+    // Origin to hand AsyncHTTPSConnection / AsyncOpenAIAPI::set_endpoint
+    string origin() const;
+    MockServerStats stats() const;
+};
+
+#endif // MOCK_OPENAI_SERVER_HPP
@@ -0,0 +1,69 @@
+/**
+ * Unit Tests for MPSCQueue
+ *
+ * Several producer threads push while the test thread pops, the way callers
+ * hand requests to the I/O thread. Every item has to come out exactly once
+ * and in each producer's order.
+ */
+
+#include "mpsc_queue.hpp"
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+TEST(MPSCQueueTest, PopsInPushOrder) {
+    MPSCQueue<int> queue;
+    EXPECT_FALSE(queue.pop().has_value());
+
+    for (int i = 0; i < 5; i++) queue.push(i);
+    for (int i = 0; i < 5; i++) {
+        optional<int> value = queue.pop();
+        ASSERT_TRUE(value.has_value());
+        EXPECT_EQ(*value, i);
+    }
+    EXPECT_FALSE(queue.pop().has_value());
+}
+
+TEST(MPSCQueueTest, HoldsMoveOnlyValuesAndFreesLeftovers) {
+    auto tracked = make_shared<int>(7);
+    {
+        MPSCQueue<unique_ptr<shared_ptr<int>>> queue;
+        queue.push(make_unique<shared_ptr<int>>(tracked));
+        queue.push(make_unique<shared_ptr<int>>(tracked));
+        EXPECT_EQ(**queue.pop(), tracked);
+        EXPECT_EQ(tracked.use_count(), 2);
+    }
+    EXPECT_EQ(tracked.use_count(), 1);
+}
+
+TEST(MPSCQueueTest, ConcurrentProducersLoseNothing) {
+    constexpr int producers = 4;
+    constexpr int per_producer = 50000;
+    MPSCQueue<pair<int, int>> queue;
+
+    vector<thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&queue, p]() {
+            for (int i = 0; i < per_producer; i++) queue.push({p, i});
+        });
+    }
+
+    vector<int> next(producers, 0);
+    int received = 0;
+    while (received < producers * per_producer) {
+        optional<pair<int, int>> item = queue.pop();
+        if (!item) {
+            this_thread::yield();
+            continue;
+        }
+        ASSERT_EQ(item->second, next[item->first]) << "producer " << item->first;
+        next[item->first]++;
+        received++;
+    }
+    for (thread& t : threads) t.join();
+
+    EXPECT_FALSE(queue.pop().has_value());
+}
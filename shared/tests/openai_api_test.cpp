@@ -0,0 +1,87 @@
+/**
+ * Tests for the synchronous OpenAIAPI / APIConnection
+ *
+ * Runs against a MockOpenAIServer on localhost, so no network or API key is
+ * needed. Covers the framings the buffered reader has to handle and keep-alive
+ * reuse across post() calls.
+ */
+
+#include "openai_api.hpp"
+#include "mock_openai_server.hpp"
+#include <gtest/gtest.h>
+#include <cmath>
+
+using namespace std;
+
+static float norm(const vector<float>& v) {
+    float sum = 0;
+    for (float x : v) sum += x * x;
+    return sqrt(sum);
+}
+
+TEST(OpenAIAPITest, PostEmbeddingParsesResponse) {
+    MockOpenAIServer server;
+    OpenAIAPI api("mock-key", "127.0.0.1:" + to_string(server.port()));
+
+    vector<float> embedding = api.post_embedding("int main() {}");
+    ASSERT_EQ(embedding.size(), 1536);
+    EXPECT_NEAR(norm(embedding), 1.0f, 1e-4);
+}
+
+TEST(OpenAIAPITest, ChunkedGzipMatchesContentLength) {
+    MockServerOptions options;
+    options.chunked = true;
+    options.gzip = true;
+    MockOpenAIServer compressed(options);
+    MockOpenAIServer plain;
+
+    OpenAIAPI from_compressed("mock-key", "127.0.0.1:" + to_string(compressed.port()));
+    OpenAIAPI from_plain("mock-key", "127.0.0.1:" + to_string(plain.port()));
+
+    vector<float> a = from_compressed.post_embedding("same text");
+    ASSERT_EQ(a.size(), 1536);
+    EXPECT_EQ(a, from_plain.post_embedding("same text"));
+}
+
+TEST(OpenAIAPITest, ReusesConnectionAcrossPosts) {
+    MockOpenAIServer server;
+    OpenAIAPI api("mock-key", "127.0.0.1:" + to_string(server.port()));
+
+    for (int i = 0; i < 20; i++) {
+        EXPECT_EQ(api.post_embedding("input " + to_string(i)).size(), 1536);
+    }
+    EXPECT_EQ(server.stats().connections, 1);
+    EXPECT_EQ(server.stats().requests, 20);
+}
+
+TEST(OpenAIAPITest, ReconnectsAfterServerClosesConnection) {
+    auto server = make_unique<MockOpenAIServer>();
+    MockServerOptions options;
+    options.port = server->port();
+    OpenAIAPI api("mock-key", "127.0.0.1:" + to_string(options.port));
+    EXPECT_EQ(api.post_embedding("before").size(), 1536);
+
+    // A fresh server on the same port: the pooled socket is dead
+    server.reset();
+    server = make_unique<MockOpenAIServer>(options);
+    EXPECT_EQ(api.post_embedding("after").size(), 1536);
+    EXPECT_EQ(server->stats().connections, 1);
+}
+
+// The server hanging up partway through a large body makes the write fail
+// with EPIPE; that must come back as a failed post, not SIGPIPE killing the
+// process, and the next post gets a fresh connection.
+TEST(OpenAIAPITest, ServerClosingDuringUploadFailsThePost) {
+    MockServerOptions options;
+    options.drop_uploads = 1;
+    MockOpenAIServer server(options);
+    APIConnection conn("127.0.0.1:" + to_string(server.port()), "/v1/embeddings");
+    vector<pair<string, string>> headers = {{"Content-Type", "application/json"}};
+
+    string large = R"({"model": "text-embedding-3-small", "input": ")" + string(4 << 20, 'x') + "\"}";
+    EXPECT_EQ(conn.post(large, headers), "");
+
+    string small = R"({"model": "text-embedding-3-small", "input": "after"})";
+    EXPECT_NE(conn.post(small, headers), "");
+    EXPECT_EQ(server.stats().connections, 2);
+}
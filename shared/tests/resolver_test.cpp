@@ -0,0 +1,121 @@
+/**
+ * Unit Tests for Resolver
+ *
+ * Covers the non-blocking lookup path and the in-process cache without
+ * relying on external DNS: "localhost" is answered by the system resolver,
+ * everything else goes through overrides or IP literals.
+ */
+
+#include "resolver.hpp"
+#include <gtest/gtest.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+
+using namespace std;
+
+class ResolverTest : public ::testing::Test {
+protected:
+    void TearDown() override {
+        Resolver::clear_overrides();
+    }
+
+    // Waits for the background lookup to signal and returns its answers
+    vector<pair<string, ResolveResult>> wait_for_completion(Resolver& resolver) {
+        struct pollfd pfd = {resolver.notify_fd(), POLLIN, 0};
+        EXPECT_EQ(poll(&pfd, 1, 5000), 1) << "Lookup never signalled";
+        return resolver.take_completed();
+    }
+};
+
+TEST_F(ResolverTest, OverrideAnswersImmediately) {
+    Resolver::add_override("api.openai.com", "127.0.0.1");
+    Resolver resolver;
+
+    ResolveResult result;
+    ASSERT_TRUE(resolver.lookup("api.openai.com", result));
+    ASSERT_EQ(result.addresses.size(), 1);
+    EXPECT_EQ(result.addresses[0].family, AF_INET);
+
+    auto* v4 = reinterpret_cast<const sockaddr_in*>(&result.addresses[0].addr);
+    EXPECT_EQ(ntohl(v4->sin_addr.s_addr), INADDR_LOOPBACK);
+}
+
+TEST_F(ResolverTest, IPv6OverrideKeepsFamily) {
+    Resolver::add_override("v6.example", "::1");
+
+    ResolveResult result = Resolver::resolve_now("v6.example");
+    ASSERT_TRUE(result.error.empty());
+    ASSERT_EQ(result.addresses.size(), 1);
+    EXPECT_EQ(result.addresses[0].family, AF_INET6);
+    EXPECT_EQ(result.addresses[0].addr_len, sizeof(sockaddr_in6));
+}
+
+TEST_F(ResolverTest, NonLiteralOverrideIsRejected) {
+    EXPECT_THROW(Resolver::add_override("host", "not-an-ip"), invalid_argument);
+}
+
+TEST_F(ResolverTest, LiteralHostSkipsLookup) {
+    Resolver resolver;
+    ResolveResult result;
+    ASSERT_TRUE(resolver.lookup("127.0.0.1", result));
+    EXPECT_EQ(result.addresses[0].family, AF_INET);
+}
+
+TEST_F(ResolverTest, WithPortSetsPortForBothFamilies) {
+    Resolver::add_override("four", "10.0.0.1");
+    Resolver::add_override("six", "fe80::1");
+
+    sockaddr_storage v4 = Resolver::resolve_now("four").addresses[0].with_port(443);
+    sockaddr_storage v6 = Resolver::resolve_now("six").addresses[0].with_port(8443);
+    EXPECT_EQ(ntohs(reinterpret_cast<sockaddr_in*>(&v4)->sin_port), 443);
+    EXPECT_EQ(ntohs(reinterpret_cast<sockaddr_in6*>(&v6)->sin6_port), 8443);
+}
+
+TEST_F(ResolverTest, ConnectionOrderAlternatesFamiliesStartingWithIPv6) {
+    Resolver::add_override("dual", vector<string>{"10.0.0.1", "10.0.0.2", "10.0.0.3", "2001:db8::1", "2001:db8::2"});
+
+    vector<ResolvedAddress> ordered = Resolver::connection_order(Resolver::resolve_now("dual").addresses);
+    vector<string> addresses;
+    for (const ResolvedAddress& address : ordered) addresses.push_back(address.to_string());
+    EXPECT_EQ(addresses, (vector<string>{"2001:db8::1", "10.0.0.1", "2001:db8::2", "10.0.0.2", "10.0.0.3"}));
+}
+
+TEST_F(ResolverTest, BackgroundLookupIsCachedAfterCompletion) {
+    Resolver resolver;
+
+    ResolveResult result;
+    ASSERT_FALSE(resolver.lookup("localhost", result)) << "First lookup should go to the background";
+    // A second caller for the same host shares the in-flight lookup
+    ASSERT_FALSE(resolver.lookup("localhost", result));
+
+    auto completed = wait_for_completion(resolver);
+    ASSERT_EQ(completed.size(), 1) << "Concurrent lookups for one host should coalesce";
+    EXPECT_EQ(completed[0].first, "localhost");
+    EXPECT_TRUE(completed[0].second.error.empty()) << completed[0].second.error;
+
+    ResolveResult cached;
+    EXPECT_TRUE(resolver.lookup("localhost", cached)) << "Answer should now be served from cache";
+    EXPECT_EQ(cached.addresses.size(), completed[0].second.addresses.size());
+}
+
+TEST_F(ResolverTest, ExpiredEntriesAreLookedUpAgain) {
+    Resolver resolver(chrono::seconds(0));
+
+    ResolveResult result;
+    ASSERT_FALSE(resolver.lookup("localhost", result));
+    wait_for_completion(resolver);
+
+    EXPECT_FALSE(resolver.lookup("localhost", result)) << "Zero TTL should never serve from cache";
+    wait_for_completion(resolver);
+}
+
+TEST_F(ResolverTest, FailedLookupReportsError) {
+    Resolver resolver;
+
+    ResolveResult result;
+    ASSERT_FALSE(resolver.lookup("this-host-does-not-exist.invalid", result));
+    auto completed = wait_for_completion(resolver);
+    ASSERT_EQ(completed.size(), 1);
+    EXPECT_FALSE(completed[0].second.error.empty());
+}
@@ -0,0 +1,64 @@
+/**
+ * Unit Tests for SSEDecoder
+ *
+ * Feeds text/event-stream bodies split at awkward points, the way they come
+ * off the socket, and checks the events that come out.
+ */
+
+#include "sse_decoder.hpp"
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace std;
+
+class SSEDecoderTest : public ::testing::Test {
+protected:
+    vector<SSEEvent> events;
+    SSEDecoder decoder{[this](const SSEEvent& e) { events.push_back(e); }};
+};
+
+TEST_F(SSEDecoderTest, DecodesDataEvents) {
+    decoder.feed("data: {\"a\":1}\n\ndata: [DONE]\n\n");
+    ASSERT_EQ(events.size(), 2);
+    EXPECT_EQ(events[0].event, "message");
+    EXPECT_EQ(events[0].data, "{\"a\":1}");
+    EXPECT_EQ(events[1].data, "[DONE]");
+}
+
+TEST_F(SSEDecoderTest, EventIsDispatchedOnlyAtBlankLine) {
+    decoder.feed("data: partial");
+    decoder.feed("\n");
+    EXPECT_TRUE(events.empty());
+    decoder.feed("\n");
+    ASSERT_EQ(events.size(), 1);
+    EXPECT_EQ(events[0].data, "partial");
+}
+
+TEST_F(SSEDecoderTest, SplitsAtEveryByteBoundary) {
+    string stream = "event: delta\r\nid: 7\r\ndata: one\r\ndata:two\r\n\r\n: keepalive\r\n\r\ndata: three\r\r";
+    for (size_t split = 0; split <= stream.size(); ++split) {
+        events.clear();
+        SSEDecoder split_decoder([this](const SSEEvent& e) { events.push_back(e); });
+        split_decoder.feed(string_view(stream).substr(0, split));
+        split_decoder.feed(string_view(stream).substr(split));
+
+        ASSERT_EQ(events.size(), 2) << "split at " << split;
+        EXPECT_EQ(events[0].event, "delta");
+        EXPECT_EQ(events[0].id, "7");
+        EXPECT_EQ(events[0].data, "one\ntwo");
+        EXPECT_EQ(events[1].event, "message");
+        EXPECT_EQ(events[1].id, "7");  // ids carry over to later events
+        EXPECT_EQ(events[1].data, "three");
+    }
+}
+
+TEST_F(SSEDecoderTest, CommentsAndEmptyEventsAreDropped) {
+    decoder.feed(": ping\n\nevent: noop\n\nretry: 100\n\n");
+    EXPECT_TRUE(events.empty());
+}
+
+TEST_F(SSEDecoderTest, FieldWithoutColonHasEmptyValue) {
+    decoder.feed("data\ndata\n\n");
+    ASSERT_EQ(events.size(), 1);
+    EXPECT_EQ(events[0].data, "\n");
+}
@@ -0,0 +1,179 @@
+#include "tls_context.hpp"
+#include <sys/socket.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+// OpenSSL's socket BIO writes with write(2), which raises SIGPIPE when the
+// peer has closed the connection; with the default action that kills the
+// process before the caller sees the error. This BIO does the same I/O
+// with send(MSG_NOSIGNAL) (SO_NOSIGPIPE on the socket where there's no
+// such flag), so a dropped connection is a failed write like any other.
+static int quiet_socket_write(BIO* bio, const char* data, int n) {
+    int fd = BIO_get_fd(bio, nullptr);
+#ifdef MSG_NOSIGNAL
+    ssize_t sent = send(fd, data, n, MSG_NOSIGNAL);
+#else
+    ssize_t sent = send(fd, data, n, 0);
+#endif
+    BIO_clear_retry_flags(bio);
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        BIO_set_retry_write(bio);
+    }
+    return (int)sent;
+}
+
+static int quiet_socket_read(BIO* bio, char* buffer, int n) {
+    ssize_t got = recv(BIO_get_fd(bio, nullptr), buffer, n, 0);
+    BIO_clear_retry_flags(bio);
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        BIO_set_retry_read(bio);
+    }
+    return (int)got;
+}
+
+static int quiet_socket_puts(BIO* bio, const char* text) {
+    return quiet_socket_write(bio, text, (int)strlen(text));
+}
+
+// The socket belongs to the caller (BIO_NOCLOSE); only the fd is kept
+static long quiet_socket_ctrl(BIO* bio, int cmd, long, void* ptr) {
+    switch (cmd) {
+    case BIO_C_SET_FD:
+        BIO_set_data(bio, reinterpret_cast<void*>((intptr_t)*static_cast<int*>(ptr)));
+        BIO_set_init(bio, 1);
+        return 1;
+    case BIO_C_GET_FD: {
+        if (!BIO_get_init(bio)) return -1;
+        int fd = (int)reinterpret_cast<intptr_t>(BIO_get_data(bio));
+        if (ptr) *static_cast<int*>(ptr) = fd;
+        return fd;
+    }
+    case BIO_CTRL_FLUSH:
+    case BIO_CTRL_DUP:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static BIO_METHOD* quiet_socket_method() {
+    static BIO_METHOD* method = []() {
+        BIO_METHOD* created = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK | BIO_TYPE_DESCRIPTOR,
+                                           "socket without SIGPIPE");
+        if (created == nullptr) throw runtime_error("Failed to create socket BIO method");
+        BIO_meth_set_write(created, quiet_socket_write);
+        BIO_meth_set_read(created, quiet_socket_read);
+        BIO_meth_set_puts(created, quiet_socket_puts);
+        BIO_meth_set_ctrl(created, quiet_socket_ctrl);
+        return created;
+    }();
+    return method;
+}
+
+static BIO* quiet_socket_bio(int socket_fd) {
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+    int one = 1;
+    setsockopt(socket_fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    BIO* bio = BIO_new(quiet_socket_method());
+    if (bio == nullptr) throw runtime_error("Failed to create socket BIO");
+    BIO_set_fd(bio, socket_fd, BIO_NOCLOSE);
+    return bio;
+}
+
+TLSContext::TLSContext() {
+    SSL_load_error_strings();
+    SSL_library_init();
+    this->ssl_ctx = SSL_CTX_new(TLS_client_method());
+    if (ssl_ctx == nullptr) {
+        throw runtime_error("Failed to create SSL_CTX");
+    }
+
+    // Keep sessions ourselves (keyed by host) rather than in OpenSSL's
+    // internal cache, which clients can't look up by server name
+    SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ssl_ctx, &TLSContext::on_new_session);
+    SSL_CTX_set_app_data(ssl_ctx, this);
+}
+
+TLSContext::~TLSContext() {
+    clear_sessions();
+    SSL_CTX_free(ssl_ctx);
+}
+
+shared_ptr<TLSContext> TLSContext::shared() {
+    static shared_ptr<TLSContext> instance = make_shared<TLSContext>();
+    return instance;
+}
+
+int TLSContext::on_new_session(SSL* conn, SSL_SESSION* session) {
+    auto* self = static_cast<TLSContext*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(conn)));
+    const char* host = SSL_get_servername(conn, TLSEXT_NAMETYPE_host_name);
+    if (self == nullptr || host == nullptr) return 0;
+
+    self->store_session(host, session);
+    return 1;  // we keep the reference
+}
+
+void TLSContext::store_session(const string& host, SSL_SESSION* session) {
+    lock_guard<mutex> lock(session_mutex);
+    auto it = sessions.find(host);
+    if (it != sessions.end()) {
+        SSL_SESSION_free(it->second);
+        it->second = session;
+    } else {
+        sessions[host] = session;
+    }
+}
+
+SSL* TLSContext::new_connection(int socket_fd, const string& host, bool offer_http2) {
+    SSL* conn = SSL_new(ssl_ctx);
+    BIO* bio = quiet_socket_bio(socket_fd);
+    SSL_set_bio(conn, bio, bio);
+    SSL_set_tlsext_host_name(conn, host.c_str());
+
+    if (offer_http2) {
+        static const unsigned char protocols[] = "\x02h2\x08http/1.1";
+        SSL_set_alpn_protos(conn, protocols, sizeof(protocols) - 1);
+    }
+
+    lock_guard<mutex> lock(session_mutex);
+    auto it = sessions.find(host);
+    if (it != sessions.end() && SSL_SESSION_is_resumable(it->second)) {
+        SSL_set_session(conn, it->second);
+    }
+    return conn;
+}
+
+bool TLSContext::negotiated_http2(SSL* conn) {
+    const unsigned char* protocol = nullptr;
+    unsigned int len = 0;
+    SSL_get0_alpn_selected(conn, &protocol, &len);
+    return len == 2 && memcmp(protocol, "h2", 2) == 0;
+}
+
+void TLSContext::record_handshake(SSL* conn) {
+    if (SSL_session_reused(conn)) {
+        resumed_handshakes++;
+    } else {
+        full_handshakes++;
+    }
+}
+
+TLSHandshakeStats TLSContext::stats() const {
+    TLSHandshakeStats s;
+    s.full = full_handshakes.load();
+    s.resumed = resumed_handshakes.load();
+    return s;
+}
+
+void TLSContext::clear_sessions() {
+    lock_guard<mutex> lock(session_mutex);
+    for (auto& [host, session] : sessions) {
+        SSL_SESSION_free(session);
+    }
+    sessions.clear();
+}
@@ -0,0 +1,58 @@
+#ifndef TLS_CONTEXT_HPP
+#define TLS_CONTEXT_HPP
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+struct TLSHandshakeStats {
+    size_t full = 0;
+    size_t resumed = 0;
+};
+
+// Process-wide client SSL_CTX plus a per-host session cache. Every connection
+// made through new_connection() offers the last session the host gave us
+// (TLS 1.3 ticket or 1.2 session ID), so repeat connections skip the full
+// handshake when the server accepts it.
+class TLSContext {
+private:
+    SSL_CTX* ssl_ctx;
+    mutex session_mutex;
+    unordered_map<string, SSL_SESSION*> sessions;
+    atomic<size_t> full_handshakes{0};
+    atomic<size_t> resumed_handshakes{0};
+
+    static int on_new_session(SSL* conn, SSL_SESSION* session);
+    void store_session(const string& host, SSL_SESSION* session);
+
+public:
+    TLSContext();
+    TLSContext(const TLSContext&) = delete;
+    TLSContext& operator=(const TLSContext&) = delete;
+
+    // The shared instance used by AsyncHTTPSConnection and APIConnection
+    static shared_ptr<TLSContext> shared();
+
+    // SSL object bound to socket_fd with SNI set and a cached session offered.
+    // Writes to a peer that has closed fail with EPIPE instead of raising
+    // SIGPIPE.
+    // offer_http2 advertises "h2" ahead of "http/1.1" via ALPN.
+    SSL* new_connection(int socket_fd, const string& host, bool offer_http2 = false);
+    // True once the handshake settled on HTTP/2
+    static bool negotiated_http2(SSL* conn);
+    // Call once SSL_connect returns 1 to count full vs resumed handshakes
+    void record_handshake(SSL* conn);
+
+    TLSHandshakeStats stats() const;
+    void clear_sessions();
+    SSL_CTX* get() const { return ssl_ctx; }
+    ~TLSContext();
+};
+
+#endif // TLS_CONTEXT_HPP
@@ -1,8 +1,10 @@
 #include "utils.hpp"
+#include "base64.hpp"
+#include <cmath>
 
 using json = nlohmann::json;
 
-float cos_sim(vector<float> a, vector<float> b) {
+float cos_sim(const vector<float>& a, const vector<float>& b) {
   float dot = 0.0;
   for (size_t i = 0; i < a.size(); i++) {
     dot += a[i] * b[i];
@@ -11,17 +13,55 @@ float cos_sim(vector<float> a, vector<float> b) {
   return dot; 
 }
 
+void normalize_embedding(vector<float>& embedding, size_t dimensions) {
+  if (dimensions > 0 && embedding.size() > dimensions) {
+    embedding.resize(dimensions);
+  }
+  double norm = 0;
+  for (float x : embedding) norm += double(x) * x;
+  if (norm == 0) return;
+  float scale = 1 / sqrt(norm);
+  for (float& x : embedding) x *= scale;
+}
+
+// With encoding_format "base64" the vector arrives as one string of raw
+// little-endian floats, decoded straight into place; otherwise it's a JSON
+// array of numbers
+static vector<float> embedding_values(const json& embedding) {
+    if (!embedding.is_string()) return embedding.get<vector<float>>();
+    vector<float> values;
+    if (!base64_decode_floats(embedding.get_ref<const string&>(), values)) {
+        throw runtime_error("embedding is not valid base64");
+    }
+    return values;
+}
+
 vector<float> parse_embedding(const string& response) {
     try {
         json j = json::parse(response);
-        vector<float> embedding = j["data"][0]["embedding"].get<vector<float>>();
-        return embedding;
-    } catch (json::exception& e) {
+        return embedding_values(j["data"][0]["embedding"]);
+    } catch (exception& e) {
         cerr << "JSON parsing error with response: " << response << endl;
         return vector<float>();
     }
 }
 
+vector<vector<float>> parse_embeddings(const string& response, size_t count) {
+    vector<vector<float>> embeddings(count);
+    try {
+        json j = json::parse(response);
+        for (const json& item : j["data"]) {
+            size_t index = item["index"].get<size_t>();
+            if (index < count) {
+                embeddings[index] = embedding_values(item["embedding"]);
+            }
+        }
+    } catch (exception& e) {
+        cerr << "JSON parsing error with response: " << response.substr(0, 200) << endl;
+    }
+    return embeddings;
+}
+
 string generate_commit_message(OpenAIAPI& chat_api, const string& code_changes) {
     // TODO: This function is currently non-functional since post_chat is commented out
     // It uses the chat API which requires a different endpoint than embeddings
@@ -46,22 +86,25 @@ string generate_commit_message(OpenAIAPI& chat_api, const string& code_changes)
 string parse_chat_response(const string& response) {
     try {
         json j = json::parse(response);
-        string message = j["choices"][0]["message"]["content"].get<string>();
-
-        // Trim whitespace and remove quotes if present
-        size_t start = message.find_first_not_of(" \t\n\r\"");
-        size_t end = message.find_last_not_of(" \t\n\r\"");
-
-        if (start == string::npos) return "update code";
-
-        return message.substr(start, end - start + 1);
+        return trim_commit_message(j["choices"][0]["message"]["content"].get<string>());
     } catch (json::exception& e) {
         cerr << "Chat JSON parsing error with response: " << response << endl;
         return "update code"; // fallback message
     }
 }
 
-future<string> async_generate_commit_message(AsyncOpenAIAPI& chat_api, const string& code_changes) {
+string trim_commit_message(const string& message) {
+    // Trim whitespace and remove quotes if present
+    size_t start = message.find_first_not_of(" \t\n\r\"");
+    size_t end = message.find_last_not_of(" \t\n\r\"");
+
+    if (start == string::npos) return "update code";
+
+    return message.substr(start, end - start + 1);
+}
+
+Task<string> async_generate_commit_message(AsyncOpenAIAPI& chat_api, string code_changes,
+                                           function<void(const string&)> on_token) {
     json messages = {
         {
             {"role", "system"},
@@ -73,12 +116,21 @@ future<string> async_generate_commit_message(AsyncOpenAIAPI& chat_api, const str
         }
     };
 
-    future<HTTPSResponse> response_future = chat_api.async_chat(messages, 50, 0.3);
+    if (on_token) {
+        // The frame outlives every token callback, so they can share it
+        string streamed;
+        HTTPSResponse response = co_await chat_api.chat_stream(messages, [&streamed, &on_token](const string& token) {
+            streamed += token;
+            on_token(token);
+        }, 50, 0.3);
+        if (response.status / 100 != 2) {
+            co_return parse_chat_response(response.body);
+        }
+        co_return trim_commit_message(streamed);
+    }
 
-    return std::async(std::launch::deferred, [](future<HTTPSResponse> resp_fut) {
-        HTTPSResponse response = resp_fut.get();
-        return parse_chat_response(response.body);
-    }, std::move(response_future));
+    HTTPSResponse response = co_await chat_api.chat(messages, 50, 0.3);
+    co_return parse_chat_response(response.body);
 }
 
 string utf8_substr(const string& str, size_t max_bytes) {
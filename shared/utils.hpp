@@ -7,15 +7,29 @@
 #include <nlohmann/json.hpp>
 #include "openai_api.hpp"
 #include "async_openai_api.hpp"
+#include "task.hpp"
 using namespace std;
 
 static constexpr unsigned char UTF8_CONTINUATION_MASK = 0xC0;
 static constexpr unsigned char UTF8_CONTINUATION_BYTE = 0x80;
 
-float cos_sim(vector<float> a, vector<float> b);
+// Dot product, which is the cosine for the unit vectors embeddings are
+float cos_sim(const vector<float>& a, const vector<float>& b);
+// Cuts embedding to dimensions (when nonzero and shorter) and scales it back
+// to unit length, as a shortened vector no longer is
+void normalize_embedding(vector<float>& embedding, size_t dimensions = 0);
 string generate_commit_message(OpenAIAPI& chat_api, const string& code_changes);
-future<string> async_generate_commit_message(AsyncOpenAIAPI& chat_api, const string& code_changes);
+// With on_token set, the message is streamed and each token is passed to it
+// as it arrives; the returned message is trimmed either way. start() the task
+// and run the connection's loop, then take its result(). The task keeps its
+// own copy of code_changes, as it only runs once started.
+Task<string> async_generate_commit_message(AsyncOpenAIAPI& chat_api, string code_changes,
+                                           function<void(const string&)> on_token = nullptr);
 string parse_chat_response(const string& response);
+string trim_commit_message(const string& message);
 vector<float> parse_embedding(const string& response);
+// Every embedding in a batched response, placed by its index; inputs the
+// response has no vector for are left empty
+vector<vector<float>> parse_embeddings(const string& response, size_t count);
 string utf8_substr(const string& str, size_t max_bytes);
 #endif // UTILS_HPP
\ No newline at end of file